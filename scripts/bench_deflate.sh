@@ -0,0 +1,59 @@
+#!/usr/bin/env bash
+#
+# Compare the zlib compressor built against libs/zlib with the one built
+# against libdeflate (DEFLATE=libdeflate): time create and apply of a patch
+# of rewritten files, which are stored whole and compressed, and check that
+# each binary applies the patches of the other.
+#
+# Usage: scripts/bench_deflate.sh [FILES] [FILE_SIZE_KB]
+
+set -e
+set -o pipefail
+
+FILES="${1:-200}"
+FILE_SIZE_KB="${2:-256}"
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+build() {
+	mkdir -p "$WORK/$1/obj" "$WORK/$1/build"
+	make -s -C "$ROOT" COV=0 OPT=-O2 DEFLATE="$1" OBJ_DIR="$WORK/$1/obj" \
+		BUILD_DIR="$WORK/$1/build" "$WORK/$1/build/patchit" > "$WORK/$1.log" 2>&1
+}
+
+BACKENDS="zlib"
+build zlib
+if build libdeflate; then
+	BACKENDS="zlib libdeflate"
+else
+	echo "libdeflate: build failed, see below; benchmarking zlib alone"
+	tail -5 "$WORK/libdeflate.log"
+fi
+
+cd "$WORK"
+mkdir before after
+INSTRUCTIONS=()
+for i in $(seq 1 "$FILES"); do
+	# hex text: compresses to about half, like typical diffs
+	head -c $((FILE_SIZE_KB * 512)) /dev/urandom | od -An -tx1 > "before/$i"
+	head -c $((FILE_SIZE_KB * 512)) /dev/urandom | od -An -tx1 > "after/$i"
+	INSTRUCTIONS+=(-M -c zlib "before/$i" "after/$i")
+done
+echo "$FILES files of $(du -sh after | cut -f1) in total"
+
+TIMEFORMAT="%3R s"
+for backend in $BACKENDS; do
+	echo "$backend: create"
+	time "$backend/build/patchit" create "$backend.patch" -j 1 "${INSTRUCTIONS[@]}" > /dev/null 2>&1
+	echo "$backend: patch of $(stat -c %s "$backend.patch") bytes"
+done
+
+for patch in $BACKENDS; do
+	for backend in $BACKENDS; do
+		rm -rf target && mkdir target && cp -r before target/
+		echo "$backend: apply the $patch patch"
+		time "$backend/build/patchit" apply "$patch.patch" target > /dev/null 2>&1
+		diff -r target/before after > /dev/null
+	done
+done
@@ -0,0 +1,64 @@
+#include <compressor.hpp>
+#include <error.hpp>
+#include <trace.hpp>
+#include <util.hpp>
+
+AutoCompressor::AutoCompressor(std::vector<std::shared_ptr<Compressor>> candidates)
+    : candidates(std::move(candidates)) {
+}
+
+std::shared_ptr<AutoCompressor> AutoCompressor::get() {
+    static std::shared_ptr<AutoCompressor> instance(new AutoCompressor(
+        {PlainCompressor::get(), ZLibCompressor::get()}));
+    return instance;
+}
+
+Compressor *AutoCompressor::select(std::span<const std::byte> data) {
+    TRACE_SCOPE("select compressor");
+    std::vector<std::byte> sample, out;
+
+    if (data.size() <= 3 * sample_size) {
+        sample.assign(data.begin(), data.end());
+    } else {
+        for (size_t start : {(size_t)0, (data.size() - sample_size) / 2,
+                             data.size() - sample_size}) {
+            sample.insert(sample.end(), data.begin() + start,
+                          data.begin() + start + sample_size);
+        }
+    }
+
+    /* A more expensive compressor has to save at least an eighth. */
+    Compressor *best = candidates.front().get();
+    size_t      best_size = SIZE_MAX;
+    for (auto &candidate : candidates) {
+        out.clear();
+        if (candidate->compress_into(sample, out)) {
+            continue;
+        }
+        if (out.size() + sample.size() / 8 < best_size) {
+            best = candidate.get();
+            best_size = out.size();
+        }
+    }
+
+    INFO("Selected compressor %d for %s (sample of %s -> %s)\n", best->get_id(),
+         shorten_size(data.size()).c_str(), shorten_size(sample.size()).c_str(),
+         shorten_size(best_size).c_str());
+    return best;
+}
+
+int AutoCompressor::get_id() {
+    ERROR("AutoCompressor has no id, the compressor it selects has to be stored.\n");
+    return -1;
+}
+
+int AutoCompressor::compress_into(std::span<const std::byte> data,
+                                  std::vector<std::byte>    &out) {
+    return select(data)->compress_into(data, out);
+}
+
+int AutoCompressor::decompress_into(std::span<const std::byte> data,
+                                    std::vector<std::byte>    &out) {
+    ERROR("Cannot decompress: the id of the selected compressor is unknown.\n");
+    return -1;
+}
@@ -0,0 +1,37 @@
+#include <buffer_pool.hpp>
+#include <utility>
+
+BufferPool::BufferPool(size_t max_buffers, size_t max_capacity)
+    : max_buffers(max_buffers), max_capacity(max_capacity) {
+}
+
+std::vector<std::byte> BufferPool::acquire() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (buffers.empty()) {
+        return {};
+    }
+
+    std::vector<std::byte> buffer = std::move(buffers.back());
+    buffers.pop_back();
+    return buffer;
+}
+
+void BufferPool::release(std::vector<std::byte> &&buffer) {
+    std::vector<std::byte> released = std::move(buffer);
+    if (!released.capacity() || released.capacity() > max_capacity) {
+        return;
+    }
+
+    released.clear();
+    std::lock_guard<std::mutex> guard(lock);
+    if (buffers.size() < max_buffers) {
+        buffers.push_back(std::move(released));
+    }
+}
+
+std::pmr::memory_resource *object_pool() {
+    /* Never destroyed: objects allocated from it may outlive static destructors. */
+    static std::pmr::synchronized_pool_resource *pool =
+        new std::pmr::synchronized_pool_resource();
+    return pool;
+}
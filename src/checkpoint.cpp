@@ -0,0 +1,334 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <checkpoint.hpp>
+#include <cstring>
+#include <error.hpp>
+#include <filesystem>
+#include <path_table.hpp>
+#include <set>
+#include <trace.hpp>
+#include <util.hpp>
+
+Checkpoint::Checkpoint(const std::string &patchfile, const std::string &destination) {
+    std::string dest = std::filesystem::absolute(destination).lexically_normal();
+    while (dest.size() > 1 && dest.back() == '/') {
+        dest.pop_back();
+    }
+
+    file = dest + ".patchit-checkpoint";
+    patch = std::filesystem::absolute(patchfile).lexically_normal();
+    patch_id = 0;
+    identified = false;
+    completed = 0;
+    started = 0;
+    pending = 0;
+    interval = 0;
+}
+
+int Checkpoint::id_of(const std::string &patchfile, uint64_t &id) {
+    const size_t           window = 64 << 10;
+    std::vector<std::byte> data;
+    struct stat            sb;
+    int                    fd = open(patchfile.c_str(), O_RDONLY);
+
+    if (fd == -1 || fstat(fd, &sb)) {
+        ERROR("Failed to identify the patch %s: %s\n", patchfile.c_str(),
+              strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    size_t size = sb.st_size;
+    store_uint64_t(size, data);
+    data.resize(8 + std::min(size, 2 * window));
+    ssize_t head = pread(fd, data.data() + 8, std::min(size, window), 0);
+    ssize_t tail = size > window ? pread(fd, data.data() + 8 + window,
+                                         std::min(size - window, window),
+                                         size - std::min(size - window, window))
+                                 : 0;
+    int error = errno;
+    close(fd);
+    if (head < 0 || tail < 0) {
+        ERROR("Failed to identify the patch %s: %s\n", patchfile.c_str(),
+              strerror(error));
+        return -1;
+    }
+
+    uLong crc = crc32(0L, (const Bytef *)data.data(), data.size());
+    id = (uint64_t)crc << 32 | (size & 0xffffffff);
+    return 0;
+}
+
+int Checkpoint::identify() {
+    if (!identified && !id_of(patch, patch_id)) {
+        identified = true;
+    }
+    return identified ? 0 : -1;
+}
+
+bool Checkpoint::exists() const {
+    return !access(file.c_str(), F_OK);
+}
+
+const std::string &Checkpoint::path() const {
+    return file;
+}
+
+uint64_t Checkpoint::completed_instructions() const {
+    return completed;
+}
+
+uint64_t Checkpoint::pending_instructions() const {
+    return pending;
+}
+
+int Checkpoint::capture(const std::vector<std::string> &paths,
+                        std::vector<PathState>         &states) {
+    states.clear();
+    for (auto &path : paths) {
+        struct stat sb;
+        PathState   state{path, false, 0, 0, 0};
+
+        if (!stat(path.c_str(), &sb)) {
+            state.exists = true;
+            if (S_ISREG(sb.st_mode)) {
+                state.size = sb.st_size;
+                state.mtime = sb.st_mtim.tv_sec * 1000000000ull + sb.st_mtim.tv_nsec;
+                state.inode = sb.st_ino;
+            }
+        } else if (errno != ENOENT) {
+            ERROR("Failed to stat %s: %s\n", path.c_str(), strerror(errno));
+            return -1;
+        }
+        states.push_back(state);
+    }
+    return 0;
+}
+
+int Checkpoint::load() {
+    TRACE_SCOPE("load checkpoint", -1, file);
+    std::vector<std::byte> data;
+    std::vector<PathState>   saved, current;
+    std::vector<std::string> rules;
+    uint64_t                 id, count;
+    size_t                 signature_size = strlen(signature) + 1;
+
+    if (identify()) {
+        ERROR("Cannot check that the checkpoint %s belongs to the patch.\n",
+              file.c_str());
+        return -1;
+    }
+    if (open_and_read_entire_file(file.c_str(), data)) {
+        ERROR("Failed to read the checkpoint %s\n", file.c_str());
+        return -1;
+    }
+
+    auto   it = data.begin() + std::min(signature_size, data.size());
+    size_t offset = signature_size + 8;
+    if (data.size() < signature_size || memcmp(data.data(), signature, signature_size) ||
+        restore_uint64_t(it, data.end(), id) ||
+        restore_varint(data, offset, completed) || restore_varint(data, offset, started) ||
+        restore_varint(data, offset, count) || count > data.size()) {
+        ERROR("Corrupted checkpoint %s\n", file.c_str());
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        std::string rule;
+        if (restore_path(data, offset, nullptr, rule)) {
+            ERROR("Corrupted checkpoint %s\n", file.c_str());
+            return -1;
+        }
+        rules.push_back(rule);
+    }
+
+    if (restore_varint(data, offset, count) || count > data.size()) {
+        ERROR("Corrupted checkpoint %s\n", file.c_str());
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        PathState state;
+        if (restore_path(data, offset, nullptr, state.path) || offset >= data.size()) {
+            ERROR("Corrupted checkpoint %s\n", file.c_str());
+            return -1;
+        }
+        state.exists = (bool)data[offset++];
+        if (restore_varint(data, offset, state.size) ||
+            restore_varint(data, offset, state.mtime) ||
+            restore_varint(data, offset, state.inode)) {
+            ERROR("Corrupted checkpoint %s\n", file.c_str());
+            return -1;
+        }
+        saved.push_back(state);
+    }
+
+    if (id != patch_id) {
+        ERROR("The checkpoint %s belongs to a different patch.\n", file.c_str());
+        return -1;
+    }
+    if (started) {
+        ERROR("Instruction %zu was interrupted while rewriting a file in place, "
+              "cannot resume.\n",
+              (size_t)(started - 1));
+        return -1;
+    }
+    if (rules != filter) {
+        ERROR("The checkpoint %s was saved with different --include/--exclude "
+              "options, cannot resume.\n",
+              file.c_str());
+        return -1;
+    }
+
+    std::vector<std::string> paths;
+    for (auto &state : saved) {
+        paths.push_back(state.path);
+    }
+    if (capture(paths, current)) {
+        return -1;
+    }
+    for (size_t i = 0; i < saved.size(); i++) {
+        if (current[i] != saved[i]) {
+            ERROR("%s changed since the checkpoint was saved, cannot resume.\n",
+                  saved[i].path.c_str());
+            return -1;
+        }
+    }
+
+    states = std::move(saved);
+    INFO("Loaded checkpoint %s: %zu instructions completed.\n", file.c_str(),
+         (size_t)completed);
+    return 0;
+}
+
+int Checkpoint::complete(uint64_t index, const std::vector<std::string> &paths) {
+    completed = index + 1;
+    if (!interval) {
+        return 0;
+    }
+
+    pending_paths.insert(pending_paths.end(), paths.begin(), paths.end());
+    last_paths = paths;
+    if (++pending < interval && !started) {
+        return 0;
+    }
+    started = 0;
+    return save();
+}
+
+int Checkpoint::start(uint64_t index) {
+    if (!interval) {
+        return 0;
+    }
+    started = index + 1;
+    return save();
+}
+
+/*
+ * fsync the given file or directory, if it exists.
+ */
+static int sync_path(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    int r = fsync(fd);
+    close(fd);
+    return r;
+}
+
+int Checkpoint::save() {
+    TRACE_SCOPE("save checkpoint", completed, file);
+    std::set<std::string> synced;
+
+    if (identify()) {
+        ERROR("Cannot save the checkpoint %s without identifying the patch.\n",
+              file.c_str());
+        return -1;
+    }
+
+    /* The checkpoint must not claim changes that could still be lost. */
+    for (auto &path : pending_paths) {
+        std::string dir = std::filesystem::path(path).parent_path();
+        for (auto &p : {path, dir.empty() ? std::string(".") : dir}) {
+            if (synced.insert(p).second && sync_path(p)) {
+                ERROR("Failed to sync %s: %s\n", p.c_str(), strerror(errno));
+                return -1;
+            }
+        }
+    }
+
+    if (capture(last_paths, states)) {
+        return -1;
+    }
+
+    std::vector<std::byte> data;
+    data.insert(data.end(), (const std::byte *)signature,
+                (const std::byte *)signature + strlen(signature) + 1);
+    store_uint64_t(patch_id, data);
+    store_varint(completed, data);
+    store_varint(started, data);
+    store_varint(filter.size(), data);
+    for (auto &rule : filter) {
+        store_string(rule, data);
+    }
+    store_varint(states.size(), data);
+    for (auto &state : states) {
+        store_string(state.path, data);
+        data.push_back((std::byte)state.exists);
+        store_varint(state.size, data);
+        store_varint(state.mtime, data);
+        store_varint(state.inode, data);
+    }
+
+    std::string temp_file = file + ".tmp";
+    int         fd = open(temp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    size_t      written = 0;
+    while (fd != -1 && written < data.size()) {
+        ssize_t r = write(fd, data.data() + written, data.size() - written);
+        if (r < 0) {
+            break;
+        }
+        written += r;
+    }
+
+    /* The descriptor is closed exactly once, whatever failed. */
+    bool failed = fd == -1 || written != data.size() || fsync(fd);
+    int  error = errno;
+    if (fd != -1 && close(fd) && !failed) {
+        failed = true;
+        error = errno;
+    }
+    if (failed) {
+        ERROR("Failed to write the checkpoint %s: %s\n", temp_file.c_str(),
+              strerror(error));
+        unlink(temp_file.c_str());
+        return -1;
+    }
+
+    if (rename(temp_file.c_str(), file.c_str()) ||
+        sync_path(std::filesystem::path(file).parent_path())) {
+        ERROR("Failed to save the checkpoint %s: %s\n", file.c_str(), strerror(errno));
+        return -1;
+    }
+
+    INFO("Saved checkpoint %s: %zu instructions completed.\n", file.c_str(),
+         (size_t)completed);
+    pending = 0;
+    pending_paths.clear();
+    return 0;
+}
+
+int Checkpoint::remove() {
+    if (unlink(file.c_str()) && errno != ENOENT) {
+        ERROR("Failed to remove the checkpoint %s: %s\n", file.c_str(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
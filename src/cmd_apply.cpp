@@ -2,6 +2,7 @@
 #include <unistd.h>
 
 #include <commands.hpp>
+#include <config.hpp>
 #include <cstdio>
 #include <cstring>
 #include <diff.hpp>
@@ -10,17 +11,55 @@
 #include <util.hpp>
 #include <utility>
 
-static struct option const long_opts[] = {{"help", 0, nullptr, 'h'},
-                                          {nullptr, 0, nullptr, 0}};
+enum LongOnlyOption {
+    OPT_DECODE_WORKERS = 256,
+    OPT_MEMORY_BUDGET,
+    OPT_INCLUDE,
+    OPT_EXCLUDE,
+    OPT_RESUME,
+    OPT_CHECKPOINT_INTERVAL,
+    OPT_NO_IN_PLACE,
+};
+
+static struct option const long_opts[] = {
+    {"help", 0, nullptr, 'h'},
+    {"decode-workers", 1, nullptr, OPT_DECODE_WORKERS},
+    {"memory-budget", 1, nullptr, OPT_MEMORY_BUDGET},
+    {"include", 1, nullptr, OPT_INCLUDE},
+    {"exclude", 1, nullptr, OPT_EXCLUDE},
+    {"resume", 0, nullptr, OPT_RESUME},
+    {"checkpoint-interval", 1, nullptr, OPT_CHECKPOINT_INTERVAL},
+    {"no-in-place", 0, nullptr, OPT_NO_IN_PLACE},
+    {nullptr, 0, nullptr, 0}};
 
 static const char *const short_opts = "-h";
 
 static void print_help() {
     // clang-format off
 	printf(
-		"Usage: apply PATCHFILE DESTPATH\n"
+		"Usage: apply [OPTIONS] PATCHFILE DESTPATH\n"
 		"\n"
 		"Apply the given patchfile at the provided path.\n"
+		"\n"
+		"Options:\n"
+		"  -h, --help                 show this message\n"
+		"      --decode-workers N     Threads decoding the upcoming instructions.\n"
+		"      --memory-budget SIZE   Maximum size of the instructions read ahead\n"
+		"                                 (e.g. 64M, default 256M).\n"
+		"      --include GLOB         Only apply the instructions touching a path\n"
+		"                                 matching GLOB (or inside a directory\n"
+		"                                 matching it). May be repeated.\n"
+		"      --exclude GLOB         Ignore the paths matching GLOB. May be\n"
+		"                                 repeated.\n"
+		"      --resume               Continue an interrupted apply, skipping the\n"
+		"                                 instructions completed before.\n"
+		"      --checkpoint-interval N\n"
+		"                             Durably record the progress every N\n"
+		"                                 instructions, so that a failed apply\n"
+		"                                 can be resumed (default 0, disabled).\n"
+		"      --no-in-place          Rewrite whole files even for the diffs that\n"
+		"                                 can write only the changed ranges\n"
+		"                                 (myers).\n"
 	);
     // clang-format on
 }
@@ -32,11 +71,17 @@ int do_command_apply(int argc, char **argv) {
     }
 
     int         r = -1;
-    char        short_option;
+    int         short_option;
     const char *patchfile = NULL;
     const char *destpath = NULL;
     char       *oldwd;
-    Patch       p;
+    size_t      value;
+    PatchReader reader;
+    PathFilter  filter;
+    bool        resume = false;
+    size_t      checkpoint_interval = 0;
+
+    std::shared_ptr<Config> config = Config::get();
 
     optind = 1;
     opterr = 0;
@@ -49,6 +94,37 @@ int do_command_apply(int argc, char **argv) {
         case 'h':
             print_help();
             return 0;
+        case OPT_DECODE_WORKERS:
+            if (parse_size(optarg, value) || value < 1 || value > 4096) {
+                ERROR("Invalid number of workers: %s\n", optarg);
+                return -1;
+            }
+            config->decode_workers = (int)value;
+            break;
+        case OPT_MEMORY_BUDGET:
+            if (parse_size(optarg, config->memory_budget) || !config->memory_budget) {
+                ERROR("Invalid memory budget: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_INCLUDE:
+            filter.include(optarg);
+            break;
+        case OPT_EXCLUDE:
+            filter.exclude(optarg);
+            break;
+        case OPT_RESUME:
+            resume = true;
+            break;
+        case OPT_CHECKPOINT_INTERVAL:
+            if (parse_size(optarg, checkpoint_interval)) {
+                ERROR("Invalid checkpoint interval: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_NO_IN_PLACE:
+            config->in_place = false;
+            break;
         case 1:
             if (!patchfile) {
                 patchfile = argv[optind - 1];
@@ -72,11 +148,20 @@ int do_command_apply(int argc, char **argv) {
     return -1;
 
 apply:
-    if ((r = p.load_from_file(patchfile))) {
+    /* Opened before changing the working directory, the path may be relative. */
+    if ((r = reader.open(patchfile))) {
         ERROR("Failed to apply the patch.\n");
         return r;
     }
 
+    Checkpoint checkpoint(patchfile, destpath);
+    checkpoint.interval = checkpoint_interval;
+    checkpoint.filter = filter.rules();
+    if (checkpoint.interval && checkpoint.identify()) {
+        ERROR("Failed to apply the patch.\n");
+        return -1;
+    }
+
     oldwd = getcwd(NULL, 0);
     if (!oldwd) {
         ERROR("Failed getcwd: %s\n", strerror(errno));
@@ -90,8 +175,21 @@ apply:
     }
     INFO("Changed CWD to %s\n", destpath);
 
-    INFO("Applying the patch...\n");
-    r = p.apply();
+    if (checkpoint.exists() && !resume) {
+        ERROR("A previous apply was interrupted, see %s. Use --resume to "
+              "continue it.\n",
+              checkpoint.path().c_str());
+        r = -1;
+    } else if (checkpoint.exists()) {
+        r = checkpoint.load();
+    } else if (resume) {
+        MSG("No checkpoint found, applying the whole patch.\n");
+    }
+
+    if (!r) {
+        INFO("Applying the patch...\n");
+        r = Patch::apply(reader, &filter, &checkpoint);
+    }
 
     if (chdir(oldwd)) {
         ERROR("Failed chdir(%s): %s\n", oldwd, strerror(errno));
@@ -1,31 +1,142 @@
+#include <fcntl.h>
 #include <getopt.h>
+#include <lzma.h>
+#include <unistd.h>
 
+#include <buffer_pool.hpp>
 #include <commands.hpp>
 #include <config.hpp>
 #include <cstdio>
 #include <cstring>
 #include <diff.hpp>
 #include <error.hpp>
+#include <file_cache.hpp>
 #include <patch.hpp>
+#include <pipeline.hpp>
 #include <util.hpp>
 #include <utility>
+#include <vector>
+
+enum LongOnlyOption {
+    OPT_READ_WORKERS = 256,
+    OPT_DIFF_WORKERS,
+    OPT_COMPRESS_WORKERS,
+    OPT_QUEUE_DEPTH,
+    OPT_FORMAT_VERSION,
+    OPT_DICTIONARY,
+    OPT_DICTIONARY_SIZE,
+    OPT_SOLID,
+    OPT_SOLID_BLOCK_SIZE,
+    OPT_CACHE,
+    OPT_XZ_PRESET,
+    OPT_XZ_THREADS,
+    OPT_SOLID_COMPRESSOR,
+    OPT_NO_CHECKSUMS,
+};
 
 static struct option const long_opts[] = {
-    {"help", 0, nullptr, 'h'},       {"modify", 0, nullptr, 'M'},
-    {"compressor", 0, nullptr, 'c'}, {"diff", 0, nullptr, 'd'},
-    {"relocate", 0, nullptr, 'R'},   {"delete", 0, nullptr, 'D'},
+    {"help", 0, nullptr, 'h'},
+    {"modify", 0, nullptr, 'M'},
+    {"compressor", 0, nullptr, 'c'},
+    {"diff", 0, nullptr, 'd'},
+    {"relocate", 0, nullptr, 'R'},
+    {"delete", 0, nullptr, 'D'},
+    {"jobs", 1, nullptr, 'j'},
+    {"read-workers", 1, nullptr, OPT_READ_WORKERS},
+    {"diff-workers", 1, nullptr, OPT_DIFF_WORKERS},
+    {"compress-workers", 1, nullptr, OPT_COMPRESS_WORKERS},
+    {"queue-depth", 1, nullptr, OPT_QUEUE_DEPTH},
+    {"format-version", 1, nullptr, OPT_FORMAT_VERSION},
+    {"dictionary", 0, nullptr, OPT_DICTIONARY},
+    {"dictionary-size", 1, nullptr, OPT_DICTIONARY_SIZE},
+    {"solid", 0, nullptr, OPT_SOLID},
+    {"solid-block-size", 1, nullptr, OPT_SOLID_BLOCK_SIZE},
+    {"cache", 1, nullptr, OPT_CACHE},
+    {"xz-preset", 1, nullptr, OPT_XZ_PRESET},
+    {"xz-threads", 1, nullptr, OPT_XZ_THREADS},
+    {"solid-compressor", 1, nullptr, OPT_SOLID_COMPRESSOR},
+    {"no-checksums", 0, nullptr, OPT_NO_CHECKSUMS},
     {nullptr, 0, nullptr, 0}};
 
-static const char *const short_opts = "-hMc:d:peRoDr";
+static const char *const short_opts = "-hMc:d:peRoDrj:";
+
+/*
+ * An instruction on its way to the patch file.
+ */
+struct CreateJob {
+    std::shared_ptr<Instruction> instruction;
+
+    /*
+     * Only set for entity modifications, whose diff is constructed in the
+     * pipeline.
+     */
+    std::shared_ptr<Diff> diff;
+    std::string           from_file;
+    std::string           to_file;
+    bool                  diffed = false;
+
+    /* Set if the files are identical, so that there is nothing to write. */
+    bool identical = false;
+
+    uint8_t                signature = 0;
+    std::vector<std::byte> repr;
+
+    /* Ids of the paths the instruction touches in the path table. */
+    std::vector<uint64_t> path_ids;
+
+    CreateJob() = default;
+    CreateJob(std::shared_ptr<Instruction> instruction, std::shared_ptr<Diff> diff = nullptr,
+              std::string from_file = "", std::string to_file = "")
+        : instruction(std::move(instruction)), diff(std::move(diff)),
+          from_file(std::move(from_file)), to_file(std::move(to_file)) {
+    }
+};
 
 static void print_help() {
     // clang-format off
 	printf(
-		"Usage: create PATCHFILE INSTRUCTIONS\n"
+		"Usage: create PATCHFILE [OPTIONS] INSTRUCTIONS\n"
 		"\n"
 		"Instructions will be stored in the same order\n"
 		"    that they were declared here.\n"
 		"\n"
+		"Options:\n"
+		"  -j, --jobs N               Use N threads for both diffing and compression.\n"
+		"      --read-workers N       Threads prefetching the input files.\n"
+		"      --diff-workers N       Threads constructing the diffs.\n"
+		"      --compress-workers N   Threads serializing and compressing instructions.\n"
+		"      --queue-depth N        Maximum number of instructions being processed\n"
+		"                                 at once.\n"
+		"      --format-version N     Write a patch of compatibility version N, for\n"
+		"                                 older versions of patchit. Default: newest.\n"
+		"      --dictionary           Train a dictionary on a sample of the diffs,\n"
+		"                                 store it in the patch and compress the\n"
+		"                                 zlib diffs with it. Helps many small,\n"
+		"                                 similar diffs.\n"
+		"      --dictionary-size N    Maximum size of the dictionary. Default: 32K.\n"
+		"      --solid                Compress the instructions together in blocks,\n"
+		"                                 with the dictionary if there is one,\n"
+		"                                 instead of compressing every diff on\n"
+		"                                 its own. Helps many small files.\n"
+		"      --solid-block-size N   Size of the blocks. Default: 4M.\n"
+		"      --solid-compressor COMP\n"
+		"                             Compress the blocks with zlib (default) or\n"
+		"                                 xz.\n"
+		"      --cache FILE           Remember the hashes and block signatures of\n"
+		"                                 the source files in FILE, so that the\n"
+		"                                 next create does not read the unchanged\n"
+		"                                 ones again to compare them.\n"
+		"      --xz-preset N[e]       Preset of the xz compressor, 0 to 9, e for\n"
+		"                                 the extreme variant. Default: 6. Every\n"
+		"                                 compress worker needs 94M at preset\n"
+		"                                 6, and 674M at preset 9.\n"
+		"      --xz-threads N         Threads compressing every large xz payload.\n"
+		"                                 Default: 1.\n"
+		"      --no-checksums         Do not store the CRC32C checksums of the\n"
+		"                                 instructions, which apply and verify\n"
+		"                                 check. Patches of compatibility\n"
+		"                                 version 0 have none.\n"
+		"\n"
 		"Instructions with their respective flags:\n"
 		"\n"
 		"Modification:\n"
@@ -37,11 +148,19 @@ static void print_help() {
 		"  -e                         Create an empty file if the target does\n"
 		"                                 not exist before applying the patch.\n"
 		"  -d, --diff       DIFF      Use the selected diff method.\n"
-		"                                 Supported diffs: default\n"
+		"                                 Supported diffs: default myers\n"
+		"                                 (myers diffs the bytes in process,\n"
+		"                                 without the diff command)\n"
 		"  -c, --compressor COMP      Use the selected compression method.\n"
-		"                                 Supported compressors: default zlib\n"
+		"                                 Supported compressors: default zlib auto\n"
+		"                                 xz (auto picks default or zlib for\n"
+		"                                 every diff, depending on how well it\n"
+		"                                 compresses; xz is the smallest and\n"
+		"                                 the slowest)\n"
 		"  Note:\n"
-		"    1. default diff requires commands xxd, diff, and patch\n"
+		"    1. default diff requires the diff command\n"
+		"    2. identical files are skipped, and files that were mostly\n"
+		"           rewritten are stored whole instead of diffed\n"
 		"\n"
 		"Relocation:\n"
 		"  -R, --relocate FLAGS SOURCEFILE DESTFILE\n"
@@ -65,7 +184,7 @@ static void print_help() {
     // clang-format on
 }
 
-int do_create_entity_modification(int argc, char **argv, Patch &p) {
+int do_create_entity_modification(int argc, char **argv, std::vector<CreateJob> &jobs) {
     INFO("Handling entity modification instruction.\n");
     for (int i = 0; i < argc; i++) {
         DEBUG("argv[%d] = %s\n", i, argv[i]);
@@ -95,6 +214,8 @@ int do_create_entity_modification(int argc, char **argv, Patch &p) {
             INFO("Selected diff: %s\n", optarg);
             if (!strcmp(optarg, "default")) {
                 diff.reset(new SystemDiff());
+            } else if (!strcmp(optarg, "myers")) {
+                diff.reset(new MyersDiff());
             } else {
                 ERROR("Unrecognized diff selected: %s\n", optarg);
                 return -1;
@@ -108,6 +229,12 @@ int do_create_entity_modification(int argc, char **argv, Patch &p) {
             } else if (!strcmp(optarg, "zlib")) {
                 Config::get()->compressor = ZLibCompressor::get();
                 INFO("Valid compressor.\n");
+            } else if (!strcmp(optarg, "auto")) {
+                Config::get()->compressor = AutoCompressor::get();
+                INFO("Valid compressor.\n");
+            } else if (!strcmp(optarg, "xz")) {
+                Config::get()->compressor = XzCompressor::get();
+                INFO("Valid compressor.\n");
             } else {
                 ERROR("Unrecognized compressor selected: %s\n", optarg);
                 return -1;
@@ -137,22 +264,14 @@ int do_create_entity_modification(int argc, char **argv, Patch &p) {
 
 create:
     diff->compressor = Config::get()->compressor;
-    if (diff->from_files(from_file, to_file)) {
-        ERROR(
-            "Failed to create an entity modification instruction: diff creation has "
-            "failed.\n");
-        return -1;
-    }
-
     ins.reset(new EntityModifyInstruction(
         create_subdirectories, create_empty_file_if_not_exists, from_file, diff));
-    p.append(ins);
-    INFO("Successfully created new entity modify instruction: %s -> %s.\n",
-         from_file, to_file);
+    jobs.emplace_back(ins, diff, from_file, to_file);
+    INFO("Queued new entity modify instruction: %s -> %s.\n", from_file, to_file);
     return 0;
 }
 
-int do_create_entity_move(int argc, char **argv, Patch &p) {
+int do_create_entity_move(int argc, char **argv, std::vector<CreateJob> &jobs) {
     INFO("Handling entity relocation instruction.\n");
     for (int i = 0; i < argc; i++) {
         DEBUG("argv[%d] = %s\n", i, argv[i]);
@@ -202,13 +321,13 @@ int do_create_entity_move(int argc, char **argv, Patch &p) {
 move:
     ins.reset(new EntityMoveInstruction(
         create_subdirectories, override_if_already_exists, move_from, move_to));
-    p.append(ins);
+    jobs.emplace_back(ins);
     INFO("Successfully created new entity relocation instruction: %s -> %s.\n",
          move_from, move_to);
     return 0;
 }
 
-int do_create_entity_delete(int argc, char **argv, Patch &p) {
+int do_create_entity_delete(int argc, char **argv, std::vector<CreateJob> &jobs) {
     INFO("Handling entity deletion instruction.\n");
     for (int i = 0; i < argc; i++) {
         DEBUG("argv[%d] = %s\n", i, argv[i]);
@@ -249,21 +368,294 @@ int do_create_entity_delete(int argc, char **argv, Patch &p) {
 
 _delete:
     ins.reset(new EntityDeleteInstruction(delete_recursively_if_directory, target));
-    p.append(ins);
+    jobs.emplace_back(ins);
     INFO("Successfully created new entity deletion instruction: %s\n", target);
     return 0;
 }
 
+/*
+ * Ask the kernel to start reading the input files, so that the diff stage
+ * finds them in the page cache.
+ */
+static int prefetch_inputs(CreateJob &job, uint64_t index) {
+    for (const std::string &file : {job.from_file, job.to_file}) {
+        if (file.empty()) {
+            continue;
+        }
+
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd == -1) {
+            /* The diff stage reports missing files. */
+            continue;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+    return 0;
+}
+
+/*
+ * Files that are identical need no instruction at all, and files that were
+ * rewritten are stored whole rather than diffed. Destinations with holes are
+ * stored without them, unless diffed byte by byte: a SystemDiff would dump
+ * every byte of the holes. If the files cannot be compared, the diff reports
+ * why.
+ */
+static int construct_diff(CreateJob &job, uint64_t index, FileCache *cache) {
+    FileRelation relation;
+    uint64_t     estimate, stored;
+
+    if (!job.diff || job.diffed) {
+        return 0;
+    }
+
+    if (!compare_files(job.from_file, job.to_file, relation, cache, &estimate)) {
+        if (relation == FILES_IDENTICAL) {
+            MSG("Skipping %s: %s is identical.\n", job.from_file.c_str(),
+                job.to_file.c_str());
+            job.identical = job.diffed = true;
+            return 0;
+        }
+        /* Holes are only kept if skipping them makes the diff smaller. */
+        if (job.diff->signature != Diff::MYERS_DIFF &&
+            SparseDiff::has_holes(job.to_file, &stored) && stored < estimate) {
+            std::shared_ptr<Diff> diff = std::make_shared<SparseDiff>();
+            diff->compressor = job.diff->compressor;
+            job.diff = diff;
+            std::static_pointer_cast<EntityModifyInstruction>(job.instruction)
+                ->set_diff(diff);
+        } else if (relation == FILES_REWRITTEN) {
+            std::shared_ptr<Diff> diff = std::make_shared<ReplaceDiff>();
+            diff->compressor = job.diff->compressor;
+            job.diff = diff;
+            std::static_pointer_cast<EntityModifyInstruction>(job.instruction)
+                ->set_diff(diff);
+        }
+    }
+
+    if (job.diff->from_files(job.from_file, job.to_file)) {
+        ERROR(
+            "Failed to create an entity modification instruction: diff creation has "
+            "failed.\n");
+        return -1;
+    }
+    job.diffed = true;
+    INFO("Successfully created new entity modify instruction: %s -> %s.\n",
+         job.from_file.c_str(), job.to_file.c_str());
+    return 0;
+}
+
+/*
+ * Whether the given diff may be compressed with zlib.
+ */
+static bool uses_zlib(const std::shared_ptr<Diff> &diff) {
+    return diff->compressor == ZLibCompressor::get() ||
+           diff->compressor == AutoCompressor::get();
+}
+
+/*
+ * Train a dictionary on the diffs of up to max_samples evenly spaced
+ * modifications. They are sampled from the modifications compressed with zlib,
+ * or, for solid patches, from all of them. The diffs are kept, so that they are
+ * not constructed twice.
+ */
+static int train_dictionary(std::vector<CreateJob> &jobs, size_t max_size, bool solid,
+                            FileCache *cache, std::vector<std::byte> &dictionary) {
+    const size_t                        max_samples = 64;
+    std::vector<CreateJob *>            candidates;
+    std::vector<std::vector<std::byte>> samples;
+
+    for (auto &job : jobs) {
+        if (job.diff && (solid || uses_zlib(job.diff))) {
+            candidates.push_back(&job);
+        }
+    }
+
+    size_t number = std::min(candidates.size(), max_samples);
+    for (size_t i = 0; i < number; i++) {
+        CreateJob &job = *candidates[i * candidates.size() / number];
+        if (construct_diff(job, 0, cache)) {
+            return -1;
+        }
+        if (job.identical) {
+            continue;
+        }
+
+        /* The uncompressed diff, without the compressor id. */
+        std::vector<std::byte>      sample;
+        std::shared_ptr<Compressor> compressor = job.diff->compressor;
+        job.diff->compressor = PlainCompressor::get();
+        job.diff->write_binary_representation(sample);
+        job.diff->compressor = compressor;
+        sample.erase(sample.begin());
+        samples.push_back(std::move(sample));
+    }
+
+    dictionary = ZLibDictionaryCompressor::train(samples, max_size);
+    return 0;
+}
+
+/*
+ * Compress the zlib diffs with the dictionary of the patch, if it has one, and
+ * let the auto ones pick it instead of zlib. The xz diffs are compressed with
+ * the given preset and threads. The blocks of solid patches are compressed
+ * instead, so compressing the diffs as well would only cost time.
+ */
+static void select_diff_compressors(std::vector<CreateJob> &jobs, PatchWriter &writer,
+                                    bool solid, std::shared_ptr<Compressor> xz) {
+    PatchContext               *context = writer.patch_context();
+    std::shared_ptr<Compressor> zlib = ZLibCompressor::get();
+    std::shared_ptr<Compressor> automatic = AutoCompressor::get();
+
+    if (solid) {
+        zlib = automatic = xz = PlainCompressor::get();
+    } else if (context && context->dictionary_compressor) {
+        zlib = context->dictionary_compressor;
+        automatic = std::make_shared<AutoCompressor>(
+            std::vector<std::shared_ptr<Compressor>>{PlainCompressor::get(), zlib});
+    }
+
+    for (auto &job : jobs) {
+        if (!job.diff) {
+            continue;
+        }
+        if (job.diff->compressor == ZLibCompressor::get()) {
+            job.diff->compressor = zlib;
+        } else if (job.diff->compressor == AutoCompressor::get()) {
+            job.diff->compressor = automatic;
+        } else if (job.diff->compressor == XzCompressor::get()) {
+            job.diff->compressor = xz;
+        }
+    }
+}
+
+/*
+ * Parse an xz preset: a level from 0 to 9, possibly followed by e for the
+ * extreme variant.
+ */
+static int parse_xz_preset(const char *arg, uint32_t &preset) {
+    if (arg[0] < '0' || arg[0] > '9' || (arg[1] && strcmp(arg + 1, "e"))) {
+        ERROR("Invalid xz preset: %s\n", arg);
+        return -1;
+    }
+    preset = (uint32_t)(arg[0] - '0') | (arg[1] ? LZMA_PRESET_EXTREME : 0);
+    return 0;
+}
+
+static int serialize_instruction(CreateJob &job, uint64_t index, BufferPool &buffers,
+                                 PatchContext *context) {
+    if (job.identical) {
+        job.instruction.reset();
+        job.diff.reset();
+        return 0;
+    }
+
+    job.signature = job.instruction->signature;
+    job.repr = buffers.acquire();
+    job.instruction->write_binary_representation(job.repr, context);
+
+    /* Only the serialized instruction is needed from now on. */
+    job.instruction.reset();
+    job.diff.reset();
+    return 0;
+}
+
+/*
+ * Construct the queued instructions and write them to the patch. Reading,
+ * diffing and compression of different instructions overlap, while the
+ * instructions are written in the order they were declared.
+ */
+static int write_instructions(std::vector<CreateJob> &jobs, PatchWriter &writer,
+                              FileCache *cache) {
+    std::shared_ptr<Config> config = Config::get();
+    Pipeline<CreateJob>     pipeline(config->queue_depth);
+    BufferPool              buffers;
+    size_t                  next = 0;
+    size_t                  skipped = 0;
+
+    INFO("Creating %zu instructions: %d read, %d diff, %d compress workers, queue "
+         "depth %zu\n",
+         jobs.size(), config->read_workers, config->diff_workers,
+         config->compress_workers, config->queue_depth);
+
+    if (PathTable *table = writer.path_table()) {
+        for (auto &job : jobs) {
+            for (auto &path : job.instruction->paths()) {
+                job.path_ids.push_back(table->intern(path));
+            }
+        }
+    }
+
+    pipeline.add_stage("read", config->read_workers, prefetch_inputs);
+    pipeline.add_stage("diff", config->diff_workers, [&](CreateJob &job, uint64_t index) {
+        return construct_diff(job, index, cache);
+    });
+    pipeline.add_stage("serialize", config->compress_workers,
+                       [&](CreateJob &job, uint64_t index) {
+                           return serialize_instruction(job, index, buffers,
+                                                        writer.patch_context());
+                       });
+
+    int r = pipeline.run(
+        [&](CreateJob &job) {
+            if (next == jobs.size()) {
+                return 0;
+            }
+            job = std::move(jobs[next++]);
+            return 1;
+        },
+        [&](CreateJob &job, uint64_t index) {
+            if (job.identical) {
+                skipped++;
+                return 0;
+            }
+            if (writer.append_representation(job.signature, job.repr, job.path_ids)) {
+                ERROR("Failed to write the instruction to the patch.\n");
+                return -1;
+            }
+            buffers.release(std::move(job.repr));
+            return 0;
+        });
+
+    if (!r && skipped) {
+        MSG("Skipped %zu modifications of identical files.\n", skipped);
+    }
+    return r;
+}
+
+static int parse_workers(const char *arg, int &workers) {
+    size_t value;
+    if (parse_size(arg, value) || value < 1 || value > 4096) {
+        ERROR("Invalid number of workers: %s\n", arg);
+        return -1;
+    }
+    workers = (int)value;
+    return 0;
+}
+
 int do_command_create(int argc, char **argv) {
     for (int i = 0; i < argc; i++) {
         DEBUG("Got argv[i]: %s\n", argv[i]);
     }
 
     int         r = -1;
-    char        short_option;
+    int         short_option;
     const char *patchfile = NULL;
+    uint64_t    format_version = Patch::compatibility_version;
+    bool        with_dictionary = false;
+    size_t      dictionary_size = 32 << 10;
+    bool        solid = false;
+    size_t      block_size = 4 << 20;
+    uint32_t    xz_preset = LZMA_PRESET_DEFAULT;
+    int         xz_threads = 1;
+    bool        solid_xz = false;
+    bool        checksums = true;
 
-    Patch p;
+    std::shared_ptr<Config>    config = Config::get();
+    std::vector<CreateJob>     jobs;
+    std::vector<std::byte>     dictionary;
+    std::unique_ptr<FileCache> cache;
+    PatchWriter                writer;
 
     optind = 1;
     opterr = 0;
@@ -281,7 +673,7 @@ int do_command_create(int argc, char **argv) {
                 return -1;
             }
 
-            if ((r = do_create_entity_modification(argc, argv, p))) {
+            if ((r = do_create_entity_modification(argc, argv, jobs))) {
                 return r;
             }
             break;
@@ -291,7 +683,7 @@ int do_command_create(int argc, char **argv) {
                 return -1;
             }
 
-            if ((r = do_create_entity_move(argc, argv, p))) {
+            if ((r = do_create_entity_move(argc, argv, jobs))) {
                 return r;
             }
             break;
@@ -301,10 +693,90 @@ int do_command_create(int argc, char **argv) {
                 return -1;
             }
 
-            if ((r = do_create_entity_delete(argc, argv, p))) {
+            if ((r = do_create_entity_delete(argc, argv, jobs))) {
                 return r;
             }
             break;
+        case 'j':
+            if (parse_workers(optarg, config->diff_workers)) {
+                return -1;
+            }
+            config->compress_workers = config->diff_workers;
+            break;
+        case OPT_READ_WORKERS:
+            if (parse_workers(optarg, config->read_workers)) {
+                return -1;
+            }
+            break;
+        case OPT_DIFF_WORKERS:
+            if (parse_workers(optarg, config->diff_workers)) {
+                return -1;
+            }
+            break;
+        case OPT_COMPRESS_WORKERS:
+            if (parse_workers(optarg, config->compress_workers)) {
+                return -1;
+            }
+            break;
+        case OPT_QUEUE_DEPTH:
+            if (parse_size(optarg, config->queue_depth) || !config->queue_depth) {
+                ERROR("Invalid queue depth: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_FORMAT_VERSION: {
+            size_t value;
+            if (parse_size(optarg, value) ||
+                value < Patch::oldest_compatibility_version ||
+                value > Patch::compatibility_version) {
+                ERROR("Unsupported compatibility version: %s\n", optarg);
+                return -1;
+            }
+            format_version = value;
+            break;
+        }
+        case OPT_DICTIONARY:
+            with_dictionary = true;
+            break;
+        case OPT_DICTIONARY_SIZE:
+            if (parse_size(optarg, dictionary_size) || !dictionary_size) {
+                ERROR("Invalid dictionary size: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_SOLID:
+            solid = true;
+            break;
+        case OPT_CACHE:
+            cache = std::make_unique<FileCache>(optarg);
+            break;
+        case OPT_XZ_PRESET:
+            if (parse_xz_preset(optarg, xz_preset)) {
+                return -1;
+            }
+            break;
+        case OPT_XZ_THREADS:
+            if (parse_workers(optarg, xz_threads)) {
+                return -1;
+            }
+            break;
+        case OPT_SOLID_COMPRESSOR:
+            if (!strcmp(optarg, "zlib") || !strcmp(optarg, "xz")) {
+                solid_xz = !strcmp(optarg, "xz");
+            } else {
+                ERROR("Unsupported block compressor: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_NO_CHECKSUMS:
+            checksums = false;
+            break;
+        case OPT_SOLID_BLOCK_SIZE:
+            if (parse_size(optarg, block_size) || !block_size) {
+                ERROR("Invalid block size: %s\n", optarg);
+                return -1;
+            }
+            break;
         case '?':
             handle_unknown_option(optind, optopt, argv);
             return -1;
@@ -322,7 +794,53 @@ int do_command_create(int argc, char **argv) {
         }
     }
 
-    r = p.write_to_file(patchfile);
+    if (!patchfile) {
+        ERROR("Patchfile was not specified.\n");
+        return -1;
+    }
+
+    if (with_dictionary && format_version == 0) {
+        ERROR("Patches of compatibility version 0 cannot have a dictionary.\n");
+        return -1;
+    }
+
+    if (cache) {
+        cache->load();
+    }
+
+    if (solid && format_version == 0) {
+        ERROR("Patches of compatibility version 0 cannot be solid.\n");
+        return -1;
+    }
+
+    if (solid_xz && with_dictionary) {
+        ERROR("The dictionary cannot be used with xz blocks.\n");
+        return -1;
+    }
+
+    std::shared_ptr<Compressor> xz = XzCompressor::get();
+    if (xz_preset != LZMA_PRESET_DEFAULT || xz_threads != 1) {
+        xz = std::make_shared<XzCompressor>(xz_preset, xz_threads);
+    }
+
+    if (with_dictionary &&
+        (r = train_dictionary(jobs, dictionary_size, solid, cache.get(), dictionary))) {
+        ERROR("Failed to create a patch (%d).\n", r);
+        return r;
+    }
+
+    if (!(r = writer.open(patchfile, format_version, dictionary, solid ? block_size : 0,
+                          solid_xz ? xz : nullptr, checksums && format_version > 0))) {
+        select_diff_compressors(jobs, writer, solid, xz);
+        if (!(r = write_instructions(jobs, writer, cache.get()))) {
+            r = writer.finish();
+        }
+    }
+
+    /* A cache that cannot be saved only makes the next create slower. */
+    if (!r && cache) {
+        cache->save();
+    }
 
     if (!r) {
         MSG("Created a patch successfully.\n");
@@ -8,9 +8,11 @@
 #include <utility>
 
 static struct option const long_opts[] = {{"help", 0, nullptr, 'h'},
-                                          {"verbose", 0, nullptr, 'V'}};
+                                          {"verbose", 0, nullptr, 'V'},
+                                          {"path", 1, nullptr, 'p'},
+                                          {nullptr, 0, nullptr, 0}};
 
-static const char *const short_opts = "-hV";
+static const char *const short_opts = "-hVp:";
 
 static void print_help() {
     // clang-format off
@@ -20,6 +22,7 @@ static void print_help() {
 		"Flags:\n"
 		"  -h, --help                 show this message\n"
 		"  -V, --verbose              increase verbosity level\n"
+		"  -p, --path PATH            only show the instructions touching PATH\n"
 	);
     // clang-format on
 }
@@ -34,6 +37,7 @@ int do_command_inspect(int argc, char **argv) {
     char        short_option;
     int         verbosity = 0;
     const char *patchfile = NULL;
+    const char *path = NULL;
     Patch       p;
 
     optind = 1;
@@ -50,6 +54,9 @@ int do_command_inspect(int argc, char **argv) {
         case 'V':
             verbosity++;
             break;
+        case 'p':
+            path = optarg;
+            break;
         case 1:
             patchfile = argv[optind - 1];
             INFO("Patchfile specified: %s\n", patchfile);
@@ -66,6 +73,10 @@ int do_command_inspect(int argc, char **argv) {
     return -1;
 
 inspect:
+    if (path) {
+        return Patch::inspect_path(patchfile, path, verbosity);
+    }
+
     if ((r = p.load_from_file(patchfile))) {
         ERROR("Failed to inspect the patch.\n");
         return r;
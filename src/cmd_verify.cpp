@@ -0,0 +1,86 @@
+#include <getopt.h>
+#include <unistd.h>
+
+#include <commands.hpp>
+#include <config.hpp>
+#include <error.hpp>
+#include <patch.hpp>
+#include <util.hpp>
+
+static struct option const long_opts[] = {{"help", 0, nullptr, 'h'},
+                                          {"jobs", 1, nullptr, 'j'},
+                                          {"decode", 0, nullptr, 'd'},
+                                          {nullptr, 0, nullptr, 0}};
+
+static const char *const short_opts = "-hj:d";
+
+static void print_help() {
+    // clang-format off
+	printf(
+		"Usage: verify [FLAGS] PATCHFILE\n"
+		"\n"
+		"Check the checksums of a patch without applying it.\n"
+		"\n"
+		"Flags:\n"
+		"  -h, --help                 show this message\n"
+		"  -j, --jobs N               check N parts of the patch at once\n"
+		"                                 Default: number of CPUs.\n"
+		"  -d, --decode               also decode every instruction, decompressing\n"
+		"                                 the diffs; always done for patches\n"
+		"                                 without checksums\n"
+	);
+    // clang-format on
+}
+
+int do_command_verify(int argc, char **argv) {
+    INFO("Running verify command.\n");
+    for (int i = 0; i < argc; i++) {
+        DEBUG("Got argv[i]: %s\n", argv[i]);
+    }
+
+    char        short_option;
+    const char *patchfile = NULL;
+    bool        decode = false;
+    int         threads = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    size_t      value;
+
+    optind = 1;
+    opterr = 0;
+    while ((short_option = getopt_long(argc, argv, short_opts, long_opts, 0)) !=
+           -1) {
+        DEBUG("Processing short option '%c' (%d)\n", short_option,
+              (int)short_option);
+
+        switch (short_option) {
+        case 'h':
+            print_help();
+            return 0;
+        case 'j':
+            if (parse_size(optarg, value) || value < 1 || value > 4096) {
+                ERROR("Invalid number of jobs: %s\n", optarg);
+                return -1;
+            }
+            threads = (int)value;
+            break;
+        case 'd':
+            decode = true;
+            break;
+        case 1:
+            patchfile = argv[optind - 1];
+            INFO("Patchfile specified: %s\n", patchfile);
+            goto verify;
+        case '?':
+            handle_unknown_option(optind, optopt, argv);
+            return -1;
+        default:
+            CRIT("Failed to parse options.\n");
+            return -1;
+        }
+    }
+
+    ERROR("Please specify patchfile.\n");
+    return -1;
+
+verify:
+    return Patch::verify(patchfile, threads, decode);
+}
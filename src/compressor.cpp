@@ -0,0 +1,21 @@
+#include <compressor.hpp>
+
+std::vector<std::byte> Compressor::compress(std::span<const std::byte> data) {
+    std::vector<std::byte> res;
+    if (compress_into(data, res)) {
+        return {};
+    }
+    return res;
+}
+
+std::vector<std::byte> Compressor::decompress(std::span<const std::byte> data) {
+    std::vector<std::byte> res;
+    if (decompress_into(data, res)) {
+        return {};
+    }
+    return res;
+}
+
+Compressor *Compressor::select(std::span<const std::byte> data) {
+    return this;
+}
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <compressor.hpp>
 #include <config.hpp>
+#include <thread>
 
 Config::Config() {
     this->verbosity = 0;
@@ -19,12 +21,20 @@ Config::Config() {
 #endif
 
     this->compressor = PlainCompressor::get();
+    this->io_backend = "posix";
+
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    this->read_workers = 1;
+    this->diff_workers = threads;
+    this->compress_workers = threads;
+    this->queue_depth = 4 * threads;
+
+    this->decode_workers = threads;
+    this->memory_budget = 256 << 20;
+    this->in_place = true;
 }
 
 std::shared_ptr<Config> Config::get() {
-    static std::shared_ptr<Config> instance;
-    if (!instance) {
-        instance.reset(new Config());
-    }
+    static std::shared_ptr<Config> instance(new Config());
     return instance;
 }
@@ -0,0 +1,163 @@
+#include <crc32c.hpp>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_X86 1
+#endif
+
+/* The polynomial 0x1edc6f41, reflected. */
+static const uint32_t polynomial = 0x82f63b78;
+
+/*
+ * table[k][b] is the checksum of byte b followed by k zero bytes, so that eight
+ * bytes are looked up at once.
+ */
+struct Tables {
+    uint32_t table[8][256];
+};
+
+static constexpr Tables make_tables() {
+    Tables tables{};
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? crc >> 1 ^ polynomial : crc >> 1;
+        }
+        tables.table[0][b] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t crc = tables.table[k - 1][b];
+            tables.table[k][b] = crc >> 8 ^ tables.table[0][crc & 0xff];
+        }
+    }
+    return tables;
+}
+
+static constexpr Tables tables = make_tables();
+
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t *data, size_t size) {
+    const auto &t = tables.table;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][word >> 8 & 0xff] ^ t[5][word >> 16 & 0xff] ^
+              t[4][word >> 24 & 0xff] ^ t[3][word >> 32 & 0xff] ^ t[2][word >> 40 & 0xff] ^
+              t[1][word >> 48 & 0xff] ^ t[0][word >> 56];
+    }
+    for (; size; data++, size--) {
+        crc = crc >> 8 ^ t[0][(crc ^ *data) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+/*
+ * Bytes per stream in every round of three streams. The checksum of a stream
+ * is moved past the streams after it by multiplying it with x^(8 * stream)
+ * modulo the polynomial.
+ */
+static const size_t stream = 4096;
+
+/* a * b modulo the polynomial, both reflected. */
+static uint32_t multiply_modulo(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31, product = 0;
+    for (;;) {
+        if (a & m) {
+            product ^= b;
+            if (!(a & (m - 1))) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? b >> 1 ^ polynomial : b >> 1;
+    }
+    return product;
+}
+
+/* x^n modulo the polynomial, reflected. */
+static uint32_t x_power_modulo(uint64_t n) {
+    uint32_t power = 1u << 31, square = 1u << 30;
+    for (; n; n >>= 1) {
+        if (n & 1) {
+            power = multiply_modulo(square, power);
+        }
+        square = multiply_modulo(square, square);
+    }
+    return power;
+}
+
+static bool has_sse42() {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+
+static bool has_pclmul() {
+    static const bool supported = __builtin_cpu_supports("pclmul");
+    return supported;
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t       crc,
+                                                               const uint8_t *data,
+                                                               size_t         size) {
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; size; data++, size--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+/*
+ * The crc32 instruction takes three cycles, but a new one can start every
+ * cycle: three independent streams keep it busy. Carry-less multiplication of
+ * a checksum with x^(8 * stream - 33) followed by the crc32 of the 64-bit
+ * product, which multiplies with x^33, shifts it past a stream.
+ */
+__attribute__((target("sse4.2,pclmul"))) static uint32_t
+crc32c_pclmul(uint32_t crc, const uint8_t *data, size_t size) {
+    static const uint64_t shift = x_power_modulo(8 * stream - 33);
+    const __m128i         multiplier = _mm_cvtsi64_si128(shift);
+
+    for (; size >= 3 * stream; data += 3 * stream, size -= 3 * stream) {
+        uint64_t a = crc, b = 0, c = 0;
+        for (size_t i = 0; i < stream; i += 8) {
+            uint64_t wa, wb, wc;
+            memcpy(&wa, data + i, 8);
+            memcpy(&wb, data + stream + i, 8);
+            memcpy(&wc, data + 2 * stream + i, 8);
+            a = _mm_crc32_u64(a, wa);
+            b = _mm_crc32_u64(b, wb);
+            c = _mm_crc32_u64(c, wc);
+        }
+        uint64_t shifted_a = _mm_cvtsi128_si64(
+            _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), multiplier, 0));
+        b ^= _mm_crc32_u64(0, shifted_a);
+        uint64_t shifted_b = _mm_cvtsi128_si64(
+            _mm_clmulepi64_si128(_mm_cvtsi64_si128(b), multiplier, 0));
+        crc = (uint32_t)(c ^ _mm_crc32_u64(0, shifted_b));
+    }
+    return crc32c_sse42(crc, data, size);
+}
+#endif
+
+uint32_t crc32c(std::span<const std::byte> data, uint32_t crc) {
+    const uint8_t *bytes = (const uint8_t *)data.data();
+
+    crc = ~crc;
+#ifdef CRC32C_X86
+    if (has_sse42()) {
+        crc = has_pclmul() ? crc32c_pclmul(crc, bytes, data.size())
+                           : crc32c_sse42(crc, bytes, data.size());
+        return ~crc;
+    }
+#endif
+    return ~crc32c_scalar(crc, bytes, data.size());
+}
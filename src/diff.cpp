@@ -1,12 +1,39 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <buffer_pool.hpp>
+#include <cstring>
 #include <diff.hpp>
 #include <error.hpp>
+#include <file_cache.hpp>
+#include <trace.hpp>
 
 std::shared_ptr<Diff> Diff::from_signature(uint8_t signature) {
     std::shared_ptr<Diff> res;
     switch (signature) {
     case Diff::SYSTEM_DIFF:
         INFO("Diff signature recognized: SystemDiff\n");
-        res.reset(new SystemDiff());
+        res = std::allocate_shared<SystemDiff>(
+            std::pmr::polymorphic_allocator<SystemDiff>(object_pool()));
+        break;
+    case Diff::REPLACE_DIFF:
+        INFO("Diff signature recognized: ReplaceDiff\n");
+        res = std::allocate_shared<ReplaceDiff>(
+            std::pmr::polymorphic_allocator<ReplaceDiff>(object_pool()));
+        break;
+    case Diff::MYERS_DIFF:
+        INFO("Diff signature recognized: MyersDiff\n");
+        res = std::allocate_shared<MyersDiff>(
+            std::pmr::polymorphic_allocator<MyersDiff>(object_pool()));
+        break;
+    case Diff::SPARSE_DIFF:
+        INFO("Diff signature recognized: SparseDiff\n");
+        res = std::allocate_shared<SparseDiff>(
+            std::pmr::polymorphic_allocator<SparseDiff>(object_pool()));
         break;
     }
     if (!res) {
@@ -14,3 +41,147 @@ std::shared_ptr<Diff> Diff::from_signature(uint8_t signature) {
     }
     return res;
 }
+
+Diff::ContentsUse Diff::contents_use() {
+    return CONTENTS_UNSUPPORTED;
+}
+
+int Diff::patch_contents(std::span<const std::byte> file, std::vector<std::byte> &out) {
+    return 1;
+}
+
+bool Diff::writes_in_place() {
+    return false;
+}
+
+std::vector<std::byte> Diff::binary_representation() {
+    std::vector<std::byte> res;
+    write_binary_representation(res);
+    return res;
+}
+
+/*
+ * A file mapped into memory for reading.
+ */
+class MappedFile {
+public:
+    std::span<const std::byte> data;
+
+    ~MappedFile() {
+        if (!data.empty()) {
+            munmap((void *)data.data(), data.size());
+        }
+    }
+
+    int map(const std::string &file) {
+        struct stat sb;
+        int         fd = open(file.c_str(), O_RDONLY);
+
+        if (fd == -1 || fstat(fd, &sb)) {
+            INFO("Cannot map %s: %s\n", file.c_str(), strerror(errno));
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+        if (!S_ISREG(sb.st_mode)) {
+            INFO("Cannot map %s: not a regular file\n", file.c_str());
+            close(fd);
+            return -1;
+        }
+
+        if (sb.st_size) {
+            void *addr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                INFO("Cannot map %s: %s\n", file.c_str(), strerror(errno));
+                close(fd);
+                return -1;
+            }
+            data = std::span((const std::byte *)addr, sb.st_size);
+        }
+        close(fd);
+        return 0;
+    }
+};
+
+int compare_files(const std::string &src, const std::string &dest,
+                  FileRelation &relation, FileCache *cache, uint64_t *estimate) {
+    TRACE_SCOPE("compare", -1, dest);
+    MappedFile    a, b;
+    FileSignature signature;
+    struct stat   sb;
+    bool          cached = false;
+
+    if (b.map(dest)) {
+        return -1;
+    }
+
+    /* A cached source is neither read nor indexed again. */
+    if (cache) {
+        if (stat(src.c_str(), &sb)) {
+            INFO("Cannot stat %s: %s\n", src.c_str(), strerror(errno));
+            return -1;
+        }
+        cached = cache->lookup(src, sb, signature);
+    }
+    if (!cached) {
+        if (a.map(src)) {
+            return -1;
+        }
+        if (cache) {
+            signature.compute_hash(a.data);
+        }
+    }
+    uint64_t src_size = cached ? (uint64_t)sb.st_size : a.data.size();
+
+    /* memcmp and std::mismatch are vectorized. */
+    if (src_size == b.data.size() &&
+        (cached ? signature.same_contents(b.data)
+                : a.data.empty() ||
+                      !memcmp(a.data.data(), b.data.data(), a.data.size()))) {
+        INFO("%s and %s are identical.\n", src.c_str(), dest.c_str());
+        if (cache && !cached) {
+            cache->store(src, sb, signature);
+        }
+        relation = FILES_IDENTICAL;
+        if (estimate) {
+            *estimate = 0;
+        }
+        return 0;
+    }
+
+    if (!signature.indexed) {
+        if (cached && a.map(src)) {
+            return -1;
+        }
+        signature.compute_index(a.data);
+        if (cache) {
+            cache->store(src, sb, signature);
+        }
+    }
+
+    /*
+     * Every byte added or removed takes a line of its own in a SystemDiff:
+     * "> xx\n" or "< xx\n". Only the signature is used, so that a cached source
+     * gives the same estimate. No more bytes than the source has can be kept,
+     * however often they are found in it.
+     */
+    const size_t line_size = 5;
+    size_t       limit = b.data.size() / line_size + 1;
+    size_t       added = signature.count_new_bytes(b.data, limit);
+    size_t       kept = std::min<uint64_t>(b.data.size() - std::min(added, b.data.size()),
+                                           src_size);
+    size_t       removed = src_size - kept;
+    added = b.data.size() - kept;
+
+    relation = (added + removed) * line_size > b.data.size() ? FILES_REWRITTEN
+                                                             : FILES_SIMILAR;
+    if (estimate) {
+        *estimate = relation == FILES_REWRITTEN ? b.data.size()
+                                                : (added + removed) * line_size;
+    }
+    INFO("%s -> %s: %zu bytes added, %zu removed (estimate), %s.\n", src.c_str(),
+         dest.c_str(), added, removed,
+         relation == FILES_REWRITTEN ? "rewritten" : "similar");
+    return 0;
+}
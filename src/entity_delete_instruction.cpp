@@ -9,6 +9,8 @@
 #include <error.hpp>
 #include <filesystem>
 #include <patch.hpp>
+#include <path_table.hpp>
+#include <trace.hpp>
 #include <util.hpp>
 #include <utility>
 
@@ -25,6 +27,7 @@ EntityDeleteInstruction::EntityDeleteInstruction(
 
 int EntityDeleteInstruction::apply() {
     INFO("Applying EntityDeleteInstruction.\n");
+    TRACE_SCOPE("delete", -1, target);
 
     std::string command = "rm -v --interactive=never --preserve-root=all";
     if (delete_recursively_if_directory) {
@@ -44,39 +47,40 @@ int EntityDeleteInstruction::apply() {
     return 0;
 }
 
-std::vector<std::byte> EntityDeleteInstruction::binary_representation() {
-    std::vector<std::byte> res;
+void EntityDeleteInstruction::write_binary_representation(
+    std::vector<std::byte> &out, PatchContext *context) {
+    PathTable *table = context ? &context->paths : nullptr;
 
-    res.push_back(std::byte{delete_recursively_if_directory});
+    out.reserve(out.size() + 1 + target.size() + 1);
 
-    for (size_t i = 0; i < target.size(); i++) {
-        res.push_back(std::byte(target[i]));
-    }
-    res.push_back(std::byte{0});
-
-    return res;
+    out.push_back(std::byte{delete_recursively_if_directory});
+    store_path(target, table, out);
 }
 
 int EntityDeleteInstruction::from_binary_representation(
-    const std::vector<std::byte> &data) {
+    std::span<const std::byte> data, const PatchContext *context) {
+    const PathTable *table = context ? &context->paths : nullptr;
     INFO("Restoring EntityDeleteInstruction\n");
     if (data.size() < 2) {
         ERROR("Corrupted data: not enough bytes\n");
         return -1;
     }
 
-    delete_recursively_if_directory = (bool)data[0];
+    delete_recursively_if_directory = table ? (uint8_t)data[0] & 1 : (bool)data[0];
 
     INFO("  delete_recursively_if_directory flag: %d\n",
          (int)delete_recursively_if_directory);
 
-    if (std::find(data.begin() + 1, data.end(), std::byte{0}) == data.end()) {
-        ERROR("Invalid source file: no NULL byte\n");
+    size_t offset = 1;
+    if (restore_path(data, offset, table, target)) {
+        ERROR("Invalid target\n");
         return -1;
     }
-
-    target = std::string((char *)(data.data()) + 1);
     INFO("  target: %s\n", target.c_str());
 
     return 0;
 }
+
+std::vector<std::string> EntityDeleteInstruction::paths() {
+    return {target};
+}
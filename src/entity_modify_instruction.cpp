@@ -8,6 +8,8 @@
 #include <cstring>
 #include <error.hpp>
 #include <patch.hpp>
+#include <path_table.hpp>
+#include <trace.hpp>
 #include <util.hpp>
 #include <utility>
 
@@ -27,6 +29,7 @@ EntityModifyInstruction::EntityModifyInstruction(
 
 int EntityModifyInstruction::apply() {
     INFO("Applying EntityModifyInstruction.\n");
+    TRACE_SCOPE("modify", -1, target);
     struct stat sb;
     FILE       *fd = NULL;
 
@@ -94,38 +97,51 @@ int EntityModifyInstruction::apply() {
     return 0;
 }
 
-std::vector<std::byte> EntityModifyInstruction::binary_representation() {
-    std::vector<std::byte> data;
-    std::vector<std::byte> diff_data = diff->binary_representation();
-
-    data.reserve(1 + (target.size() + 1) + diff_data.size());
-
-    data.push_back(std::byte{diff->signature});
+size_t EntityModifyInstruction::data_size() {
+    return diff ? diff->data_size() : 0;
+}
 
-    for (char c : target) {
-        data.push_back((std::byte)c);
-    }
-    data.push_back(std::byte{0});
+bool EntityModifyInstruction::modifies_in_place() {
+    return diff && diff->writes_in_place();
+}
 
-    data.push_back((std::byte)this->create_subdirectories);
-    data.push_back((std::byte)this->create_empty_file_if_not_exists);
+void EntityModifyInstruction::set_diff(std::shared_ptr<Diff> diff) {
+    this->diff = diff;
+}
 
-    for (std::byte byte : diff_data) {
-        data.push_back(byte);
+/*
+ * Without a path table the flags take a byte each, with a table they share a
+ * byte with the diff signature (bits 4 and 5).
+ */
+void EntityModifyInstruction::write_binary_representation(
+    std::vector<std::byte> &out, PatchContext *context) {
+    PathTable *table = context ? &context->paths : nullptr;
+
+    if (table) {
+        out.push_back((std::byte)(diff->signature | create_subdirectories << 4 |
+                                  create_empty_file_if_not_exists << 5));
+        store_path(target, table, out);
+    } else {
+        out.reserve(out.size() + 1 + (target.size() + 1) + 2 + diff->data_size());
+        out.push_back(std::byte{diff->signature});
+        store_path(target, table, out);
+        out.push_back((std::byte)this->create_subdirectories);
+        out.push_back((std::byte)this->create_empty_file_if_not_exists);
     }
 
-    return data;
+    diff->write_binary_representation(out);
 }
 
 int EntityModifyInstruction::from_binary_representation(
-    const std::vector<std::byte> &data) {
+    std::span<const std::byte> data, const PatchContext *context) {
+    const PathTable *table = context ? &context->paths : nullptr;
 	INFO("Restoring EntityModifyInstruction\n");
     if (data.empty()) {
         WARN("Empty instruction.\n");
         return 0;
     }
 
-    uint8_t signature = (uint8_t)data[0];
+    uint8_t signature = (uint8_t)data[0] & (table ? 0x0f : 0xff);
 
     diff = Diff::from_signature(signature);
 
@@ -134,27 +150,32 @@ int EntityModifyInstruction::from_binary_representation(
         return -1;
     }
 
-    if (std::find(data.begin() + 1, data.end(), std::byte{0}) == data.end()) {
-        ERROR("Invalid diff target: no NULL byte.\n");
+    size_t offset = 1;
+    if (restore_path(data, offset, table, target)) {
+        ERROR("Invalid diff target.\n");
         return -1;
     }
-
-    target = std::string((char *)(data.data()) + 1);
     INFO("  target: %s\n", target.c_str());
 
-    if (data.size() < 1 + target.size() + 1) {
-        ERROR("Invalid diff: no flags.\n");
-        return -1;
+    if (table) {
+        this->create_subdirectories = (uint8_t)data[0] & 0x10;
+        this->create_empty_file_if_not_exists = (uint8_t)data[0] & 0x20;
+    } else {
+        if (data.size() < offset + 2) {
+            ERROR("Invalid diff: no flags.\n");
+            return -1;
+        }
+        this->create_subdirectories = (bool)data[offset];
+        this->create_empty_file_if_not_exists = (bool)data[offset + 1];
+        offset += 2;
     }
 
-    this->create_subdirectories = (bool)data[1 + target.size() + 1];
-    this->create_empty_file_if_not_exists = (bool)data[1 + target.size() + 2];
-
 	INFO("  create_subdirectories flag: %d\n", (int)create_subdirectories);
 	INFO("  create empty file flag: %d\n", (int)create_empty_file_if_not_exists);
 
-    std::vector<std::byte> data_copy = data;
-    data_copy.erase(data_copy.begin(), data_copy.begin() + 1 + target.size() + 3);
+    return diff->from_binary_representation(data.subspan(offset), context);
+}
 
-    return diff->from_binary_representation(data_copy);
+std::vector<std::string> EntityModifyInstruction::paths() {
+    return {target};
 }
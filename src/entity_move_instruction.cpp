@@ -8,7 +8,10 @@
 #include <cstring>
 #include <error.hpp>
 #include <filesystem>
+#include <io.hpp>
 #include <patch.hpp>
+#include <path_table.hpp>
+#include <trace.hpp>
 #include <util.hpp>
 #include <utility>
 
@@ -29,10 +32,17 @@ EntityMoveInstruction::EntityMoveInstruction(bool create_subdirectories,
 
 int EntityMoveInstruction::apply() {
     INFO("Applying EntityMoveInstruction.\n");
+    TRACE_SCOPE("move", -1, move_from);
 
-    struct stat sb_src, sb_dest;
-    if (stat(move_from.c_str(), &sb_src)) {
-        ERROR("Cannot relocate %s: %s\n", move_from.c_str(), strerror(errno));
+    std::vector<FileIO::StatRequest> stats(2);
+    stats[0].path = move_from;
+    stats[1].path = move_to;
+    FileIO::get()->stat_files(stats);
+
+    struct stat &sb_src = stats[0].sb;
+    if (stats[0].error) {
+        ERROR("Cannot relocate %s: %s\n", move_from.c_str(),
+              strerror(stats[0].error));
         return -1;
     }
 
@@ -47,7 +57,7 @@ int EntityMoveInstruction::apply() {
         return -1;
     }
 
-    bool exists = !stat(move_to.c_str(), &sb_dest);
+    bool exists = !stats[1].error;
 
     INFO("Destination exists: %d\n", (int)exists);
     INFO("Override flag: %d\n", (int)override_if_already_exists);
@@ -91,56 +101,64 @@ int EntityMoveInstruction::apply() {
     return 0;
 }
 
-std::vector<std::byte> EntityMoveInstruction::binary_representation() {
-    std::vector<std::byte> res;
-
-    res.push_back(std::byte{override_if_already_exists});
-    res.push_back(std::byte{create_subdirectories});
-
-    for (size_t i = 0; i < move_from.size(); i++) {
-        res.push_back(std::byte(move_from[i]));
-    }
-    res.push_back(std::byte{0});
+void EntityMoveInstruction::write_binary_representation(std::vector<std::byte> &out,
+                                                        PatchContext *context) {
+    PathTable *table = context ? &context->paths : nullptr;
 
-    for (size_t i = 0; i < move_to.size(); i++) {
-        res.push_back(std::byte(move_to[i]));
+    if (table) {
+        out.push_back(
+            (std::byte)(override_if_already_exists | create_subdirectories << 1));
+    } else {
+        out.reserve(out.size() + 2 + move_from.size() + 1 + move_to.size() + 1);
+        out.push_back(std::byte{override_if_already_exists});
+        out.push_back(std::byte{create_subdirectories});
     }
-    res.push_back(std::byte{0});
 
-    return res;
+    store_path(move_from, table, out);
+    store_path(move_to, table, out);
 }
 
+/*
+ * Without a path table the flags take a byte each, with a table they are
+ * packed into a single byte.
+ */
 int EntityMoveInstruction::from_binary_representation(
-    const std::vector<std::byte> &data) {
+    std::span<const std::byte> data, const PatchContext *context) {
+    const PathTable *table = context ? &context->paths : nullptr;
 	INFO("Restoring EntityMoveInstruction\n");
-    if (data.size() < 4) {
+    size_t offset = table ? 1 : 2;
+
+    if (data.size() < offset + 2) {
         ERROR("Corrupted data: not enough bytes\n");
         return -1;
     }
 
-    override_if_already_exists = (bool)data[0];
-    create_subdirectories = (bool)data[1];
+    if (table) {
+        override_if_already_exists = (uint8_t)data[0] & 1;
+        create_subdirectories = (uint8_t)data[0] & 2;
+    } else {
+        override_if_already_exists = (bool)data[0];
+        create_subdirectories = (bool)data[1];
+    }
 
 	INFO("  override flag: %d\n", (int)override_if_already_exists);
 	INFO("  create_subdirectories flag: %d\n", (int)create_subdirectories);
 
-    if (std::find(data.begin() + 2, data.end(), std::byte{0}) == data.end()) {
-        ERROR("Invalid source file: no NULL byte\n");
+    if (restore_path(data, offset, table, move_from)) {
+        ERROR("Invalid source file\n");
         return -1;
     }
-
-    move_from = std::string((char *)(data.data()) + 2);
 	INFO("  move_from: %s\n", move_from.c_str());
 
-    int where = move_from.size() + 3;
-
-    if (std::find(data.begin() + where, data.end(), std::byte{0}) == data.end()) {
-        ERROR("Invalid destination file: no NULL byte\n");
+    if (restore_path(data, offset, table, move_to)) {
+        ERROR("Invalid destination file\n");
         return -1;
     }
-
-    move_to = std::string((char *)(data.data()) + where);
 	INFO("  move_to: %s\n", move_to.c_str());
 
     return 0;
 }
+
+std::vector<std::string> EntityMoveInstruction::paths() {
+    return {move_from, move_to};
+}
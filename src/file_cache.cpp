@@ -0,0 +1,269 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <error.hpp>
+#include <file_cache.hpp>
+#include <filesystem>
+#include <path_table.hpp>
+#include <trace.hpp>
+#include <util.hpp>
+
+/* Rolling hash of a block: the block as a number in base rolling_base. */
+static const uint64_t rolling_base = 0x100000001b3;
+
+static uint64_t block_hash(const std::byte *block) {
+    uint64_t h = 0;
+    for (size_t i = 0; i < FileSignature::block_size; i++) {
+        h = h * rolling_base + (uint64_t)block[i];
+    }
+    return h;
+}
+
+/* The signature keeps the better mixed high half of the rolling hash. */
+static uint32_t block_signature(uint64_t hash) {
+    return hash >> 32;
+}
+
+static uint64_t load_uint64(const std::byte *data) {
+    uint64_t value;
+    memcpy(&value, data, 8);
+    return value;
+}
+
+static uint64_t rotate(uint64_t value, int bits) {
+    return value << bits | value >> (64 - bits);
+}
+
+/* Finalizer of MurmurHash3. */
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    return h ^ h >> 33;
+}
+
+/*
+ * Two independent lanes of 64 bits, eight bytes at a time.
+ */
+void FileSignature::compute_hash(std::span<const std::byte> data) {
+    const uint64_t prime1 = 0x9e3779b185ebca87, prime2 = 0xc2b2ae3d27d4eb4f;
+    uint64_t       h1 = data.size(), h2 = ~(uint64_t)data.size();
+    size_t         i = 0;
+
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t word = load_uint64(data.data() + i);
+        h1 = rotate(h1 ^ word * prime1, 31) * prime2;
+        h2 = rotate(h2 ^ word * prime2, 29) * prime1;
+    }
+
+    uint64_t tail = 0;
+    if (i < data.size()) {
+        memcpy(&tail, data.data() + i, data.size() - i);
+    }
+    hash[0] = mix(h1 ^ tail * prime1);
+    hash[1] = mix(h2 ^ tail * prime2 ^ hash[0]);
+}
+
+void FileSignature::compute_index(std::span<const std::byte> data) {
+    blocks.clear();
+    blocks.reserve(data.size() / block_size + 1);
+    for (size_t i = 0; i + block_size <= data.size(); i += block_size) {
+        blocks.push_back(block_signature(block_hash(data.data() + i)));
+    }
+    /* The last block_size bytes as well, for a tail that did not change. */
+    if (data.size() >= block_size) {
+        blocks.push_back(
+            block_signature(block_hash(data.data() + data.size() - block_size)));
+    }
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    indexed = true;
+}
+
+bool FileSignature::same_contents(std::span<const std::byte> data) const {
+    FileSignature other;
+    other.compute_hash(data);
+    return hash[0] == other.hash[0] && hash[1] == other.hash[1];
+}
+
+size_t FileSignature::count_new_bytes(std::span<const std::byte> data,
+                                      size_t                     limit) const {
+    uint64_t top = 1;
+
+    if (data.size() < block_size || blocks.empty()) {
+        return data.size();
+    }
+
+    /* rolling_base^block_size, to remove the byte leaving the window. */
+    for (size_t i = 0; i < block_size; i++) {
+        top *= rolling_base;
+    }
+
+    size_t   new_bytes = 0, i = 0;
+    uint64_t h = block_hash(data.data());
+    while (i + block_size <= data.size() && new_bytes < limit) {
+        if (std::binary_search(blocks.begin(), blocks.end(), block_signature(h))) {
+            i += block_size;
+            if (i + block_size <= data.size()) {
+                h = block_hash(data.data() + i);
+            }
+            continue;
+        }
+        new_bytes++;
+        if (i + block_size < data.size()) {
+            h = h * rolling_base + (uint64_t)data[i + block_size] -
+                top * (uint64_t)data[i];
+        }
+        i++;
+    }
+    if (i < data.size() && new_bytes < limit &&
+        !std::binary_search(
+            blocks.begin(), blocks.end(),
+            block_signature(block_hash(data.data() + data.size() - block_size)))) {
+        new_bytes += data.size() - i;
+    }
+    return new_bytes;
+}
+
+FileCache::FileCache(const std::string &file) {
+    this->file = file;
+    hits = 0;
+    misses = 0;
+}
+
+std::string FileCache::key(const std::string &path) {
+    return std::filesystem::absolute(path).lexically_normal();
+}
+
+void FileCache::load() {
+    TRACE_SCOPE("load cache", -1, file);
+    std::vector<std::byte> data;
+    size_t                 signature_size = strlen(signature) + 1;
+    size_t                 offset = signature_size;
+    uint64_t               count;
+
+    entries.clear();
+    if (access(file.c_str(), F_OK)) {
+        INFO("No cache at %s yet.\n", file.c_str());
+        return;
+    }
+
+    if (open_and_read_entire_file(file.c_str(), data) || data.size() < signature_size ||
+        memcmp(data.data(), signature, signature_size) ||
+        restore_varint(data, offset, count) || count > data.size()) {
+        WARN("Ignoring the corrupted cache %s\n", file.c_str());
+        return;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        std::string path;
+        Entry       entry;
+        uint64_t    number_of_blocks;
+
+        if (restore_path(data, offset, nullptr, path) ||
+            restore_varint(data, offset, entry.inode) ||
+            restore_varint(data, offset, entry.size) ||
+            restore_varint(data, offset, entry.mtime) || data.size() - offset < 16) {
+            WARN("Ignoring the corrupted cache %s\n", file.c_str());
+            entries.clear();
+            return;
+        }
+        entry.signature.hash[0] = load_uint64(data.data() + offset);
+        entry.signature.hash[1] = load_uint64(data.data() + offset + 8);
+        offset += 16;
+
+        if (restore_varint(data, offset, number_of_blocks) ||
+            number_of_blocks > (data.size() - offset) / 4) {
+            WARN("Ignoring the corrupted cache %s\n", file.c_str());
+            entries.clear();
+            return;
+        }
+        entry.signature.indexed = number_of_blocks;
+        entry.signature.blocks.resize(number_of_blocks);
+        for (auto &block : entry.signature.blocks) {
+            block = 0;
+            for (int j = 0; j < 4; j++) {
+                block |= (uint32_t)data[offset++] << (8 * j);
+            }
+        }
+        entries[path] = std::move(entry);
+    }
+
+    INFO("Loaded %zu entries from the cache %s\n", entries.size(), file.c_str());
+}
+
+int FileCache::save() {
+    TRACE_SCOPE("save cache", -1, file);
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<std::byte>      data;
+
+    data.insert(data.end(), (const std::byte *)signature,
+                (const std::byte *)signature + strlen(signature) + 1);
+    store_varint(entries.size(), data);
+    for (auto &[path, entry] : entries) {
+        store_string(path, data);
+        store_varint(entry.inode, data);
+        store_varint(entry.size, data);
+        store_varint(entry.mtime, data);
+        for (auto h : entry.signature.hash) {
+            for (int j = 0; j < 8; j++) {
+                data.push_back((std::byte)(h >> (8 * j)));
+            }
+        }
+        store_varint(entry.signature.indexed ? entry.signature.blocks.size() : 0, data);
+        for (auto block : entry.signature.blocks) {
+            for (int j = 0; j < 4; j++) {
+                data.push_back((std::byte)(block >> (8 * j)));
+            }
+        }
+    }
+
+    std::string temp_file = file + ".tmp";
+    if (open_and_write_entire_file(temp_file.c_str(), data) ||
+        rename(temp_file.c_str(), file.c_str())) {
+        ERROR("Failed to save the cache %s: %s\n", file.c_str(), strerror(errno));
+        unlink(temp_file.c_str());
+        return -1;
+    }
+
+    MSG("Cache %s: %zu hits, %zu misses, %zu entries.\n", file.c_str(), (size_t)hits,
+        (size_t)misses, entries.size());
+    return 0;
+}
+
+bool FileCache::lookup(const std::string &path, const struct stat &sb,
+                       FileSignature &signature) {
+    std::string                 k = key(path);
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = entries.find(k);
+    if (it == entries.end() || it->second.inode != (uint64_t)sb.st_ino ||
+        it->second.size != (uint64_t)sb.st_size ||
+        it->second.mtime !=
+            (uint64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec) {
+        misses++;
+        return false;
+    }
+    hits++;
+    signature = it->second.signature;
+    return true;
+}
+
+void FileCache::store(const std::string &path, const struct stat &sb,
+                      const FileSignature &signature) {
+    std::string                 k = key(path);
+    std::lock_guard<std::mutex> guard(lock);
+
+    entries[k] = {(uint64_t)sb.st_ino, (uint64_t)sb.st_size,
+                  (uint64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec,
+                  signature};
+}
+
+size_t FileCache::size() {
+    std::lock_guard<std::mutex> guard(lock);
+    return entries.size();
+}
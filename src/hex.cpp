@@ -0,0 +1,205 @@
+#include <cstdint>
+#include <error.hpp>
+#include <hex.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_SSSE3 1
+#endif
+
+static const char digits[] = "0123456789abcdef";
+
+/* Every byte takes a line: two digits and a newline. */
+static const size_t line_size = 3;
+
+static int hex_value(uint8_t c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static void dump_scalar(const uint8_t *data, size_t size, uint8_t *out) {
+    for (size_t i = 0; i < size; i++) {
+        out[line_size * i] = digits[data[i] >> 4];
+        out[line_size * i + 1] = digits[data[i] & 0xf];
+        out[line_size * i + 2] = '\n';
+    }
+}
+
+#ifdef HEX_SSSE3
+/*
+ * 16 bytes make 48 bytes of dump, 3 vectors. Byte offset o of the dump holds
+ * the high digit of byte o / 3 if o % 3 is 0, the low digit if it is 1, and a
+ * newline if it is 2. The masks move the digits between the dump vectors and
+ * vectors of the 16 high or low digits.
+ */
+struct ShuffleMasks {
+    alignas(16) uint8_t to_dump[3][2][16];
+    alignas(16) uint8_t from_dump[3][3][16];
+    alignas(16) uint8_t newlines[3][16];
+};
+
+static constexpr ShuffleMasks make_masks() {
+    ShuffleMasks masks{};
+    for (size_t k = 0; k < 3; k++) {
+        for (size_t j = 0; j < 16; j++) {
+            size_t offset = 16 * k + j;
+            for (size_t phase = 0; phase < 2; phase++) {
+                masks.to_dump[k][phase][j] =
+                    offset % line_size == phase ? offset / line_size : 0x80;
+            }
+            masks.newlines[k][j] = offset % line_size == 2 ? '\n' : 0;
+        }
+        for (size_t phase = 0; phase < 3; phase++) {
+            for (size_t i = 0; i < 16; i++) {
+                size_t offset = line_size * i + phase;
+                masks.from_dump[k][phase][i] = offset / 16 == k ? offset % 16 : 0x80;
+            }
+        }
+    }
+    return masks;
+}
+
+static constexpr ShuffleMasks masks = make_masks();
+
+static bool has_ssse3() {
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+}
+
+#define LOAD(p) _mm_load_si128((const __m128i *)(p))
+
+__attribute__((target("ssse3"))) static size_t dump_ssse3(const uint8_t *data,
+                                                           size_t         size,
+                                                           uint8_t       *out) {
+    const __m128i table = _mm_loadu_si128((const __m128i *)digits);
+    const __m128i nibble = _mm_set1_epi8(0xf);
+    size_t        i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i high =
+            _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i low = _mm_shuffle_epi8(table, _mm_and_si128(v, nibble));
+        for (size_t k = 0; k < 3; k++) {
+            __m128i line =
+                _mm_or_si128(_mm_shuffle_epi8(high, LOAD(masks.to_dump[k][0])),
+                             _mm_shuffle_epi8(low, LOAD(masks.to_dump[k][1])));
+            line = _mm_or_si128(line, LOAD(masks.newlines[k]));
+            _mm_storeu_si128((__m128i *)(out + line_size * i + 16 * k), line);
+        }
+    }
+    return i;
+}
+
+/*
+ * Values of 16 hex digits of either case. Returns 0 if they all are digits.
+ */
+__attribute__((target("ssse3"))) static int hex_values(__m128i c, __m128i &value) {
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                   _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+    if (_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xffff) {
+        return -1;
+    }
+    value = _mm_or_si128(
+        _mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+        _mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+    return 0;
+}
+
+/*
+ * Decode the dump as long as it has exactly the layout xxd writes. Returns the
+ * number of bytes decoded.
+ */
+__attribute__((target("ssse3"))) static size_t undump_ssse3(const uint8_t *dump,
+                                                             size_t         size,
+                                                             uint8_t       *out) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t        i = 0;
+
+    for (; line_size * i + 48 <= size; i += 16) {
+        __m128i high = _mm_setzero_si128(), low = high, newlines = high;
+        for (size_t k = 0; k < 3; k++) {
+            __m128i v =
+                _mm_loadu_si128((const __m128i *)(dump + line_size * i + 16 * k));
+            high = _mm_or_si128(high, _mm_shuffle_epi8(v, LOAD(masks.from_dump[k][0])));
+            low = _mm_or_si128(low, _mm_shuffle_epi8(v, LOAD(masks.from_dump[k][1])));
+            newlines = _mm_or_si128(newlines,
+                                    _mm_shuffle_epi8(v, LOAD(masks.from_dump[k][2])));
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(newlines, newline)) != 0xffff ||
+            hex_values(high, high) || hex_values(low, low)) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(out + i),
+                         _mm_or_si128(_mm_slli_epi16(high, 4), low));
+    }
+    return i;
+}
+#endif
+
+void hex_dump(std::span<const std::byte> data, std::vector<std::byte> &out) {
+    size_t start = out.size();
+    out.resize(start + line_size * data.size());
+
+    const uint8_t *in = (const uint8_t *)data.data();
+    uint8_t       *dump = (uint8_t *)out.data() + start;
+    size_t         done = 0;
+#ifdef HEX_SSSE3
+    if (has_ssse3()) {
+        done = dump_ssse3(in, data.size(), dump);
+    }
+#endif
+    dump_scalar(in + done, data.size() - done, dump + line_size * done);
+}
+
+int hex_undump(std::span<const std::byte> dump, std::vector<std::byte> &out) {
+    size_t start = out.size();
+    out.resize(start + dump.size() / 2);
+
+    const uint8_t *in = (const uint8_t *)dump.data();
+    uint8_t       *bytes = (uint8_t *)out.data() + start;
+    size_t         done = 0;
+#ifdef HEX_SSSE3
+    if (has_ssse3()) {
+        done = undump_ssse3(in, dump.size(), bytes);
+    }
+#endif
+
+    /* The rest, and any dump laid out differently, a digit at a time. */
+    int high = -1;
+    for (size_t pos = line_size * done; pos < dump.size(); pos++) {
+        uint8_t c = in[pos];
+        if (c == '\n' || c == ' ' || c == '\t' || c == '\r') {
+            continue;
+        }
+        int value = hex_value(c);
+        if (value < 0) {
+            ERROR("Invalid hex dump: unexpected character at offset %zu.\n", pos);
+            out.resize(start);
+            return -1;
+        }
+        if (high < 0) {
+            high = value;
+        } else {
+            bytes[done++] = high << 4 | value;
+            high = -1;
+        }
+    }
+    if (high >= 0) {
+        ERROR("Invalid hex dump: odd number of digits.\n");
+        out.resize(start);
+        return -1;
+    }
+
+    out.resize(start + done);
+    return 0;
+}
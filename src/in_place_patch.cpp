@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <error.hpp>
+#include <in_place_patch.hpp>
+#include <trace.hpp>
+#include <util.hpp>
+
+/* Size of the buffer the copies are moved through. */
+static const size_t scratch_size = 1 << 20;
+
+void InPlacePatch::copy(uint64_t from, uint64_t to, uint64_t length) {
+    if (length && from != to) {
+        copies.push_back({from, to, length});
+    }
+}
+
+void InPlacePatch::insert(uint64_t to, std::span<const std::byte> data) {
+    if (!data.empty()) {
+        inserts.push_back({to, data});
+    }
+}
+
+int InPlacePatch::order(std::vector<size_t> &sequence, std::vector<bool> &held) {
+    size_t n = copies.size();
+
+    std::sort(copies.begin(), copies.end(),
+              [](const Copy &l, const Copy &r) { return l.from < r.from; });
+    std::vector<size_t> by_to(n);
+    for (size_t i = 0; i < n; i++) {
+        by_to[i] = i;
+    }
+    std::sort(by_to.begin(), by_to.end(),
+              [&](size_t l, size_t r) { return copies[l].to < copies[r].to; });
+    for (size_t i = 1; i < n; i++) {
+        if (copies[i - 1].from + copies[i - 1].length > copies[i].from ||
+            copies[by_to[i - 1]].to + copies[by_to[i - 1]].length > copies[by_to[i]].to) {
+            ERROR("Corrupted diff: overlapping copies.\n");
+            return -1;
+        }
+    }
+
+    /*
+     * Copy i must run before copy j if j writes over the source of i. The
+     * sources are sorted and disjoint, so those of the copies j writes over
+     * are consecutive.
+     */
+    std::vector<std::vector<size_t>> before(n);
+    std::vector<size_t>              waiting(n);
+    for (size_t j = 0; j < n; j++) {
+        const Copy &target = copies[j];
+        auto        first = std::partition_point(
+            copies.begin(), copies.end(),
+            [&](const Copy &c) { return c.from + c.length <= target.to; });
+        for (size_t i = first - copies.begin();
+             i < n && copies[i].from < target.to + target.length; i++) {
+            if (i != j) {
+                before[i].push_back(j);
+                waiting[j]++;
+            }
+        }
+    }
+
+    std::vector<size_t> ready;
+    std::vector<bool>   done(n);
+    for (size_t i = 0; i < n; i++) {
+        if (!waiting[i]) {
+            ready.push_back(i);
+        }
+    }
+
+    /* The copies to hold if there are cycles, shortest first, and the next one. */
+    std::vector<size_t> by_length;
+    size_t              shortest = 0;
+
+    sequence.clear();
+    held.assign(n, false);
+    while (sequence.size() < n) {
+        size_t next;
+        if (!ready.empty()) {
+            next = ready.back();
+            ready.pop_back();
+        } else {
+            /* A cycle: hold the shortest copy left. */
+            if (by_length.empty()) {
+                by_length = by_to;
+                std::sort(by_length.begin(), by_length.end(), [&](size_t l, size_t r) {
+                    return copies[l].length < copies[r].length;
+                });
+            }
+            while (done[by_length[shortest]]) {
+                shortest++;
+            }
+            next = by_length[shortest];
+            held[next] = true;
+        }
+
+        done[next] = true;
+        sequence.push_back(next);
+        for (size_t j : before[next]) {
+            if (!--waiting[j] && !done[j]) {
+                ready.push_back(j);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Move bytes [from, from + length) to [to, to + length) as memmove does: from
+ * the left end if they move left, from the right end otherwise.
+ */
+static int move_range(int fd, uint64_t from, uint64_t to, uint64_t length,
+                      std::vector<std::byte> &scratch) {
+    for (uint64_t moved = 0; moved < length;) {
+        uint64_t size = std::min<uint64_t>(scratch.size(), length - moved);
+        uint64_t offset = to < from ? moved : length - moved - size;
+        if (read_at(fd, scratch.data(), size, from + offset) ||
+            write_at(fd, scratch.data(), size, to + offset)) {
+            return -1;
+        }
+        moved += size;
+    }
+    return 0;
+}
+
+int InPlacePatch::apply(const std::string &file, uint64_t old_size, uint64_t new_size) {
+    TRACE_SCOPE("patch in place", -1, file);
+    std::vector<size_t>                 sequence;
+    std::vector<bool>                   held;
+    std::vector<std::vector<std::byte>> held_data;
+    std::vector<std::byte>              scratch;
+    struct stat                         sb;
+    int                                 fd;
+
+    written = 0;
+    for (auto &c : copies) {
+        if (c.from > old_size || c.length > old_size - c.from || c.to > new_size ||
+            c.length > new_size - c.to) {
+            ERROR("Corrupted diff: copy past the end.\n");
+            return -1;
+        }
+    }
+    for (auto &i : inserts) {
+        if (i.to > new_size || i.data.size() > new_size - i.to) {
+            ERROR("Corrupted diff: insert past the end.\n");
+            return -1;
+        }
+    }
+    if (order(sequence, held)) {
+        return -1;
+    }
+
+    uint64_t held_size = 0;
+    for (size_t i = 0; i < copies.size(); i++) {
+        held_size += held[i] ? copies[i].length : 0;
+    }
+    if (held_size > max_held) {
+        ERROR("Cannot patch %s in place: the copies need %s in memory, over the "
+              "limit of %s.\n",
+              file.c_str(), shorten_size(held_size).c_str(),
+              shorten_size(max_held).c_str());
+        return -1;
+    }
+
+    if ((fd = open(file.c_str(), O_RDWR)) == -1) {
+        ERROR("Failed to open %s: %s\n", file.c_str(), strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &sb)) {
+        ERROR("Failed to stat %s: %s\n", file.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if ((uint64_t)sb.st_size != old_size) {
+        ERROR("The diff does not match: it is for %zu bytes, not %zu.\n",
+              (size_t)old_size, (size_t)sb.st_size);
+        close(fd);
+        return -1;
+    }
+
+    try {
+        scratch.resize(scratch_size);
+        held_data.resize(copies.size());
+    } catch (...) {
+        ERROR("Out of memory.\n");
+        close(fd);
+        return -1;
+    }
+
+    int r = 0;
+    for (size_t i : sequence) {
+        const Copy &c = copies[i];
+        if (held[i]) {
+            try {
+                held_data[i].resize(c.length);
+            } catch (...) {
+                ERROR("Out of memory.\n");
+                r = -1;
+                break;
+            }
+            if ((r = read_at(fd, held_data[i].data(), c.length, c.from))) {
+                break;
+            }
+        } else if ((r = move_range(fd, c.from, c.to, c.length, scratch))) {
+            break;
+        } else {
+            written += c.length;
+        }
+    }
+
+    for (size_t i = 0; !r && i < copies.size(); i++) {
+        if (held[i]) {
+            r = write_at(fd, held_data[i].data(), copies[i].length, copies[i].to);
+            written += copies[i].length;
+        }
+    }
+    for (size_t i = 0; !r && i < inserts.size(); i++) {
+        r = write_at(fd, inserts[i].data.data(), inserts[i].data.size(), inserts[i].to);
+        written += inserts[i].data.size();
+    }
+    if (!r && new_size != old_size) {
+        r = ftruncate(fd, new_size);
+    }
+
+    if (r) {
+        ERROR("Failed to patch %s: %s\n", file.c_str(), strerror(errno));
+    }
+    if (close(fd) && !r) {
+        ERROR("Failed to close %s: %s\n", file.c_str(), strerror(errno));
+        r = -1;
+    }
+    return r ? -1 : 0;
+}
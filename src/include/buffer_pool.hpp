@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+/*
+ * Recycles byte buffers, so that (de)serializing many instructions reuses a few
+ * grown buffers instead of allocating one for each instruction. Thread-safe.
+ */
+class BufferPool {
+private:
+    std::mutex                          lock;
+    std::vector<std::vector<std::byte>> buffers;
+    size_t                              max_buffers;
+    size_t                              max_capacity;
+
+public:
+    /*
+     * Keep at most max_buffers buffers, and none larger than max_capacity bytes,
+     * so that a single huge instruction does not stay allocated.
+     */
+    BufferPool(size_t max_buffers = 64, size_t max_capacity = 1 << 20);
+
+    /*
+     * Return an empty buffer, reusing a released one if possible.
+     */
+    std::vector<std::byte> acquire();
+
+    /*
+     * Give the buffer back to the pool.
+     */
+    void release(std::vector<std::byte> &&buffer);
+};
+
+/*
+ * Memory shared by all threads for the small objects created for every
+ * instruction, such as the instructions and diffs themselves.
+ */
+std::pmr::memory_resource *object_pool();
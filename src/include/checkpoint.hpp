@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Progress of applying a patch, kept in a file next to the destination so that
+ * an interrupted apply can be resumed. The checkpoint records how many
+ * instructions were completed, and what the paths touched by the last of them
+ * looked like afterwards, which is verified before resuming. A path is
+ * identified by what stat gives (size, modification time and inode), so that
+ * saving does not read it back. Before an instruction rewriting a file in
+ * place, the checkpoint is saved with that instruction marked as started: if
+ * it is interrupted, the file is neither version, and resuming is refused.
+ *
+ * Binary representation:
+ *
+ * SIGNATURE(with NULL byte)
+ * patch_id (uint64, least to most significant)
+ * completed (varint, number of instructions applied)
+ * started (varint, index + 1 of the instruction rewriting a file in place, 0
+ *          if none)
+ * number_of_rules (varint, of the filter)
+ * rule_1 (with NULL byte)
+ * ...
+ * number_of_paths (varint)
+ * path_1 (with NULL byte)
+ * exists_1 (1 byte)
+ * size_1 (varint)
+ * mtime_1 (varint, nanoseconds)
+ * inode_1 (varint)
+ * ...
+ */
+class Checkpoint {
+private:
+    static constexpr const char *signature = "__PATCHIT_CHECKPOINT__";
+
+    struct PathState {
+        std::string path;
+        bool        exists;
+        uint64_t    size;
+        uint64_t    mtime;
+        uint64_t    inode;
+
+        bool operator==(const PathState &other) const = default;
+    };
+
+    std::string            file;
+    std::string            patch;
+    uint64_t               patch_id;
+    bool                   identified;
+    uint64_t               completed;
+    uint64_t               started;
+    std::vector<PathState> states;
+
+    /* Instructions completed since the checkpoint was last saved. */
+    uint64_t                 pending;
+    std::vector<std::string> pending_paths;
+    std::vector<std::string> last_paths;
+
+    static int capture(const std::vector<std::string> &paths,
+                       std::vector<PathState>         &states);
+
+public:
+    /*
+     * Save the checkpoint every interval instructions, never if 0.
+     */
+    uint64_t interval;
+
+    /*
+     * Rules of the path filter the patch is applied with (see
+     * PathFilter::rules). Resuming with a different filter is refused.
+     */
+    std::vector<std::string> filter;
+
+    /*
+     * Checkpoint for applying the given patch at the given destination.
+     */
+    Checkpoint(const std::string &patchfile, const std::string &destination);
+
+    /*
+     * Identify a patch by its size and the data at its beginning and end,
+     * which contain the header and the index. Returns 0 on success.
+     */
+    static int id_of(const std::string &patchfile, uint64_t &id);
+
+    /*
+     * Identify the patch of the checkpoint, once. load and save fail without
+     * it. Returns 0 on success.
+     */
+    int identify();
+
+    bool exists() const;
+
+    /*
+     * Path of the checkpoint file.
+     */
+    const std::string &path() const;
+
+    /*
+     * Load a saved checkpoint and check that it belongs to the patch and the
+     * filter, and that the paths touched by the last completed instruction are
+     * as they were left. Must run in the destination directory. Returns 0 on
+     * success.
+     */
+    int load();
+
+    /*
+     * Number of instructions already applied.
+     */
+    uint64_t completed_instructions() const;
+
+    /*
+     * Number of instructions completed since the checkpoint was last saved.
+     */
+    uint64_t pending_instructions() const;
+
+    /*
+     * Record that the instructions up to the given index are applied, the last
+     * of them touching the given paths, and save the checkpoint if interval
+     * instructions were completed since it was last saved. Must run in the
+     * destination directory. Returns 0 on success.
+     */
+    int complete(uint64_t index, const std::vector<std::string> &paths);
+
+    /*
+     * Record that the instruction with the given index, which rewrites a file
+     * in place, is about to be applied, and save the checkpoint so. The next
+     * complete saves it again. Does nothing if the checkpoint is never saved.
+     * Returns 0 on success.
+     */
+    int start(uint64_t index);
+
+    /*
+     * Make the changes of the completed instructions durable, then atomically
+     * replace the checkpoint file. Returns 0 on success.
+     */
+    int save();
+
+    /*
+     * Delete the checkpoint, once the patch is fully applied.
+     */
+    int remove();
+};
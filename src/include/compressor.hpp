@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <span>
 #include <vector>
 
 class Compressor {
@@ -11,16 +13,35 @@ public:
      */
     virtual int get_id() = 0;
 
+    /*
+     * Compress the provided data, appending the result to out.
+     * Returns 0 on success.
+     */
+    virtual int compress_into(std::span<const std::byte> data,
+                              std::vector<std::byte>    &out) = 0;
+
+    /*
+     * Decompress the provided data, appending the result to out. On error, out
+     * is left as it was. Returns 0 on success.
+     */
+    virtual int decompress_into(std::span<const std::byte> data,
+                                std::vector<std::byte>    &out) = 0;
+
     /*
      * Compress the provided data.
      */
-    virtual std::vector<std::byte> compress(const std::vector<std::byte> &data) = 0;
+    std::vector<std::byte> compress(std::span<const std::byte> data);
 
     /*
      * Decompress the provided data. Returns an empty vector on error.
      */
-    virtual std::vector<std::byte> decompress(
-        const std::vector<std::byte> &data) = 0;
+    std::vector<std::byte> decompress(std::span<const std::byte> data);
+
+    /*
+     * Compressor to actually use for the provided data, whose id is the one
+     * stored with the compressed data. This compressor itself by default.
+     */
+    virtual Compressor *select(std::span<const std::byte> data);
 };
 
 /*
@@ -33,9 +54,11 @@ private:
 public:
     static std::shared_ptr<PlainCompressor> get();
 
-    int                    get_id() override;
-    std::vector<std::byte> compress(const std::vector<std::byte> &data) override;
-    std::vector<std::byte> decompress(const std::vector<std::byte> &data) override;
+    int get_id() override;
+    int compress_into(std::span<const std::byte> data,
+                      std::vector<std::byte>    &out) override;
+    int decompress_into(std::span<const std::byte> data,
+                        std::vector<std::byte>    &out) override;
 };
 
 /*
@@ -43,12 +66,133 @@ public:
  */
 class ZLibCompressor : public Compressor {
 private:
-    ZLibCompressor();
+    ZLibCompressor(int level, int strategy);
 
 public:
+    /* The zlib level and strategy, those of compress() for the shared instance. */
+    const int level;
+    const int strategy;
+
+    /*
+     * Safe to use from any number of threads at once: each thread compresses
+     * with zlib streams of its own, kept for its next payloads.
+     */
     static std::shared_ptr<ZLibCompressor> get();
 
-    int                    get_id() override;
-    std::vector<std::byte> compress(const std::vector<std::byte> &data) override;
-    std::vector<std::byte> decompress(const std::vector<std::byte> &data) override;
+    int get_id() override;
+    int compress_into(std::span<const std::byte> data,
+                      std::vector<std::byte>    &out) override;
+    int decompress_into(std::span<const std::byte> data,
+                        std::vector<std::byte>    &out) override;
+};
+
+/*
+ * Uses zlib with a preset dictionary, shared by all the diffs of a patch and
+ * stored once in it. Small diffs compress a lot better when the stream does not
+ * start out empty. The representation is the same as that of ZLibCompressor,
+ * and so is the use of per-thread streams: an instance is safe to share.
+ */
+class ZLibDictionaryCompressor : public Compressor {
+private:
+    std::vector<std::byte> dictionary;
+
+public:
+    static constexpr int id = 2;
+
+    ZLibDictionaryCompressor(std::span<const std::byte> dictionary);
+
+    /*
+     * Build a dictionary of at most max_size bytes from the given samples: the
+     * lines (or pieces of long lines) repeated most often, the most valuable
+     * ones last, where zlib finds them at the shortest distance.
+     */
+    static std::vector<std::byte> train(const std::vector<std::vector<std::byte>> &samples,
+                                        size_t max_size = 32 << 10);
+
+    const std::vector<std::byte> &get_dictionary();
+
+    int get_id() override;
+    int compress_into(std::span<const std::byte> data,
+                      std::vector<std::byte>    &out) override;
+    int decompress_into(std::span<const std::byte> data,
+                        std::vector<std::byte>    &out) override;
+};
+
+/*
+ * Uses xz (LZMA2) to compress the data: a lot slower than zlib, and needing a
+ * lot more memory, but a good deal smaller, for patches that are kept for long.
+ * The representation is a complete .xz stream, with its CRC64, followed by the
+ * original size like that of ZLibCompressor. Any instance decompresses the data
+ * of any other, whatever their preset.
+ */
+class XzCompressor : public Compressor {
+public:
+    static constexpr int id = 3;
+
+    /*
+     * The xz preset, 0 to 9, possibly with LZMA_PRESET_EXTREME. Preset 6 is the
+     * default of xz and needs about 94M per compressing thread, preset 9 674M.
+     */
+    const uint32_t preset;
+
+    /*
+     * Threads compressing every payload, in blocks of three times the size of
+     * the LZMA2 dictionary: a payload smaller than two blocks is compressed on
+     * the calling thread alone.
+     */
+    const int threads;
+
+    XzCompressor(uint32_t preset, int threads = 1);
+
+    /*
+     * The instance with the default preset, on a single thread. Safe to use
+     * from any number of threads at once, like every instance.
+     */
+    static std::shared_ptr<XzCompressor> get();
+
+    int get_id() override;
+    int compress_into(std::span<const std::byte> data,
+                      std::vector<std::byte>    &out) override;
+    int decompress_into(std::span<const std::byte> data,
+                        std::vector<std::byte>    &out) override;
+};
+
+/*
+ * Picks one of the given compressors for every piece of data, by compressing
+ * samples of it with each of them. A compressor is only picked over a cheaper
+ * one, earlier in the list, if it saves a sizeable part of the data, so that
+ * incompressible data is not run through zlib on both ends for nothing.
+ *
+ * Only ever used through select(): the id of the compressor picked is stored
+ * with the data. It has no id of its own (get_id fails), and cannot decompress
+ * anything.
+ */
+class AutoCompressor : public Compressor {
+private:
+    std::vector<std::shared_ptr<Compressor>> candidates;
+
+public:
+    /*
+     * Samples of this size are taken from the start, the middle and the end of
+     * larger data.
+     */
+    static const size_t sample_size = 16 << 10;
+
+    /*
+     * Candidates, from the cheapest to the most expensive.
+     */
+    AutoCompressor(std::vector<std::shared_ptr<Compressor>> candidates);
+
+    /*
+     * Picks between PlainCompressor and ZLibCompressor.
+     */
+    static std::shared_ptr<AutoCompressor> get();
+
+    Compressor *select(std::span<const std::byte> data) override;
+
+    int get_id() override;
+    int compress_into(std::span<const std::byte> data,
+                      std::vector<std::byte>    &out) override;
+    int decompress_into(std::span<const std::byte> data,
+                        std::vector<std::byte>    &out) override;
 };
@@ -12,8 +12,41 @@ public:
 
     int verbosity;
 
+    /*
+     * Where to write the trace events. Empty if tracing is disabled.
+     */
+    std::string trace_file;
+
     std::shared_ptr<Compressor> compressor;
 
+    /*
+     * File I/O backend: "posix", or "uring" to batch the system calls through
+     * io_uring where the kernel supports it.
+     */
+    std::string io_backend;
+
+    /*
+     * Number of threads of each stage of the create pipeline, and how many
+     * instructions may be in the pipeline at once.
+     */
+    int    read_workers;
+    int    diff_workers;
+    int    compress_workers;
+    size_t queue_depth;
+
+    /*
+     * Number of threads decoding instructions during apply, and how many bytes
+     * the instructions read ahead may occupy.
+     */
+    int    decode_workers;
+    size_t memory_budget;
+
+    /*
+     * Whether diffs that support it (MyersDiff) are applied in place, writing
+     * only the changed ranges of the file instead of all of it.
+     */
+    bool in_place;
+
 private:
     Config();
 
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/*
+ * CRC-32C (Castagnoli), the checksum of iSCSI, ext4 and btrfs, which x86 CPUs
+ * compute in hardware since SSE4.2. With PCLMULQDQ as well, three streams are
+ * computed at once and combined, at several gigabytes a second. Otherwise the
+ * table-driven version is used, with the same results.
+ */
+
+/*
+ * Continue the checksum crc, that of the data before, with the given data. The
+ * checksum of nothing is 0, so that crc32c(b, crc32c(a)) is the checksum of a
+ * followed by b.
+ */
+uint32_t crc32c(std::span<const std::byte> data, uint32_t crc = 0);
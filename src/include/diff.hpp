@@ -2,14 +2,21 @@
 #include <compressor.hpp>
 #include <cstddef>
 #include <memory>
+#include <span>
 #include <string>
 #include <variant>
 #include <vector>
 
+class FileCache;
+class PatchContext;
+
 class Diff {
 public:
     enum DiffSignature : uint8_t {
         SYSTEM_DIFF,
+        REPLACE_DIFF,
+        MYERS_DIFF,
+        SPARSE_DIFF,
     } signature;
 
     std::shared_ptr<Compressor> compressor;
@@ -19,35 +26,224 @@ public:
     virtual int from_files(const std::string &src, const std::string &dest) = 0;
 
     /*
-     * Return uncompressed binary representation of the diff.
+     * Append the binary representation of the diff to out.
      */
-    virtual std::vector<std::byte> binary_representation() = 0;
+    virtual void write_binary_representation(std::vector<std::byte> &out) = 0;
 
     /*
-     * Reconstruct the diff from its given binary representation.
-     * Returns 0 on success.
+     * Return binary representation of the diff.
+     */
+    std::vector<std::byte> binary_representation();
+
+    /*
+     * Reconstruct the diff from its given binary representation, which may
+     * refer to the dictionary of the given context. Returns 0 on success.
      */
-    virtual int from_binary_representation(const std::vector<std::byte> &data) = 0;
+    virtual int from_binary_representation(std::span<const std::byte> data,
+                                           const PatchContext *context = nullptr) = 0;
 
     /*
      * Apply this patch to the given file. Returns 0 on success.
      */
     virtual int apply(const std::string &file) = 0;
 
+    /*
+     * What patch_contents needs from the file to patch.
+     */
+    enum ContentsUse : uint8_t {
+        CONTENTS_UNSUPPORTED, /* only apply can patch the file */
+        CONTENTS_READ,        /* its current contents */
+        CONTENTS_IGNORED,     /* nothing, the file is replaced */
+    };
+    virtual ContentsUse contents_use();
+
+    /*
+     * Compute the patched contents of a file from its current contents, so that
+     * the caller can read and write many files at once. Returns 0 on success, 1
+     * if the file has to be patched with apply instead, -1 on error.
+     */
+    virtual int patch_contents(std::span<const std::byte> file, std::vector<std::byte> &out);
+
+    /*
+     * Whether apply rewrites the file in place, rather than replacing all of it.
+     */
+    virtual bool writes_in_place();
+
+    /*
+     * Number of bytes of (uncompressed) data held by this diff.
+     */
+    virtual size_t data_size() = 0;
+
     static std::shared_ptr<Diff> from_signature(uint8_t signature);
 };
 
 /*
- * Uses diff, od, and patch.
+ * The diff, taken with the diff tool, between the hex dumps of two files (see
+ * hex_dump). The tool is spawned without a shell, with the dumps passed to it
+ * in memory.
  */
 class SystemDiff : public Diff {
 private:
     std::vector<std::byte> data;
 
+    /*
+     * Apply the diff with the patch tool, for a payload patch_bytes rejects.
+     */
+    int apply_with_tools(const std::string &file);
+
 public:
     SystemDiff();
     int from_files(const std::string &src, const std::string &dest) override;
-    std::vector<std::byte> binary_representation() override;
-    int from_binary_representation(const std::vector<std::byte> &data) override;
-    int apply(const std::string &file) override;
+    void write_binary_representation(std::vector<std::byte> &out) override;
+    int  from_binary_representation(std::span<const std::byte> data,
+                                    const PatchContext *context = nullptr) override;
+    int  apply(const std::string &file) override;
+    ContentsUse contents_use() override;
+    int    patch_contents(std::span<const std::byte> file,
+                          std::vector<std::byte>    &out) override;
+    size_t data_size() override;
+
+    /*
+     * Apply a diff in the normal format of diff, taken between the hex dumps
+     * (one byte per line) of two files, to the bytes of the first file without
+     * dumping it: line n of a dump is byte n - 1. The removed bytes are checked.
+     * Returns 0 on success.
+     */
+    static int patch_bytes(std::span<const std::byte> file,
+                           std::span<const std::byte> diff, std::vector<std::byte> &out);
+};
+
+/*
+ * Holds the whole destination file, which replaces the target. Cheaper to
+ * construct and apply, and smaller, than a SystemDiff of a file that was
+ * mostly rewritten.
+ */
+class ReplaceDiff : public Diff {
+private:
+    std::vector<std::byte> data;
+
+public:
+    ReplaceDiff();
+    int from_files(const std::string &src, const std::string &dest) override;
+    void write_binary_representation(std::vector<std::byte> &out) override;
+    int  from_binary_representation(std::span<const std::byte> data,
+                                    const PatchContext *context = nullptr) override;
+    int  apply(const std::string &file) override;
+    ContentsUse contents_use() override;
+    int    patch_contents(std::span<const std::byte> file,
+                          std::vector<std::byte>    &out) override;
+    size_t data_size() override;
+};
+
+/*
+ * Byte-level diff of two files, taken with the O(ND) algorithm of Myers in
+ * linear space, without any external tool. A part of the files whose shortest
+ * edit script costs more than max_cost steps to find is split heuristically
+ * instead, which gives a longer script but bounds the time to
+ * O((N + M) * max_cost).
+ *
+ * Binary representation (compressed as a whole):
+ *
+ * source_size (varint)
+ * copy_1 (varint, number of bytes kept)
+ * delete_1 (varint, number of bytes removed)
+ * insert_1 (varint, number of bytes inserted)
+ * inserted_bytes_1
+ * ...
+ *
+ * Unless disabled in the config, the script is applied in place (see
+ * InPlacePatch): the file is not read and rewritten, only the bytes that move
+ * or change are written.
+ */
+class MyersDiff : public Diff {
+private:
+    std::vector<std::byte> data;
+
+public:
+    /*
+     * Limit of the steps spent on one part of the files, 0 for one growing with
+     * the square root of their sizes.
+     */
+    uint64_t max_cost = 0;
+
+    MyersDiff();
+    int from_files(const std::string &src, const std::string &dest) override;
+    void write_binary_representation(std::vector<std::byte> &out) override;
+    int  from_binary_representation(std::span<const std::byte> data,
+                                    const PatchContext *context = nullptr) override;
+    int  apply(const std::string &file) override;
+    ContentsUse contents_use() override;
+    int    patch_contents(std::span<const std::byte> file,
+                          std::vector<std::byte>    &out) override;
+    bool   writes_in_place() override;
+    size_t data_size() override;
+
+    /*
+     * Take the diff between the given contents.
+     */
+    void compute(std::span<const std::byte> src, std::span<const std::byte> dest);
+
+    /*
+     * Apply the given edit script to file. Returns 0 on success.
+     */
+    static int patch(std::span<const std::byte> file, std::span<const std::byte> script,
+                     std::vector<std::byte> &out);
 };
+
+/*
+ * Holds the destination like a ReplaceDiff, but without its holes: the file
+ * is walked with SEEK_DATA and SEEK_HOLE, and only the ranges holding data are
+ * read and stored. Applying it recreates the holes by leaving them unwritten,
+ * so that a sparse file stays sparse.
+ *
+ * Binary representation (compressed as a whole):
+ *
+ * size (varint, of the destination)
+ * number_of_extents (varint)
+ * for every range holding data, in order:
+ *   gap (varint, bytes of hole since the end of the previous range)
+ *   length (varint)
+ * data of the ranges, one after the other
+ */
+class SparseDiff : public Diff {
+private:
+    std::vector<std::byte> data;
+
+public:
+    SparseDiff();
+    int from_files(const std::string &src, const std::string &dest) override;
+    void write_binary_representation(std::vector<std::byte> &out) override;
+    int  from_binary_representation(std::span<const std::byte> data,
+                                    const PatchContext *context = nullptr) override;
+    int  apply(const std::string &file) override;
+    size_t data_size() override;
+
+    /*
+     * Whether the file has holes, so that a SparseDiff may store it. If stored
+     * is given, it receives the size of such a SparseDiff before compression.
+     */
+    static bool has_holes(const std::string &file, uint64_t *stored = nullptr);
+};
+
+/*
+ * How the destination of a modification relates to its source.
+ */
+enum FileRelation {
+    FILES_IDENTICAL,
+    FILES_SIMILAR,
+    FILES_REWRITTEN,
+};
+
+/*
+ * Find out how the given files relate without running a diff: from their
+ * sizes, their common prefix and suffix, and how much of the rest of the
+ * destination can be found in the source. The files are rewritten if a
+ * SystemDiff would likely be larger than the destination. With a cache, the
+ * signature of an unchanged source is taken from it instead of reading the
+ * source. If estimate is given, it receives the likely size, before
+ * compression, of the diff the relation calls for: a SystemDiff if they are
+ * similar, a ReplaceDiff if rewritten. Returns 0 on success.
+ */
+int compare_files(const std::string &src, const std::string &dest,
+                  FileRelation &relation, FileCache *cache = nullptr,
+                  uint64_t *estimate = nullptr);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * What create needs to know about a source file to compare it with its
+ * destination (see compare_files): a hash of its contents, and the signatures
+ * of its blocks, to estimate how much of the destination is new.
+ */
+class FileSignature {
+public:
+    static const size_t block_size = 64;
+
+    /*
+     * 128-bit hash of the contents. Tells contents apart reliably, but is not
+     * meant to resist collisions crafted on purpose.
+     */
+    uint64_t hash[2] = {0, 0};
+
+    /*
+     * Sorted signatures of the blocks at every multiple of block_size, if they
+     * were computed.
+     */
+    bool                  indexed = false;
+    std::vector<uint32_t> blocks;
+
+    void compute_hash(std::span<const std::byte> data);
+    void compute_index(std::span<const std::byte> data);
+
+    /*
+     * Whether the given data has the hashed contents.
+     */
+    bool same_contents(std::span<const std::byte> data) const;
+
+    /*
+     * Number of bytes of data that are not found in the indexed file, in blocks
+     * of block_size bytes at any offset, as in rsync. Stops counting once limit
+     * is reached.
+     */
+    size_t count_new_bytes(std::span<const std::byte> data, size_t limit) const;
+};
+
+/*
+ * Signatures of source files kept from one create to the next, so that a base
+ * tree that did not change is not read and indexed again. An entry is only
+ * used while the path still has the same inode, size and modification time.
+ * Thread-safe.
+ *
+ * Binary representation:
+ *
+ * SIGNATURE(with NULL byte)
+ * number_of_entries (varint)
+ * path_1 (absolute, with NULL byte)
+ * inode_1, size_1, mtime_1 (varint each, mtime in nanoseconds)
+ * hash_1 (2 uint64, least to most significant)
+ * number_of_blocks_1 (varint, 0 if not indexed)
+ * blocks_1 (uint32 each, least to most significant)
+ * ...
+ */
+class FileCache {
+private:
+    static constexpr const char *signature = "__PATCHIT_CACHE__";
+
+    struct Entry {
+        uint64_t      inode;
+        uint64_t      size;
+        uint64_t      mtime;
+        FileSignature signature;
+    };
+
+    std::string                            file;
+    std::mutex                             lock;
+    std::unordered_map<std::string, Entry> entries;
+    uint64_t                               hits;
+    uint64_t                               misses;
+
+    static std::string key(const std::string &path);
+
+public:
+    FileCache(const std::string &file);
+
+    /*
+     * Load the cache file. A missing or unreadable one leaves the cache empty.
+     */
+    void load();
+
+    /*
+     * Write the cache file, atomically replacing it. Returns 0 on success.
+     */
+    int save();
+
+    /*
+     * Signature of the given file, whose status is sb, if it is cached and the
+     * file did not change since.
+     */
+    bool lookup(const std::string &path, const struct stat &sb,
+                FileSignature &signature);
+
+    /*
+     * Remember the signature of the given file, whose status is sb.
+     */
+    void store(const std::string &path, const struct stat &sb,
+               const FileSignature &signature);
+
+    size_t size();
+};
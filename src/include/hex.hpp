@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+/*
+ * The hex dump written by `xxd -c1 -ps`: every byte on a line of its own, as
+ * two lowercase hex digits. Both directions are vectorized where the CPU
+ * allows it, with the same output as xxd.
+ */
+
+/*
+ * Append the dump of data to out.
+ */
+void hex_dump(std::span<const std::byte> data, std::vector<std::byte> &out);
+
+/*
+ * Append the bytes of the given dump to out. As with `xxd -r -ps`, the digits
+ * can be of either case and whitespace is ignored. Returns 0 on success, and
+ * leaves out as it was on failure.
+ */
+int hex_undump(std::span<const std::byte> dump, std::vector<std::byte> &out);
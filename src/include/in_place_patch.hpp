@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+/*
+ * Turns a file into a new version of it, made of ranges copied from the old
+ * version and of given bytes, by writing only the bytes that change: ranges
+ * copied to where they already are are not touched.
+ *
+ * A copy must not overwrite bytes that another copy still has to read, so the
+ * copies are ordered: every copy runs before the copies writing over its
+ * source. A copy overlapping its own source is moved through a scratch buffer
+ * from the right end. The copies of an edit script, in which both the sources
+ * and the destinations are in order, are always ordered this way; a cycle, for
+ * example two ranges swapped, is broken by reading the source of one of its
+ * copies into memory first, the shortest copy left. Ordering takes
+ * O(n log n) for n copies. The given bytes are written last.
+ */
+class InPlacePatch {
+private:
+    struct Copy {
+        uint64_t from;
+        uint64_t to;
+        uint64_t length;
+    };
+
+    struct Insert {
+        uint64_t                   to;
+        std::span<const std::byte> data;
+    };
+
+    std::vector<Copy>   copies;
+    std::vector<Insert> inserts;
+
+    /*
+     * Order the copies (sorted by their source first). held[i] is set for the
+     * copies whose source is read into memory when they come up in the order,
+     * and written with the inserts. Returns 0 on success, -1 if the sources or
+     * the destinations of the copies overlap.
+     */
+    int order(std::vector<size_t> &sequence, std::vector<bool> &held);
+
+public:
+    /* Number of bytes written by the last apply. */
+    uint64_t written = 0;
+
+    /*
+     * Bytes the sources of the copies read into memory may take at most. If
+     * breaking the cycles needs more, apply fails before writing anything.
+     */
+    uint64_t max_held = UINT64_MAX;
+
+    /*
+     * Bytes [to, to + length) of the new version are bytes [from, from + length)
+     * of the old one.
+     */
+    void copy(uint64_t from, uint64_t to, uint64_t length);
+
+    /*
+     * Bytes [to, to + data.size()) of the new version are data, which must be
+     * kept alive until apply returns.
+     */
+    void insert(uint64_t to, std::span<const std::byte> data);
+
+    /*
+     * Patch the file, which must be old_size bytes long, into the new version
+     * of new_size bytes. Every byte of the new version must be given by a copy
+     * or an insert. Returns 0 on success.
+     */
+    int apply(const std::string &file, uint64_t old_size, uint64_t new_size);
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * File I/O performed on whole batches of files. Each request gets its own
+ * error (an errno value, 0 on success), and the methods return 0 only if every
+ * request of the batch succeeded.
+ */
+class FileIO {
+public:
+    struct StatRequest {
+        std::string path;
+        struct stat sb;
+        int         error;
+    };
+
+    struct ReadRequest {
+        std::string            path;
+        std::vector<std::byte> data;
+        int                    error;
+    };
+
+    struct WriteRequest {
+        std::string                   path;
+        const std::vector<std::byte> *data;
+        bool                          sync;
+        int                           error;
+    };
+
+    virtual ~FileIO() = default;
+
+    virtual const char *name() = 0;
+
+    /*
+     * stat() every path. Missing files are reported with an error, but not
+     * printed.
+     */
+    virtual int stat_files(std::vector<StatRequest> &batch) = 0;
+
+    /*
+     * Read every file entirely.
+     */
+    virtual int read_files(std::vector<ReadRequest> &batch) = 0;
+
+    /*
+     * Create or truncate every file and write the data to it. Files with the
+     * sync flag are fsync()ed before they are closed.
+     */
+    virtual int write_files(std::vector<WriteRequest> &batch) = 0;
+
+    /*
+     * Backend selected by Config::io_backend for the calling thread.
+     */
+    static std::shared_ptr<FileIO> get();
+};
+
+/*
+ * Processes the requests one by one using stdio.
+ */
+class PosixIO : public FileIO {
+private:
+    PosixIO();
+
+public:
+    static std::shared_ptr<PosixIO> get();
+
+    const char *name() override;
+    int         stat_files(std::vector<StatRequest> &batch) override;
+    int         read_files(std::vector<ReadRequest> &batch) override;
+    int         write_files(std::vector<WriteRequest> &batch) override;
+};
+
+/*
+ * Submits the requests of a batch to an io_uring together, so that a batch of
+ * any size takes a handful of system calls. A ring must not be shared between
+ * threads, so every thread gets its own.
+ */
+class UringIO : public FileIO {
+private:
+    int ring_fd;
+
+    uint32_t  sq_entries;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    void     *sqes;
+
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    void     *cqes;
+
+    void  *ring_ptr;
+    size_t ring_size;
+    size_t sqes_size;
+
+    uint32_t queued;
+
+    /* The ring failed, and get() no longer hands it out. */
+    bool broken;
+
+    /* Operations that may still complete after waiting for them failed. */
+    uint32_t in_flight;
+
+    UringIO();
+
+    /*
+     * Create the ring and check that the kernel supports every operation used.
+     */
+    int setup();
+
+    /*
+     * Queue an operation, returns the submission entry to fill in.
+     */
+    void *queue(uint8_t opcode, int fd, uint64_t user_data);
+
+    /*
+     * Store the results of the completed operations, counting them in completed.
+     */
+    void reap(std::vector<int> &results, uint32_t &completed);
+
+    /*
+     * Submit all the queued operations and wait for them to complete. results[i]
+     * receives the result of the operation with user_data i. If the ring fails,
+     * the operations not taken by the kernel are dropped (their results are left
+     * untouched), the others are waited for, and the ring is marked broken.
+     */
+    int submit_and_wait(std::vector<int> &results);
+
+    /*
+     * Process the requests of a batch from first on with PosixIO after the ring
+     * failed. If operations may still be in flight, they fail instead. Returns
+     * -1 if any request failed, res otherwise.
+     */
+    template <typename Request>
+    int fall_back(std::vector<Request> &batch, size_t first, int res,
+                  int (PosixIO::*process)(std::vector<Request> &));
+
+public:
+    ~UringIO();
+
+    /*
+     * The ring of the calling thread, or nullptr if io_uring is not available or
+     * the ring failed.
+     */
+    static std::shared_ptr<UringIO> get();
+
+    const char *name() override;
+    int         stat_files(std::vector<StatRequest> &batch) override;
+    int         read_files(std::vector<ReadRequest> &batch) override;
+    int         write_files(std::vector<WriteRequest> &batch) override;
+};
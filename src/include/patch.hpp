@@ -1,8 +1,12 @@
 #pragma once
+#include <checkpoint.hpp>
 #include <compressor.hpp>
 #include <cstddef>
 #include <diff.hpp>
 #include <memory>
+#include <patch_context.hpp>
+#include <path_filter.hpp>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -24,15 +28,39 @@ public:
     virtual int apply() = 0;
 
     /*
-     * Return uncompressed binary representation of the instruction.
+     * Append the binary representation of the instruction to out. With a
+     * context, paths are stored as ids into its path table (see PathTable).
      */
-    virtual std::vector<std::byte> binary_representation() = 0;
+    virtual void write_binary_representation(std::vector<std::byte> &out,
+                                             PatchContext *context = nullptr) = 0;
 
     /*
-     * Reconstruct the instruction from its given binary representation.
-     * Returns 0 on success.
+     * Return binary representation of the instruction.
+     */
+    std::vector<std::byte> binary_representation();
+
+    /*
+     * Reconstruct the instruction from its given binary representation, which
+     * has to be written with the same context. Returns 0 on success.
+     */
+    virtual int from_binary_representation(std::span<const std::byte> data,
+                                           const PatchContext *context = nullptr) = 0;
+
+    /*
+     * Paths this instruction touches.
+     */
+    virtual std::vector<std::string> paths() = 0;
+
+    /*
+     * Number of bytes of data held by this instruction.
      */
-    virtual int from_binary_representation(const std::vector<std::byte> &data) = 0;
+    virtual size_t data_size();
+
+    /*
+     * Whether applying this instruction rewrites a file in place, so that the
+     * file is neither its old nor its new version if it is interrupted.
+     */
+    virtual bool modifies_in_place();
 
     /*
      * Select the desired Compressor to use.
@@ -58,9 +86,12 @@ public:
                           const std::string &move_from, const std::string &move_to);
     EntityMoveInstruction();
 
-    int                    apply() override;
-    std::vector<std::byte> binary_representation() override;
-    int from_binary_representation(const std::vector<std::byte> &data) override;
+    int  apply() override;
+    void write_binary_representation(std::vector<std::byte> &out,
+                                     PatchContext *context = nullptr) override;
+    int  from_binary_representation(std::span<const std::byte> data,
+                                    const PatchContext *context = nullptr) override;
+    std::vector<std::string> paths() override;
 };
 
 class EntityDeleteInstruction : public Instruction {
@@ -76,9 +107,12 @@ public:
                             const std::string &target);
     EntityDeleteInstruction();
 
-    int                    apply() override;
-    std::vector<std::byte> binary_representation() override;
-    int from_binary_representation(const std::vector<std::byte> &data) override;
+    int  apply() override;
+    void write_binary_representation(std::vector<std::byte> &out,
+                                     PatchContext *context = nullptr) override;
+    int  from_binary_representation(std::span<const std::byte> data,
+                                    const PatchContext *context = nullptr) override;
+    std::vector<std::string> paths() override;
 };
 
 class EntityModifyInstruction : public Instruction {
@@ -97,34 +131,389 @@ public:
                             std::shared_ptr<Diff> diff);
     EntityModifyInstruction();
 
-    int                    apply() override;
-    std::vector<std::byte> binary_representation() override;
-    int from_binary_representation(const std::vector<std::byte> &data) override;
+    int  apply() override;
+    void write_binary_representation(std::vector<std::byte> &out,
+                                     PatchContext *context = nullptr) override;
+    int  from_binary_representation(std::span<const std::byte> data,
+                                    const PatchContext *context = nullptr) override;
+    std::vector<std::string> paths() override;
+    size_t data_size() override;
+    bool   modifies_in_place() override;
+
+    /*
+     * Replace the diff to apply to the target.
+     */
+    void set_diff(std::shared_ptr<Diff> diff);
 };
 
+class PatchReader;
+
 class Patch {
 private:
+    friend class PatchReader;
+    friend class PatchWriter;
+
     /*
-     * Compatibility version of the source code for which this patch was created.
-     * Used to check compatibility.
+     * Magic string (followed by a NULL byte) every patch file starts with.
      */
-    static const uint64_t compatibility_version = 0;
+    static constexpr const char *signature = "__PATCHIT__";
 
     std::vector<std::shared_ptr<Instruction>> instructions;
 
+    /*
+     * Compatibility version of the loaded patch.
+     */
+    uint64_t version = compatibility_version;
+
+    /*
+     * Print the instruction with the given number.
+     */
+    static void inspect_instruction(const Instruction *ins, size_t number,
+                                    int verbosity);
+
+    /*
+     * A modification applied together with the ones around it (see apply_batch).
+     */
+    struct BatchedModify {
+        uint64_t                                 number;
+        std::shared_ptr<EntityModifyInstruction> instruction;
+    };
+
+    /*
+     * Apply consecutive modifications of distinct targets, statting, reading and
+     * writing the targets in batches of the FileIO backend. A target that cannot
+     * be patched so (missing, too large, the same file as an earlier target, or
+     * with a diff that has to be applied to the file) is left to the apply of
+     * its instruction. The modifications
+     * are completed in the checkpoint in order, and none after the first that
+     * fails is written. Returns 0 on success.
+     */
+    static int apply_batch(std::vector<BatchedModify> &batch, Checkpoint *checkpoint);
+
 public:
+    /*
+     * Compatibility version (format revision) written by default. Patches of any
+     * version from oldest_compatibility_version on can be read.
+     *
+     * 0: fixed-size lengths, paths stored in every instruction
+     * 1: varint lengths, paths stored once in a table, packed flags
+     */
+    static const uint64_t compatibility_version = 1;
+    static const uint64_t oldest_compatibility_version = 0;
+
+    /*
+     * Optional features of a patch of compatibility version 1 and later.
+     */
+    enum PatchFlags : uint64_t {
+        PATCH_DICTIONARY = 1,
+        PATCH_SOLID = 2,
+        PATCH_CHECKSUMS = 4,
+    };
+
     /*
      * Apply this patch. Returns 0 on success.
      */
     int apply();
 
+    /*
+     * Apply the instructions of the given patch without loading all of them.
+     * While one instruction is applied, the following ones are read and decoded
+     * by other threads. With a filter, only the instructions touching a selected
+     * path are applied. With a checkpoint, the progress is recorded in it, and
+     * the instructions it has as completed are skipped. Returns 0 on success.
+     */
+    static int apply(PatchReader &reader, const PathFilter *filter = nullptr,
+                     Checkpoint *checkpoint = nullptr);
+
+    /*
+     * Check the given patch without applying it: its checksums, if it has any,
+     * on the given number of threads, and, if it has none or with decode, that
+     * every instruction decodes, decompressing the diffs. Returns 0 if the patch
+     * is intact.
+     */
+    static int verify(const std::string &file, int threads, bool decode = false);
+
     /*
      * Append the given instruction to the end of the instructions list.
      */
     void append(std::shared_ptr<Instruction> instruction);
 
-    int write_to_file(const std::string &file);
+    int write_to_file(const std::string &file,
+                      uint64_t           version = compatibility_version);
     int load_from_file(const std::string &file);
 
     void inspect_contents(int verbosity);
+
+    /*
+     * Print the instructions of the given patch that touch the given path. The
+     * index of the patch is used to read only those instructions.
+     * Returns 0 on success.
+     */
+    static int inspect_path(const std::string &file, const std::string &path,
+                            int verbosity);
+};
+
+/*
+ * Reads a patch from a file one instruction at a time.
+ */
+class PatchReader {
+private:
+    friend class Patch;
+
+    std::string file;
+    FILE       *fd;
+
+    uint64_t version;
+    uint64_t file_size;
+    uint64_t offset;
+    uint64_t count;
+    uint64_t index;
+
+    PatchContext context;
+
+    /*
+     * The footer of a patch with a path table, mapped into memory, and its
+     * index: where every instruction starts, and the positions in the table of
+     * the paths it touches (instruction i owns index_paths[index_paths_offsets[i]]
+     * up to index_paths[index_paths_offsets[i + 1]]).
+     */
+    void                 *footer;
+    size_t                footer_size;
+    std::vector<uint64_t> index_offsets;
+    std::vector<uint64_t> index_paths_offsets;
+    std::vector<uint64_t> index_paths;
+
+    /*
+     * Blocks of a solid patch: where block b starts in the file
+     * (block_offsets[b + 1] is where it ends), where it starts among the
+     * decompressed instructions, and which block every instruction is in.
+     * index_offsets then refer to the decompressed instructions. The block that
+     * was read last is kept decompressed.
+     */
+    bool                   solid;
+    std::vector<uint64_t>  block_offsets;
+    std::vector<uint64_t>  block_starts;
+    std::vector<uint64_t>  index_blocks;
+    std::vector<std::byte> block;
+    std::vector<std::byte> compressed_block;
+    int64_t                loaded_block;
+
+    /*
+     * Instructions not selected by the filter are skipped using the index. The
+     * verdict for every position in the path table is cached: -1 if unknown,
+     * otherwise a combination of PATH_INCLUDED and PATH_EXCLUDED.
+     */
+    enum PathVerdict : int8_t {
+        PATH_INCLUDED = 1,
+        PATH_EXCLUDED = 2,
+    };
+    const PathFilter   *filter;
+    std::vector<int8_t> selected_positions;
+    uint64_t            skipped;
+
+    /*
+     * Patches with checksums have the CRC32C of every instruction, or of every
+     * block of a solid patch, which is checked as it is read. read_bytes keeps
+     * the checksum of the bytes read since crc was last reset.
+     */
+    bool                  checksums;
+    std::vector<uint32_t> record_checksums;
+    uint32_t              crc;
+
+    bool selected(uint64_t index);
+
+    int read_bytes(void *data, size_t size);
+    int read_varint(uint64_t &value);
+    int read_dictionary();
+    int read_footer();
+    int read_index(std::span<const std::byte> data, size_t &pos, uint64_t end);
+    int read_blocks(std::span<const std::byte> data, size_t &pos, uint64_t end);
+    int read_checksums(std::span<const std::byte> data, size_t &pos, uint32_t header);
+    int load_block(uint64_t number);
+    int next_from_block(uint8_t &signature, std::vector<std::byte> &repr);
+
+public:
+    PatchReader();
+    ~PatchReader();
+
+    /*
+     * Open the given patch and check its header. Returns 0 on success.
+     */
+    int open(const std::string &file);
+
+    /*
+     * Number of instructions in the patch.
+     */
+    uint64_t size();
+
+    /*
+     * Table the instructions were serialized with, nullptr for patches without
+     * one.
+     */
+    const PathTable *path_table();
+
+    /*
+     * Context the instructions were serialized with, nullptr for patches
+     * without one.
+     */
+    const PatchContext *patch_context();
+
+    /*
+     * Positions in path_table() of the paths touched by the instruction with the
+     * given index, taken from the index without reading the instruction. Empty
+     * for patches without a path table.
+     */
+    std::span<const uint64_t> instruction_paths(uint64_t index);
+
+    /*
+     * Continue reading at the instruction with the given index. Without the
+     * index of a path table, the instructions up to it are read and thrown away,
+     * so it cannot go back. Returns 0 on success.
+     */
+    int seek(uint64_t index);
+
+    /*
+     * Skip the instructions touching no paths selected by the given filter, if
+     * the patch has an index. Returns whether it does.
+     */
+    bool set_filter(const PathFilter *filter);
+
+    /*
+     * Number of instructions skipped so far.
+     */
+    uint64_t skipped_instructions();
+
+    /*
+     * Read the next serialized instruction. Returns 1 if an instruction was read,
+     * 0 if there are no more instructions, and -1 on error.
+     */
+    int next(uint8_t &signature, std::vector<std::byte> &repr);
+
+    /*
+     * Whether the patch has checksums.
+     */
+    bool has_checksums();
+
+    /*
+     * Check the checksums of all the instructions (or blocks) of the patch, on
+     * the given number of threads, without decoding any. The header and the
+     * footer are checked by open. Returns the number of corrupted instructions
+     * (or blocks), or -1 on error.
+     */
+    int64_t verify_checksums(int threads);
+
+    void close();
+};
+
+/*
+ * Writes a patch to a file one instruction at a time, so that the whole patch
+ * never has to be held in memory. The data goes to a temporary file next to the
+ * destination, which replaces the destination only once the patch is finished.
+ */
+class PatchWriter {
+private:
+    std::string file;
+    std::string temp_file;
+    FILE       *fd;
+
+    uint64_t version;
+    uint64_t count;
+    long     count_offset;
+
+    PatchContext context;
+
+    /*
+     * Size of every written instruction and the ids of the paths it touches,
+     * stored as the index in the footer.
+     */
+    std::vector<uint64_t> index_sizes;
+    std::vector<uint64_t> index_path_counts;
+    std::vector<uint64_t> index_paths;
+
+    /* Reused to serialize the appended instructions. */
+    std::vector<std::byte> buffer;
+    std::vector<uint64_t>  ids;
+
+    /*
+     * Solid patches collect the instructions into a block until it holds
+     * block_size bytes, and then compress the block as a whole. The compressed
+     * size of every block and the number of instructions in it are stored in
+     * the footer.
+     */
+    uint64_t                    block_size;
+    std::shared_ptr<Compressor> block_compressor;
+    std::vector<std::byte>      block;
+    std::vector<std::byte>      compressed_block;
+    uint64_t                    block_count;
+    std::vector<uint64_t>       block_sizes;
+    std::vector<uint64_t>       block_counts;
+
+    /*
+     * CRC32C of the header, and of every instruction, or every block of a solid
+     * patch, stored in the footer if checksums are written.
+     */
+    bool                  checksums;
+    uint32_t              header_checksum;
+    std::vector<uint32_t> record_checksums;
+
+    int write_bytes(const void *data, size_t size);
+    int flush_block();
+
+public:
+    PatchWriter();
+    ~PatchWriter();
+
+    /*
+     * Start writing a new patch of the given compatibility version to the given
+     * file. With a dictionary, which needs version 1, the diffs can be compressed
+     * with ZLibDictionaryCompressor (see patch_context()). With a block size,
+     * which needs version 1 as well, the patch is solid: the instructions are
+     * compressed together in blocks of about that many bytes, with the given
+     * block compressor, or else with the dictionary if there is one, or else
+     * with zlib. With checksums, which need version 1 too, the footer holds the
+     * CRC32C of every part of the patch, which readers check (see
+     * Patch::PATCH_CHECKSUMS). Returns 0 on success.
+     */
+    int open(const std::string &file,
+             uint64_t           version = Patch::compatibility_version,
+             std::span<const std::byte> dictionary = {}, uint64_t block_size = 0,
+             std::shared_ptr<Compressor> block_compressor = nullptr,
+             bool                        checksums = false);
+
+    /*
+     * Table the instructions have to be serialized with, nullptr if the patch
+     * has none. Interning all the paths up front, in order, before serializing
+     * the instructions on several threads keeps the patch reproducible.
+     */
+    PathTable *path_table();
+
+    /*
+     * Context the instructions have to be serialized with, nullptr if the patch
+     * has none.
+     */
+    PatchContext *patch_context();
+
+    /*
+     * Serialize the given instruction and write it out. The writer does not keep
+     * a reference to the instruction. Returns 0 on success.
+     */
+    int append(std::shared_ptr<Instruction> instruction);
+
+    /*
+     * Write out an instruction that has already been serialized, touching the
+     * paths with the given ids in path_table(). Returns 0 on success.
+     */
+    int append_representation(uint8_t signature, std::span<const std::byte> repr,
+                              std::span<const uint64_t> path_ids = {});
+
+    /*
+     * Write the number of instructions (and the path table and index) and move
+     * the patch into place. Returns 0 on success.
+     */
+    int finish();
+
+    /*
+     * Discard the partially written patch.
+     */
+    void abort();
 };
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <compressor.hpp>
+#include <memory>
+#include <path_table.hpp>
+
+/*
+ * State shared by all the instructions of a patch and stored once in it.
+ * Instructions serialized with a context refer to their paths by id into its
+ * path table, and their diffs may be compressed with its dictionary.
+ */
+class PatchContext {
+public:
+    PathTable paths;
+
+    /*
+     * Compressor using the dictionary of the patch, nullptr if it has none.
+     */
+    std::shared_ptr<Compressor> dictionary_compressor;
+
+    void clear();
+
+    /*
+     * Compressor with the given id, which may need the dictionary of the given
+     * context. Returns nullptr if there is no such compressor.
+     */
+    static std::shared_ptr<Compressor> compressor_from_id(int                 id,
+                                                          const PatchContext *context);
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+ * Selects instructions by the paths they touch, using shell globs (see
+ * fnmatch(3)). An instruction is selected if one of its paths matches one of
+ * the included globs, or there are none, and none of its paths match any of the
+ * excluded globs. A glob matching a directory matches everything inside it, and
+ * '*' also matches '/'. Globs and paths are compared in their normal form (see
+ * normalize()), so "./dir/" matches the same paths as "dir".
+ */
+class PathFilter {
+private:
+    std::vector<std::string> includes;
+    std::vector<std::string> excludes;
+
+    /*
+     * The lexically normal form of a path or glob, without a leading "./" or a
+     * trailing '/'.
+     */
+    static std::string normalize(const std::string &path);
+
+    static bool matches_any(const std::vector<std::string> &globs,
+                            const std::string              &original);
+
+public:
+    void include(const std::string &glob);
+    void exclude(const std::string &glob);
+
+    /*
+     * Whether any globs were given, i.e. whether not everything is selected.
+     */
+    bool active() const;
+
+    /*
+     * The globs, each prefixed with '+' if included or '-' if excluded, the
+     * included ones first.
+     */
+    std::vector<std::string> rules() const;
+
+    bool included(const std::string &path) const;
+    bool excluded(const std::string &path) const;
+
+    /*
+     * Whether an instruction touching the given paths is selected.
+     */
+    bool selects(const std::vector<std::string> &paths) const;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Paths shared by all the instructions of a patch. Instructions serialized with
+ * a table refer to their paths by id, and the table is stored once per patch.
+ *
+ * Ids are handed out in the order the paths are interned, while the stored
+ * table is sorted, so that a path can be found by binary search. A table that
+ * was read is used in place, without decoding all of it, which is why the
+ * restart points and positions have a fixed size.
+ *
+ * Binary representation:
+ *
+ * number_of_paths (varint)
+ * restart_interval (varint)
+ * entries_size (varint)
+ * entries, in sorted order (front coding):
+ *   shared_1 (varint, length of the prefix shared with the previous path,
+ *             0 at every restart point)
+ *   suffix_length_1 (varint)
+ *   suffix_1
+ *   ...
+ * restart points (uint32, least to most significant, offset into the entries
+ *                 of every restart_interval-th path)
+ * positions (uint32, least to most significant, position in the sorted order
+ *            of the path with id 0, 1, ...)
+ */
+class PathTable {
+private:
+    std::mutex                                lock;
+    std::vector<std::string>                  paths;
+    std::unordered_map<std::string, uint64_t> ids;
+
+    /* Views into the representation of a table that was read. */
+    uint64_t                   count;
+    uint64_t                   interval;
+    std::span<const std::byte> entries;
+    std::span<const std::byte> restarts;
+    std::span<const std::byte> positions;
+
+    uint32_t load_uint32(std::span<const std::byte> data, uint64_t index) const;
+
+    /*
+     * Decode the entry at the given offset, which shares a prefix with path,
+     * into path. Returns 0 on success.
+     */
+    int decode_entry(size_t &offset, std::string &path) const;
+
+public:
+    static const uint64_t restart_interval = 16;
+
+    PathTable();
+
+    /*
+     * Return the id of the given path, adding it to the table if needed.
+     * Ids are assigned in order, so interning the same paths in the same order
+     * gives the same table. Thread-safe.
+     */
+    uint64_t intern(const std::string &path);
+
+    /*
+     * Path with the given id. Returns 0 on success.
+     */
+    int lookup(uint64_t id, std::string &path) const;
+
+    /*
+     * Position of the path with the given id in the sorted order, of a table
+     * that was read. Returns 0 on success.
+     */
+    int position_of(uint64_t id, uint64_t &position) const;
+
+    /*
+     * Path at the given position in the sorted order, of a table that was read.
+     * Returns 0 on success.
+     */
+    int path_at(uint64_t position, std::string &path) const;
+
+    /*
+     * Position of the given path in the sorted order, of a table that was read,
+     * or -1 if the table does not contain it.
+     */
+    int64_t find(const std::string &path) const;
+
+    size_t size() const;
+    void   clear();
+
+    /*
+     * Append the binary representation of the table to out. If positions is
+     * given, it receives the position in the sorted order of every id. Fails,
+     * leaving out unchanged, for a table too large for its uint32 restart
+     * points and positions (4 GiB of entries or 2^32 paths). Returns 0 on
+     * success.
+     */
+    int write(std::vector<std::byte> &out,
+              std::vector<uint64_t>  *positions = nullptr) const;
+
+    /*
+     * Use the table at data[offset] and advance offset past it. The table
+     * refers to data, which has to outlive it. Returns 0 on success.
+     */
+    int read(std::span<const std::byte> data, size_t &offset);
+};
+
+/*
+ * Append a path: its id if a table is given, otherwise the path itself
+ * followed by a NULL byte.
+ */
+void store_path(const std::string &path, PathTable *table, std::vector<std::byte> &out);
+
+/*
+ * Read a path stored by store_path at data[offset] and advance offset past it.
+ * Returns 0 on success.
+ */
+int restore_path(std::span<const std::byte> data, size_t &offset,
+                 const PathTable *table, std::string &path);
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <trace.hpp>
+#include <utility>
+#include <vector>
+
+/*
+ * FIFO queue shared between threads. Once closed, push() fails and pop() fails
+ * as soon as the queue is drained.
+ */
+template <typename T>
+class BoundedQueue {
+private:
+    std::mutex              lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T>           items;
+    size_t                  capacity;
+    bool                    closed;
+
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1), closed(false) {
+    }
+
+    /*
+     * Blocks while the queue is full. Returns false if the queue was closed.
+     */
+    bool push(T &&item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_full.wait(guard, [&]() { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    /*
+     * Blocks while the queue is empty. Returns false if the queue was closed and
+     * there is nothing left to pop.
+     */
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [&]() { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
+
+/*
+ * Pushes items through a sequence of stages, each served by its own pool of
+ * worker threads, and hands them to a consumer in the order they were produced.
+ *
+ * Every item has a cost (e.g. its size in bytes), and the total cost of the items
+ * between the producer and the consumer never exceeds the budget, unless a
+ * single item is more expensive than the whole budget. This bounds both the
+ * memory in use and the reordering in front of the consumer, and provides the
+ * backpressure between the stages.
+ */
+template <typename Item>
+class Pipeline {
+public:
+    /*
+     * Fills the given item. Returns 1 if an item was produced, 0 if there is
+     * nothing left to produce, and a negative value on error.
+     */
+    typedef std::function<int(Item &item)> Producer;
+
+    /*
+     * Process the given item. Returns 0 on success.
+     */
+    typedef std::function<int(Item &item, uint64_t index)> Handler;
+
+    /*
+     * Cost of the given item, checked after every stage.
+     */
+    typedef std::function<size_t(const Item &item)> Cost;
+
+private:
+    struct Slot {
+        uint64_t index;
+        size_t   cost;
+        Item     item;
+    };
+
+    struct Stage {
+        const char *name;
+        int         workers;
+        Handler     handler;
+    };
+
+    std::vector<Stage> stages;
+    size_t             budget;
+    Cost               cost_of;
+
+    std::mutex              budget_lock;
+    std::condition_variable budget_freed;
+    size_t                  in_flight;
+
+    std::atomic<bool> failed;
+
+    void acquire(size_t cost) {
+        std::unique_lock<std::mutex> guard(budget_lock);
+        budget_freed.wait(guard, [&]() {
+            return failed || !in_flight || in_flight + cost <= budget;
+        });
+        in_flight += cost;
+    }
+
+    void release(size_t cost) {
+        std::lock_guard<std::mutex> guard(budget_lock);
+        in_flight -= cost;
+        budget_freed.notify_all();
+    }
+
+    /*
+     * Items may grow while being processed. That is accounted for without
+     * blocking, so the producer just waits longer.
+     */
+    void update_cost(Slot &slot) {
+        size_t cost = cost_of(slot.item);
+        if (cost == slot.cost) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(budget_lock);
+        in_flight = in_flight + cost - slot.cost;
+        slot.cost = cost;
+        budget_freed.notify_all();
+    }
+
+    void fail(std::vector<std::unique_ptr<BoundedQueue<Slot>>> &queues) {
+        {
+            std::lock_guard<std::mutex> guard(budget_lock);
+            failed = true;
+            budget_freed.notify_all();
+        }
+        for (auto &queue : queues) {
+            queue->close();
+        }
+    }
+
+public:
+    Pipeline(size_t budget, Cost cost_of = [](const Item &) { return 1; })
+        : budget(budget ? budget : 1), cost_of(cost_of), in_flight(0), failed(false) {
+    }
+
+    /*
+     * Append a stage served by the given number of threads.
+     */
+    void add_stage(const char *name, int workers, Handler handler) {
+        stages.push_back({name, workers > 0 ? workers : 1, handler});
+    }
+
+    /*
+     * Produce all the items, push them through the stages and consume them in
+     * order on the calling thread. Stops at the first error.
+     * Returns 0 on success.
+     */
+    int run(Producer producer, Handler consumer) {
+        std::vector<std::unique_ptr<BoundedQueue<Slot>>> queues;
+        std::vector<std::thread>                         threads;
+        std::vector<std::atomic<int>>                    active(stages.size());
+
+        for (size_t i = 0; i <= stages.size(); i++) {
+            queues.emplace_back(new BoundedQueue<Slot>(budget));
+        }
+
+        threads.emplace_back([&]() {
+            for (uint64_t index = 0; !failed; index++) {
+                Slot slot{index, 0, Item()};
+                int  r = producer(slot.item);
+                if (r < 0) {
+                    fail(queues);
+                    break;
+                } else if (r == 0) {
+                    break;
+                }
+
+                slot.cost = cost_of(slot.item);
+                acquire(slot.cost);
+                if (!queues[0]->push(std::move(slot))) {
+                    break;
+                }
+            }
+            queues[0]->close();
+        });
+
+        for (size_t s = 0; s < stages.size(); s++) {
+            active[s] = stages[s].workers;
+            for (int w = 0; w < stages[s].workers; w++) {
+                threads.emplace_back([&, s]() {
+                    Slot slot;
+                    while (queues[s]->pop(slot)) {
+                        if (failed) {
+                            continue;
+                        }
+                        TRACE_SCOPE(stages[s].name, slot.index);
+                        if (stages[s].handler(slot.item, slot.index)) {
+                            fail(queues);
+                            continue;
+                        }
+                        update_cost(slot);
+                        if (!queues[s + 1]->push(std::move(slot))) {
+                            fail(queues);
+                        }
+                    }
+                    if (--active[s] == 0) {
+                        queues[s + 1]->close();
+                    }
+                });
+            }
+        }
+
+        std::map<uint64_t, Slot> pending;
+        uint64_t                 next = 0;
+        Slot                     slot;
+
+        while (queues.back()->pop(slot)) {
+            pending.emplace(slot.index, std::move(slot));
+            for (auto it = pending.find(next); it != pending.end() && !failed;
+                 it = pending.find(next)) {
+                if (consumer(it->second.item, it->first)) {
+                    fail(queues);
+                    break;
+                }
+                release(it->second.cost);
+                pending.erase(it);
+                next++;
+            }
+        }
+
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        return failed ? -1 : 0;
+    }
+};
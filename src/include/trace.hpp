@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Collects begin/end events in the Chrome trace-event format, which can be
+ * opened in chrome://tracing or ui.perfetto.dev.
+ *
+ * Every thread records into its own ring buffer, which only that thread writes
+ * to, so recording an event never takes a lock. Once a ring is full, the
+ * oldest events are overwritten.
+ */
+class Tracer {
+public:
+    struct Event {
+        const char *name;
+        char        phase;
+        uint64_t    timestamp;
+        int64_t     index;
+        std::string path;
+    };
+
+    struct Ring {
+        std::vector<Event>    events;
+        std::atomic<uint64_t> head;
+        long                  tid;
+    };
+
+private:
+    std::atomic<bool>                  enabled;
+    size_t                             ring_capacity;
+    std::mutex                         rings_lock;
+    std::vector<std::shared_ptr<Ring>> rings;
+
+    Tracer();
+
+    Ring *thread_ring();
+
+public:
+    static std::shared_ptr<Tracer> get();
+
+    /*
+     * Start recording events. Does nothing if already enabled.
+     */
+    void enable();
+    bool is_enabled();
+
+    /*
+     * Number of events kept per thread. Affects only rings of threads that have
+     * not recorded anything yet.
+     */
+    void set_ring_capacity(size_t capacity);
+
+    /*
+     * Record an event of the calling thread. index is -1 and path is empty if
+     * not applicable.
+     */
+    void record(const char *name, char phase, int64_t index, std::string_view path);
+
+    /*
+     * Write all the recorded events to the given file as JSON. End events
+     * whose begin event was overwritten in a full ring are left out.
+     * Must not race with threads that are still recording.
+     * Returns 0 on success.
+     */
+    int write_to_file(const std::string &file);
+};
+
+/*
+ * Records a begin event on construction and the matching end event on
+ * destruction. Does nothing if the tracer is disabled: the path is only copied
+ * when it is recorded.
+ */
+class TraceScope {
+private:
+    const char *name;
+    bool        active;
+
+public:
+    TraceScope(const char *name, int64_t index = -1, std::string_view path = {});
+    ~TraceScope();
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
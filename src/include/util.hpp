@@ -2,11 +2,18 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <span>
 #include <string>
 #include <vector>
 
 std::string shorten_size(size_t bytes);
 
+/*
+ * Parse a non-negative number with an optional K, M, G or T suffix (powers of
+ * 1024). Returns 0 on success.
+ */
+int parse_size(const char *str, size_t &value);
+
 int open_and_read_entire_file(const char *filename, std::vector<std::byte> &buffer);
 int read_entire_file(const char *filename, FILE *fd, std::vector<std::byte> &buffer);
 
@@ -18,10 +25,57 @@ int write_entire_file(const char *filename, FILE *fd,
 void handle_unknown_option(int optind, char optopt, char **argv);
 
 void store_uint64_t(uint64_t value, std::vector<std::byte> &data);
+
+/*
+ * Append the string followed by a NULL byte.
+ */
+void store_string(const std::string &value, std::vector<std::byte> &data);
 int  restore_uint64_t(std::vector<std::byte>::iterator       &it,
                       const std::vector<std::byte>::iterator &end_it,
                       uint64_t                               &value);
 
+/*
+ * LEB128: 7 bits per byte, least significant first, the high bit set on all
+ * bytes but the last. Takes 1 byte for values below 128, at most 10 bytes.
+ */
+void store_varint(uint64_t value, std::vector<std::byte> &data);
+
+/*
+ * Decode a varint at data[offset] and advance offset past it.
+ * Returns 0 on success, -1 if the varint is truncated or too long.
+ */
+int restore_varint(std::span<const std::byte> data, size_t &offset, uint64_t &value);
+
+/*
+ * Append, or decode at data[offset] and advance offset past, 4 bytes, least
+ * significant first. restore_uint32_t returns 0 on success, -1 if truncated.
+ */
+void store_uint32_t(uint32_t value, std::vector<std::byte> &data);
+int  restore_uint32_t(std::span<const std::byte> data, size_t &offset, uint32_t &value);
+
+/*
+ * Read or write exactly size bytes at the given offset of the file, with pread
+ * and pwrite, so from any thread. Returns 0 on success, -1 with errno set
+ * otherwise (EIO for a file that ends before, or a write that makes no progress).
+ */
+int read_at(int fd, void *data, size_t size, uint64_t offset);
+int write_at(int fd, const void *data, size_t size, uint64_t offset);
+
+/*
+ * A range of bytes of a file.
+ */
+struct FileExtent {
+    uint64_t offset;
+    uint64_t length;
+};
+
+/*
+ * Find the ranges of the open file of the given size that hold data, in order,
+ * skipping its holes with SEEK_DATA and SEEK_HOLE. The whole file is data on
+ * file systems without holes. Returns 0 on success.
+ */
+int find_data_extents(int fd, uint64_t size, std::vector<FileExtent> &extents);
+
 /*
  * mkdirs A, A/B, A/B/C for path=A/B/C
  * */
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+/*
+ * Every thread keeps a deflate and an inflate stream of its own, reset between
+ * payloads instead of set up for each of them: a deflate stream allocates about
+ * 256K, which costs more than compressing a small diff. The streams are only
+ * touched by their thread, so the compressors using them can be called from
+ * any number of threads at once.
+ *
+ * Built with PATCHIT_LIBDEFLATE, the payloads without a dictionary go through
+ * libdeflate instead, a lot faster on whole buffers, with SIMD Adler-32. The
+ * format is the same, so either build reads what the other wrote.
+ */
+
+/*
+ * Compress data in the zlib format, with the given level and strategy and the
+ * preset dictionary if one is given, appending the result to out. Without a
+ * dictionary and libdeflate, the output is that of zlib's compress2(). Returns
+ * 0 on success, and leaves out as it was on failure.
+ */
+int zlib_deflate(std::span<const std::byte> data, std::vector<std::byte> &out,
+                 int level, int strategy, std::span<const std::byte> dictionary = {});
+
+/*
+ * Decompress the zlib stream in data into out, which has room for capacity
+ * bytes, and set size to the number of bytes written. A stream compressed with
+ * a preset dictionary needs the same dictionary. Returns 0 on success.
+ */
+int zlib_inflate(std::span<const std::byte> data, std::byte *out, size_t capacity,
+                 size_t &size, std::span<const std::byte> dictionary = {});
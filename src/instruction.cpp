@@ -1,5 +1,19 @@
 #include <patch.hpp>
 
+size_t Instruction::data_size() {
+    return 0;
+}
+
+bool Instruction::modifies_in_place() {
+    return false;
+}
+
 void Instruction::set_compressor(std::shared_ptr<Compressor> compressor) {
     this->compressor = compressor;
 }
+
+std::vector<std::byte> Instruction::binary_representation() {
+    std::vector<std::byte> res;
+    write_binary_representation(res);
+    return res;
+}
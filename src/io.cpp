@@ -0,0 +1,99 @@
+#include <errno.h>
+#include <unistd.h>
+
+#include <config.hpp>
+#include <cstdio>
+#include <cstring>
+#include <error.hpp>
+#include <io.hpp>
+#include <util.hpp>
+
+std::shared_ptr<FileIO> FileIO::get() {
+    if (Config::get()->io_backend == "uring") {
+        std::shared_ptr<UringIO> uring = UringIO::get();
+        if (uring) {
+            return uring;
+        }
+    }
+    return PosixIO::get();
+}
+
+PosixIO::PosixIO() {
+}
+
+std::shared_ptr<PosixIO> PosixIO::get() {
+    static std::shared_ptr<PosixIO> instance(new PosixIO());
+    return instance;
+}
+
+const char *PosixIO::name() {
+    return "posix";
+}
+
+int PosixIO::stat_files(std::vector<StatRequest> &batch) {
+    int res = 0;
+    for (auto &request : batch) {
+        request.error = stat(request.path.c_str(), &request.sb) ? errno : 0;
+        if (request.error) {
+            res = -1;
+        }
+    }
+    return res;
+}
+
+int PosixIO::read_files(std::vector<ReadRequest> &batch) {
+    int res = 0;
+    for (auto &request : batch) {
+        const char *path = request.path.c_str();
+        FILE       *fd = NULL;
+
+        request.error = 0;
+        if (!(fd = std::fopen(path, "r"))) {
+            request.error = errno;
+            ERROR("Failed to open %s: %s\n", path, strerror(errno));
+        } else {
+            if (read_entire_file(path, fd, request.data)) {
+                request.error = errno ? errno : EIO;
+            }
+            std::fclose(fd);
+        }
+
+        if (request.error) {
+            res = -1;
+        }
+    }
+    return res;
+}
+
+int PosixIO::write_files(std::vector<WriteRequest> &batch) {
+    int res = 0;
+    for (auto &request : batch) {
+        const char *path = request.path.c_str();
+        FILE       *fd = NULL;
+
+        request.error = 0;
+        if (!(fd = std::fopen(path, "w"))) {
+            request.error = errno;
+            ERROR("Failed to open %s: %s\n", path, strerror(errno));
+            res = -1;
+            continue;
+        }
+
+        if (write_entire_file(path, fd, *request.data)) {
+            request.error = errno ? errno : EIO;
+        } else if (request.sync && (std::fflush(fd) || fsync(fileno(fd)))) {
+            request.error = errno;
+            ERROR("Failed to sync %s: %s\n", path, strerror(errno));
+        }
+
+        if (std::fclose(fd) && !request.error) {
+            request.error = errno;
+            ERROR("Failed to write %s: %s\n", path, strerror(errno));
+        }
+
+        if (request.error) {
+            res = -1;
+        }
+    }
+    return res;
+}
@@ -5,20 +5,28 @@
 #include <cstdio>
 #include <cstring>
 #include <error.hpp>
+#include <io.hpp>
+#include <trace.hpp>
 #include <utility>
 
+enum LongOption {
+    OPTION_IO = 256,
+};
+
 static struct option const long_opts[] = {
     {"help", 0, nullptr, 'h'},    {"version", 0, nullptr, 'v'},
     {"verbose", 0, nullptr, 'V'}, {"info", 0, nullptr, 'I'},
-    {"debug", 0, nullptr, 'D'},   {nullptr, 0, nullptr, 0},
+    {"debug", 0, nullptr, 'D'},   {"trace", 1, nullptr, 'T'},
+    {"io", 1, nullptr, OPTION_IO}, {nullptr, 0, nullptr, 0},
 };
 
-static const char *const short_opts = "-hvVID";
+static const char *const short_opts = "-hvVIDT:";
 
 static const std::pair<const char *, CommandHandler> command_list[] = {
     {"create", do_command_create},
     {"apply", do_command_apply},
-    {"inspect", do_command_inspect}};
+    {"inspect", do_command_inspect},
+    {"verify", do_command_verify}};
 
 static void print_help() {
     // clang-format off
@@ -31,11 +39,16 @@ static void print_help() {
         "  -V, --verbose            increase verbosity level (1 per V)\n"
 		"  -I, --info               set verbosity level to info\n"
         "  -D, --debug              set verbosity level to debug (max)\n"
+        "  -T, --trace FILE         write trace events of the command to FILE\n"
+        "                               (chrome://tracing, ui.perfetto.dev)\n"
+        "      --io BACKEND         file I/O backend: posix (default) or uring\n"
+        "                               (batched io_uring, falls back to posix)\n"
         "\n"
         "Supported commands:\n"
         "  create                   create a new patch\n"
         "  apply                    apply the given patch\n"
 		"  inspect                  inspect contents of a patch\n"
+		"  verify                   check the checksums of a patch\n"
 	);
     // clang-format on
 }
@@ -54,7 +67,7 @@ static void print_version() {
 }
 
 int main(int argc, char **argv) {
-    char        short_option;
+    int         short_option;
     const char *command;
 
     opterr = 0;
@@ -79,6 +92,20 @@ int main(int argc, char **argv) {
         case 'D':
             Config::get()->verbosity = 3;
             break;
+        case 'T':
+            Config::get()->trace_file = optarg;
+            Tracer::get()->enable();
+            INFO("Tracing to %s\n", optarg);
+            break;
+        case OPTION_IO:
+            if (strcmp(optarg, "posix") && strcmp(optarg, "uring")) {
+                CRIT("Unknown I/O backend: %s\n", optarg);
+            }
+            Config::get()->io_backend = optarg;
+            if (Config::get()->io_backend == "uring" && !UringIO::get()) {
+                WARN("io_uring is not available. Falling back to posix I/O.\n");
+            }
+            break;
         case '?':
             if (optopt) {
                 CRIT("Unrecognized option: -%c\n", optopt);
@@ -96,7 +123,15 @@ int main(int argc, char **argv) {
             for (auto &[name, func] : command_list) {
                 if (!strcmp(command, name)) {
                     argv[0] = strdup(command);  // leaks memory but its ok
-                    return func(argc - optind + 1, argv + optind - 1);
+                    int r = func(argc - optind + 1, argv + optind - 1);
+
+                    const std::string &trace_file = Config::get()->trace_file;
+                    if (!trace_file.empty() &&
+                        Tracer::get()->write_to_file(trace_file)) {
+                        ERROR("Failed to write the trace to %s\n",
+                              trace_file.c_str());
+                    }
+                    return r;
                 }
             }
 
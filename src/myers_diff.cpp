@@ -0,0 +1,538 @@
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <compressor.hpp>
+#include <cstdint>
+#include <cstring>
+#include <diff.hpp>
+#include <config.hpp>
+#include <error.hpp>
+#include <in_place_patch.hpp>
+#include <patch_context.hpp>
+#include <trace.hpp>
+#include <util.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYERS_X86 1
+#endif
+
+/*
+ * Number of equal bytes at the start of a and b, of which n are compared, and
+ * at the end of the n bytes before a_end and b_end. The snakes of the diff
+ * are followed with these, many bytes at a time.
+ */
+using CommonRun = size_t (*)(const uint8_t *, const uint8_t *, size_t);
+
+static size_t common_prefix_scalar(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+        for (; i + 8 <= n; i += 8) {
+            uint64_t x, y;
+            memcpy(&x, a + i, 8);
+            memcpy(&y, b + i, 8);
+            if (x != y) {
+                return i + std::countr_zero(x ^ y) / 8;
+            }
+        }
+    }
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+static size_t common_suffix_scalar(const uint8_t *a_end, const uint8_t *b_end,
+                                   size_t n) {
+    size_t i = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+        for (; i + 8 <= n; i += 8) {
+            uint64_t x, y;
+            memcpy(&x, a_end - i - 8, 8);
+            memcpy(&y, b_end - i - 8, 8);
+            if (x != y) {
+                return i + std::countl_zero(x ^ y) / 8;
+            }
+        }
+    }
+    while (i < n && a_end[-1 - (ptrdiff_t)i] == b_end[-1 - (ptrdiff_t)i]) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef MYERS_X86
+static size_t common_prefix_sse2(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i  x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i  y = _mm_loadu_si128((const __m128i *)(b + i));
+        uint32_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (equal != 0xffff) {
+            return i + std::countr_one(equal);
+        }
+    }
+    return i + common_prefix_scalar(a + i, b + i, n - i);
+}
+
+static size_t common_suffix_sse2(const uint8_t *a_end, const uint8_t *b_end,
+                                 size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i  x = _mm_loadu_si128((const __m128i *)(a_end - i - 16));
+        __m128i  y = _mm_loadu_si128((const __m128i *)(b_end - i - 16));
+        uint16_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (equal != 0xffff) {
+            return i + std::countl_one(equal);
+        }
+    }
+    return i + common_suffix_scalar(a_end - i, b_end - i, n - i);
+}
+
+/* 64 bytes, two vectors, are compared before branching. */
+__attribute__((target("avx2"))) static size_t
+common_prefix_avx2(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i low = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                        _mm256_loadu_si256((const __m256i *)(b + i)));
+        __m256i high =
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i + 32)),
+                              _mm256_loadu_si256((const __m256i *)(b + i + 32)));
+        uint64_t equal = (uint32_t)_mm256_movemask_epi8(low) |
+                         (uint64_t)(uint32_t)_mm256_movemask_epi8(high) << 32;
+        if (~equal) {
+            return i + std::countr_one(equal);
+        }
+    }
+    return i + common_prefix_sse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+common_suffix_avx2(const uint8_t *a_end, const uint8_t *b_end, size_t n) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i low = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(a_end - i - 64)),
+            _mm256_loadu_si256((const __m256i *)(b_end - i - 64)));
+        __m256i high = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(a_end - i - 32)),
+            _mm256_loadu_si256((const __m256i *)(b_end - i - 32)));
+        uint64_t equal = (uint32_t)_mm256_movemask_epi8(low) |
+                         (uint64_t)(uint32_t)_mm256_movemask_epi8(high) << 32;
+        if (~equal) {
+            return i + std::countl_one(equal);
+        }
+    }
+    return i + common_suffix_sse2(a_end - i, b_end - i, n - i);
+}
+#endif
+
+/*
+ * Finds the matching runs of two byte strings, as in GNU diff: the ranges to
+ * compare are split at the middle snake of their shortest edit script, found by
+ * searching forward from their start and backward from their end at once.
+ */
+class MyersDiffer {
+private:
+    struct Range {
+        int64_t xoff, xlim, yoff, ylim;
+    };
+
+    const uint8_t *a, *b;
+    CommonRun      prefix, suffix;
+
+    /*
+     * Furthest point reached on every diagonal (x - y) forward and backward,
+     * around the diagonal of the start and the end of the range.
+     */
+    int64_t              max_cost;
+    std::vector<int64_t> fd, bd;
+
+    /* Steps left before the remaining ranges are just replaced. */
+    int64_t budget;
+
+    int split(const Range &r, int64_t &xmid, int64_t &ymid);
+
+public:
+    struct Match {
+        int64_t x, y, length;
+    };
+    std::vector<Match> matches;
+
+    MyersDiffer(const uint8_t *a, const uint8_t *b, int64_t max_cost, int64_t budget)
+        : a(a), b(b), max_cost(max_cost), budget(budget) {
+        prefix = common_prefix_scalar;
+        suffix = common_suffix_scalar;
+#ifdef MYERS_X86
+        bool avx2 = __builtin_cpu_supports("avx2");
+        prefix = avx2 ? common_prefix_avx2 : common_prefix_sse2;
+        suffix = avx2 ? common_suffix_avx2 : common_suffix_sse2;
+#endif
+        fd.resize(2 * max_cost + 5);
+        bd.resize(2 * max_cost + 5);
+    }
+
+    void run(int64_t n, int64_t m);
+};
+
+/*
+ * Find where to split the given range, which starts and ends with a
+ * difference. Returns -1 if the budget ran out.
+ */
+int MyersDiffer::split(const Range &r, int64_t &xmid, int64_t &ymid) {
+    const int64_t dmin = r.xoff - r.ylim, dmax = r.xlim - r.yoff;
+    const int64_t fmid = r.xoff - r.yoff, bmid = r.xlim - r.ylim;
+    const bool    odd = (fmid - bmid) & 1;
+    const int64_t center = max_cost + 2;
+    int64_t       fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+
+    auto F = [&](int64_t d) -> int64_t & { return fd[d - fmid + center]; };
+    auto B = [&](int64_t d) -> int64_t & { return bd[d - bmid + center]; };
+
+    F(fmid) = r.xoff;
+    B(bmid) = r.xlim;
+
+    for (int64_t c = 1;; c++) {
+        if (fmin > dmin) {
+            F(--fmin - 1) = -1;
+        } else {
+            ++fmin;
+        }
+        if (fmax < dmax) {
+            F(++fmax + 1) = -1;
+        } else {
+            --fmax;
+        }
+        for (int64_t d = fmax; d >= fmin; d -= 2) {
+            int64_t tlo = F(d - 1), thi = F(d + 1);
+            int64_t x = tlo >= thi ? tlo + 1 : thi, y = x - d;
+            x += prefix(a + x, b + y,
+                        std::max<int64_t>(0, std::min(r.xlim - x, r.ylim - y)));
+            F(d) = x;
+            if (odd && bmin <= d && d <= bmax && B(d) <= x) {
+                xmid = x;
+                ymid = x - d;
+                return 0;
+            }
+        }
+
+        if (bmin > dmin) {
+            B(--bmin - 1) = INT64_MAX;
+        } else {
+            ++bmin;
+        }
+        if (bmax < dmax) {
+            B(++bmax + 1) = INT64_MAX;
+        } else {
+            --bmax;
+        }
+        for (int64_t d = bmax; d >= bmin; d -= 2) {
+            int64_t tlo = B(d - 1), thi = B(d + 1);
+            int64_t x = tlo < thi ? tlo : thi - 1, y = x - d;
+            x -= suffix(a + x, b + y,
+                        std::max<int64_t>(0, std::min(x - r.xoff, y - r.yoff)));
+            B(d) = x;
+            if (!odd && fmin <= d && d <= fmax && x <= F(d)) {
+                xmid = x;
+                ymid = x - d;
+                return 0;
+            }
+        }
+
+        budget -= (fmax - fmin) / 2 + (bmax - bmin) / 2 + 2;
+        if (budget < 0) {
+            return -1;
+        }
+
+        if (c < max_cost) {
+            continue;
+        }
+
+        /*
+         * Too expensive: split at the point furthest from its end reached by
+         * either search.
+         */
+        int64_t fxybest = -1, fxbest = 0;
+        for (int64_t d = fmax; d >= fmin; d -= 2) {
+            int64_t x = std::min(F(d), r.xlim), y = x - d;
+            if (r.ylim < y) {
+                x = r.ylim + d;
+                y = r.ylim;
+            }
+            if (fxybest < x + y) {
+                fxybest = x + y;
+                fxbest = x;
+            }
+        }
+        int64_t bxybest = INT64_MAX, bxbest = 0;
+        for (int64_t d = bmax; d >= bmin; d -= 2) {
+            int64_t x = std::max(r.xoff, B(d)), y = x - d;
+            if (y < r.yoff) {
+                x = r.yoff + d;
+                y = r.yoff;
+            }
+            if (x + y < bxybest) {
+                bxybest = x + y;
+                bxbest = x;
+            }
+        }
+        if ((r.xlim + r.ylim) - bxybest < fxybest - (r.xoff + r.yoff)) {
+            xmid = fxbest;
+            ymid = fxybest - fxbest;
+        } else {
+            xmid = bxbest;
+            ymid = bxybest - bxbest;
+        }
+        return 0;
+    }
+}
+
+void MyersDiffer::run(int64_t n, int64_t m) {
+    std::vector<Range> ranges{{0, n, 0, m}};
+
+    while (!ranges.empty()) {
+        Range r = ranges.back();
+        ranges.pop_back();
+
+        int64_t length = prefix(a + r.xoff, b + r.yoff,
+                                std::min(r.xlim - r.xoff, r.ylim - r.yoff));
+        if (length) {
+            matches.push_back({r.xoff, r.yoff, length});
+            r.xoff += length;
+            r.yoff += length;
+        }
+        length = suffix(a + r.xlim, b + r.ylim,
+                        std::min(r.xlim - r.xoff, r.ylim - r.yoff));
+        if (length) {
+            r.xlim -= length;
+            r.ylim -= length;
+            matches.push_back({r.xlim, r.ylim, length});
+        }
+
+        int64_t xmid, ymid;
+        if (r.xoff == r.xlim || r.yoff == r.ylim || split(r, xmid, ymid)) {
+            continue;
+        }
+        /* A split that makes no progress leaves the range replaced. */
+        if ((xmid == r.xoff && ymid == r.yoff) ||
+            (xmid == r.xlim && ymid == r.ylim)) {
+            continue;
+        }
+        ranges.push_back({xmid, r.xlim, ymid, r.ylim});
+        ranges.push_back({r.xoff, xmid, r.yoff, ymid});
+    }
+
+    std::sort(matches.begin(), matches.end(),
+              [](const Match &l, const Match &r) { return l.x < r.x; });
+}
+
+MyersDiff::MyersDiff() {
+    signature = Diff::MYERS_DIFF;
+}
+
+/* Steps the search may take per byte of the files, on top of a fixed amount. */
+static const int64_t work_per_byte = 16;
+static const int64_t base_work = 1 << 22;
+
+static void store_edit(uint64_t copy, uint64_t remove, std::span<const std::byte> insert,
+                       std::vector<std::byte> &out) {
+    store_varint(copy, out);
+    store_varint(remove, out);
+    store_varint(insert.size(), out);
+    out.insert(out.end(), insert.begin(), insert.end());
+}
+
+void MyersDiff::compute(std::span<const std::byte> src, std::span<const std::byte> dest) {
+    int64_t n = src.size(), m = dest.size();
+    int64_t cost = max_cost;
+
+    /* As in GNU diff: about the square root of the sizes, at least 4096. */
+    if (!cost) {
+        cost = 1;
+        for (uint64_t diagonals = n + m + 3; diagonals; diagonals >>= 2) {
+            cost <<= 1;
+        }
+        cost = std::max<int64_t>(cost, 4096);
+    }
+
+    MyersDiffer differ((const uint8_t *)src.data(), (const uint8_t *)dest.data(), cost,
+                       base_work + work_per_byte * (n + m));
+    differ.run(n, m);
+
+    data.clear();
+    store_varint(n, data);
+
+    int64_t x = 0, y = 0, copy = 0;
+    for (auto &match : differ.matches) {
+        if (match.x != x || match.y != y) {
+            store_edit(copy, match.x - x, dest.subspan(y, match.y - y), data);
+            copy = 0;
+        }
+        copy += match.length;
+        x = match.x + match.length;
+        y = match.y + match.length;
+    }
+    if (copy || x != n || y != m) {
+        store_edit(copy, n - x, dest.subspan(y), data);
+    }
+}
+
+int MyersDiff::from_files(const std::string &src, const std::string &dest) {
+    TRACE_SCOPE("diff", -1, dest);
+    INFO("Constructing MyersDiff from files: %s and %s\n", src.c_str(), dest.c_str());
+
+    std::vector<std::byte> a, b;
+    if (open_and_read_entire_file(src.c_str(), a) ||
+        open_and_read_entire_file(dest.c_str(), b)) {
+        ERROR("Failed to create a diff from %s and %s.\n", src.c_str(), dest.c_str());
+        return -1;
+    }
+    compute(a, b);
+
+    MSG("Created a diff (%s -> %s): %s.\n", src.c_str(), dest.c_str(),
+        shorten_size(data.size()).c_str());
+    return 0;
+}
+
+int MyersDiff::patch(std::span<const std::byte> file, std::span<const std::byte> script,
+                     std::vector<std::byte> &out) {
+    size_t   offset = 0;
+    uint64_t size, position = 0;
+
+    if (restore_varint(script, offset, size)) {
+        ERROR("Corrupted diff: missing the source size.\n");
+        return -1;
+    }
+    if (size != file.size()) {
+        ERROR("The diff does not match: it is for %zu bytes, not %zu.\n", (size_t)size,
+              file.size());
+        return -1;
+    }
+
+    out.clear();
+    while (offset < script.size()) {
+        uint64_t copy, remove, insert;
+        if (restore_varint(script, offset, copy) ||
+            restore_varint(script, offset, remove) ||
+            restore_varint(script, offset, insert) || copy > size - position ||
+            remove > size - position - copy || insert > script.size() - offset) {
+            ERROR("Corrupted diff: invalid edit.\n");
+            return -1;
+        }
+        out.insert(out.end(), file.begin() + position, file.begin() + position + copy);
+        position += copy + remove;
+        out.insert(out.end(), script.begin() + offset, script.begin() + offset + insert);
+        offset += insert;
+    }
+    out.insert(out.end(), file.begin() + position, file.end());
+    return 0;
+}
+
+/*
+ * Turn the edit script into the copies and inserts of an in-place patch, which
+ * refer to the script. Stores the sizes of the file before and after.
+ */
+static int plan_in_place(std::span<const std::byte> script, InPlacePatch &patch,
+                         uint64_t &old_size, uint64_t &new_size) {
+    size_t   offset = 0;
+    uint64_t position = 0;
+
+    if (restore_varint(script, offset, old_size)) {
+        ERROR("Corrupted diff: missing the source size.\n");
+        return -1;
+    }
+
+    new_size = 0;
+    while (offset < script.size()) {
+        uint64_t copy, remove, insert;
+        if (restore_varint(script, offset, copy) ||
+            restore_varint(script, offset, remove) ||
+            restore_varint(script, offset, insert) || copy > old_size - position ||
+            remove > old_size - position - copy || insert > script.size() - offset) {
+            ERROR("Corrupted diff: invalid edit.\n");
+            return -1;
+        }
+        patch.copy(position, new_size, copy);
+        position += copy + remove;
+        new_size += copy;
+        patch.insert(new_size, script.subspan(offset, insert));
+        new_size += insert;
+        offset += insert;
+    }
+    patch.copy(position, new_size, old_size - position);
+    new_size += old_size - position;
+    return 0;
+}
+
+void MyersDiff::write_binary_representation(std::vector<std::byte> &out) {
+    Compressor *selected = compressor->select(data);
+    out.push_back((std::byte)selected->get_id());
+    selected->compress_into(data, out);
+}
+
+int MyersDiff::from_binary_representation(std::span<const std::byte> data,
+                                          const PatchContext        *context) {
+    if (data.empty()) {
+        ERROR("Empty data: missing compressor id\n");
+        return -1;
+    }
+
+    if (!(compressor = PatchContext::compressor_from_id((int)data[0], context))) {
+        return -1;
+    }
+
+    this->data.clear();
+    return compressor->decompress_into(data.subspan(1), this->data);
+}
+
+size_t MyersDiff::data_size() {
+    return data.size();
+}
+
+int MyersDiff::apply(const std::string &dest) {
+    TRACE_SCOPE("patch", -1, dest);
+    INFO("Applying MyersDiff to %s\n", dest.c_str());
+
+    if (writes_in_place()) {
+        InPlacePatch patch;
+        uint64_t     old_size, new_size;
+        patch.max_held = Config::get()->memory_budget;
+        if (plan_in_place(data, patch, old_size, new_size) ||
+            patch.apply(dest, old_size, new_size)) {
+            ERROR("Failed to apply the diff to %s\n", dest.c_str());
+            return -1;
+        }
+
+        MSG("Applied diff to %s in place: wrote %s.\n", dest.c_str(),
+            shorten_size(patch.written).c_str());
+        return 0;
+    }
+
+    std::vector<std::byte> file, patched;
+    if (open_and_read_entire_file(dest.c_str(), file) || patch(file, data, patched) ||
+        open_and_write_entire_file(dest.c_str(), patched)) {
+        ERROR("Failed to apply the diff to %s\n", dest.c_str());
+        return -1;
+    }
+
+    MSG("Applied diff to %s\n", dest.c_str());
+    return 0;
+}
+
+/*
+ * Applying in place writes only the changed ranges, which beats rewriting the
+ * file in a batch.
+ */
+Diff::ContentsUse MyersDiff::contents_use() {
+    return writes_in_place() ? CONTENTS_UNSUPPORTED : CONTENTS_READ;
+}
+
+int MyersDiff::patch_contents(std::span<const std::byte> file,
+                              std::vector<std::byte>    &out) {
+    return patch(file, data, out) ? -1 : 0;
+}
+
+bool MyersDiff::writes_in_place() {
+    return Config::get()->in_place;
+}
@@ -1,22 +1,31 @@
+#include <algorithm>
+#include <atomic>
+#include <buffer_pool.hpp>
+#include <config.hpp>
 #include <cstring>
 #include <error.hpp>
+#include <filesystem>
+#include <io.hpp>
 #include <patch.hpp>
+#include <pipeline.hpp>
+#include <trace.hpp>
 #include <util.hpp>
 
-static const char *const SIGNATURE = "__PATCHIT__";
-
 std::shared_ptr<Instruction> Instruction::from_signature(uint8_t signature) {
     std::shared_ptr<Instruction> res;
     switch (signature) {
     case Instruction::ENTITY_MOVE:
-        res.reset(new EntityMoveInstruction());
+        res = std::allocate_shared<EntityMoveInstruction>(
+            std::pmr::polymorphic_allocator<EntityMoveInstruction>(object_pool()));
         break;
     case Instruction::ENTITY_DELETE:
-        res.reset(new EntityDeleteInstruction());
+        res = std::allocate_shared<EntityDeleteInstruction>(
+            std::pmr::polymorphic_allocator<EntityDeleteInstruction>(object_pool()));
         break;
     case Instruction::ENTITY_MODIFY:
         INFO("Instruction signature recognized: ENTITY_MODIFY\n");
-        res.reset(new EntityModifyInstruction());
+        res = std::allocate_shared<EntityModifyInstruction>(
+            std::pmr::polymorphic_allocator<EntityModifyInstruction>(object_pool()));
         break;
     }
 
@@ -28,8 +37,9 @@ std::shared_ptr<Instruction> Instruction::from_signature(uint8_t signature) {
 
 int Patch::apply() {
     INFO("Applying patch...\n");
-    for (auto i : instructions) {
-        if (i->apply()) {
+    for (size_t index = 0; index < instructions.size(); index++) {
+        TRACE_SCOPE("instruction", index);
+        if (instructions[index]->apply()) {
             ERROR("Failed to apply patch.\n");
             return -1;
         }
@@ -43,7 +53,7 @@ void Patch::append(std::shared_ptr<Instruction> instruction) {
 }
 
 /*
- * Binary representation:
+ * Binary representation, compatibility version 0:
  *
  * SIGNATURE(with NULL byte)
  * compatibility_version (uint64, least to most significant)
@@ -55,131 +65,519 @@ void Patch::append(std::shared_ptr<Instruction> instruction) {
  * I2_signature (1byte)
  * I2
  * ...
+ *
+ * Compatibility version 1:
+ *
+ * SIGNATURE(with NULL byte)
+ * compatibility_version (uint64, least to most significant)
+ * flags (varint, optional features, see Patch::PatchFlags)
+ * if flags & PATCH_DICTIONARY:
+ *   dictionary_size (varint)
+ *   dictionary (preset for ZLibDictionaryCompressor)
+ * len_I1 (varint)
+ * I1_signature (1byte)
+ * I1 (paths stored as ids into the path table)
+ * ...
+ * footer:
+ *   number_of_instructions (varint)
+ *   path table (see PathTable)
+ *   index, for every instruction:
+ *     size (varint, of len, signature and the instruction)
+ *     number_of_paths (varint)
+ *     path positions (varint each, in the sorted path table)
+ *   if flags & PATCH_SOLID:
+ *     number_of_blocks (varint)
+ *     for every block:
+ *       size (varint, compressed)
+ *       number_of_instructions (varint)
+ *   if flags & PATCH_CHECKSUMS (uint32_t each, least to most significant):
+ *     header_checksum (of everything before len_I1)
+ *     for every instruction, or every block if solid:
+ *       checksum (of len, signature and instruction, or of the compressed block)
+ *     footer_checksum (of the footer before it)
+ * footer_offset (uint64_t, least to most significant)
+ *
+ * In a solid patch, the instructions (len, signature and instruction, as
+ * above) are grouped into blocks, which are stored compressed one after the
+ * other:
+ *
+ * B1_compressor_id (1byte)
+ * B1 (compressed instructions)
+ * ...
+ *
+ * The sizes in the index are then those of the decompressed instructions, so
+ * an instruction is found by its block and its offset in it.
+ *
+ * The footer is written last, as only then are all the instructions and paths
+ * known. It lets readers find the instructions touching a path without
+ * reading any of them.
+ *
+ * The checksums are CRC-32C (see crc32c.hpp), so that verify reads the
+ * patch at the speed of the disk.
  */
 
-int Patch::write_to_file(const std::string &file) {
-    INFO("Writing patch to file: %s\n", file.c_str());
-    std::vector<std::byte> data;
+int Patch::write_to_file(const std::string &file, uint64_t version) {
+    TRACE_SCOPE("write patch", -1, file);
+    PatchWriter writer;
 
-    for (char *ptr = (char *)SIGNATURE; *ptr != 0; ptr++) {
-        data.push_back((std::byte)*ptr);
+    if (writer.open(file, version)) {
+        return -1;
     }
 
-    data.push_back(std::byte{0});
-
-    store_uint64_t(Patch::compatibility_version, data);
-
-    store_uint64_t(instructions.size(), data);
-
     for (auto i : instructions) {
-        const std::vector<std::byte> repr = i->binary_representation();
-        store_uint64_t(repr.size(), data);
-        data.push_back((std::byte)i->signature);
-        for (std::byte b : repr) {
-            data.push_back(b);
+        if (writer.append(i)) {
+            writer.abort();
+            return -1;
         }
     }
 
-    return open_and_write_entire_file(file.c_str(), data);
+    return writer.finish();
+}
+
+/*
+ * Reconstruct an instruction from its serialized form.
+ */
+static std::shared_ptr<Instruction> decode_instruction(const std::string &file,
+                                                       uint8_t          signature,
+                                                       std::span<const std::byte> repr,
+                                                       const PatchContext *context) {
+    std::shared_ptr<Instruction> instruction = Instruction::from_signature(signature);
+
+    if (!instruction) {
+        ERROR("Failed to load patch %s: invalid instruction signature.\n",
+              file.c_str());
+        return nullptr;
+    }
+
+    if (instruction->from_binary_representation(repr, context)) {
+        ERROR("Failed to load patch %s: corrupted instruction.\n", file.c_str());
+        return nullptr;
+    }
+    return instruction;
 }
 
 int Patch::load_from_file(const std::string &file) {
-    INFO("Loading patch from file: %s\n", file.c_str());
-    std::vector<std::byte> data;
+    TRACE_SCOPE("load patch", -1, file);
+    PatchReader            reader;
+    std::vector<std::byte> repr;
+    uint8_t                signature;
+    int                    r;
 
-    if (open_and_read_entire_file(file.c_str(), data)) {
+    instructions.clear();
+    if (reader.open(file)) {
         ERROR("Failed to load patch %s\n", file.c_str());
         return -1;
     }
-    std::vector<std::byte>::iterator it = data.begin();
 
-    if (data.size() < sizeof(SIGNATURE) ||
-        memcmp(data.data(), SIGNATURE, strlen(SIGNATURE))) {
-        ERROR("Failed to load patch %s: invalid signature.\n", file.c_str());
-        return -1;
+    version = reader.version;
+    while ((r = reader.next(signature, repr)) == 1) {
+        std::shared_ptr<Instruction> instruction =
+            decode_instruction(file, signature, repr, reader.patch_context());
+        if (!instruction) {
+            return -1;
+        }
+        append(instruction);
     }
-    it += strlen(SIGNATURE);
 
-    if (it >= data.end() || *it != std::byte{0}) {
-        ERROR("Failed to load patch %s: invalid signature separator.\n",
-              file.c_str());
+    if (r) {
         return -1;
     }
-    it++;
+    INFO("Loaded %zu instructions successfully.\n", instructions.size());
+    return 0;
+}
 
-    uint64_t compatibility_version;
-    if (restore_uint64_t(it, data.end(), compatibility_version)) {
-        ERROR("Failed to load patch %s: invalid compatibility version.\n",
-              file.c_str());
-        return -1;
+/*
+ * An instruction on its way from the patch file to being applied.
+ */
+struct ApplyJob {
+    uint8_t                      signature;
+    std::vector<std::byte>       repr;
+    std::shared_ptr<Instruction> instruction;
+    bool                         selected;
+
+    /* Index of the instruction in the patch. */
+    uint64_t number;
+};
+
+/*
+ * Bounds of a batch of modifications: files, and bytes of diffs and contents.
+ */
+static const size_t batch_files = 64;
+static const size_t batch_bytes = 16 << 20;
+
+int Patch::apply_batch(std::vector<BatchedModify> &batch, Checkpoint *checkpoint) {
+    TRACE_SCOPE("modify batch", batch.size());
+    std::shared_ptr<FileIO>          io = FileIO::get();
+    std::vector<FileIO::StatRequest> stats(batch.size());
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        stats[i].path = batch[i].instruction->target;
     }
+    io->stat_files(stats);
+
+    /* Targets left to apply, and where the others are read. */
+    std::vector<bool>                single(batch.size(), true);
+    std::vector<size_t>              read_of(batch.size(), SIZE_MAX);
+    std::vector<FileIO::ReadRequest> reads;
+    size_t                           bytes = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+        const struct stat &sb = stats[i].sb;
+        Diff::ContentsUse  use = batch[i].instruction->diff->contents_use();
+        if (stats[i].error || !S_ISREG(sb.st_mode) ||
+            (sb.st_mode & (S_IRUSR | S_IWUSR)) != (S_IRUSR | S_IWUSR) ||
+            use == Diff::CONTENTS_UNSUPPORTED) {
+            continue;
+        }
 
-    if (compatibility_version != Patch::compatibility_version) {
-        ERROR(
-            "Failed to load patch %s: compatibility version differs: found %zu, "
-            "must be %zu\n",
-            file.c_str(), (size_t)compatibility_version,
-            (size_t)Patch::compatibility_version);
+        /*
+         * A file reached again through another path (a link) is applied after
+         * the earlier modifications are written, so it is not patched from a
+         * stale pre-image.
+         */
+        bool same_file = false;
+        for (size_t k = 0; k < i && !same_file; k++) {
+            same_file = !stats[k].error && stats[k].sb.st_dev == sb.st_dev &&
+                        stats[k].sb.st_ino == sb.st_ino;
+        }
+        if (same_file) {
+            continue;
+        }
+
+        size_t size = use == Diff::CONTENTS_READ ? sb.st_size : 0;
+        if (bytes + size > batch_bytes) {
+            continue;
+        }
+        bytes += size;
+        single[i] = false;
+        if (use == Diff::CONTENTS_READ) {
+            read_of[i] = reads.size();
+            reads.push_back({stats[i].path, {}, 0});
+        }
+    }
+    if (!reads.empty()) {
+        io->read_files(reads);
     }
 
-    uint64_t count;
-    if (restore_uint64_t(it, data.end(), count)) {
-        ERROR("Failed to load patch %s: invalid number of instructions.\n",
-              file.c_str());
-        return -1;
+    std::vector<std::vector<std::byte>> contents(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (single[i]) {
+            continue;
+        }
+        TRACE_SCOPE("instruction", batch[i].number);
+        TRACE_SCOPE("modify", -1, stats[i].path);
+        std::span<const std::byte> file;
+        if (read_of[i] != SIZE_MAX) {
+            FileIO::ReadRequest &read = reads[read_of[i]];
+            if (read.error) {
+                single[i] = true;
+                continue;
+            }
+            file = read.data;
+        }
+        if (batch[i].instruction->diff->patch_contents(file, contents[i])) {
+            single[i] = true;
+        }
+        if (read_of[i] != SIZE_MAX) {
+            std::vector<std::byte>().swap(reads[read_of[i]].data);
+        }
     }
-    INFO("Patch contains %zu instructions.\n", count);
 
-    std::vector<std::byte> repr;
-    uint64_t               len;
+    /*
+     * The targets patched so far are written before a modification is applied
+     * on its own, so that nothing after a failure is written.
+     */
+    std::vector<FileIO::WriteRequest> writes;
+    std::vector<size_t>               written;
+    for (size_t i = 0; i <= batch.size(); i++) {
+        if (i < batch.size() && !single[i]) {
+            writes.push_back({stats[i].path, &contents[i], false, 0});
+            written.push_back(i);
+            continue;
+        }
 
-    while (count--) {
-        if (restore_uint64_t(it, data.end(), len)) {
-            ERROR("Failed to load patch %s: invalid instruction size.\n",
-                  file.c_str());
-            return -1;
+        if (!writes.empty()) {
+            io->write_files(writes);
+            for (size_t k = 0; k < writes.size(); k++) {
+                const BatchedModify &modify = batch[written[k]];
+                if (writes[k].error) {
+                    ERROR("Failed to apply modification to %s\n", writes[k].path.c_str());
+                    return -1;
+                }
+                MSG("Applied modification to %s\n", writes[k].path.c_str());
+                if (checkpoint &&
+                    checkpoint->complete(modify.number, modify.instruction->paths())) {
+                    return -1;
+                }
+            }
+            writes.clear();
+            written.clear();
+        }
+        if (i == batch.size()) {
+            break;
         }
 
-        std::shared_ptr<Instruction> instruction;
-        if (it == data.end() ||
-            !(instruction = Instruction::from_signature((uint8_t)*it))) {
-            ERROR("Failed to load patch %s: invalid instruction signature.\n",
-                  file.c_str());
+        TRACE_SCOPE("instruction", batch[i].number);
+        if (batch[i].instruction->apply() ||
+            (checkpoint &&
+             checkpoint->complete(batch[i].number, batch[i].instruction->paths()))) {
             return -1;
         }
-        it++;
+    }
+    return 0;
+}
 
-        repr.clear();
-        try {
-            repr.reserve(len);
-        } catch (...) {
-            ERROR("Failed to load patch %s: Likely out of memory.\n", file.c_str());
+int Patch::apply(PatchReader &reader, const PathFilter *filter, Checkpoint *checkpoint) {
+    std::shared_ptr<Config>    config = Config::get();
+    BufferPool                 buffers;
+    std::atomic<uint64_t>      skipped = 0;
+    std::vector<BatchedModify> batch;
+    size_t                     batch_size = 0;
+    Pipeline<ApplyJob>      pipeline(config->memory_budget, [](const ApplyJob &job) {
+        return job.repr.capacity() +
+               (job.instruction ? job.instruction->data_size() : 0);
+    });
+
+    /* Patches without an index are filtered once the instructions are decoded. */
+    if (filter && !filter->active()) {
+        filter = nullptr;
+    }
+    if (filter && reader.set_filter(filter)) {
+        filter = nullptr;
+    }
+
+    if (checkpoint && checkpoint->completed_instructions()) {
+        MSG("Resuming after %zu completed instructions.\n",
+            (size_t)checkpoint->completed_instructions());
+        if (reader.seek(checkpoint->completed_instructions())) {
+            ERROR("Failed to skip the completed instructions.\n");
             return -1;
         }
+    }
 
-        while (len--) {
-            if (it == data.end()) {
-                ERROR("Failed to load patch %s: truncated instruction.\n",
-                      file.c_str());
+    INFO("Applying patch: %d decode workers, memory budget %s\n",
+         config->decode_workers, shorten_size(config->memory_budget).c_str());
+
+    pipeline.add_stage("decode", config->decode_workers,
+                       [&](ApplyJob &job, uint64_t index) {
+                           job.instruction =
+                               decode_instruction(reader.file, job.signature,
+                                                  job.repr, reader.patch_context());
+                           buffers.release(std::move(job.repr));
+                           if (!job.instruction) {
+                               return -1;
+                           }
+                           job.selected =
+                               !filter || filter->selects(job.instruction->paths());
+                           return 0;
+                       });
+
+    auto flush = [&]() {
+        int r = batch.empty() ? 0 : apply_batch(batch, checkpoint);
+        batch.clear();
+        batch_size = 0;
+        return r;
+    };
+
+    /*
+     * Consecutive modifications whose new contents can be computed in memory are
+     * gathered, so that their targets are read and written together.
+     */
+    int r = pipeline.run(
+        [&](ApplyJob &job) {
+            job.repr = buffers.acquire();
+            int r = reader.next(job.signature, job.repr);
+            job.number = reader.index - 1;
+            return r;
+        },
+        [&](ApplyJob &job, uint64_t index) {
+            if (!job.selected) {
+                skipped++;
+                return 0;
+            }
+
+            std::shared_ptr<EntityModifyInstruction> modify;
+            if (job.instruction->signature == Instruction::ENTITY_MODIFY) {
+                modify = std::static_pointer_cast<EntityModifyInstruction>(job.instruction);
+            }
+            if (modify && modify->diff->contents_use() != Diff::CONTENTS_UNSUPPORTED) {
+                std::filesystem::path target =
+                    std::filesystem::path(modify->target).lexically_normal();
+                bool same_target =
+                    std::any_of(batch.begin(), batch.end(), [&](const BatchedModify &b) {
+                        return std::filesystem::path(b.instruction->target)
+                                   .lexically_normal() == target;
+                    });
+                if ((same_target || batch.size() == batch_files ||
+                     batch_size + modify->data_size() > batch_bytes) &&
+                    flush()) {
+                    return -1;
+                }
+                batch.push_back({job.number, modify});
+                batch_size += modify->data_size();
+                return 0;
+            }
+
+            if (flush()) {
                 return -1;
             }
-            repr.push_back(*it);
-            it++;
-        }
+            TRACE_SCOPE("instruction", job.number);
+            if (checkpoint && job.instruction->modifies_in_place() &&
+                checkpoint->start(job.number)) {
+                return -1;
+            }
+            if (job.instruction->apply()) {
+                return -1;
+            }
+            return checkpoint ? checkpoint->complete(job.number, job.instruction->paths())
+                              : 0;
+        });
+
+    /* The modifications gathered before a failure are applied all the same. */
+    if (flush() && !r) {
+        r = -1;
+    }
+
+    if (checkpoint && !r) {
+        r = checkpoint->remove();
+    } else if (checkpoint && checkpoint->pending_instructions()) {
+        /* Resuming starts at the instruction that failed. */
+        checkpoint->save();
+    }
+
+    if (r) {
+        ERROR("Failed to apply patch.\n");
+    } else if (reader.skipped_instructions() || skipped) {
+        MSG("Skipped %zu instructions not touching the selected paths.\n",
+            (size_t)(reader.skipped_instructions() + skipped));
+    }
+    return r;
+}
+
+int Patch::verify(const std::string &file, int threads, bool decode) {
+    TRACE_SCOPE("verify patch", -1, file);
+    std::shared_ptr<Config> config = Config::get();
+    PatchReader             reader;
+    BufferPool              buffers;
+    std::atomic<uint64_t>   decoded = 0;
+    Pipeline<ApplyJob>      pipeline(config->memory_budget, [](const ApplyJob &job) {
+        return job.repr.capacity() +
+               (job.instruction ? job.instruction->data_size() : 0);
+    });
+
+    /* The header and the footer are checked when the patch is opened. */
+    if (reader.open(file)) {
+        ERROR("Patch %s is corrupted.\n", file.c_str());
+        return -1;
+    }
 
-        if (instruction->from_binary_representation(repr)) {
-            ERROR("Failed to load patch %s: corrupted instruction.\n", file.c_str());
+    if (reader.has_checksums()) {
+        int64_t corrupted = reader.verify_checksums(threads);
+        if (corrupted) {
+            if (corrupted > 0) {
+                ERROR("Patch %s is corrupted: %zu %s do not match their checksums.\n",
+                      file.c_str(), (size_t)corrupted,
+                      reader.solid ? "blocks" : "instructions");
+            }
             return -1;
         }
+        MSG("All checksums of %s match.\n", file.c_str());
+    } else {
+        MSG("Patch %s has no checksums, decoding every instruction instead.\n",
+            file.c_str());
+        decode = true;
+    }
 
-        append(instruction);
+    if (!decode) {
+        return 0;
     }
-    INFO("Loaded %zu instructions successfully.\n", instructions.size());
+
+    pipeline.add_stage("decode", threads, [&](ApplyJob &job, uint64_t index) {
+        job.instruction =
+            decode_instruction(reader.file, job.signature, job.repr, reader.patch_context());
+        buffers.release(std::move(job.repr));
+        return job.instruction ? 0 : -1;
+    });
+
+    int r = pipeline.run(
+        [&](ApplyJob &job) {
+            job.repr = buffers.acquire();
+            return reader.next(job.signature, job.repr);
+        },
+        [&](ApplyJob &job, uint64_t index) {
+            decoded++;
+            return 0;
+        });
+
+    if (r) {
+        ERROR("Patch %s is corrupted.\n", file.c_str());
+        return -1;
+    }
+    MSG("All %zu instructions of %s decode.\n", (size_t)decoded.load(), file.c_str());
     return 0;
 }
 
+void Patch::inspect_instruction(const Instruction *ins, size_t number, int verbosity) {
+    MSG("  %zu. ", number);
+
+    const EntityModifyInstruction *emIns;
+    const EntityMoveInstruction   *evIns;
+    const EntityDeleteInstruction *edIns;
+
+    switch (ins->signature) {
+    case Instruction::ENTITY_MODIFY:
+        MSG("entity modification\n");
+        emIns = (const EntityModifyInstruction *)ins;
+        if (verbosity >= 2) {
+            MSG("      target: %s\n", emIns->target.c_str());
+            if (verbosity >= 3) {
+                MSG("      flags: ");
+                if (emIns->create_subdirectories) {
+                    MSG("create subdirectories, ");
+                }
+                if (emIns->create_empty_file_if_not_exists) {
+                    MSG("create empty file if not exists, ");
+                }
+                MSG("\n");
+            }
+        }
+        break;
+    case Instruction::ENTITY_MOVE:
+        MSG("entity relocation\n");
+        evIns = (const EntityMoveInstruction *)ins;
+        if (verbosity >= 2) {
+            MSG("      move_from: %s\n", evIns->move_from.c_str());
+            MSG("      move_to: %s\n", evIns->move_to.c_str());
+            if (verbosity >= 3) {
+                MSG("      flags: ");
+                if (evIns->create_subdirectories) {
+                    MSG("create subdirectories, ");
+                }
+                if (evIns->override_if_already_exists) {
+                    MSG("override, ");
+                }
+                MSG("\n");
+            }
+        }
+        break;
+    case Instruction::ENTITY_DELETE:
+        MSG("entity delete\n");
+        edIns = (const EntityDeleteInstruction *)ins;
+        if (verbosity >= 2) {
+            MSG("      target: %s\n", edIns->target.c_str());
+            if (verbosity >= 3) {
+                MSG("      flags: ");
+                if (edIns->delete_recursively_if_directory) {
+                    MSG("delete recursively, ");
+                }
+                MSG("\n");
+            }
+        }
+        break;
+    }
+}
+
 void Patch::inspect_contents(int verbosity) {
-    MSG("compatibility version: %zu\n", (size_t)Patch::compatibility_version);
+    MSG("compatibility version: %zu\n", (size_t)version);
     MSG("contains: %zu instructions\n", instructions.size());
 
     if (verbosity < 1) {
@@ -188,63 +586,62 @@ void Patch::inspect_contents(int verbosity) {
 
     MSG("instructions:\n");
     for (size_t i = 0; i < instructions.size(); i++) {
-        MSG("  %zu. ", i + 1);
-
-        const Instruction *const       ins = instructions[i].get();
-        const EntityModifyInstruction *emIns;
-        const EntityMoveInstruction   *evIns;
-        const EntityDeleteInstruction *edIns;
-
-        switch (ins->signature) {
-        case Instruction::ENTITY_MODIFY:
-            MSG("entity modification\n");
-            emIns = (const EntityModifyInstruction *)ins;
-            if (verbosity >= 2) {
-                MSG("      target: %s\n", emIns->target.c_str());
-                if (verbosity >= 3) {
-                    MSG("      flags: ");
-                    if (emIns->create_subdirectories) {
-                        MSG("create subdirectories, ");
-                    }
-                    if (emIns->create_empty_file_if_not_exists) {
-                        MSG("create empty file if not exists, ");
-                    }
-                    MSG("\n");
-                }
-            }
-            break;
-        case Instruction::ENTITY_MOVE:
-            MSG("entity relocation\n");
-            evIns = (const EntityMoveInstruction *)ins;
-            if (verbosity >= 2) {
-                MSG("      move_from: %s\n", evIns->move_from.c_str());
-                MSG("      move_to: %s\n", evIns->move_to.c_str());
-                if (verbosity >= 3) {
-                    MSG("      flags: ");
-                    if (evIns->create_subdirectories) {
-                        MSG("create subdirectories, ");
-                    }
-                    if (evIns->override_if_already_exists) {
-                        MSG("override, ");
-                    }
-                    MSG("\n");
-                }
+        inspect_instruction(instructions[i].get(), i + 1, verbosity);
+    }
+}
+
+int Patch::inspect_path(const std::string &file, const std::string &path,
+                        int verbosity) {
+    PatchReader            reader;
+    std::vector<std::byte> repr;
+    uint8_t                signature;
+    size_t                 found = 0;
+    int                    r;
+
+    if (reader.open(file)) {
+        ERROR("Failed to inspect the patch.\n");
+        return -1;
+    }
+    MSG("compatibility version: %zu\n", (size_t)reader.version);
+    MSG("instructions touching %s:\n", path.c_str());
+
+    const PathTable *table = reader.path_table();
+    if (!table) {
+        /* Without an index every instruction has to be decoded. */
+        for (uint64_t i = 0; (r = reader.next(signature, repr)) == 1; i++) {
+            auto instruction = decode_instruction(file, signature, repr, nullptr);
+            if (!instruction) {
+                return -1;
             }
-            break;
-        case Instruction::ENTITY_DELETE:
-            MSG("entity delete\n");
-            edIns = (const EntityDeleteInstruction *)ins;
-            if (verbosity >= 2) {
-                MSG("      target: %s\n", edIns->target.c_str());
-                if (verbosity >= 3) {
-                    MSG("      flags: ");
-                    if (edIns->delete_recursively_if_directory) {
-                        MSG("delete recursively, ");
-                    }
-                    MSG("\n");
-                }
+            auto paths = instruction->paths();
+            if (std::find(paths.begin(), paths.end(), path) != paths.end()) {
+                inspect_instruction(instruction.get(), i + 1, verbosity + 2);
+                found++;
             }
-            break;
         }
+        if (r) {
+            return -1;
+        }
+        MSG("found: %zu instructions\n", found);
+        return 0;
     }
+
+    int64_t position = table->find(path);
+    for (uint64_t i = 0; position != -1 && i < reader.size(); i++) {
+        auto paths = reader.instruction_paths(i);
+        if (std::find(paths.begin(), paths.end(), (uint64_t)position) == paths.end()) {
+            continue;
+        }
+
+        std::shared_ptr<Instruction> instruction;
+        if (reader.seek(i) || reader.next(signature, repr) != 1 ||
+            !(instruction =
+                  decode_instruction(file, signature, repr, reader.patch_context()))) {
+            return -1;
+        }
+        inspect_instruction(instruction.get(), i + 1, verbosity + 2);
+        found++;
+    }
+    MSG("found: %zu instructions\n", found);
+    return 0;
 }
@@ -0,0 +1,26 @@
+#include <error.hpp>
+#include <patch_context.hpp>
+
+void PatchContext::clear() {
+    paths.clear();
+    dictionary_compressor = nullptr;
+}
+
+std::shared_ptr<Compressor> PatchContext::compressor_from_id(int                 id,
+                                                             const PatchContext *context) {
+    if (id == PlainCompressor::get()->get_id()) {
+        return PlainCompressor::get();
+    } else if (id == ZLibCompressor::get()->get_id()) {
+        return ZLibCompressor::get();
+    } else if (id == ZLibDictionaryCompressor::id) {
+        if (!context || !context->dictionary_compressor) {
+            ERROR("Compressed with a dictionary, but the patch has none.\n");
+            return nullptr;
+        }
+        return context->dictionary_compressor;
+    } else if (id == XzCompressor::id) {
+        return XzCompressor::get();
+    }
+    ERROR("Invalid compressor id: %d\n", id);
+    return nullptr;
+}
@@ -0,0 +1,682 @@
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <crc32c.hpp>
+#include <cstdio>
+#include <cstring>
+#include <error.hpp>
+#include <patch.hpp>
+#include <thread>
+#include <trace.hpp>
+#include <util.hpp>
+
+PatchReader::PatchReader() {
+    fd = NULL;
+    footer = NULL;
+    footer_size = 0;
+    filter = NULL;
+    skipped = 0;
+    solid = false;
+    checksums = false;
+    crc = 0;
+    loaded_block = -1;
+    version = Patch::compatibility_version;
+    file_size = 0;
+    offset = 0;
+    count = 0;
+    index = 0;
+}
+
+PatchReader::~PatchReader() {
+    close();
+}
+
+int PatchReader::read_bytes(void *data, size_t size) {
+    if (size > file_size - offset) {
+        return -1;
+    }
+    if (size && std::fread(data, size, 1, fd) != 1) {
+        ERROR("Failed to read %s: %s\n", file.c_str(),
+              std::ferror(fd) ? strerror(errno) : "unexpected end of file");
+        return -1;
+    }
+    offset += size;
+    crc = crc32c(std::span((const std::byte *)data, size), crc);
+    return 0;
+}
+
+int PatchReader::read_varint(uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        std::byte byte;
+        if (read_bytes(&byte, 1)) {
+            return -1;
+        }
+        value |= (uint64_t)((uint8_t)byte & 0x7f) << shift;
+        if (!((uint8_t)byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Read the number of instructions, the path table and the index from the
+ * footer, and stop reading instructions where the footer starts. The footer is
+ * mapped rather than read, so that only the parts of the path table that are
+ * looked up are loaded.
+ */
+int PatchReader::read_footer() {
+    std::vector<std::byte> data(8);
+    auto                   it = data.begin();
+    uint64_t               footer_offset;
+
+    if (file_size < offset + 8 || std::fseek(fd, file_size - 8, SEEK_SET) ||
+        std::fread(data.data(), 8, 1, fd) != 1 ||
+        restore_uint64_t(it, data.end(), footer_offset) || footer_offset < offset ||
+        footer_offset >= file_size - 8) {
+        ERROR("Failed to load patch %s: invalid footer offset.\n", file.c_str());
+        return -1;
+    }
+
+    uint64_t start = footer_offset - footer_offset % sysconf(_SC_PAGESIZE);
+    footer_size = file_size - 8 - start;
+    footer = mmap(NULL, footer_size, PROT_READ, MAP_PRIVATE, fileno(fd), start);
+    if (footer == MAP_FAILED) {
+        ERROR("Failed to map the footer of %s: %s\n", file.c_str(), strerror(errno));
+        footer = NULL;
+        return -1;
+    }
+
+    std::span<const std::byte> footer_data(
+        (const std::byte *)footer + (footer_offset - start), file_size - 8 - footer_offset);
+    size_t   pos = 0;
+    uint32_t checksum;
+    if (checksums) {
+        pos = footer_data.size() - 4;
+        if (footer_data.size() < 4 || restore_uint32_t(footer_data, pos, checksum) ||
+            checksum != crc32c(footer_data.first(footer_data.size() - 4))) {
+            ERROR("Failed to load patch %s: corrupted footer (checksum mismatch).\n",
+                  file.c_str());
+            return -1;
+        }
+        footer_data = footer_data.first(footer_data.size() - 4);
+    }
+
+    pos = 0;
+    if (restore_varint(footer_data, pos, count) || context.paths.read(footer_data, pos) ||
+        read_index(footer_data, pos, footer_offset) ||
+        (solid && read_blocks(footer_data, pos, footer_offset)) ||
+        (checksums && read_checksums(footer_data, pos, crc)) ||
+        pos != footer_data.size()) {
+        ERROR("Failed to load patch %s: corrupted footer.\n", file.c_str());
+        return -1;
+    }
+
+    if (std::fseek(fd, offset, SEEK_SET)) {
+        ERROR("Failed to read %s: %s\n", file.c_str(), strerror(errno));
+        return -1;
+    }
+    file_size = footer_offset;
+    return 0;
+}
+
+int PatchReader::read_dictionary() {
+    uint64_t               size;
+    std::vector<std::byte> dictionary;
+
+    /* Checking the size first keeps corrupted sizes from exhausting memory. */
+    if (read_varint(size) || size == 0 || size > file_size - offset) {
+        ERROR("Failed to load patch %s: invalid dictionary size.\n", file.c_str());
+        return -1;
+    }
+
+    dictionary.resize(size);
+    if (read_bytes(dictionary.data(), size)) {
+        ERROR("Failed to load patch %s: truncated dictionary.\n", file.c_str());
+        return -1;
+    }
+
+    context.dictionary_compressor = std::make_shared<ZLibDictionaryCompressor>(dictionary);
+    INFO("Patch has a dictionary of %s\n", shorten_size(size).c_str());
+    return 0;
+}
+
+/*
+ * Read the index at data[pos], for the instructions starting at the current
+ * offset and ending at end.
+ */
+int PatchReader::read_index(std::span<const std::byte> data, size_t &pos, uint64_t end) {
+    uint64_t record = offset;
+
+    /* Every entry takes at least two bytes. */
+    if (count > data.size()) {
+        return -1;
+    }
+    index_offsets.reserve(count + 1);
+    index_paths_offsets.reserve(count + 1);
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t size, number_of_paths, position;
+        if (restore_varint(data, pos, size) ||
+            size > (solid ? UINT64_MAX - record : end - record) ||
+            restore_varint(data, pos, number_of_paths) ||
+            number_of_paths > data.size() - pos) {
+            ERROR("Corrupted index: invalid entry %zu.\n", (size_t)i);
+            return -1;
+        }
+
+        index_offsets.push_back(record);
+        index_paths_offsets.push_back(index_paths.size());
+        record += size;
+
+        for (uint64_t j = 0; j < number_of_paths; j++) {
+            if (restore_varint(data, pos, position) || position >= context.paths.size()) {
+                ERROR("Corrupted index: invalid path of entry %zu.\n", (size_t)i);
+                return -1;
+            }
+            index_paths.push_back(position);
+        }
+    }
+    index_offsets.push_back(record);
+    index_paths_offsets.push_back(index_paths.size());
+
+    /* The blocks of a solid patch are checked against the index instead. */
+    if (!solid && record != end) {
+        ERROR("Corrupted index: the instructions take %zu bytes, not %zu.\n",
+              (size_t)(record - offset), (size_t)(end - offset));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Read the blocks of a solid patch at data[pos], which start at the current
+ * offset and end at end, and find the block of every instruction.
+ */
+int PatchReader::read_blocks(std::span<const std::byte> data, size_t &pos, uint64_t end) {
+    uint64_t number_of_blocks, position = offset, first = 0;
+
+    /* Every block takes at least two bytes. */
+    if (restore_varint(data, pos, number_of_blocks) ||
+        number_of_blocks > data.size() - pos) {
+        ERROR("Corrupted block table: invalid number of blocks.\n");
+        return -1;
+    }
+    block_offsets.reserve(number_of_blocks + 1);
+    block_starts.reserve(number_of_blocks);
+    index_blocks.reserve(count);
+
+    for (uint64_t b = 0; b < number_of_blocks; b++) {
+        uint64_t size, instructions;
+        if (restore_varint(data, pos, size) || size == 0 || size > end - position ||
+            restore_varint(data, pos, instructions) || instructions == 0 ||
+            instructions > count - first) {
+            ERROR("Corrupted block table: invalid block %zu.\n", (size_t)b);
+            return -1;
+        }
+
+        block_offsets.push_back(position);
+        block_starts.push_back(index_offsets[first] - offset);
+        index_blocks.insert(index_blocks.end(), instructions, b);
+        position += size;
+        first += instructions;
+    }
+    block_offsets.push_back(position);
+
+    if (position != end || first != count) {
+        ERROR("Corrupted block table: the blocks hold %zu instructions in %zu bytes, "
+              "not %zu in %zu.\n",
+              (size_t)first, (size_t)(position - offset), (size_t)count,
+              (size_t)(end - offset));
+        return -1;
+    }
+
+    /* From now on, index_offsets refer to the decompressed instructions. */
+    for (auto &record : index_offsets) {
+        record -= offset;
+    }
+    return 0;
+}
+
+/*
+ * Read the checksums at data[pos] and check that of the header, whose checksum
+ * is given.
+ */
+int PatchReader::read_checksums(std::span<const std::byte> data, size_t &pos,
+                                uint32_t header) {
+    uint32_t checksum;
+    uint64_t records = solid ? block_offsets.size() - 1 : count;
+
+    if (restore_uint32_t(data, pos, checksum) || (data.size() - pos) / 4 < records) {
+        ERROR("Corrupted checksums: %zu expected.\n", (size_t)records);
+        return -1;
+    }
+    if (checksum != header) {
+        ERROR("Corrupted header: checksum mismatch.\n");
+        return -1;
+    }
+
+    record_checksums.resize(records);
+    for (auto &record : record_checksums) {
+        restore_uint32_t(data, pos, record);
+    }
+    return 0;
+}
+
+/*
+ * Read and decompress the block with the given number, unless it is the one
+ * read last.
+ */
+int PatchReader::load_block(uint64_t number) {
+    if ((int64_t)number == loaded_block) {
+        return 0;
+    }
+    TRACE_SCOPE("read block", number, file);
+
+    uint64_t size = block_offsets[number + 1] - block_offsets[number];
+    uint64_t expected = (number + 1 < block_starts.size() ? block_starts[number + 1]
+                                                           : index_offsets[count]) -
+                        block_starts[number];
+
+    loaded_block = -1;
+    compressed_block.resize(size);
+    if (std::fseek(fd, block_offsets[number], SEEK_SET)) {
+        ERROR("Failed to read %s: %s\n", file.c_str(), strerror(errno));
+        return -1;
+    }
+    offset = block_offsets[number];
+    if (read_bytes(compressed_block.data(), size)) {
+        ERROR("Failed to load patch %s: truncated block %zu.\n", file.c_str(),
+              (size_t)number);
+        return -1;
+    }
+    if (checksums && crc32c(compressed_block) != record_checksums[number]) {
+        ERROR("Failed to load patch %s: corrupted block %zu (checksum mismatch).\n",
+              file.c_str(), (size_t)number);
+        return -1;
+    }
+
+    std::shared_ptr<Compressor> compressor =
+        PatchContext::compressor_from_id((int)compressed_block[0], &context);
+    block.clear();
+    if (!compressor ||
+        compressor->decompress_into(std::span(compressed_block).subspan(1), block) ||
+        block.size() != expected) {
+        ERROR("Failed to load patch %s: corrupted block %zu.\n", file.c_str(),
+              (size_t)number);
+        return -1;
+    }
+
+    loaded_block = number;
+    return 0;
+}
+
+/*
+ * Same as next, for solid patches.
+ */
+int PatchReader::next_from_block(uint8_t &signature, std::vector<std::byte> &repr) {
+    uint64_t number = index_blocks[index];
+    uint64_t len;
+
+    if (load_block(number)) {
+        return -1;
+    }
+
+    size_t pos = index_offsets[index] - block_starts[number];
+    if (restore_varint(block, pos, len) || pos >= block.size() ||
+        len > block.size() - pos - 1) {
+        ERROR("Failed to load patch %s: invalid instruction size.\n", file.c_str());
+        return -1;
+    }
+    signature = (uint8_t)block[pos++];
+    repr.assign(block.begin() + pos, block.begin() + pos + len);
+    return 0;
+}
+
+/*
+ * See Patch::write_to_file for the binary representation.
+ */
+
+int PatchReader::open(const std::string &file) {
+    INFO("Loading patch from file: %s\n", file.c_str());
+    struct stat sb;
+
+    close();
+    this->file = file;
+    this->offset = 0;
+    this->count = 0;
+    this->index = 0;
+    this->skipped = 0;
+    this->crc = 0;
+
+    if (!(fd = std::fopen(file.c_str(), "r")) || fstat(fileno(fd), &sb)) {
+        ERROR("Failed to open %s: %s\n", file.c_str(), strerror(errno));
+        close();
+        return -1;
+    }
+    file_size = sb.st_size;
+
+    size_t                 signature_size = strlen(Patch::signature) + 1;
+    std::vector<std::byte> header(signature_size + 8 + 8);
+    auto                   it = header.begin() + signature_size;
+    uint64_t               compatibility_version;
+
+    if (read_bytes(header.data(), signature_size - 1) ||
+        memcmp(header.data(), Patch::signature, signature_size - 1)) {
+        ERROR("Failed to load patch %s: invalid signature.\n", file.c_str());
+        close();
+        return -1;
+    }
+
+    if (read_bytes(header.data() + signature_size - 1, 1) ||
+        header[signature_size - 1] != std::byte{0}) {
+        ERROR("Failed to load patch %s: invalid signature separator.\n",
+              file.c_str());
+        close();
+        return -1;
+    }
+
+    if (read_bytes(header.data() + signature_size, 8) ||
+        restore_uint64_t(it, header.end(), compatibility_version)) {
+        ERROR("Failed to load patch %s: invalid compatibility version.\n",
+              file.c_str());
+        close();
+        return -1;
+    }
+
+    if (compatibility_version < Patch::oldest_compatibility_version ||
+        compatibility_version > Patch::compatibility_version) {
+        ERROR(
+            "Failed to load patch %s: compatibility version differs: found %zu, "
+            "must be %zu to %zu\n",
+            file.c_str(), (size_t)compatibility_version,
+            (size_t)Patch::oldest_compatibility_version,
+            (size_t)Patch::compatibility_version);
+        close();
+        return -1;
+    }
+    version = compatibility_version;
+
+    if (version == 0) {
+        if (read_bytes(header.data() + signature_size + 8, 8) ||
+            restore_uint64_t(it, header.end(), count)) {
+            ERROR("Failed to load patch %s: invalid number of instructions.\n",
+                  file.c_str());
+            close();
+            return -1;
+        }
+    } else {
+        uint64_t flags;
+        if (read_varint(flags)) {
+            ERROR("Failed to load patch %s: invalid flags.\n", file.c_str());
+            close();
+            return -1;
+        }
+        if (flags & ~(uint64_t)(Patch::PATCH_DICTIONARY | Patch::PATCH_SOLID |
+                                Patch::PATCH_CHECKSUMS)) {
+            ERROR("Failed to load patch %s: unsupported features (flags %zx).\n",
+                  file.c_str(), (size_t)flags);
+            close();
+            return -1;
+        }
+        if ((flags & Patch::PATCH_DICTIONARY) && read_dictionary()) {
+            close();
+            return -1;
+        }
+        solid = flags & Patch::PATCH_SOLID;
+        checksums = flags & Patch::PATCH_CHECKSUMS;
+        if (read_footer()) {
+            close();
+            return -1;
+        }
+        INFO("Patch contains %zu paths.\n", context.paths.size());
+    }
+    INFO("Patch contains %zu instructions.\n", (size_t)count);
+
+    return 0;
+}
+
+uint64_t PatchReader::size() {
+    return count;
+}
+
+const PathTable *PatchReader::path_table() {
+    return version == 0 ? nullptr : &context.paths;
+}
+
+const PatchContext *PatchReader::patch_context() {
+    return version == 0 ? nullptr : &context;
+}
+
+std::span<const uint64_t> PatchReader::instruction_paths(uint64_t index) {
+    if (index + 1 >= index_paths_offsets.size()) {
+        return {};
+    }
+    return std::span(index_paths)
+        .subspan(index_paths_offsets[index],
+                 index_paths_offsets[index + 1] - index_paths_offsets[index]);
+}
+
+int PatchReader::seek(uint64_t index) {
+    if (fd && index_offsets.empty() && index >= this->index && index <= count) {
+        std::vector<std::byte> repr;
+        uint8_t                signature;
+        while (this->index < index) {
+            if (next(signature, repr) != 1) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if (!fd || index >= index_offsets.size()) {
+        ERROR("Cannot seek to instruction %zu of %s.\n", (size_t)index, file.c_str());
+        return -1;
+    }
+    if (solid) {
+        /* The block is read when the instruction is. */
+        this->index = index;
+        return 0;
+    }
+    if (std::fseek(fd, index_offsets[index], SEEK_SET)) {
+        ERROR("Failed to read %s: %s\n", file.c_str(), strerror(errno));
+        return -1;
+    }
+    offset = index_offsets[index];
+    this->index = index;
+    return 0;
+}
+
+bool PatchReader::set_filter(const PathFilter *filter) {
+    if (index_offsets.empty()) {
+        this->filter = NULL;
+        return false;
+    }
+    this->filter = filter;
+    selected_positions.assign(context.paths.size(), -1);
+    return true;
+}
+
+uint64_t PatchReader::skipped_instructions() {
+    return skipped;
+}
+
+/*
+ * Same as PathFilter::selects, without decoding the instruction.
+ */
+bool PatchReader::selected(uint64_t index) {
+    std::string path;
+    bool        any_included = false;
+
+    for (auto position : instruction_paths(index)) {
+        int8_t &verdict = selected_positions[position];
+        if (verdict == -1) {
+            if (context.paths.path_at(position, path)) {
+                /* Let decoding the instruction report the corruption. */
+                return true;
+            }
+            verdict = (filter->included(path) ? PATH_INCLUDED : 0) |
+                      (filter->excluded(path) ? PATH_EXCLUDED : 0);
+        }
+        if (verdict & PATH_EXCLUDED) {
+            return false;
+        }
+        any_included = any_included || (verdict & PATH_INCLUDED);
+    }
+    return any_included;
+}
+
+int PatchReader::next(uint8_t &signature, std::vector<std::byte> &repr) {
+    if (!fd) {
+        ERROR("Cannot read an instruction: no patch is open.\n");
+        return -1;
+    }
+
+    if (filter) {
+        uint64_t first = index;
+        while (index < count && !selected(index)) {
+            index++;
+        }
+        if (index != first) {
+            INFO("Skipping instructions %zu to %zu.\n", (size_t)first, (size_t)index - 1);
+            skipped += index - first;
+            if (seek(index)) {
+                return -1;
+            }
+        }
+    }
+
+    if (index == count) {
+        return 0;
+    }
+    TRACE_SCOPE("read instruction", index, file);
+
+    if (solid) {
+        if (next_from_block(signature, repr)) {
+            return -1;
+        }
+        index++;
+        return 1;
+    }
+
+    std::vector<std::byte> header(8);
+    auto                   it = header.begin();
+    uint64_t               len;
+
+    crc = 0;
+    if (version == 0 ? read_bytes(header.data(), 8) ||
+                           restore_uint64_t(it, header.end(), len)
+                     : read_varint(len)) {
+        ERROR("Failed to load patch %s: invalid instruction size.\n", file.c_str());
+        return -1;
+    }
+
+    if (read_bytes(&signature, 1)) {
+        ERROR("Failed to load patch %s: invalid instruction signature.\n",
+              file.c_str());
+        return -1;
+    }
+
+    /* Checking the size first keeps corrupted lengths from exhausting memory. */
+    if (len > file_size - offset) {
+        ERROR("Failed to load patch %s: truncated instruction.\n", file.c_str());
+        return -1;
+    }
+
+    try {
+        repr.resize(len);
+    } catch (...) {
+        ERROR("Failed to load patch %s: Likely out of memory.\n", file.c_str());
+        return -1;
+    }
+
+    if (read_bytes(repr.data(), len)) {
+        ERROR("Failed to load patch %s: truncated instruction.\n", file.c_str());
+        return -1;
+    }
+
+    if (checksums && crc != record_checksums[index]) {
+        ERROR("Failed to load patch %s: corrupted instruction %zu (checksum mismatch).\n",
+              file.c_str(), (size_t)index);
+        return -1;
+    }
+
+    index++;
+    return 1;
+}
+
+bool PatchReader::has_checksums() {
+    return checksums;
+}
+
+int64_t PatchReader::verify_checksums(int threads) {
+    if (!fd || !checksums) {
+        ERROR("Cannot verify %s: the patch has no checksums.\n", file.c_str());
+        return -1;
+    }
+    TRACE_SCOPE("verify checksums", -1, file);
+
+    /* Where every instruction or block starts in the file, and where it ends. */
+    std::vector<uint64_t> bounds = solid ? block_offsets : index_offsets;
+    std::atomic<uint64_t> next = 0;
+    std::atomic<int64_t>  corrupted = 0;
+    std::atomic<bool>     failed = false;
+    int                   descriptor = fileno(fd);
+
+    auto check = [&]() {
+        std::vector<std::byte> data;
+        for (uint64_t i; (i = next++) < record_checksums.size();) {
+            data.resize(bounds[i + 1] - bounds[i]);
+            if (read_at(descriptor, data.data(), data.size(), bounds[i])) {
+                ERROR("Failed to read %s: %s\n", file.c_str(), strerror(errno));
+                failed = true;
+                return;
+            }
+            if (crc32c(data) != record_checksums[i]) {
+                ERROR("%s: %s %zu is corrupted (checksum mismatch).\n", file.c_str(),
+                      solid ? "block" : "instruction", (size_t)i);
+                corrupted++;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.emplace_back(check);
+    }
+    check();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    return failed ? -1 : corrupted.load();
+}
+
+void PatchReader::close() {
+    if (fd) {
+        std::fclose(fd);
+        fd = NULL;
+    }
+
+    /* The path table refers to the footer. */
+    filter = NULL;
+    context.clear();
+    index_offsets.clear();
+    index_paths_offsets.clear();
+    index_paths.clear();
+    solid = false;
+    checksums = false;
+    record_checksums.clear();
+    block_offsets.clear();
+    block_starts.clear();
+    index_blocks.clear();
+    block.clear();
+    loaded_block = -1;
+    if (footer) {
+        munmap(footer, footer_size);
+        footer = NULL;
+    }
+}
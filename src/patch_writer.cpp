@@ -0,0 +1,350 @@
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <crc32c.hpp>
+#include <cstring>
+#include <error.hpp>
+#include <patch.hpp>
+#include <trace.hpp>
+#include <util.hpp>
+
+PatchWriter::PatchWriter() {
+    fd = NULL;
+    version = Patch::compatibility_version;
+    count = 0;
+    count_offset = -1;
+    block_size = 0;
+    block_count = 0;
+    checksums = false;
+    header_checksum = 0;
+}
+
+PatchWriter::~PatchWriter() {
+    if (fd) {
+        INFO("Patch %s was not finished. Discarding it.\n", file.c_str());
+        abort();
+    }
+}
+
+int PatchWriter::write_bytes(const void *data, size_t size) {
+    if (size && std::fwrite(data, size, 1, fd) != 1) {
+        ERROR("Failed to write %s: %s\n", temp_file.c_str(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * See Patch::write_to_file for the binary representation.
+ */
+
+int PatchWriter::open(const std::string &file, uint64_t version,
+                      std::span<const std::byte> dictionary, uint64_t block_size,
+                      std::shared_ptr<Compressor> block_compressor, bool checksums) {
+    INFO("Writing patch to file: %s (compatibility version %zu)\n", file.c_str(),
+         (size_t)version);
+    if (fd) {
+        ERROR("Patch %s is already being written.\n", this->file.c_str());
+        return -1;
+    }
+
+    if (version < Patch::oldest_compatibility_version ||
+        version > Patch::compatibility_version) {
+        ERROR("Cannot write patches of compatibility version %zu.\n",
+              (size_t)version);
+        return -1;
+    }
+
+    if (!dictionary.empty() && version == 0) {
+        ERROR("Patches of compatibility version 0 cannot have a dictionary.\n");
+        return -1;
+    }
+
+    if (block_size && version == 0) {
+        ERROR("Patches of compatibility version 0 cannot be solid.\n");
+        return -1;
+    }
+
+    if (checksums && version == 0) {
+        ERROR("Patches of compatibility version 0 cannot have checksums.\n");
+        return -1;
+    }
+
+    this->file = file;
+    this->temp_file = file + ".XXXXXX";
+    this->version = version;
+    this->count = 0;
+    this->context.clear();
+    if (!dictionary.empty()) {
+        context.dictionary_compressor =
+            std::make_shared<ZLibDictionaryCompressor>(dictionary);
+    }
+    if (!block_compressor) {
+        block_compressor = context.dictionary_compressor ? context.dictionary_compressor
+                                                         : ZLibCompressor::get();
+    }
+    this->block_compressor = block_compressor;
+    this->index_sizes.clear();
+    this->index_path_counts.clear();
+    this->index_paths.clear();
+    this->block_size = block_size;
+    this->block.clear();
+    this->block_count = 0;
+    this->block_sizes.clear();
+    this->block_counts.clear();
+    this->checksums = checksums;
+    this->record_checksums.clear();
+
+    int tmp = mkstemp(temp_file.data());
+    if (tmp == -1 || !(fd = fdopen(tmp, "w"))) {
+        ERROR("Failed to create a temporary file for %s: %s\n", file.c_str(),
+              strerror(errno));
+        if (tmp != -1) {
+            close(tmp);
+            unlink(temp_file.c_str());
+        }
+        return -1;
+    }
+    INFO("Patch will be temporarily written to %s\n", temp_file.c_str());
+
+    /* mkstemp creates the file with 0600, fopen would have respected umask. */
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(tmp, 0666 & ~mask);
+
+    std::vector<std::byte> header;
+    header.insert(header.end(), (const std::byte *)Patch::signature,
+                  (const std::byte *)Patch::signature + strlen(Patch::signature) + 1);
+    store_uint64_t(version, header);
+    if (version == 0) {
+        count_offset = header.size();
+        store_uint64_t(0, header);
+    } else {
+        store_varint((dictionary.empty() ? 0 : Patch::PATCH_DICTIONARY) |
+                         (block_size ? Patch::PATCH_SOLID : 0) |
+                         (checksums ? Patch::PATCH_CHECKSUMS : 0),
+                     header);
+        if (!dictionary.empty()) {
+            store_varint(dictionary.size(), header);
+            header.insert(header.end(), dictionary.begin(), dictionary.end());
+            INFO("Patch has a dictionary of %s\n",
+                 shorten_size(dictionary.size()).c_str());
+        }
+        if (block_size) {
+            INFO("Patch is solid, with blocks of %s\n", shorten_size(block_size).c_str());
+        }
+    }
+
+    if (write_bytes(header.data(), header.size())) {
+        abort();
+        return -1;
+    }
+    header_checksum = crc32c(header);
+    return 0;
+}
+
+PathTable *PatchWriter::path_table() {
+    return version == 0 ? nullptr : &context.paths;
+}
+
+PatchContext *PatchWriter::patch_context() {
+    return version == 0 ? nullptr : &context;
+}
+
+int PatchWriter::append(std::shared_ptr<Instruction> instruction) {
+    if (!fd) {
+        ERROR("Cannot append an instruction: no patch is being written.\n");
+        return -1;
+    }
+
+    buffer.clear();
+    ids.clear();
+    instruction->write_binary_representation(buffer, patch_context());
+    if (PathTable *table = path_table()) {
+        for (auto &path : instruction->paths()) {
+            ids.push_back(table->intern(path));
+        }
+    }
+    return append_representation(instruction->signature, buffer, ids);
+}
+
+int PatchWriter::append_representation(uint8_t                    signature,
+                                       std::span<const std::byte> repr,
+                                       std::span<const uint64_t>  path_ids) {
+    if (!fd) {
+        ERROR("Cannot append an instruction: no patch is being written.\n");
+        return -1;
+    }
+    TRACE_SCOPE("write instruction", count, file);
+
+    for (auto id : path_ids) {
+        if (id >= context.paths.size()) {
+            ERROR("Cannot append an instruction: invalid path id %zu.\n", (size_t)id);
+            return -1;
+        }
+    }
+
+    std::byte header[10 + 1];
+    size_t    header_size = 0;
+    uint64_t  len = repr.size();
+
+    if (version == 0) {
+        for (; header_size < 8; header_size++) {
+            header[header_size] = (std::byte)(len >> (8 * header_size));
+        }
+    } else {
+        for (; len >= 0x80; len >>= 7) {
+            header[header_size++] = (std::byte)(len | 0x80);
+        }
+        header[header_size++] = (std::byte)len;
+    }
+    header[header_size++] = (std::byte)signature;
+
+    if (block_size) {
+        block.insert(block.end(), header, header + header_size);
+        block.insert(block.end(), repr.begin(), repr.end());
+        block_count++;
+        if (block.size() >= block_size && flush_block()) {
+            return -1;
+        }
+    } else if (write_bytes(header, header_size) ||
+               write_bytes(repr.data(), repr.size())) {
+        return -1;
+    } else if (checksums) {
+        record_checksums.push_back(crc32c(repr, crc32c(std::span(header, header_size))));
+    }
+
+    if (version != 0) {
+        index_sizes.push_back(header_size + repr.size());
+        index_path_counts.push_back(path_ids.size());
+        index_paths.insert(index_paths.end(), path_ids.begin(), path_ids.end());
+    }
+    count++;
+    return 0;
+}
+
+/*
+ * Compress the instructions collected so far and write them out as one block.
+ */
+int PatchWriter::flush_block() {
+    if (block.empty()) {
+        return 0;
+    }
+    TRACE_SCOPE("write block", block_sizes.size(), file);
+
+    Compressor *selected = block_compressor->select(block);
+    compressed_block.clear();
+    compressed_block.push_back((std::byte)selected->get_id());
+    if (selected->compress_into(block, compressed_block) ||
+        write_bytes(compressed_block.data(), compressed_block.size())) {
+        ERROR("Failed to write block %zu of %s\n", block_sizes.size(), file.c_str());
+        return -1;
+    }
+    INFO("Wrote block %zu: %zu instructions, %s -> %s\n", block_sizes.size(),
+         (size_t)block_count, shorten_size(block.size()).c_str(),
+         shorten_size(compressed_block.size()).c_str());
+
+    block_sizes.push_back(compressed_block.size());
+    block_counts.push_back(block_count);
+    if (checksums) {
+        record_checksums.push_back(crc32c(compressed_block));
+    }
+    block.clear();
+    block_count = 0;
+    return 0;
+}
+
+int PatchWriter::finish() {
+    if (!fd) {
+        ERROR("Cannot finish the patch: no patch is being written.\n");
+        return -1;
+    }
+
+    if (flush_block()) {
+        abort();
+        return -1;
+    }
+
+    std::vector<std::byte> data;
+    if (version == 0) {
+        store_uint64_t(count, data);
+
+        if (std::fseek(fd, count_offset, SEEK_SET) ||
+            write_bytes(data.data(), data.size())) {
+            ERROR("Failed to write the number of instructions to %s\n",
+                  temp_file.c_str());
+            abort();
+            return -1;
+        }
+    } else {
+        long                  footer_offset = std::ftell(fd);
+        std::vector<uint64_t> positions;
+        size_t                next = 0;
+
+        store_varint(count, data);
+        if (context.paths.write(data, &positions)) {
+            ERROR("Failed to write the path table to %s\n", temp_file.c_str());
+            abort();
+            return -1;
+        }
+        for (size_t i = 0; i < index_sizes.size(); i++) {
+            store_varint(index_sizes[i], data);
+            store_varint(index_path_counts[i], data);
+            for (uint64_t j = 0; j < index_path_counts[i]; j++) {
+                store_varint(positions[index_paths[next++]], data);
+            }
+        }
+        if (block_size) {
+            store_varint(block_sizes.size(), data);
+            for (size_t i = 0; i < block_sizes.size(); i++) {
+                store_varint(block_sizes[i], data);
+                store_varint(block_counts[i], data);
+            }
+        }
+        if (checksums) {
+            store_uint32_t(header_checksum, data);
+            for (auto checksum : record_checksums) {
+                store_uint32_t(checksum, data);
+            }
+            store_uint32_t(crc32c(data), data);
+        }
+        store_uint64_t(footer_offset, data);
+
+        if (footer_offset == -1 || write_bytes(data.data(), data.size())) {
+            ERROR("Failed to write the footer to %s\n", temp_file.c_str());
+            abort();
+            return -1;
+        }
+        INFO("Wrote %zu paths to %s\n", context.paths.size(), file.c_str());
+    }
+
+    int r = std::fclose(fd);
+    fd = NULL;
+    if (r) {
+        ERROR("Failed to write %s: %s\n", temp_file.c_str(), strerror(errno));
+        unlink(temp_file.c_str());
+        return -1;
+    }
+
+    if (rename(temp_file.c_str(), file.c_str())) {
+        ERROR("Failed to move %s to %s: %s\n", temp_file.c_str(), file.c_str(),
+              strerror(errno));
+        unlink(temp_file.c_str());
+        return -1;
+    }
+
+    INFO("Wrote %zu instructions to %s\n", (size_t)count, file.c_str());
+    return 0;
+}
+
+void PatchWriter::abort() {
+    if (!fd) {
+        return;
+    }
+    std::fclose(fd);
+    fd = NULL;
+    unlink(temp_file.c_str());
+    INFO("Discarded %s\n", temp_file.c_str());
+}
@@ -0,0 +1,76 @@
+#include <fnmatch.h>
+
+#include <filesystem>
+#include <path_filter.hpp>
+
+std::string PathFilter::normalize(const std::string &path) {
+    std::string res = std::filesystem::path(path).lexically_normal().string();
+    if (res.starts_with("./")) {
+        res.erase(0, 2);
+    }
+    while (res.size() > 1 && res.back() == '/') {
+        res.pop_back();
+    }
+    return res;
+}
+
+bool PathFilter::matches_any(const std::vector<std::string> &globs,
+                             const std::string              &original) {
+    std::string path = normalize(original);
+    for (auto &glob : globs) {
+        if (!fnmatch(glob.c_str(), path.c_str(), 0)) {
+            return true;
+        }
+
+        /* The directories containing the path. */
+        for (size_t end = path.find('/'); end != std::string::npos;
+             end = path.find('/', end + 1)) {
+            if (!fnmatch(glob.c_str(), path.substr(0, end).c_str(), 0)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void PathFilter::include(const std::string &glob) {
+    includes.push_back(normalize(glob));
+}
+
+void PathFilter::exclude(const std::string &glob) {
+    excludes.push_back(normalize(glob));
+}
+
+bool PathFilter::active() const {
+    return !includes.empty() || !excludes.empty();
+}
+
+std::vector<std::string> PathFilter::rules() const {
+    std::vector<std::string> res;
+    for (auto &glob : includes) {
+        res.push_back("+" + glob);
+    }
+    for (auto &glob : excludes) {
+        res.push_back("-" + glob);
+    }
+    return res;
+}
+
+bool PathFilter::included(const std::string &path) const {
+    return includes.empty() || matches_any(includes, path);
+}
+
+bool PathFilter::excluded(const std::string &path) const {
+    return matches_any(excludes, path);
+}
+
+bool PathFilter::selects(const std::vector<std::string> &paths) const {
+    bool any_included = false;
+    for (auto &path : paths) {
+        if (excluded(path)) {
+            return false;
+        }
+        any_included = any_included || included(path);
+    }
+    return any_included;
+}
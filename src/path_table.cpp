@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <error.hpp>
+#include <numeric>
+#include <path_table.hpp>
+#include <util.hpp>
+
+static void store_uint32(uint32_t value, std::vector<std::byte> &out) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((std::byte)(value >> (8 * i)));
+    }
+}
+
+PathTable::PathTable() {
+    count = 0;
+    interval = restart_interval;
+}
+
+uint64_t PathTable::intern(const std::string &path) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto [it, inserted] = ids.emplace(path, paths.size());
+    if (inserted) {
+        paths.push_back(path);
+    }
+    return it->second;
+}
+
+uint32_t PathTable::load_uint32(std::span<const std::byte> data, uint64_t index) const {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)data[4 * index + i] << (8 * i);
+    }
+    return value;
+}
+
+int PathTable::decode_entry(size_t &offset, std::string &path) const {
+    uint64_t shared, length;
+    if (restore_varint(entries, offset, shared) ||
+        restore_varint(entries, offset, length) || shared > path.size() ||
+        length > entries.size() - offset) {
+        ERROR("Corrupted path table: invalid entry.\n");
+        return -1;
+    }
+    path.resize(shared);
+    path.append((const char *)entries.data() + offset, length);
+    offset += length;
+    return 0;
+}
+
+int PathTable::lookup(uint64_t id, std::string &path) const {
+    uint64_t position;
+    if (id < paths.size()) {
+        path = paths[id];
+        return 0;
+    }
+    return position_of(id, position) || path_at(position, path) ? -1 : 0;
+}
+
+int PathTable::position_of(uint64_t id, uint64_t &position) const {
+    if (id >= count || (position = load_uint32(positions, id)) >= count) {
+        return -1;
+    }
+    return 0;
+}
+
+int PathTable::path_at(uint64_t position, std::string &path) const {
+    if (position >= count) {
+        return -1;
+    }
+
+    size_t offset = load_uint32(restarts, position / interval);
+    path.clear();
+    for (uint64_t i = 0; i <= position % interval; i++) {
+        if (decode_entry(offset, path)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int64_t PathTable::find(const std::string &path) const {
+    std::string current;
+    uint64_t    low = 0, high = (count + interval - 1) / interval;
+
+    /* Find the last block starting with a path not greater than the given one. */
+    while (high - low > 1) {
+        uint64_t mid = low + (high - low) / 2;
+        if (path_at(mid * interval, current)) {
+            return -1;
+        }
+        if (current <= path) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == high) {
+        return -1;
+    }
+
+    size_t offset = load_uint32(restarts, low);
+    current.clear();
+    for (uint64_t position = low * interval;
+         position < std::min(count, (low + 1) * interval); position++) {
+        if (decode_entry(offset, current) || current > path) {
+            return -1;
+        }
+        if (current == path) {
+            return position;
+        }
+    }
+    return -1;
+}
+
+size_t PathTable::size() const {
+    return paths.empty() ? count : paths.size();
+}
+
+void PathTable::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    paths.clear();
+    ids.clear();
+    count = 0;
+    interval = restart_interval;
+    entries = restarts = positions = {};
+}
+
+int PathTable::write(std::vector<std::byte> &out,
+                     std::vector<uint64_t>  *positions) const {
+    std::vector<uint64_t>  order(paths.size());
+    std::vector<std::byte> data;
+    std::vector<uint32_t>  offsets;
+
+    if (paths.size() > UINT32_MAX) {
+        ERROR("Too many paths for a path table: %zu\n", paths.size());
+        return -1;
+    }
+
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](uint64_t a, uint64_t b) { return paths[a] < paths[b]; });
+
+    for (size_t i = 0; i < order.size(); i++) {
+        const std::string &path = paths[order[i]];
+        size_t             shared = 0;
+
+        if (i % restart_interval == 0) {
+            if (data.size() > UINT32_MAX) {
+                ERROR("Path table too large: more than %s of paths.\n",
+                      shorten_size((uint64_t)UINT32_MAX + 1).c_str());
+                return -1;
+            }
+            offsets.push_back(data.size());
+        } else {
+            const std::string &previous = paths[order[i - 1]];
+            size_t             max_shared = std::min(previous.size(), path.size());
+            while (shared < max_shared && previous[shared] == path[shared]) {
+                shared++;
+            }
+        }
+
+        store_varint(shared, data);
+        store_varint(path.size() - shared, data);
+        data.insert(data.end(), (const std::byte *)path.data() + shared,
+                    (const std::byte *)path.data() + path.size());
+    }
+
+    store_varint(paths.size(), out);
+    store_varint(restart_interval, out);
+    store_varint(data.size(), out);
+    out.insert(out.end(), data.begin(), data.end());
+    for (auto offset : offsets) {
+        store_uint32(offset, out);
+    }
+
+    std::vector<uint64_t> sorted(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        sorted[order[i]] = i;
+    }
+    for (auto position : sorted) {
+        store_uint32(position, out);
+    }
+    if (positions) {
+        *positions = std::move(sorted);
+    }
+    return 0;
+}
+
+int PathTable::read(std::span<const std::byte> data, size_t &offset) {
+    uint64_t entries_size;
+
+    clear();
+    if (restore_varint(data, offset, count) ||
+        restore_varint(data, offset, interval) ||
+        restore_varint(data, offset, entries_size)) {
+        ERROR("Corrupted path table: invalid header.\n");
+        clear();
+        return -1;
+    }
+
+    /* Every path takes at least two bytes, which bounds the sizes below. */
+    uint64_t blocks = interval ? (count + interval - 1) / interval : 0;
+    if (!interval || interval > UINT32_MAX || count > data.size() ||
+        entries_size > data.size() - offset ||
+        4 * (blocks + count) > data.size() - offset - entries_size) {
+        ERROR("Corrupted path table: out of bounds.\n");
+        clear();
+        return -1;
+    }
+
+    entries = data.subspan(offset, entries_size);
+    restarts = data.subspan(offset + entries_size, 4 * blocks);
+    positions = data.subspan(offset + entries_size + 4 * blocks, 4 * count);
+    offset += entries_size + 4 * (blocks + count);
+
+    for (uint64_t block = 0; block < blocks; block++) {
+        if (load_uint32(restarts, block) >= entries_size) {
+            ERROR("Corrupted path table: invalid restart point.\n");
+            clear();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void store_path(const std::string &path, PathTable *table, std::vector<std::byte> &out) {
+    if (table) {
+        store_varint(table->intern(path), out);
+    } else {
+        store_string(path, out);
+    }
+}
+
+int restore_path(std::span<const std::byte> data, size_t &offset,
+                 const PathTable *table, std::string &path) {
+    if (table) {
+        uint64_t id;
+        if (restore_varint(data, offset, id) || table->lookup(id, path)) {
+            ERROR("Invalid path id.\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    auto end = std::find(data.begin() + std::min(offset, data.size()), data.end(),
+                         std::byte{0});
+    if (end == data.end()) {
+        ERROR("Invalid path: no NULL byte.\n");
+        return -1;
+    }
+    path.assign((const char *)data.data() + offset, end - (data.begin() + offset));
+    offset += path.size() + 1;
+    return 0;
+}
@@ -4,10 +4,7 @@ PlainCompressor::PlainCompressor() {
 }
 
 std::shared_ptr<PlainCompressor> PlainCompressor::get() {
-    static std::shared_ptr<PlainCompressor> instance;
-    if (!instance) {
-        instance.reset(new PlainCompressor());
-    }
+    static std::shared_ptr<PlainCompressor> instance(new PlainCompressor());
     return instance;
 }
 
@@ -15,12 +12,14 @@ int PlainCompressor::get_id() {
     return 0;
 }
 
-std::vector<std::byte> PlainCompressor::compress(
-    const std::vector<std::byte> &data) {
-    return data;
+int PlainCompressor::compress_into(std::span<const std::byte> data,
+                                   std::vector<std::byte>    &out) {
+    out.insert(out.end(), data.begin(), data.end());
+    return 0;
 }
 
-std::vector<std::byte> PlainCompressor::decompress(
-    const std::vector<std::byte> &data) {
-    return data;
+int PlainCompressor::decompress_into(std::span<const std::byte> data,
+                                     std::vector<std::byte>    &out) {
+    out.insert(out.end(), data.begin(), data.end());
+    return 0;
 }
@@ -0,0 +1,74 @@
+#include <compressor.hpp>
+#include <diff.hpp>
+#include <error.hpp>
+#include <patch_context.hpp>
+#include <trace.hpp>
+#include <util.hpp>
+
+ReplaceDiff::ReplaceDiff() {
+    signature = Diff::REPLACE_DIFF;
+}
+
+int ReplaceDiff::from_files(const std::string &src, const std::string &dest) {
+    TRACE_SCOPE("diff", -1, dest);
+    INFO("Constructing ReplaceDiff from file: %s\n", dest.c_str());
+
+    data.clear();
+    if (open_and_read_entire_file(dest.c_str(), data)) {
+        ERROR("Failed to create a replacement of %s by %s.\n", src.c_str(),
+              dest.c_str());
+        return -1;
+    }
+
+    MSG("Created a replacement (%s -> %s): %s.\n", src.c_str(), dest.c_str(),
+        shorten_size(data.size()).c_str());
+    return 0;
+}
+
+void ReplaceDiff::write_binary_representation(std::vector<std::byte> &out) {
+    Compressor *selected = compressor->select(data);
+    out.push_back((std::byte)selected->get_id());
+    selected->compress_into(data, out);
+}
+
+int ReplaceDiff::from_binary_representation(std::span<const std::byte> data,
+                                            const PatchContext        *context) {
+    if (data.empty()) {
+        ERROR("Empty data: missing compressor id\n");
+        return -1;
+    }
+
+    if (!(compressor = PatchContext::compressor_from_id((int)data[0], context))) {
+        return -1;
+    }
+
+    this->data.clear();
+    return compressor->decompress_into(data.subspan(1), this->data);
+}
+
+size_t ReplaceDiff::data_size() {
+    return data.size();
+}
+
+int ReplaceDiff::apply(const std::string &dest) {
+    TRACE_SCOPE("patch", -1, dest);
+    INFO("Applying ReplaceDiff to %s\n", dest.c_str());
+
+    if (open_and_write_entire_file(dest.c_str(), data)) {
+        ERROR("Failed to replace %s\n", dest.c_str());
+        return -1;
+    }
+
+    MSG("Replaced %s\n", dest.c_str());
+    return 0;
+}
+
+Diff::ContentsUse ReplaceDiff::contents_use() {
+    return CONTENTS_IGNORED;
+}
+
+int ReplaceDiff::patch_contents(std::span<const std::byte> file,
+                                std::vector<std::byte>    &out) {
+    out = data;
+    return 0;
+}
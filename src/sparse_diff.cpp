@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <compressor.hpp>
+#include <cstring>
+#include <diff.hpp>
+#include <error.hpp>
+#include <patch_context.hpp>
+#include <trace.hpp>
+#include <util.hpp>
+
+SparseDiff::SparseDiff() {
+    signature = Diff::SPARSE_DIFF;
+}
+
+bool SparseDiff::has_holes(const std::string &file, uint64_t *stored) {
+    std::vector<FileExtent> extents;
+    std::vector<std::byte>  header;
+    struct stat             sb;
+    int                     fd = open(file.c_str(), O_RDONLY);
+    bool                    holes = false;
+
+    if (fd == -1) {
+        return false;
+    }
+    if (!fstat(fd, &sb) && S_ISREG(sb.st_mode) &&
+        !find_data_extents(fd, sb.st_size, extents)) {
+        uint64_t data = 0, end = 0;
+        store_varint(sb.st_size, header);
+        store_varint(extents.size(), header);
+        for (auto &extent : extents) {
+            data += extent.length;
+            store_varint(extent.offset - end, header);
+            store_varint(extent.length, header);
+            end = extent.offset + extent.length;
+        }
+        holes = data < (uint64_t)sb.st_size;
+        if (stored) {
+            *stored = header.size() + data;
+        }
+    }
+    close(fd);
+    return holes;
+}
+
+int SparseDiff::from_files(const std::string &src, const std::string &dest) {
+    TRACE_SCOPE("diff", -1, dest);
+    INFO("Constructing SparseDiff from file: %s\n", dest.c_str());
+    std::vector<FileExtent> extents;
+    struct stat             sb;
+    int                     fd;
+    uint64_t                end = 0, stored = 0;
+
+    if ((fd = open(dest.c_str(), O_RDONLY)) == -1 || fstat(fd, &sb) ||
+        find_data_extents(fd, sb.st_size, extents)) {
+        ERROR("Failed to read %s: %s\n", dest.c_str(), strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    data.clear();
+    store_varint(sb.st_size, data);
+    store_varint(extents.size(), data);
+    for (auto &extent : extents) {
+        store_varint(extent.offset - end, data);
+        store_varint(extent.length, data);
+        end = extent.offset + extent.length;
+        stored += extent.length;
+    }
+
+    size_t header_size = data.size();
+    try {
+        data.resize(header_size + stored);
+    } catch (...) {
+        ERROR("Failed to read %s. Likely out of memory.\n", dest.c_str());
+        close(fd);
+        return -1;
+    }
+
+    std::byte *out = data.data() + header_size;
+    for (auto &extent : extents) {
+        if (read_at(fd, out, extent.length, extent.offset)) {
+            ERROR("Failed to read %s: %s\n", dest.c_str(), strerror(errno));
+            close(fd);
+            return -1;
+        }
+        out += extent.length;
+    }
+    close(fd);
+
+    MSG("Created a sparse replacement (%s -> %s): %s of data, %s of holes.\n",
+        src.c_str(), dest.c_str(), shorten_size(stored).c_str(),
+        shorten_size(sb.st_size - stored).c_str());
+    return 0;
+}
+
+void SparseDiff::write_binary_representation(std::vector<std::byte> &out) {
+    Compressor *selected = compressor->select(data);
+    out.push_back((std::byte)selected->get_id());
+    selected->compress_into(data, out);
+}
+
+int SparseDiff::from_binary_representation(std::span<const std::byte> data,
+                                           const PatchContext        *context) {
+    if (data.empty()) {
+        ERROR("Empty data: missing compressor id\n");
+        return -1;
+    }
+
+    if (!(compressor = PatchContext::compressor_from_id((int)data[0], context))) {
+        return -1;
+    }
+
+    this->data.clear();
+    return compressor->decompress_into(data.subspan(1), this->data);
+}
+
+size_t SparseDiff::data_size() {
+    return data.size();
+}
+
+int SparseDiff::apply(const std::string &dest) {
+    TRACE_SCOPE("patch", -1, dest);
+    INFO("Applying SparseDiff to %s\n", dest.c_str());
+    std::vector<FileExtent> extents;
+    size_t                  offset = 0;
+    uint64_t                size, number, end = 0, stored = 0;
+
+    /* The whole diff is checked before the file is touched. */
+    if (restore_varint(data, offset, size) || restore_varint(data, offset, number) ||
+        number > data.size() - offset) {
+        ERROR("Corrupted diff: invalid header.\n");
+        return -1;
+    }
+    extents.resize(number);
+    for (auto &extent : extents) {
+        uint64_t gap;
+        if (restore_varint(data, offset, gap) ||
+            restore_varint(data, offset, extent.length) || gap > size - end ||
+            extent.length > size - end - gap) {
+            ERROR("Corrupted diff: invalid range.\n");
+            return -1;
+        }
+        extent.offset = end + gap;
+        end = extent.offset + extent.length;
+        stored += extent.length;
+    }
+    if (stored != data.size() - offset) {
+        ERROR("Corrupted diff: %zu bytes of data for %zu.\n", data.size() - offset,
+              (size_t)stored);
+        return -1;
+    }
+
+    /*
+     * Emptying the file first drops all its blocks, so that the ranges not
+     * written to are holes.
+     */
+    int fd = open(dest.c_str(), O_WRONLY);
+    int r = fd == -1 || ftruncate(fd, 0) || ftruncate(fd, size);
+    for (auto &extent : extents) {
+        if (r || (r = write_at(fd, data.data() + offset, extent.length, extent.offset))) {
+            break;
+        }
+        offset += extent.length;
+    }
+    if (r) {
+        ERROR("Failed to replace %s: %s\n", dest.c_str(), strerror(errno));
+    }
+    if (fd != -1 && close(fd) && !r) {
+        ERROR("Failed to close %s: %s\n", dest.c_str(), strerror(errno));
+        r = -1;
+    }
+    if (r) {
+        return -1;
+    }
+
+    MSG("Replaced %s, keeping %s of holes\n", dest.c_str(),
+        shorten_size(size - stored).c_str());
+    return 0;
+}
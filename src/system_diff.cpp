@@ -1,41 +1,335 @@
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <compressor.hpp>
 #include <config.hpp>
-#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <diff.hpp>
 #include <error.hpp>
+#include <hex.hpp>
+#include <patch_context.hpp>
+#include <trace.hpp>
 #include <util.hpp>
 #include <utility>
 #include <vector>
 
-static int invoke_tool(const char *tool, const char *command, int ec1, int ec2) {
-    INFO("Invoking command `%s`\n", command);
-    int r = system(command);
-    if (r == -1 || (WEXITSTATUS(r) != ec1 && WEXITSTATUS(r) != ec2)) {
-        ERROR(
-            "Failed to execute command `%s`, ec=%d, errno: %s. Is `%s` installed?\n",
-            command, r, strerror(errno), tool);
+extern char **environ;
+
+/*
+ * Anonymous files in memory pass the data between the tools, so that nothing
+ * is written to disk.
+ */
+static int memory_file(const char *name) {
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd == -1) {
+        ERROR("Failed to create a file in memory: %s\n", strerror(errno));
+    }
+    return fd;
+}
+
+static int read_memory_file(int fd, std::vector<std::byte> &data) {
+    struct stat sb;
+    if (fstat(fd, &sb)) {
+        ERROR("Failed to stat a file in memory: %s\n", strerror(errno));
         return -1;
     }
+    data.resize(sb.st_size);
+    for (size_t done = 0; done < data.size();) {
+        ssize_t n = pread(fd, data.data() + done, data.size() - done, done);
+        if (n <= 0) {
+            ERROR("Failed to read a file in memory: %s\n",
+                  n ? strerror(errno) : "unexpected end of file");
+            return -1;
+        }
+        done += n;
+    }
     return 0;
 }
 
-static const char *const COMMAND_XXD = "xxd -c1 -ps %s > %s";
-static const char *const COMMAND_XXD_REVERSE = "xxd -r -c1 -ps %s > %s";
-static const char *const COMMAND_DIFF = "diff %s %s > %s";
-static const char *const COMMAND_PATCH = "patch -f -s %s %s";
-
-static const char *format(const char *format, ...) {
-    va_list list;
-    va_start(list, format);
-    static char buf[4096];
-    vsnprintf(buf, 4096, format, list);
-    va_end(list);
-    return buf;
+static int write_memory_file(int fd, std::span<const std::byte> data) {
+    for (size_t done = 0; done < data.size();) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            ERROR("Failed to write a file in memory: %s\n", strerror(errno));
+            return -1;
+        }
+        done += n;
+    }
+    return lseek(fd, 0, SEEK_SET) ? -1 : 0;
+}
+
+/*
+ * Run the given tool with the given arguments, without a shell, and wait for
+ * it. in (unless -1) and out become its standard input and output, and the
+ * files in inputs its descriptors 3, 4, ..., which it can open as /dev/fd/3.
+ * Returns 0 if it exits with ec1 or ec2.
+ *
+ * The files are first duplicated above all those slots, so that moving one
+ * into its slot cannot replace another one that is still to be moved, and a
+ * file already in its slot loses its close-on-exec flag all the same.
+ */
+static int invoke_tool(const char *tool, std::vector<const char *> args, int in,
+                       int out, std::span<const int> inputs, int ec1, int ec2) {
+    posix_spawn_file_actions_t actions;
+    pid_t                      pid;
+    int                        status, r;
+    std::vector<int>           fds, slots;
+
+    std::string command = tool;
+    for (auto arg : args) {
+        command += std::string(" ") + arg;
+    }
+    INFO("Invoking command `%s`\n", command.c_str());
+
+    args.insert(args.begin(), tool);
+    args.push_back(nullptr);
+
+    if (in != -1) {
+        fds.push_back(in);
+        slots.push_back(STDIN_FILENO);
+    }
+    fds.push_back(out);
+    slots.push_back(STDOUT_FILENO);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        fds.push_back(inputs[i]);
+        slots.push_back(3 + i);
+    }
+
+    std::vector<int> moved;
+    for (int fd : fds) {
+        int copy = fcntl(fd, F_DUPFD_CLOEXEC, (int)(3 + inputs.size()));
+        if (copy == -1) {
+            ERROR("Failed to pass the files to `%s`: %s\n", command.c_str(),
+                  strerror(errno));
+            for (int fd : moved) {
+                close(fd);
+            }
+            return -1;
+        }
+        moved.push_back(copy);
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    for (size_t i = 0; i < moved.size(); i++) {
+        posix_spawn_file_actions_adddup2(&actions, moved[i], slots[i]);
+    }
+    r = posix_spawnp(&pid, tool, &actions, nullptr, (char *const *)args.data(),
+                     environ);
+    posix_spawn_file_actions_destroy(&actions);
+    for (int fd : moved) {
+        close(fd);
+    }
+
+    if (r) {
+        ERROR("Failed to execute command `%s`: %s. Is `%s` installed?\n",
+              command.c_str(), strerror(r), tool);
+        return -1;
+    }
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            ERROR("Failed to wait for command `%s`: %s\n", command.c_str(),
+                  strerror(errno));
+            return -1;
+        }
+    }
+    if (!WIFEXITED(status) ||
+        (WEXITSTATUS(status) != ec1 && WEXITSTATUS(status) != ec2)) {
+        ERROR("Command `%s` failed, status=%d. Is `%s` installed?\n",
+              command.c_str(), status, tool);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reads the normal format output of diff, one line at a time.
+ */
+class NormalDiffParser {
+private:
+    std::span<const std::byte> data;
+    size_t                     pos = 0;
+
+public:
+    NormalDiffParser(std::span<const std::byte> data) : data(data) {}
+
+    bool done() {
+        return pos == data.size();
+    }
+
+    char peek() {
+        return pos < data.size() ? (char)data[pos] : '\0';
+    }
+
+    bool expect(char c) {
+        if (peek() != c) {
+            return false;
+        }
+        pos++;
+        return true;
+    }
+
+    bool number(uint64_t &value) {
+        if (peek() < '0' || peek() > '9') {
+            return false;
+        }
+        value = 0;
+        while (peek() >= '0' && peek() <= '9') {
+            if (value > (UINT64_MAX - 9) / 10) {
+                return false;
+            }
+            value = value * 10 + (peek() - '0');
+            pos++;
+        }
+        return true;
+    }
+
+    /* A line number, or a range of them: "first" or "first,last". */
+    bool range(uint64_t &first, uint64_t &last) {
+        if (!number(first)) {
+            return false;
+        }
+        last = first;
+        return !expect(',') || (number(last) && last >= first);
+    }
+
+    static int hex_digit(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    /* A line holding a byte as printed by xxd: "<prefix> xx\n". */
+    bool byte_line(char prefix, std::byte &value) {
+        if (data.size() - pos < 5 || (char)data[pos] != prefix ||
+            (char)data[pos + 1] != ' ' || (char)data[pos + 4] != '\n') {
+            return false;
+        }
+        int high = hex_digit((char)data[pos + 2]);
+        int low = hex_digit((char)data[pos + 3]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        value = (std::byte)(high << 4 | low);
+        pos += 5;
+        return true;
+    }
+
+    /* Skip "\ No newline at end of file", which xxd output never needs. */
+    void skip_notes() {
+        while (peek() == '\\') {
+            while (!done() && !expect('\n')) {
+                pos++;
+            }
+        }
+    }
+};
+
+int SystemDiff::patch_bytes(std::span<const std::byte> file,
+                            std::span<const std::byte> diff,
+                            std::vector<std::byte>    &out) {
+    NormalDiffParser parser(diff);
+    uint64_t         copied = 0;
+
+    out.clear();
+    out.reserve(file.size() + diff.size() / 5);
+
+    while (!parser.done()) {
+        uint64_t first, last, new_first, new_last;
+        char     command;
+
+        if (!parser.range(first, last) || !(command = parser.peek()) ||
+            !parser.expect(command) || !parser.range(new_first, new_last) ||
+            !parser.expect('\n')) {
+            ERROR("Corrupted diff: invalid command.\n");
+            return -1;
+        }
+
+        /* Line n of the dump holds byte n - 1. "NaM" adds after line N. */
+        uint64_t start, end;
+        if (command == 'a') {
+            if (first != last) {
+                ERROR("Corrupted diff: invalid command.\n");
+                return -1;
+            }
+            start = end = first;
+        } else if (command == 'd' || command == 'c') {
+            if (!first) {
+                ERROR("Corrupted diff: invalid command.\n");
+                return -1;
+            }
+            start = first - 1;
+            end = last;
+        } else {
+            ERROR("Corrupted diff: unknown command '%c'.\n", command);
+            return -1;
+        }
+
+        if (start < copied || end > file.size()) {
+            ERROR("Corrupted diff: hunk out of order or past the end.\n");
+            return -1;
+        }
+        out.insert(out.end(), file.begin() + copied, file.begin() + start);
+
+        if (command != 'a') {
+            for (uint64_t i = start; i < end; i++) {
+                std::byte value;
+                if (!parser.byte_line('<', value)) {
+                    ERROR("Corrupted diff: invalid removed line.\n");
+                    return -1;
+                }
+                if (value != file[i]) {
+                    ERROR("The diff does not match: byte %zu differs.\n", (size_t)i);
+                    return -1;
+                }
+            }
+            parser.skip_notes();
+        }
+
+        if (command == 'c' &&
+            !(parser.expect('-') && parser.expect('-') && parser.expect('-') &&
+              parser.expect('\n'))) {
+            ERROR("Corrupted diff: missing separator.\n");
+            return -1;
+        }
+
+        if (command != 'd') {
+            if (new_first != out.size() + 1) {
+                ERROR("The diff does not match: hunk at the wrong place.\n");
+                return -1;
+            }
+            for (uint64_t i = new_first; i <= new_last; i++) {
+                std::byte value;
+                if (!parser.byte_line('>', value)) {
+                    ERROR("Corrupted diff: invalid added line.\n");
+                    return -1;
+                }
+                out.push_back(value);
+            }
+            parser.skip_notes();
+        } else if (new_first != out.size()) {
+            ERROR("The diff does not match: hunk at the wrong place.\n");
+            return -1;
+        }
+
+        copied = end;
+    }
+
+    out.insert(out.end(), file.begin() + copied, file.end());
+    return 0;
 }
 
 SystemDiff::SystemDiff() {
@@ -44,6 +338,7 @@ SystemDiff::SystemDiff() {
 
 int SystemDiff::from_files(const std::string &src, const std::string &dest) {
     int r = -1;
+    TRACE_SCOPE("diff", -1, dest);
 
     INFO("Constructing SystemDiff from files: %s and %s\n", src.c_str(),
          dest.c_str());
@@ -53,41 +348,32 @@ int SystemDiff::from_files(const std::string &src, const std::string &dest) {
         data.clear();
     }
 
-    char *src_temp = (char *)strdup("/tmp/.patchit.src.XXXXXX");
-    char *dest_temp = (char *)strdup("/tmp/.patchit.dest.XXXXXX");
-    char *diff_temp = (char *)strdup("/tmp/.patchit.diff.XXXXXX");
-    int   fd;
-
-    DEBUG("src_temp: %s, dest_temp: %s, diff_temp: %s\n", src_temp, dest_temp,
-          diff_temp);
-
-    if ((fd = mkstemp(src_temp)) == -1 || close(fd)) {
-        ERROR("Failed to make a unique temporary file for %s\n", src.c_str());
-        goto cleanup;
-    }
-    INFO("%s will be temporarily written to %s\n", src.c_str(), src_temp);
+    int                    dumps[2] = {-1, -1}, diff_fd = -1;
+    std::vector<std::byte> file, dump;
 
-    if ((fd = mkstemp(dest_temp)) == -1 || close(fd)) {
-        ERROR("Failed to make a unique temporary file for %s\n", dest.c_str());
+    if ((dumps[0] = memory_file("patchit-src")) == -1 ||
+        (dumps[1] = memory_file("patchit-dest")) == -1 ||
+        (diff_fd = memory_file("patchit-diff")) == -1) {
         goto cleanup;
     }
-    INFO("%s will be temporarily written to %s\n", dest.c_str(), dest_temp);
 
-    if ((fd = mkstemp(diff_temp)) == -1 || close(fd)) {
-        ERROR("Failed to make a unique temporary file for future diff.\n");
-        goto cleanup;
+    for (int i = 0; i < 2; i++) {
+        if (open_and_read_entire_file(i ? dest.c_str() : src.c_str(), file)) {
+            goto cleanup;
+        }
+        dump.clear();
+        hex_dump(file, dump);
+        if (write_memory_file(dumps[i], dump)) {
+            goto cleanup;
+        }
     }
-    INFO("SystemDiff will be temporarily written to %s\n", diff_temp);
 
-    if (invoke_tool("xxd", format(COMMAND_XXD, src.c_str(), src_temp), 0, 0) ||
-        invoke_tool("xxd", format(COMMAND_XXD, dest.c_str(), dest_temp), 0, 0) ||
-        invoke_tool("diff", format(COMMAND_DIFF, src_temp, dest_temp, diff_temp), 0,
-                    1) == 2) {
+    if (invoke_tool("diff", {"/dev/fd/3", "/dev/fd/4"}, -1, diff_fd, dumps, 0, 1)) {
         ERROR("Failed to execute the required commands.\n");
         goto cleanup;
     }
 
-    if (open_and_read_entire_file(diff_temp, data)) {
+    if (read_memory_file(diff_fd, data)) {
         goto cleanup;
     }
 
@@ -97,19 +383,11 @@ cleanup:
     if (r) {
         data.clear();
     }
-    if (!r) {
-        unlink(src_temp);
-        unlink(dest_temp);
-        unlink(diff_temp);
-    } else {
-        MSG("To debug the issue, please check the following files:\n");
-        MSG("    %s - temporary source file data\n", src_temp);
-        MSG("    %s - temporary destination file data\n", dest_temp);
-        MSG("    %s - temporary diff data\n", diff_temp);
+    for (int fd : {dumps[0], dumps[1], diff_fd}) {
+        if (fd != -1) {
+            close(fd);
+        }
     }
-    free(src_temp);
-    free(dest_temp);
-    free(diff_temp);
 
     if (!r) {
         MSG("Created a diff (%s -> %s): %s.\n", src.c_str(), dest.c_str(),
@@ -121,90 +399,118 @@ cleanup:
     return r;
 }
 
-std::vector<std::byte> SystemDiff::binary_representation() {
-    std::vector<std::byte> ret = compressor->compress(data);
-    ret.insert(ret.begin(), (std::byte)compressor->get_id());
-    return ret;
+void SystemDiff::write_binary_representation(std::vector<std::byte> &out) {
+    Compressor *selected = compressor->select(data);
+    out.push_back((std::byte)selected->get_id());
+    selected->compress_into(data, out);
 }
 
-// TODO: better error handling
-int SystemDiff::from_binary_representation(const std::vector<std::byte> &data) {
-    std::vector<std::byte> bytes;
-
+int SystemDiff::from_binary_representation(std::span<const std::byte> data,
+                                           const PatchContext        *context) {
     if (data.empty()) {
         ERROR("Empty data: missing compressor id\n");
         return -1;
     }
 
-    if ((int)data[0] == PlainCompressor::get()->get_id()) {
-        compressor = PlainCompressor::get();
-    } else if ((int)data[0] == ZLibCompressor::get()->get_id()) {
-        compressor = ZLibCompressor::get();
-    } else {
-        ERROR("Invalid compressor id: %d\n", (int)data[0]);
+    if (!(compressor = PatchContext::compressor_from_id((int)data[0], context))) {
         return -1;
     }
 
-    for (size_t i = 1; i < data.size(); i++) {
-        bytes.push_back(data[i]);
-    }
-    this->data = compressor->decompress(bytes);
-    return data.size() <= 1 ? !this->data.empty() : this->data.empty();
+    this->data.clear();
+    return compressor->decompress_into(data.subspan(1), this->data);
+}
+
+size_t SystemDiff::data_size() {
+    return data.size();
 }
 
 int SystemDiff::apply(const std::string &dest) {
-    int r = -1;
+    TRACE_SCOPE("patch", -1, dest);
 
     INFO("Applying SystemDiff to %s\n", dest.c_str());
     if (data.empty()) {
         WARN("Empty diff.\n");
     }
 
-    char *diff_temp = (char *)strdup("/tmp/.patchit.diff.XXXXXX");
-    char *file_temp = (char *)strdup("/tmp/.patchit.file.XXXXXX");
-    int   fd;
-    FILE *file = NULL;
+    std::vector<std::byte> file, patched;
+    if (open_and_read_entire_file(dest.c_str(), file)) {
+        ERROR("Failed to apply the diff to %s\n", dest.c_str());
+        return -1;
+    }
 
-    if ((fd = mkstemp(diff_temp)) == -1 || close(fd)) {
-        ERROR("Failed to make a unique temporary file for diff: %s\n",
-              strerror(errno));
-        goto cleanup;
+    if (patch_bytes(file, data, patched)) {
+        WARN("Cannot apply the diff to %s directly, trying the patch tool.\n",
+             dest.c_str());
+        return apply_with_tools(dest);
+    }
+
+    if (open_and_write_entire_file(dest.c_str(), patched)) {
+        ERROR("Failed to apply the diff to %s\n", dest.c_str());
+        return -1;
     }
-    INFO("SystemDiff will be temporarily written to %s\n", diff_temp);
 
-    if ((fd = mkstemp(file_temp)) == -1 || close(fd)) {
-        ERROR("Failed to make a unique temporary file for %s: %s\n", dest.c_str(),
-              strerror(errno));
+    MSG("Applied diff to %s\n", dest.c_str());
+    return 0;
+}
+
+Diff::ContentsUse SystemDiff::contents_use() {
+    return CONTENTS_READ;
+}
+
+/*
+ * A payload patch_bytes rejects is left to apply, which falls back to the
+ * patch tool.
+ */
+int SystemDiff::patch_contents(std::span<const std::byte> file,
+                               std::vector<std::byte>    &out) {
+    return patch_bytes(file, data, out) ? 1 : 0;
+}
+
+int SystemDiff::apply_with_tools(const std::string &dest) {
+    int                    r = -1;
+    int                    diff_fd = -1, dump_fd = -1, patched_fd = -1;
+    std::vector<std::byte> file, dump;
+
+    if ((diff_fd = memory_file("patchit-diff")) == -1 ||
+        (dump_fd = memory_file("patchit-dump")) == -1 ||
+        (patched_fd = memory_file("patchit-patched")) == -1 ||
+        write_memory_file(diff_fd, data)) {
         goto cleanup;
     }
-    INFO("%s will be temporarily written to %s\n", dest.c_str(), file_temp);
 
-    if (open_and_write_entire_file(diff_temp, data)) {
-        ERROR("Failed to write the diff file %s: %s\n", diff_temp, strerror(errno));
+    if (open_and_read_entire_file(dest.c_str(), file)) {
+        goto cleanup;
+    }
+    hex_dump(file, dump);
+    if (write_memory_file(dump_fd, dump)) {
         goto cleanup;
     }
-    file = NULL;
 
-    if (invoke_tool("xxd", format(COMMAND_XXD, dest.c_str(), file_temp), 0, 0) ||
-        invoke_tool("patch", format(COMMAND_PATCH, file_temp, diff_temp), 0, 0) ||
-        invoke_tool("xxd", format(COMMAND_XXD_REVERSE, file_temp, dest.c_str()), 0,
-                    0)) {
+    /*
+     * patch reads the dump through a link in /dev/fd, and writes the patched
+     * dump out, discarding rejects.
+     */
+    if (invoke_tool("patch",
+                    {"-f", "-s", "--follow-symlinks", "-r", "-", "-o", "-",
+                     "/dev/fd/3"},
+                    diff_fd, patched_fd, {&dump_fd, 1}, 0, 0)) {
         ERROR("Failed to execute the required commands.\n");
         goto cleanup;
     }
 
+    file.clear();
+    if (read_memory_file(patched_fd, dump) || hex_undump(dump, file) ||
+        open_and_write_entire_file(dest.c_str(), file)) {
+        goto cleanup;
+    }
+
     r = 0;
 
 cleanup:
-    if (file)
-        std::fclose(file);
-    if (!r) {
-        unlink(file_temp);
-        unlink(diff_temp);
-    } else {
-        MSG("To debug the issue, please check the following files:\n");
-        MSG("    %s - temporary SystemDiff data\n", diff_temp);
-        MSG("    %s - temporary destionation file data\n", file_temp);
+    for (int fd : {diff_fd, dump_fd, patched_fd}) {
+        if (fd != -1) {
+            close(fd);
+        }
     }
 
     if (!r) {
@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <error.hpp>
+#include <trace.hpp>
+
+static const size_t DEFAULT_RING_CAPACITY = 1 << 16;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static std::string escape_json(const std::string &s) {
+    std::string res;
+    char        buf[8];
+
+    for (char c : s) {
+        switch (c) {
+        case '"':
+            res += "\\\"";
+            break;
+        case '\\':
+            res += "\\\\";
+            break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                snprintf(buf, sizeof(buf), "\\u%04x", (int)c);
+                res += buf;
+            } else {
+                res += c;
+            }
+        }
+    }
+    return res;
+}
+
+Tracer::Tracer() {
+    enabled = false;
+    ring_capacity = DEFAULT_RING_CAPACITY;
+}
+
+std::shared_ptr<Tracer> Tracer::get() {
+    static std::shared_ptr<Tracer> instance(new Tracer());
+    return instance;
+}
+
+void Tracer::enable() {
+    enabled.store(true, std::memory_order_release);
+}
+
+bool Tracer::is_enabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void Tracer::set_ring_capacity(size_t capacity) {
+    std::lock_guard<std::mutex> guard(rings_lock);
+    ring_capacity = capacity ? capacity : 1;
+}
+
+Tracer::Ring *Tracer::thread_ring() {
+    /*
+     * Rings are owned by the tracer, so events of threads that have already
+     * exited are still written out.
+     */
+    thread_local Ring *ring = nullptr;
+
+    if (!ring) {
+        auto r = std::make_shared<Ring>();
+        r->head = 0;
+        r->tid = syscall(SYS_gettid);
+
+        std::lock_guard<std::mutex> guard(rings_lock);
+        r->events.resize(ring_capacity);
+        rings.push_back(r);
+        ring = r.get();
+    }
+    return ring;
+}
+
+void Tracer::record(const char *name, char phase, int64_t index,
+                    std::string_view path) {
+    Ring    *ring = thread_ring();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Event   &event = ring->events[head % ring->events.size()];
+
+    event.name = name;
+    event.phase = phase;
+    event.timestamp = now_ns();
+    event.index = index;
+    event.path = path;
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+int Tracer::write_to_file(const std::string &file) {
+    INFO("Writing trace to file: %s\n", file.c_str());
+    FILE *fd = std::fopen(file.c_str(), "w");
+    if (!fd) {
+        ERROR("Failed to open %s: %s\n", file.c_str(), strerror(errno));
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> guard(rings_lock);
+    bool                        first = true;
+    long                        pid = getpid();
+
+    std::fprintf(fd, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (auto &ring : rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t size = ring->events.size();
+        uint64_t begin = head > size ? head - size : 0;
+        uint64_t depth = 0;
+
+        for (uint64_t i = begin; i < head; i++) {
+            const Event &event = ring->events[i % size];
+
+            /* The scopes of a thread nest, so an unmatched end comes first. */
+            if (event.phase == 'B') {
+                depth++;
+            } else if (!depth) {
+                continue;
+            } else {
+                depth--;
+            }
+            std::fprintf(fd,
+                         "%s\n{\"name\":\"%s\",\"cat\":\"patchit\",\"ph\":\"%c\","
+                         "\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld,\"args\":{",
+                         first ? "" : ",", event.name, event.phase,
+                         event.timestamp / 1000.0, pid, ring->tid);
+            if (event.index >= 0) {
+                std::fprintf(fd, "\"index\":%lld%s", (long long)event.index,
+                             event.path.empty() ? "" : ",");
+            }
+            if (!event.path.empty()) {
+                std::fprintf(fd, "\"path\":\"%s\"", escape_json(event.path).c_str());
+            }
+            std::fprintf(fd, "}}");
+            first = false;
+        }
+    }
+    std::fprintf(fd, "\n]}\n");
+
+    int err = std::ferror(fd);
+    if (std::fclose(fd) || err) {
+        ERROR("Failed to write %s: %s\n", file.c_str(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+TraceScope::TraceScope(const char *name, int64_t index, std::string_view path) {
+    this->name = name;
+    this->active = Tracer::get()->is_enabled();
+    if (active) {
+        Tracer::get()->record(name, 'B', index, path);
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (active) {
+        Tracer::get()->record(name, 'E', -1, {});
+    }
+}
@@ -0,0 +1,542 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <error.hpp>
+#include <io.hpp>
+#include <trace.hpp>
+
+/*
+ * liburing is not required: the few system calls used here are invoked
+ * directly.
+ */
+
+static const uint32_t ring_entries = 64;
+
+/* A single read or write transfers at most this many bytes. */
+static const size_t max_transfer = 1 << 30;
+
+static int io_uring_setup(uint32_t entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                          uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                        NULL, 0);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void statx_to_stat(const struct statx &stx, struct stat &sb) {
+    memset(&sb, 0, sizeof(sb));
+    sb.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    sb.st_ino = stx.stx_ino;
+    sb.st_mode = stx.stx_mode;
+    sb.st_nlink = stx.stx_nlink;
+    sb.st_uid = stx.stx_uid;
+    sb.st_gid = stx.stx_gid;
+    sb.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    sb.st_size = stx.stx_size;
+    sb.st_blksize = stx.stx_blksize;
+    sb.st_blocks = stx.stx_blocks;
+    sb.st_atim.tv_sec = stx.stx_atime.tv_sec;
+    sb.st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+    sb.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    sb.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    sb.st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+    sb.st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+}
+
+UringIO::UringIO() {
+    ring_fd = -1;
+    ring_ptr = MAP_FAILED;
+    ring_size = 0;
+    sqes = MAP_FAILED;
+    sqes_size = 0;
+    queued = 0;
+    broken = false;
+    in_flight = 0;
+}
+
+UringIO::~UringIO() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqes_size);
+    }
+    if (ring_ptr != MAP_FAILED) {
+        munmap(ring_ptr, ring_size);
+    }
+    if (ring_fd != -1) {
+        close(ring_fd);
+    }
+}
+
+int UringIO::setup() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    if ((ring_fd = io_uring_setup(ring_entries, &params)) < 0) {
+        ring_fd = -1;
+        DEBUG("io_uring_setup: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        DEBUG("io_uring: the kernel is too old.\n");
+        return -1;
+    }
+
+    ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                         params.cq_off.cqes +
+                             params.cq_entries * sizeof(struct io_uring_cqe));
+    ring_ptr = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd, IORING_OFF_SQES);
+    if (ring_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+        DEBUG("io_uring: mmap: %s\n", strerror(errno));
+        return -1;
+    }
+
+    char *base = (char *)ring_ptr;
+    sq_entries = params.sq_entries;
+    sq_head = (uint32_t *)(base + params.sq_off.head);
+    sq_tail = (uint32_t *)(base + params.sq_off.tail);
+    sq_mask = (uint32_t *)(base + params.sq_off.ring_mask);
+    sq_array = (uint32_t *)(base + params.sq_off.array);
+    cq_head = (uint32_t *)(base + params.cq_off.head);
+    cq_tail = (uint32_t *)(base + params.cq_off.tail);
+    cq_mask = (uint32_t *)(base + params.cq_off.ring_mask);
+    cqes = base + params.cq_off.cqes;
+
+    const int              max_ops = 256;
+    std::vector<std::byte> buffer(sizeof(struct io_uring_probe) +
+                                  max_ops * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe *probe = (struct io_uring_probe *)buffer.data();
+
+    if (io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, max_ops) < 0) {
+        DEBUG("io_uring: probe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (int op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                   IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            DEBUG("io_uring: operation %d is not supported.\n", op);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+std::shared_ptr<UringIO> UringIO::get() {
+    thread_local std::shared_ptr<UringIO> instance;
+    thread_local bool                     initialized = false;
+
+    if (!initialized) {
+        initialized = true;
+        instance.reset(new UringIO());
+        if (instance->setup()) {
+            INFO("io_uring is not available.\n");
+            instance.reset();
+        }
+    }
+    if (instance && instance->broken) {
+        INFO("io_uring failed, using stdio from now on.\n");
+        instance.reset();
+    }
+    return instance;
+}
+
+const char *UringIO::name() {
+    return "uring";
+}
+
+void *UringIO::queue(uint8_t opcode, int fd, uint64_t user_data) {
+    uint32_t              tail = *sq_tail;
+    uint32_t              index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)sqes + index;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    sq_array[index] = index;
+
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+    return sqe;
+}
+
+void UringIO::reap(std::vector<int> &results, uint32_t &completed) {
+    uint32_t head = *cq_head;
+    uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = (struct io_uring_cqe *)cqes + (head & *cq_mask);
+        if (cqe->user_data < results.size()) {
+            results[cqe->user_data] = cqe->res;
+        }
+        completed++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+int UringIO::submit_and_wait(std::vector<int> &results) {
+    uint32_t submitted = 0, completed = 0;
+
+    while (completed < queued) {
+        int r = io_uring_enter(ring_fd, queued - submitted, queued - completed,
+                               IORING_ENTER_GETEVENTS);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERROR("io_uring_enter: %s\n", strerror(errno));
+            break;
+        }
+        submitted += r;
+        reap(results, completed);
+    }
+    if (completed == queued) {
+        queued = 0;
+        return 0;
+    }
+
+    /*
+     * Drop what the kernel has not taken, and wait for the rest, so that no
+     * completion is left for the next batch and no buffer is still in use.
+     */
+    uint32_t head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    submitted = queued - (*sq_tail - head);
+    __atomic_store_n(sq_tail, head, __ATOMIC_RELEASE);
+    while (completed < submitted) {
+        if (io_uring_enter(ring_fd, 0, submitted - completed, IORING_ENTER_GETEVENTS) <
+                0 &&
+            errno != EINTR) {
+            ERROR("io_uring_enter: %s\n", strerror(errno));
+            in_flight = submitted - completed;
+            break;
+        }
+        reap(results, completed);
+    }
+
+    broken = true;
+    queued = 0;
+    return -1;
+}
+
+template <typename Request>
+int UringIO::fall_back(std::vector<Request> &batch, size_t first, int res,
+                       int (PosixIO::*process)(std::vector<Request> &)) {
+    if (in_flight) {
+        for (size_t i = first; i < batch.size(); i++) {
+            batch[i].error = EIO;
+        }
+        return -1;
+    }
+
+    std::vector<Request> rest(std::make_move_iterator(batch.begin() + first),
+                              std::make_move_iterator(batch.end()));
+    int r = (PosixIO::get().get()->*process)(rest);
+    std::move(rest.begin(), rest.end(), batch.begin() + first);
+    return r ? -1 : res;
+}
+
+/*
+ * Close the descriptors left open by a batch on which the ring failed.
+ */
+static void close_fds(const std::vector<int> &fds) {
+    for (int fd : fds) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+int UringIO::stat_files(std::vector<StatRequest> &batch) {
+    TRACE_SCOPE("stat", batch.size());
+    int res = 0;
+
+    if (broken) {
+        return fall_back(batch, 0, 0, &PosixIO::stat_files);
+    }
+
+    for (size_t first = 0; first < batch.size(); first += sq_entries) {
+        size_t                    n = std::min((size_t)sq_entries, batch.size() - first);
+        std::vector<struct statx> stx(n);
+        std::vector<int>          results(n, -ECANCELED);
+
+        for (size_t i = 0; i < n; i++) {
+            auto sqe = (struct io_uring_sqe *)queue(IORING_OP_STATX, AT_FDCWD, i);
+            sqe->addr = (uint64_t)batch[first + i].path.c_str();
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (uint64_t)&stx[i];
+        }
+        if (submit_and_wait(results)) {
+            return fall_back(batch, first, res, &PosixIO::stat_files);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            StatRequest &request = batch[first + i];
+            request.error = results[i] < 0 ? -results[i] : 0;
+            if (request.error) {
+                res = -1;
+            } else {
+                statx_to_stat(stx[i], request.sb);
+            }
+        }
+    }
+    return res;
+}
+
+/*
+ * Reading takes three rounds for the whole batch: opening and sizing every
+ * file, reading them (repeated only for short reads) and closing them.
+ */
+int UringIO::read_files(std::vector<ReadRequest> &batch) {
+    TRACE_SCOPE("read", batch.size());
+    int res = 0;
+
+    if (broken) {
+        return fall_back(batch, 0, 0, &PosixIO::read_files);
+    }
+
+    for (size_t first = 0; first < batch.size(); first += sq_entries / 2) {
+        size_t n = std::min((size_t)sq_entries / 2, batch.size() - first);
+        std::vector<struct statx> stx(n);
+        std::vector<int>          fds(n, -1);
+        std::vector<size_t>       done(n, 0);
+        std::vector<int>          results(2 * n, -ECANCELED);
+
+        for (size_t i = 0; i < n; i++) {
+            const char *path = batch[first + i].path.c_str();
+            auto sqe = (struct io_uring_sqe *)queue(IORING_OP_OPENAT, AT_FDCWD, 2 * i);
+            sqe->addr = (uint64_t)path;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+            sqe = (struct io_uring_sqe *)queue(IORING_OP_STATX, AT_FDCWD, 2 * i + 1);
+            sqe->addr = (uint64_t)path;
+            sqe->len = STATX_SIZE;
+            sqe->off = (uint64_t)&stx[i];
+        }
+        if (submit_and_wait(results)) {
+            for (size_t i = 0; i < n; i++) {
+                fds[i] = results[2 * i] >= 0 ? results[2 * i] : -1;
+            }
+            close_fds(fds);
+            return fall_back(batch, first, res, &PosixIO::read_files);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            ReadRequest &request = batch[first + i];
+            request.error = 0;
+            if (results[2 * i] < 0 || results[2 * i + 1] < 0) {
+                request.error = results[2 * i] < 0 ? -results[2 * i]
+                                                   : -results[2 * i + 1];
+                ERROR("Failed to open %s: %s\n", request.path.c_str(),
+                      strerror(request.error));
+            }
+            if (results[2 * i] >= 0) {
+                fds[i] = results[2 * i];
+            }
+            if (request.error) {
+                continue;
+            }
+
+            try {
+                request.data.resize(stx[i].stx_size);
+            } catch (...) {
+                ERROR("Failed to read %s. Likely out of memory.\n",
+                      request.path.c_str());
+                request.error = ENOMEM;
+            }
+        }
+
+        for (;;) {
+            std::fill(results.begin(), results.end(), -ECANCELED);
+            for (size_t i = 0; i < n; i++) {
+                ReadRequest &request = batch[first + i];
+                if (request.error || done[i] == request.data.size()) {
+                    continue;
+                }
+                auto sqe = (struct io_uring_sqe *)queue(IORING_OP_READ, fds[i], i);
+                sqe->addr = (uint64_t)(request.data.data() + done[i]);
+                sqe->len = std::min(request.data.size() - done[i], max_transfer);
+                sqe->off = done[i];
+            }
+            if (!queued) {
+                break;
+            }
+            if (submit_and_wait(results)) {
+                close_fds(fds);
+                return fall_back(batch, first, res, &PosixIO::read_files);
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                ReadRequest &request = batch[first + i];
+                if (request.error || done[i] == request.data.size()) {
+                    continue;
+                }
+                if (results[i] < 0) {
+                    request.error = -results[i];
+                    ERROR("Failed to read %s: %s\n", request.path.c_str(),
+                          strerror(request.error));
+                } else if (results[i] == 0) {
+                    /* The file was truncated meanwhile. */
+                    request.data.resize(done[i]);
+                } else {
+                    done[i] += results[i];
+                }
+            }
+        }
+
+        std::fill(results.begin(), results.end(), -ECANCELED);
+        for (size_t i = 0; i < n; i++) {
+            if (fds[i] != -1) {
+                queue(IORING_OP_CLOSE, fds[i], i);
+            }
+        }
+        if (submit_and_wait(results)) {
+            for (size_t i = 0; i < n; i++) {
+                if (results[i] != -ECANCELED) {
+                    fds[i] = -1;
+                }
+            }
+            close_fds(fds);
+            return fall_back(batch, first, res, &PosixIO::read_files);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (batch[first + i].error) {
+                res = -1;
+            }
+        }
+    }
+    return res;
+}
+
+/*
+ * Like reading, writing takes three rounds: opening, writing and closing. The
+ * fsync of a file is linked to its close, so both fit into the last round.
+ */
+int UringIO::write_files(std::vector<WriteRequest> &batch) {
+    TRACE_SCOPE("write", batch.size());
+    int res = 0;
+
+    if (broken) {
+        return fall_back(batch, 0, 0, &PosixIO::write_files);
+    }
+
+    for (size_t first = 0; first < batch.size(); first += sq_entries / 2) {
+        size_t              n = std::min((size_t)sq_entries / 2, batch.size() - first);
+        std::vector<int>    fds(n, -1);
+        std::vector<size_t> done(n, 0);
+        std::vector<int>    results(2 * n, -ECANCELED);
+
+        for (size_t i = 0; i < n; i++) {
+            auto sqe = (struct io_uring_sqe *)queue(IORING_OP_OPENAT, AT_FDCWD, i);
+            sqe->addr = (uint64_t)batch[first + i].path.c_str();
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+            sqe->len = 0666;
+        }
+        if (submit_and_wait(results)) {
+            for (size_t i = 0; i < n; i++) {
+                fds[i] = results[i] >= 0 ? results[i] : -1;
+            }
+            close_fds(fds);
+            return fall_back(batch, first, res, &PosixIO::write_files);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            WriteRequest &request = batch[first + i];
+            request.error = 0;
+            if (results[i] < 0) {
+                request.error = -results[i];
+                ERROR("Failed to open %s: %s\n", request.path.c_str(),
+                      strerror(request.error));
+            } else {
+                fds[i] = results[i];
+            }
+        }
+
+        for (;;) {
+            std::fill(results.begin(), results.end(), -ECANCELED);
+            for (size_t i = 0; i < n; i++) {
+                WriteRequest &request = batch[first + i];
+                if (request.error || done[i] == request.data->size()) {
+                    continue;
+                }
+                auto sqe = (struct io_uring_sqe *)queue(IORING_OP_WRITE, fds[i], i);
+                sqe->addr = (uint64_t)(request.data->data() + done[i]);
+                sqe->len = std::min(request.data->size() - done[i], max_transfer);
+                sqe->off = done[i];
+            }
+            if (!queued) {
+                break;
+            }
+            if (submit_and_wait(results)) {
+                close_fds(fds);
+                return fall_back(batch, first, res, &PosixIO::write_files);
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                WriteRequest &request = batch[first + i];
+                if (request.error || done[i] == request.data->size()) {
+                    continue;
+                }
+                if (results[i] <= 0) {
+                    request.error = results[i] ? -results[i] : EIO;
+                    ERROR("Failed to write %s: %s\n", request.path.c_str(),
+                          strerror(request.error));
+                } else {
+                    done[i] += results[i];
+                }
+            }
+        }
+
+        std::fill(results.begin(), results.end(), 0);
+        for (size_t i = 0; i < n; i++) {
+            if (fds[i] == -1) {
+                continue;
+            }
+            if (batch[first + i].sync && !batch[first + i].error) {
+                auto sqe = (struct io_uring_sqe *)queue(IORING_OP_FSYNC, fds[i], 2 * i);
+                sqe->flags = IOSQE_IO_HARDLINK;
+            }
+            queue(IORING_OP_CLOSE, fds[i], 2 * i + 1);
+            results[2 * i + 1] = -ECANCELED;
+        }
+        if (submit_and_wait(results)) {
+            for (size_t i = 0; i < n; i++) {
+                if (results[2 * i + 1] != -ECANCELED) {
+                    fds[i] = -1;
+                }
+            }
+            close_fds(fds);
+            return fall_back(batch, first, res, &PosixIO::write_files);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            WriteRequest &request = batch[first + i];
+            if (!request.error && (results[2 * i] < 0 || results[2 * i + 1] < 0)) {
+                bool sync_failed = results[2 * i] < 0;
+                request.error = sync_failed ? -results[2 * i] : -results[2 * i + 1];
+                ERROR("Failed to %s %s: %s\n", sync_failed ? "sync" : "write",
+                      request.path.c_str(), strerror(request.error));
+            }
+            if (request.error) {
+                res = -1;
+            }
+        }
+    }
+    return res;
+}
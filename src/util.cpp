@@ -1,9 +1,15 @@
 #include <errno.h>
+#include <unistd.h>
 
 #include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <cstring>
 #include <error.hpp>
+#include <io.hpp>
 #include <sstream>
+#include <trace.hpp>
 #include <util.hpp>
 
 std::string shorten_size(size_t bytes) {
@@ -28,8 +34,45 @@ std::string shorten_size(size_t bytes) {
     return std::move(out).str() + " " + selected;
 }
 
+int parse_size(const char *str, size_t &value) {
+    char              *end;
+    unsigned long long res;
+
+    if (!str || !isdigit((unsigned char)*str)) {
+        return -1;
+    }
+
+    errno = 0;
+    res = strtoull(str, &end, 10);
+    if (errno) {
+        return -1;
+    }
+
+    int shift = 0;
+    switch (*end) {
+    case 'T':
+        shift += 10;
+    case 'G':
+        shift += 10;
+    case 'M':
+        shift += 10;
+    case 'K':
+        shift += 10;
+        end++;
+        break;
+    }
+
+    if (*end || (shift && res > (~0ull >> shift))) {
+        return -1;
+    }
+
+    value = res << shift;
+    return 0;
+}
+
 int read_entire_file(const char *filename, FILE *fd,
                      std::vector<std::byte> &buffer) {
+    TRACE_SCOPE("read", -1, filename);
     long pos;
 
     if (std::fseek(fd, 0, SEEK_END) || (pos = std::ftell(fd)) == -1 ||
@@ -54,24 +97,20 @@ int read_entire_file(const char *filename, FILE *fd,
 }
 
 int open_and_read_entire_file(const char *filename, std::vector<std::byte> &buffer) {
-    FILE *fd = nullptr;
-
-    if (!(fd = std::fopen(filename, "r"))) {
-        ERROR("Failed to open %s: %s\n", filename, strerror(errno));
-        return -1;
-    }
+    std::vector<FileIO::ReadRequest> batch(1);
+    batch[0].path = filename;
 
-    if (read_entire_file(filename, fd, buffer)) {
-        std::fclose(fd);
+    if (FileIO::get()->read_files(batch)) {
         return -1;
     }
 
-    std::fclose(fd);
+    buffer = std::move(batch[0].data);
     return 0;
 }
 
 int write_entire_file(const char *filename, FILE *fd,
                       const std::vector<std::byte> &buffer) {
+    TRACE_SCOPE("write", -1, filename);
     if (std::fseek(fd, 0, SEEK_SET) ||
         (std::fwrite(buffer.data(), buffer.size(), 1, fd) != 1 && std::ferror(fd))) {
         ERROR("Failed to write %s: %s\n", filename, strerror(errno));
@@ -83,20 +122,12 @@ int write_entire_file(const char *filename, FILE *fd,
 
 int open_and_write_entire_file(const char                   *filename,
                                const std::vector<std::byte> &buffer) {
-    FILE *fd = nullptr;
+    std::vector<FileIO::WriteRequest> batch(1);
+    batch[0].path = filename;
+    batch[0].data = &buffer;
+    batch[0].sync = false;
 
-    if (!(fd = std::fopen(filename, "w"))) {
-        ERROR("Failed to open %s: %s\n", filename, strerror(errno));
-        return -1;
-    }
-
-    if (write_entire_file(filename, fd, buffer)) {
-        std::fclose(fd);
-        return -1;
-    }
-
-    std::fclose(fd);
-    return 0;
+    return FileIO::get()->write_files(batch);
 }
 
 void handle_unknown_option(int optind, char optopt, char **argv) {
@@ -116,6 +147,11 @@ void store_uint64_t(uint64_t value, std::vector<std::byte> &data) {
     }
 }
 
+void store_string(const std::string &value, std::vector<std::byte> &data) {
+    const std::byte *begin = (const std::byte *)value.c_str();
+    data.insert(data.end(), begin, begin + value.size() + 1);
+}
+
 int restore_uint64_t(std::vector<std::byte>::iterator       &it,
                      const std::vector<std::byte>::iterator &end_it,
                      uint64_t                               &value) {
@@ -134,6 +170,113 @@ int restore_uint64_t(std::vector<std::byte>::iterator       &it,
     return 0;
 }
 
+void store_varint(uint64_t value, std::vector<std::byte> &data) {
+    while (value >= 0x80) {
+        data.push_back((std::byte)(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back((std::byte)value);
+}
+
+int restore_varint(std::span<const std::byte> data, size_t &offset, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && offset < data.size(); shift += 7) {
+        uint8_t byte = (uint8_t)data[offset++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void store_uint32_t(uint32_t value, std::vector<std::byte> &data) {
+    for (int i = 0; i < 4; i++) {
+        data.push_back((std::byte)(value & 0xFF));
+        value >>= 8;
+    }
+}
+
+int restore_uint32_t(std::span<const std::byte> data, size_t &offset, uint32_t &value) {
+    if (offset > data.size() || data.size() - offset < 4) {
+        return -1;
+    }
+    value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = value << 8 | (uint32_t)data[offset + i];
+    }
+    offset += 4;
+    return 0;
+}
+
+int read_at(int fd, void *data, size_t size, uint64_t offset) {
+    std::byte *bytes = (std::byte *)data;
+    while (size) {
+        ssize_t n = pread(fd, bytes, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int write_at(int fd, const void *data, size_t size, uint64_t offset) {
+    const std::byte *bytes = (const std::byte *)data;
+    while (size) {
+        ssize_t n = pwrite(fd, bytes, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int find_data_extents(int fd, uint64_t size, std::vector<FileExtent> &extents) {
+    extents.clear();
+    for (uint64_t offset = 0; offset < size;) {
+        off_t data = lseek(fd, offset, SEEK_DATA);
+        if (data == -1 && errno == ENXIO) {
+            /* Only a hole is left. */
+            break;
+        } else if (data == -1 && errno == EINVAL) {
+            extents.push_back({offset, size - offset});
+            break;
+        } else if (data == -1) {
+            return -1;
+        }
+
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1) {
+            return -1;
+        }
+        uint64_t end = std::min<uint64_t>(hole, size);
+        if ((uint64_t)data >= end) {
+            break;
+        }
+        extents.push_back({(uint64_t)data, end - data});
+        offset = end;
+    }
+    return 0;
+}
+
 void mkdirr(char *path, mode_t mode) {
     char *ptr = strrchr(path, '/');
 
@@ -0,0 +1,153 @@
+#include <lzma.h>
+
+#include <compressor.hpp>
+#include <error.hpp>
+#include <trace.hpp>
+#include <util.hpp>
+
+/*
+ * The encoder of the calling thread. liblzma keeps the memory of an encoder
+ * initialized again with the same filters, which for the higher presets is
+ * hundreds of megabytes.
+ */
+struct ThreadEncoder {
+    lzma_stream stream = LZMA_STREAM_INIT;
+
+    ~ThreadEncoder() {
+        lzma_end(&stream);
+    }
+};
+
+static thread_local ThreadEncoder encoder;
+
+XzCompressor::XzCompressor(uint32_t preset, int threads)
+    : preset(preset), threads(threads) {
+}
+
+std::shared_ptr<XzCompressor> XzCompressor::get() {
+    static std::shared_ptr<XzCompressor> instance(new XzCompressor(LZMA_PRESET_DEFAULT));
+    return instance;
+}
+
+int XzCompressor::get_id() {
+    return id;
+}
+
+int XzCompressor::compress_into(std::span<const std::byte> data,
+                                std::vector<std::byte>    &out) {
+    TRACE_SCOPE("compress");
+    size_t            old_size = out.size();
+    lzma_stream      *stream = &encoder.stream;
+    lzma_options_lzma options;
+    lzma_ret          ret;
+
+    if (lzma_lzma_preset(&options, preset)) {
+        ERROR("xz failed: invalid preset %u\n", preset);
+        return -1;
+    }
+
+    /* The blocks of the multithreaded encoder hold three dictionaries. */
+    if (threads > 1 && data.size() >= 6 * (uint64_t)options.dict_size) {
+        lzma_mt mt = {};
+        mt.threads = threads;
+        mt.preset = preset;
+        mt.check = LZMA_CHECK_CRC64;
+        ret = lzma_stream_encoder_mt(stream, &mt);
+    } else {
+        ret = lzma_easy_encoder(stream, preset, LZMA_CHECK_CRC64);
+    }
+    if (ret == LZMA_MEM_ERROR) {
+        ERROR("xz failed: out of memory\n");
+        return -1;
+    } else if (ret != LZMA_OK) {
+        ERROR("xz failed: cannot initialize the encoder (%d)\n", (int)ret);
+        return -1;
+    }
+
+    try {
+        out.resize(old_size + lzma_stream_buffer_bound(data.size()));
+    } catch (...) {
+        ERROR("Out of memory.\n");
+        out.resize(old_size);
+        return -1;
+    }
+
+    stream->next_in = (const uint8_t *)data.data();
+    stream->avail_in = data.size();
+    stream->next_out = (uint8_t *)out.data() + old_size;
+    stream->avail_out = out.size() - old_size;
+    while ((ret = lzma_code(stream, LZMA_FINISH)) == LZMA_OK) {
+        if (stream->avail_out) {
+            continue;
+        }
+        /* Blocks compressed in parallel can take a little more than the bound. */
+        try {
+            out.resize(out.size() + out.size() / 8 + 4096);
+        } catch (...) {
+            ERROR("Out of memory.\n");
+            out.resize(old_size);
+            return -1;
+        }
+        stream->next_out = (uint8_t *)out.data() + old_size + stream->total_out;
+        stream->avail_out = out.size() - old_size - stream->total_out;
+    }
+
+    if (ret != LZMA_STREAM_END) {
+        ERROR("xz failed: %s\n", ret == LZMA_MEM_ERROR ? "out of memory" : "cannot compress");
+        out.resize(old_size);
+        return -1;
+    }
+
+    out.resize(old_size + stream->total_out);
+
+    /* Insert original size. */
+    store_uint64_t((uint64_t)data.size(), out);
+
+    MSG("xz compressed: %s -> %s\n", shorten_size(data.size()).c_str(),
+        shorten_size(out.size() - old_size).c_str());
+    return 0;
+}
+
+int XzCompressor::decompress_into(std::span<const std::byte> data,
+                                  std::vector<std::byte>    &out) {
+    TRACE_SCOPE("decompress");
+    size_t   old_size = out.size();
+    uint64_t dest_size = 0;
+
+    if (data.size() < 8) {
+        ERROR("Corrupted data: less than 8 bytes\n");
+        return -1;
+    }
+
+    /* The original size is stored little-endian after the compressed stream. */
+    for (int i = 7; i >= 0; i--) {
+        dest_size = dest_size << 8 | (uint64_t)data[data.size() - 8 + i];
+    }
+
+    try {
+        out.resize(old_size + dest_size);
+    } catch (...) {
+        ERROR("Out of memory.\n");
+        out.resize(old_size);
+        return -1;
+    }
+
+    uint64_t memory_limit = UINT64_MAX;
+    size_t   in_pos = 0, out_pos = 0;
+    lzma_ret ret = lzma_stream_buffer_decode(
+        &memory_limit, 0, nullptr, (const uint8_t *)data.data(), &in_pos, data.size() - 8,
+        (uint8_t *)out.data() + old_size, &out_pos, dest_size);
+
+    /* A wrong original size cannot be told apart: liblzma rewinds on errors. */
+    if (ret == LZMA_MEM_ERROR) {
+        ERROR("xz failed: out of memory\n");
+    } else if (ret != LZMA_OK || out_pos != dest_size || in_pos != data.size() - 8) {
+        ERROR("xz failed: corrupted data\n");
+        ret = LZMA_DATA_ERROR;
+    }
+    if (ret != LZMA_OK) {
+        out.resize(old_size);
+        return -1;
+    }
+    return 0;
+}
@@ -2,16 +2,17 @@
 
 #include <compressor.hpp>
 #include <error.hpp>
+#include <trace.hpp>
 #include <util.hpp>
+#include <zlib_streams.hpp>
 
-ZLibCompressor::ZLibCompressor() {
+ZLibCompressor::ZLibCompressor(int level, int strategy)
+    : level(level), strategy(strategy) {
 }
 
 std::shared_ptr<ZLibCompressor> ZLibCompressor::get() {
-    static std::shared_ptr<ZLibCompressor> instance;
-    if (!instance) {
-        instance.reset(new ZLibCompressor());
-    }
+    static std::shared_ptr<ZLibCompressor> instance(
+        new ZLibCompressor(Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY));
     return instance;
 }
 
@@ -19,80 +20,55 @@ int ZLibCompressor::get_id() {
     return 1;
 }
 
-std::vector<std::byte> ZLibCompressor::compress(const std::vector<std::byte> &data) {
-    std::vector<std::byte> ret;
-
-    try {
-        ret.resize(compressBound(data.size()));
-    } catch (...) {
-        ERROR("Out of memory.\n");
-        return {};
-    }
-
-    uLong comprLen = ret.size();
-    int   err = ::compress((Byte *)ret.data(), &comprLen, (const Bytef *)data.data(),
-                           data.size());
+int ZLibCompressor::compress_into(std::span<const std::byte> data,
+                                  std::vector<std::byte>    &out) {
+    TRACE_SCOPE("compress");
+    size_t old_size = out.size();
 
-    if (err == Z_MEM_ERROR) {
-        ERROR("Zlib failed: out of memory\n");
-        return {};
-    } else if (err == Z_BUF_ERROR) {
-        ERROR("Zlib failed: compresBound gave incorrect estimate\n");
-        return {};
+    if (zlib_deflate(data, out, level, strategy) != 0) {
+        return -1;
     }
 
-    ret.resize(comprLen);
-
     /* Insert original size. */
-    store_uint64_t((uint64_t)data.size(), ret);
+    store_uint64_t((uint64_t)data.size(), out);
 
     MSG("ZLib compressed: %s -> %s\n", shorten_size(data.size()).c_str(),
-        shorten_size(ret.size()).c_str());
+        shorten_size(out.size() - old_size).c_str());
 
-    return ret;
+    return 0;
 }
 
-std::vector<std::byte> ZLibCompressor::decompress(
-    const std::vector<std::byte> &data) {
-    uint64_t               dest_size;
-    std::vector<std::byte> ret;
+int ZLibCompressor::decompress_into(std::span<const std::byte> data,
+                                    std::vector<std::byte>    &out) {
+    TRACE_SCOPE("decompress");
+    size_t   old_size = out.size();
+    uint64_t dest_size = 0;
 
     if (data.size() < 8) {
         ERROR("Corrupted data: less than 8 bytes\n");
-        return {};
+        return -1;
     }
 
-    /* I suck at C++ */
-    for (int i = 0; i < 8; i++) {
-        ret.push_back(*(data.end() - 8 + i));
+    /* The original size is stored little-endian after the compressed stream. */
+    for (int i = 7; i >= 0; i--) {
+        dest_size = dest_size << 8 | (uint64_t)data[data.size() - 8 + i];
     }
-    std::vector<std::byte>::iterator it = ret.end() - 8;
-    restore_uint64_t(it, ret.end(), dest_size);
-    ret.clear();
 
     try {
-        ret.resize(dest_size);
+        out.resize(old_size + dest_size);
     } catch (...) {
         ERROR("Out of memory.\n");
-        return {};
+        out.resize(old_size);
+        return -1;
     }
 
-    uLongf sz = dest_size;
-    int    err =
-        ::uncompress((Byte *)ret.data(), &sz, (Byte *)data.data(), data.size());
-
-    if (err == Z_MEM_ERROR) {
-        ERROR("Zlib failed: out of memory\n");
-        return {};
-    } else if (err == Z_BUF_ERROR) {
-        ERROR("Zlib failed: corrupted data: original size is wrong\n");
-        return {};
-    } else if (err == Z_DATA_ERROR) {
-        ERROR("Zlib failed: corrupted data\n");
-        return {};
+    size_t sz = 0;
+    if (zlib_inflate(data.first(data.size() - 8), out.data() + old_size, dest_size, sz) !=
+        0) {
+        out.resize(old_size);
+        return -1;
     }
 
-    ret.resize(sz);
-
-    return ret;
+    out.resize(old_size + sz);
+    return 0;
 }
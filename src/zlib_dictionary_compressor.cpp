@@ -0,0 +1,129 @@
+#include <zlib.h>
+
+#include <algorithm>
+#include <compressor.hpp>
+#include <error.hpp>
+#include <string>
+#include <trace.hpp>
+#include <unordered_map>
+#include <util.hpp>
+#include <zlib_streams.hpp>
+
+ZLibDictionaryCompressor::ZLibDictionaryCompressor(std::span<const std::byte> dictionary)
+    : dictionary(dictionary.begin(), dictionary.end()) {
+}
+
+int ZLibDictionaryCompressor::get_id() {
+    return id;
+}
+
+const std::vector<std::byte> &ZLibDictionaryCompressor::get_dictionary() {
+    return dictionary;
+}
+
+std::vector<std::byte> ZLibDictionaryCompressor::train(
+    const std::vector<std::vector<std::byte>> &samples, size_t max_size) {
+    TRACE_SCOPE("train dictionary");
+    const size_t                              max_segment = 64;
+    std::unordered_map<std::string, uint64_t> counts;
+
+    for (auto &sample : samples) {
+        const char *data = (const char *)sample.data();
+        size_t      start = 0;
+        while (start < sample.size()) {
+            size_t end = start;
+            while (end < sample.size() && end - start < max_segment &&
+                   data[end++] != '\n') {
+            }
+            counts[std::string(data + start, end - start)]++;
+            start = end;
+        }
+    }
+
+    /* A segment seen n times saves about n - 1 copies of itself. */
+    std::vector<std::pair<uint64_t, const std::string *>> candidates;
+    for (auto &[segment, count] : counts) {
+        if (count > 1) {
+            candidates.push_back({(count - 1) * segment.size(), &segment});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](auto &a, auto &b) {
+        return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+    });
+
+    size_t size = 0, selected = 0;
+    for (; selected < candidates.size(); selected++) {
+        if (size + candidates[selected].second->size() > max_size) {
+            break;
+        }
+        size += candidates[selected].second->size();
+    }
+
+    std::vector<std::byte> res;
+    res.reserve(size);
+    while (selected--) {
+        const std::string *segment = candidates[selected].second;
+        res.insert(res.end(), (const std::byte *)segment->data(),
+                   (const std::byte *)segment->data() + segment->size());
+    }
+
+    INFO("Trained a dictionary of %s from %zu samples.\n", shorten_size(res.size()).c_str(),
+         samples.size());
+    return res;
+}
+
+int ZLibDictionaryCompressor::compress_into(std::span<const std::byte> data,
+                                            std::vector<std::byte>    &out) {
+    TRACE_SCOPE("compress");
+    size_t old_size = out.size();
+
+    if (zlib_deflate(data, out, Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY, dictionary) !=
+        0) {
+        return -1;
+    }
+
+    /* Insert original size. */
+    store_uint64_t((uint64_t)data.size(), out);
+
+    MSG("ZLib compressed with a dictionary: %s -> %s\n",
+        shorten_size(data.size()).c_str(), shorten_size(out.size() - old_size).c_str());
+    return 0;
+}
+
+int ZLibDictionaryCompressor::decompress_into(std::span<const std::byte> data,
+                                              std::vector<std::byte>    &out) {
+    TRACE_SCOPE("decompress");
+    size_t   old_size = out.size();
+    uint64_t dest_size = 0;
+
+    if (data.size() < 8) {
+        ERROR("Corrupted data: less than 8 bytes\n");
+        return -1;
+    }
+
+    /* The original size is stored little-endian after the compressed stream. */
+    for (int i = 7; i >= 0; i--) {
+        dest_size = dest_size << 8 | (uint64_t)data[data.size() - 8 + i];
+    }
+
+    try {
+        out.resize(old_size + dest_size);
+    } catch (...) {
+        ERROR("Out of memory.\n");
+        out.resize(old_size);
+        return -1;
+    }
+
+    size_t sz = 0;
+    if (zlib_inflate(data.first(data.size() - 8), out.data() + old_size, dest_size, sz,
+                     dictionary) != 0) {
+        out.resize(old_size);
+        return -1;
+    }
+    if (sz != dest_size) {
+        ERROR("Zlib failed: corrupted data\n");
+        out.resize(old_size);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,282 @@
+#include <zlib.h>
+#ifdef PATCHIT_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include <algorithm>
+#include <climits>
+#include <error.hpp>
+#include <zlib_streams.hpp>
+
+/* Parameters of deflateInit(), which compress2() uses as well. */
+static const int window_bits = MAX_WBITS;
+static const int memory_level = 8;
+
+struct ThreadStreams {
+    z_stream deflater = {};
+    z_stream inflater = {};
+    bool     deflater_ready = false;
+    bool     inflater_ready = false;
+    int      level = Z_DEFAULT_COMPRESSION;
+    int      strategy = Z_DEFAULT_STRATEGY;
+
+    ~ThreadStreams() {
+        if (deflater_ready) {
+            deflateEnd(&deflater);
+        }
+        if (inflater_ready) {
+            inflateEnd(&inflater);
+        }
+    }
+};
+
+static thread_local ThreadStreams streams;
+
+#ifdef PATCHIT_LIBDEFLATE
+/*
+ * libdeflate only compresses whole buffers, which is all the compressors do,
+ * and has no preset dictionaries: those and the zlib strategies other than
+ * the default stay with zlib. Its output is a zlib stream like any other, but
+ * not byte for byte the one zlib would make.
+ */
+struct ThreadLibdeflate {
+    libdeflate_compressor   *compressor = nullptr;
+    libdeflate_decompressor *decompressor = nullptr;
+    int                      level = 0;
+
+    ~ThreadLibdeflate() {
+        libdeflate_free_compressor(compressor);
+        libdeflate_free_decompressor(decompressor);
+    }
+};
+
+static thread_local ThreadLibdeflate libdeflate;
+
+static int libdeflate_deflate(std::span<const std::byte> data, std::vector<std::byte> &out,
+                              int level) {
+    size_t old_size = out.size();
+
+    /* Level 6 is also zlib's default, its levels 0-9 mean the same in libdeflate. */
+    level = level == Z_DEFAULT_COMPRESSION ? 6 : level;
+    if (!libdeflate.compressor || libdeflate.level != level) {
+        libdeflate_free_compressor(libdeflate.compressor);
+        libdeflate.compressor = libdeflate_alloc_compressor(level);
+        libdeflate.level = level;
+        if (!libdeflate.compressor) {
+            ERROR("libdeflate failed: cannot allocate a compressor\n");
+            return -1;
+        }
+    }
+
+    try {
+        out.resize(old_size + libdeflate_zlib_compress_bound(libdeflate.compressor,
+                                                             data.size()));
+    } catch (...) {
+        ERROR("Out of memory.\n");
+        out.resize(old_size);
+        return -1;
+    }
+
+    size_t size = libdeflate_zlib_compress(libdeflate.compressor, data.data(), data.size(),
+                                           out.data() + old_size, out.size() - old_size);
+    if (size == 0) {
+        ERROR("libdeflate failed: the compression bound is wrong\n");
+        out.resize(old_size);
+        return -1;
+    }
+
+    out.resize(old_size + size);
+    return 0;
+}
+
+static int libdeflate_inflate(std::span<const std::byte> data, std::byte *out,
+                              size_t capacity, size_t &size) {
+    if (!libdeflate.decompressor) {
+        libdeflate.decompressor = libdeflate_alloc_decompressor();
+        if (!libdeflate.decompressor) {
+            ERROR("libdeflate failed: out of memory\n");
+            return -1;
+        }
+    }
+
+    size_t actual = 0;
+    switch (libdeflate_zlib_decompress(libdeflate.decompressor, data.data(), data.size(),
+                                       out, capacity, &actual)) {
+    case LIBDEFLATE_SUCCESS:
+        size = actual;
+        return 0;
+    case LIBDEFLATE_INSUFFICIENT_SPACE:
+        ERROR("Zlib failed: corrupted data: original size is wrong\n");
+        return -1;
+    default:
+        /* Possibly a stream with a preset dictionary, which zlib reports. */
+        return 1;
+    }
+}
+#endif
+
+static z_stream *get_deflater(int level, int strategy) {
+    z_stream *stream = &streams.deflater;
+
+    if (!streams.deflater_ready) {
+        if (deflateInit2(stream, level, Z_DEFLATED, window_bits, memory_level,
+                         strategy) != Z_OK) {
+            ERROR("Zlib failed: cannot initialize: %s\n",
+                  stream->msg ? stream->msg : "out of memory");
+            deflateEnd(stream);
+            *stream = {};
+            return nullptr;
+        }
+        streams.deflater_ready = true;
+        streams.level = level;
+        streams.strategy = strategy;
+        return stream;
+    }
+
+    if (deflateReset(stream) != Z_OK) {
+        ERROR("Zlib failed: cannot reset the stream\n");
+        return nullptr;
+    }
+    /* Nothing was compressed since the reset, so no output is produced. */
+    if ((level != streams.level || strategy != streams.strategy) &&
+        deflateParams(stream, level, strategy) != Z_OK) {
+        ERROR("Zlib failed: invalid level or strategy\n");
+        return nullptr;
+    }
+    streams.level = level;
+    streams.strategy = strategy;
+    return stream;
+}
+
+static z_stream *get_inflater() {
+    z_stream *stream = &streams.inflater;
+
+    if (!streams.inflater_ready) {
+        if (inflateInit2(stream, window_bits) != Z_OK) {
+            ERROR("Zlib failed: out of memory\n");
+            inflateEnd(stream);
+            *stream = {};
+            return nullptr;
+        }
+        streams.inflater_ready = true;
+        return stream;
+    }
+
+    if (inflateReset(stream) != Z_OK) {
+        ERROR("Zlib failed: cannot reset the stream\n");
+        return nullptr;
+    }
+    return stream;
+}
+
+int zlib_deflate(std::span<const std::byte> data, std::vector<std::byte> &out,
+                 int level, int strategy, std::span<const std::byte> dictionary) {
+#ifdef PATCHIT_LIBDEFLATE
+    if (dictionary.empty() && strategy == Z_DEFAULT_STRATEGY) {
+        return libdeflate_deflate(data, out, level);
+    }
+#endif
+    size_t    old_size = out.size();
+    z_stream *stream = get_deflater(level, strategy);
+
+    if (!stream) {
+        return -1;
+    }
+    if (!dictionary.empty() &&
+        deflateSetDictionary(stream, (const Bytef *)dictionary.data(),
+                             dictionary.size()) != Z_OK) {
+        ERROR("Zlib failed: cannot set the dictionary\n");
+        return -1;
+    }
+
+    try {
+        out.resize(old_size + deflateBound(stream, data.size()));
+    } catch (...) {
+        ERROR("Out of memory.\n");
+        out.resize(old_size);
+        return -1;
+    }
+
+    /* avail_in and avail_out are 32 bits wide, larger data goes in pieces. */
+    size_t in_left = data.size(), out_left = out.size() - old_size;
+    int    err;
+    stream->next_in = (Bytef *)data.data();
+    stream->next_out = (Bytef *)out.data() + old_size;
+    do {
+        uInt in_chunk = std::min<size_t>(in_left, UINT_MAX);
+        uInt out_chunk = std::min<size_t>(out_left, UINT_MAX);
+        stream->avail_in = in_chunk;
+        stream->avail_out = out_chunk;
+        err = deflate(stream, in_chunk == in_left ? Z_FINISH : Z_NO_FLUSH);
+        in_left -= in_chunk - stream->avail_in;
+        out_left -= out_chunk - stream->avail_out;
+    } while (err == Z_OK);
+
+    if (err != Z_STREAM_END) {
+        ERROR("Zlib failed: deflateBound gave incorrect estimate\n");
+        out.resize(old_size);
+        return -1;
+    }
+
+    out.resize(out.size() - out_left);
+    return 0;
+}
+
+int zlib_inflate(std::span<const std::byte> data, std::byte *out, size_t capacity,
+                 size_t &size, std::span<const std::byte> dictionary) {
+#ifdef PATCHIT_LIBDEFLATE
+    if (int r = libdeflate_inflate(data, out, capacity, size); r <= 0) {
+        return r;
+    }
+#endif
+    z_stream *stream = get_inflater();
+
+    if (!stream) {
+        return -1;
+    }
+
+    size_t in_left = data.size(), out_left = capacity;
+    int    err;
+    stream->next_in = (Bytef *)data.data();
+    stream->next_out = (Bytef *)out;
+    do {
+        uInt in_chunk = std::min<size_t>(in_left, UINT_MAX);
+        uInt out_chunk = std::min<size_t>(out_left, UINT_MAX);
+        stream->avail_in = in_chunk;
+        stream->avail_out = out_chunk;
+        err = inflate(stream, Z_NO_FLUSH);
+        in_left -= in_chunk - stream->avail_in;
+        out_left -= out_chunk - stream->avail_out;
+
+        if (err == Z_NEED_DICT) {
+            if (dictionary.empty()) {
+                ERROR("Zlib failed: compressed with a dictionary\n");
+                return -1;
+            }
+            if (inflateSetDictionary(stream, (const Bytef *)dictionary.data(),
+                                     dictionary.size()) != Z_OK) {
+                ERROR("Zlib failed: compressed with a different dictionary\n");
+                return -1;
+            }
+            err = Z_OK;
+        }
+    } while (err == Z_OK && (in_left || stream->avail_in) && out_left);
+
+    if (err == Z_OK || err == Z_BUF_ERROR) {
+        /* Out of input or of room before the end of the stream. */
+        err = out_left ? Z_DATA_ERROR : Z_BUF_ERROR;
+    }
+    if (err == Z_MEM_ERROR) {
+        ERROR("Zlib failed: out of memory\n");
+    } else if (err == Z_BUF_ERROR) {
+        ERROR("Zlib failed: corrupted data: original size is wrong\n");
+    } else if (err != Z_STREAM_END) {
+        ERROR("Zlib failed: corrupted data\n");
+    }
+    if (err != Z_STREAM_END) {
+        return -1;
+    }
+
+    size = capacity - out_left;
+    return 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# diffs are applied without xxd and patch
+
+mkdir -p before after
+seq 1 2000 > before/lines.txt
+seq 1 2000 | sed -e 's/^10$/ten/' -e '/^500$/d' -e 's/^2000$/2000\nend/' > after/lines.txt
+head -c 20000 /dev/urandom > before/random.bin
+cp before/random.bin after/random.bin
+printf "changed" | dd of=after/random.bin bs=1 seek=5000 conv=notrunc
+printf "" > before/empty.txt
+printf "no longer empty" > after/empty.txt
+
+"$BINARY" create patch -M before/lines.txt after/lines.txt \
+	-M before/random.bin after/random.bin \
+	-M before/empty.txt after/empty.txt
+
+PATH=/nonexistent "$BINARY" apply patch . 2>&1 | tee apply.log
+! grep "trying the patch tool" apply.log
+diff -r before after
@@ -0,0 +1,33 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# every diff gets the compressor that suits it
+
+mkdir -p before after
+seq 1 5000 > before/text.txt
+seq 1 5000 | sed "s/$/ changed/" > after/text.txt
+echo a > before/tiny.txt
+echo b > after/tiny.txt
+
+"$BINARY" create auto.patch -M -c auto before/text.txt after/text.txt \
+	-M -c auto before/tiny.txt after/tiny.txt
+"$BINARY" create zlib.patch -M -c zlib before/text.txt after/text.txt \
+	-M -c zlib before/tiny.txt after/tiny.txt
+"$BINARY" create plain.patch -M before/text.txt after/text.txt \
+	-M before/tiny.txt after/tiny.txt
+[ "$(stat -c %s auto.patch)" -le "$(stat -c %s zlib.patch)" ]
+[ "$(stat -c %s auto.patch)" -lt "$(stat -c %s plain.patch)" ]
+
+"$BINARY" apply auto.patch .
+diff -r before after
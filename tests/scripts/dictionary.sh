@@ -0,0 +1,33 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# many small, similar diffs compress better with a shared dictionary
+
+args=()
+mkdir -p before after
+for i in $(seq 1 40); do
+	printf "name=value$i\nlocale=en_US\ncolor=blue\noption.alpha=true\n" > "before/$i.conf"
+	printf "name=value$i\nlocale=de_DE\ncolor=red\noption.alpha=false\nnew=1\n" > "after/$i.conf"
+	args+=(-M -c zlib "before/$i.conf" "after/$i.conf")
+done
+
+"$BINARY" create plain.patch "${args[@]}"
+"$BINARY" create dictionary.patch --dictionary "${args[@]}"
+[ "$(stat -c %s dictionary.patch)" -lt "$(stat -c %s plain.patch)" ]
+
+# a dictionary needs compatibility version 1
+! "$BINARY" create legacy.patch --format-version 0 --dictionary "${args[@]}"
+
+"$BINARY" apply dictionary.patch .
+diff -r before after
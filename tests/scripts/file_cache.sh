@@ -0,0 +1,44 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# a second create with the same cache does not read the base tree again
+
+args=()
+mkdir -p before after
+for i in $(seq 1 10); do
+	seq 1 "$((i * 100))" > "before/$i.txt"
+	seq 1 "$((i * 100))" | sed 's/^50$/changed/' > "after/$i.txt"
+	args+=(-M "before/$i.txt" "after/$i.txt")
+done
+cp before/1.txt after/1.txt
+
+"$BINARY" create first.patch --cache cache "${args[@]}" | tee first.log
+grep "0 hits, 10 misses, 10 entries" first.log
+"$BINARY" create second.patch --cache cache "${args[@]}" | tee second.log
+grep "10 hits, 0 misses, 10 entries" second.log
+cmp first.patch second.patch
+
+# a changed base file is read again
+seq 1 300 > before/2.txt
+"$BINARY" create third.patch --cache cache "${args[@]}" | tee third.log
+grep "9 hits, 1 misses, 10 entries" third.log
+seq 1 200 > before/2.txt
+
+# a corrupted cache is ignored
+head -c 100 /dev/urandom > cache
+"$BINARY" create fourth.patch --cache cache "${args[@]}"
+cmp first.patch fourth.patch
+
+"$BINARY" apply first.patch .
+diff -r before after
@@ -0,0 +1,42 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# only the instructions touching the included subtrees are applied
+
+args=()
+for service in web db cache; do
+	mkdir -p "before/$service" "after/$service"
+	for i in $(seq 1 5); do
+		seq 1 $i > "before/$service/$i.txt"
+		seq 2 $((i * 2)) > "after/$service/$i.txt"
+		args+=(-M "before/$service/$i.txt" "after/$service/$i.txt")
+	done
+done
+
+for version in 0 1; do
+	"$BINARY" create "patch$version" --format-version $version "${args[@]}"
+	rm -rf "dest$version"
+	mkdir "dest$version"
+	cp -r before "dest$version/before"
+	"$BINARY" apply --include "before/web" --include "before/c*" \
+		--exclude "*/5.txt" "patch$version" "dest$version" | grep "Skipped 7 instructions"
+
+	diff -r "dest$version/before/db" before/db
+	diff "dest$version/before/web/5.txt" before/web/5.txt
+	diff "dest$version/before/cache/5.txt" before/cache/5.txt
+	for i in $(seq 1 4); do
+		diff "dest$version/before/web/$i.txt" "after/web/$i.txt"
+		diff "dest$version/before/cache/$i.txt" "after/cache/$i.txt"
+	done
+done
@@ -0,0 +1,37 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# identical files are skipped and rewritten files are stored whole
+
+mkdir -p before after
+seq 1 2000 > before/same.txt
+seq 1 2000 > after/same.txt
+seq 1 2000 > before/similar.txt
+seq 1 2000 | sed 's/^1000$/changed/' > after/similar.txt
+head -c 50000 /dev/urandom > before/rewritten.bin
+head -c 50000 /dev/urandom > after/rewritten.bin
+
+"$BINARY" create patch -M before/same.txt after/same.txt \
+	-M before/similar.txt after/similar.txt \
+	-M before/rewritten.bin after/rewritten.bin |
+	tee create.log
+grep "Skipped 1 modifications of identical files" create.log
+grep "Created a replacement (before/rewritten.bin" create.log
+"$BINARY" inspect patch | grep "contains: 2 instructions"
+
+# a diff of 50K random bytes would take several times their size
+[ "$(stat -c %s patch)" -lt 60000 ]
+
+"$BINARY" apply patch .
+diff -r before after
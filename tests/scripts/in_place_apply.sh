@@ -0,0 +1,49 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# a small change to a large file writes only the changed bytes
+
+mkdir -p before after
+head -c 16M /dev/urandom > before/image.bin
+cp before/image.bin after/image.bin
+printf "changed" | dd of=after/image.bin bs=1 seek=9000000 conv=notrunc
+head -c 300000 /dev/urandom > before/grown.bin
+{ head -c 1000 before/grown.bin; printf "inserted"; tail -c +1001 before/grown.bin; } > after/grown.bin
+
+"$BINARY" create patch -M -d myers before/image.bin after/image.bin \
+	-M -d myers before/grown.bin after/grown.bin
+
+rm -rf dest
+mkdir dest
+cp -r before dest/before
+"$BINARY" apply patch dest | tee output
+grep "image.bin in place: wrote 7 B" output
+grep "grown.bin in place" output
+diff -r dest/before after
+
+rm -rf dest_rewritten
+mkdir dest_rewritten
+cp -r before dest_rewritten/before
+"$BINARY" apply --no-in-place patch dest_rewritten | tee output
+! grep "in place" output
+diff -r dest_rewritten/before after
+
+# an in-place rewrite that fails is never resumed
+rm -rf dest_failed
+mkdir dest_failed
+cp -r before dest_failed/before
+printf "extra" >> dest_failed/before/grown.bin
+! "$BINARY" apply --checkpoint-interval 10 patch dest_failed
+! "$BINARY" apply --resume patch dest_failed 2>&1 | tee output
+grep "instruction 1 was interrupted while rewriting a file in place" -i output
@@ -0,0 +1,35 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# inspect finds the instructions touching a path, with and without an index
+
+mkdir -p before/dir after/dir
+args=()
+for i in $(seq 1 40); do
+	seq 1 $i > "before/dir/$i.txt"
+	seq 2 $((i * 2)) > "after/dir/$i.txt"
+	args+=(-M "before/dir/$i.txt" "after/dir/$i.txt")
+done
+
+for version in 0 1; do
+	"$BINARY" create "patch$version" --format-version $version "${args[@]}" \
+		-R "before/dir/7.txt" "before/dir/moved.txt" -D "before/dir/moved.txt"
+	"$BINARY" inspect --path "before/dir/7.txt" "patch$version" > out
+	grep "found: 2 instructions" out
+	grep "^  1\. " out && false
+	grep "^  7\. entity modification" out
+	grep "^  41\. entity relocation" out
+	"$BINARY" inspect -p "before/dir/moved.txt" "patch$version" | grep "found: 2 instructions"
+	"$BINARY" inspect -p "before/dir/missing.txt" "patch$version" | grep "found: 0 instructions"
+done
@@ -0,0 +1,43 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# patches of compatibility version 0 are still created and applied
+
+mkdir -p before/dir after/dir
+for i in $(seq 1 5); do
+	seq 1 $i > "before/dir/$i.txt"
+	seq 2 $((i * 2)) > "after/dir/$i.txt"
+done
+
+args=()
+for i in $(seq 1 5); do
+	args+=(-M "before/dir/$i.txt" "after/dir/$i.txt")
+done
+
+"$BINARY" create "legacy" --format-version 0 "${args[@]}" -R "before/dir/1.txt" "before/dir/moved.txt"
+"$BINARY" create "compact" "${args[@]}" -R "before/dir/1.txt" "before/dir/moved.txt"
+"$BINARY" inspect "legacy" | grep "compatibility version: 0"
+"$BINARY" inspect "compact" | grep "compatibility version: 1"
+[ "$(stat -c %s compact)" -lt "$(stat -c %s legacy)" ]
+
+mkdir other
+cp -r before other/before
+"$BINARY" apply "legacy" .
+"$BINARY" apply "compact" other
+mv before/dir/moved.txt before/dir/1.txt
+mv other/before/dir/moved.txt other/before/dir/1.txt
+diff -r before after
+diff -r other/before after
+
+! "$BINARY" create "invalid" --format-version 2 "${args[@]}"
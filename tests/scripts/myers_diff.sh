@@ -0,0 +1,29 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# byte-level diffs taken and applied without the diff and patch commands
+
+mkdir -p before after
+seq 1 20000 > before/lines.txt
+seq 1 20000 | sed -e 's/^10$/ten/' -e '/^5000$/d' -e 's/^19999$/end\n&/' > after/lines.txt
+head -c 200000 /dev/urandom > before/random.bin
+cp before/random.bin after/random.bin
+printf "changed" | dd of=after/random.bin bs=1 seek=100000 conv=notrunc
+
+PATH=/nonexistent "$BINARY" create patch -M -d myers -c zlib before/lines.txt after/lines.txt \
+	-M -d myers before/random.bin after/random.bin
+[ "$(stat -c %s patch)" -lt 2000 ]
+
+PATH=/nonexistent "$BINARY" apply patch .
+diff -r before after
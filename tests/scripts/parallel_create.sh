@@ -0,0 +1,33 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# many modifications created and applied by several workers, followed by moves
+# that depend on the order of the instructions
+
+mkdir before after
+args=()
+for i in $(seq 1 40); do
+	seq 1 $i > "before/$i.txt"
+	seq 2 $((i * 2)) > "after/$i.txt"
+	args+=(-M "before/$i.txt" "after/$i.txt")
+done
+
+"$BINARY" create "patchfile" -j 4 --read-workers 2 --queue-depth 3 -c zlib \
+	"${args[@]}" \
+	-R "before/1.txt" "before/moved.txt" \
+	-R "before/moved.txt" "before/final.txt"
+"$BINARY" apply --decode-workers 3 --memory-budget 1K "patchfile" .
+
+mv before/final.txt before/1.txt
+diff -r before after
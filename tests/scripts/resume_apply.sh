@@ -0,0 +1,69 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# an apply failing halfway is resumed after the completed instructions
+
+mkdir -p before after
+args=()
+for i in $(seq 1 10); do
+	seq 1 $i > "before/$i.txt"
+	seq 2 $((i * 2)) > "after/$i.txt"
+	args+=(-M "before/$i.txt" "after/$i.txt")
+done
+echo "late" > "after/late.txt"
+args+=(-R "before/late.txt" "before/moved.txt")
+for i in $(seq 11 15); do
+	seq 1 $i > "before/$i.txt"
+	seq 3 $((i * 3)) > "after/$i.txt"
+	args+=(-M "before/$i.txt" "after/$i.txt")
+done
+
+"$BINARY" create "patch" "${args[@]}"
+mkdir dest
+cp -r before dest/before
+
+# checkpointing is opt-in
+! "$BINARY" apply "patch" dest
+[ ! -f dest.patchit-checkpoint ]
+rm -rf dest
+mkdir dest
+cp -r before dest/before
+
+# before/late.txt is missing, so the 11th instruction fails
+! "$BINARY" apply --checkpoint-interval 1 "patch" dest
+[ -f dest.patchit-checkpoint ]
+diff dest/before/10.txt after/10.txt
+diff dest/before/11.txt before/11.txt
+
+echo "late" > dest/before/late.txt
+! "$BINARY" apply "patch" dest
+
+# the post-image of the last completed instruction is verified
+cp -p dest/before/10.txt saved
+echo "changed" >> dest/before/10.txt
+! "$BINARY" apply --resume "patch" dest
+cp -p saved dest/before/10.txt
+
+# and so is the filter
+! "$BINARY" apply --resume --exclude "*.txt" "patch" dest
+
+"$BINARY" apply --resume "patch" dest | grep "Resuming after 10 completed instructions"
+[ ! -f dest.patchit-checkpoint ]
+mv dest/before/moved.txt dest/before/late.txt
+diff -r dest/before after
+
+# nothing to resume
+"$BINARY" create "patch2" -M "before/1.txt" "after/1.txt"
+"$BINARY" apply --resume "patch2" . | grep "No checkpoint found"
+diff before/1.txt after/1.txt
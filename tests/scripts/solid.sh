@@ -0,0 +1,50 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# many small files compress better together than one by one
+
+args=()
+zlib_args=()
+mkdir -p before after
+for i in $(seq 1 40); do
+	printf "name=value$i\nlocale=en_US\ncolor=blue\noption.alpha=true\n" > "before/$i.conf"
+	printf "name=value$i\nlocale=de_DE\ncolor=red\noption.alpha=false\nnew=1\n" > "after/$i.conf"
+	args+=(-M "before/$i.conf" "after/$i.conf")
+	zlib_args+=(-M -c zlib "before/$i.conf" "after/$i.conf")
+done
+
+"$BINARY" create zlib.patch "${zlib_args[@]}"
+"$BINARY" create solid.patch --solid "${args[@]}"
+"$BINARY" create small_blocks.patch --solid --solid-block-size 300 --dictionary "${zlib_args[@]}"
+[ "$(stat -c %s solid.patch)" -lt "$(stat -c %s zlib.patch)" ]
+
+# solid patches need compatibility version 1
+! "$BINARY" create legacy.patch --format-version 0 --solid "${args[@]}"
+
+for patch in solid small_blocks; do
+	rm -rf "dest_$patch"
+	mkdir "dest_$patch"
+	cp -r before "dest_$patch/before"
+	"$BINARY" apply "$patch.patch" "dest_$patch"
+	diff -r "dest_$patch/before" after
+done
+
+# only the blocks holding the selected instructions are read
+rm -rf dest_filtered
+mkdir dest_filtered
+cp -r before dest_filtered/before
+"$BINARY" apply --include "before/7.conf" small_blocks.patch dest_filtered |
+	grep "Skipped 39 instructions"
+diff dest_filtered/before/7.conf after/7.conf
+diff dest_filtered/before/8.conf before/8.conf
@@ -0,0 +1,53 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# the holes of a sparse destination are neither stored nor written
+
+mkdir -p before after
+truncate -s 64M before/image.bin
+printf "header" | dd of=before/image.bin bs=1 seek=0 conv=notrunc
+cp --sparse=always before/image.bin after/image.bin
+printf "table" | dd of=after/image.bin bs=1 seek=40000000 conv=notrunc
+truncate -s 80M after/image.bin
+
+# without support for holes, there is nothing to check
+if [ "$(du -k after/image.bin | cut -f1)" -ge 1024 ]; then
+	exit 0
+fi
+
+"$BINARY" create patch -M before/image.bin after/image.bin | grep "sparse replacement"
+[ "$(stat -c %s patch)" -lt 100000 ]
+
+rm -rf dest
+mkdir dest
+cp --sparse=always -r before dest/before
+"$BINARY" apply patch dest
+cmp dest/before/image.bin after/image.bin
+[ "$(du -k dest/before/image.bin | cut -f1)" -lt 1024 ]
+
+# a small change to a file with more data than holes is stored as a diff
+head -c 1M /dev/urandom > before/disk.bin
+truncate -s 2M before/disk.bin
+cp --sparse=always before/disk.bin after/disk.bin
+printf "changed" | dd of=after/disk.bin bs=1 seek=1000 conv=notrunc
+
+"$BINARY" create patch2 -M before/disk.bin after/disk.bin | tee output
+! grep "sparse replacement" output
+[ "$(stat -c %s patch2)" -lt 100000 ]
+
+rm -rf dest
+mkdir dest
+cp --sparse=always -r before dest/before
+"$BINARY" apply patch2 dest
+cmp dest/before/disk.bin after/disk.bin
@@ -0,0 +1,33 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# trace create and apply of a single modification
+
+file_before="file.txt"
+echo "abc" > "$file_before"
+
+file_after="file.after.txt"
+echo "abcdef" > "$file_after"
+
+"$BINARY" -D --trace create.json create "patchfile" -M -c zlib "$file_before" "$file_after"
+"$BINARY" -D --trace apply.json apply "patchfile" .
+
+[ "$(cat $file_before)" == "abcdef" ] || exit 1
+
+grep -q '"name":"diff"' create.json || exit 1
+grep -q '"name":"write instruction"' create.json || exit 1
+grep -q '"name":"read instruction"' apply.json || exit 1
+grep -q '"name":"decompress"' apply.json || exit 1
+grep -q '"name":"instruction","cat":"patchit","ph":"B",.*"index":0' apply.json || exit 1
+grep -q '"name":"modify".*"path":"file.txt"' apply.json || exit 1
@@ -0,0 +1,31 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# moves and modifications applied through the io_uring backend (which falls
+# back to posix I/O where io_uring is not available)
+
+mkdir before after
+args=()
+for i in $(seq 1 20); do
+	seq 1 $i > "before/$i.txt"
+	seq 3 $((i * 3)) > "after/$i.txt"
+	args+=(-M "before/$i.txt" "after/$i.txt")
+done
+
+"$BINARY" --io uring create "patchfile" "${args[@]}" \
+	-R "before/1.txt" "before/moved.txt"
+"$BINARY" --io uring apply "patchfile" .
+
+mv before/moved.txt before/1.txt
+diff -r before after
@@ -0,0 +1,54 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# a corrupted patch is detected by verify and refused by apply
+
+mkdir -p before after
+args=()
+for i in $(seq 1 20); do
+	head -c 20000 /dev/zero | tr '\0' "$((i % 10))" > "before/$i.txt"
+	{ cat "before/$i.txt"; echo "changed $i"; } > "after/$i.txt"
+	args+=(-M "before/$i.txt" "after/$i.txt")
+done
+
+"$BINARY" create plain.patch "${args[@]}"
+"$BINARY" create solid.patch --solid --solid-block-size 100 "${args[@]}"
+"$BINARY" create unchecked.patch --no-checksums "${args[@]}"
+
+for patch in plain solid; do
+	"$BINARY" verify "$patch.patch" | grep "All checksums"
+	"$BINARY" verify -j 1 --decode "$patch.patch" | grep "All 20 instructions"
+
+	# flip a byte in the middle of the instructions
+	cp "$patch.patch" "corrupted_$patch.patch"
+	printf '\x5a' | dd of="corrupted_$patch.patch" bs=1 seek=200 conv=notrunc
+	cmp -s "$patch.patch" "corrupted_$patch.patch" && exit 1
+	! "$BINARY" verify "corrupted_$patch.patch"
+
+	rm -rf "corrupted_dest_$patch" "dest_$patch"
+	mkdir "corrupted_dest_$patch" "dest_$patch"
+	cp -r before "corrupted_dest_$patch/before"
+	cp -r before "dest_$patch/before"
+	! "$BINARY" apply "corrupted_$patch.patch" "corrupted_dest_$patch"
+	"$BINARY" apply "$patch.patch" "dest_$patch"
+	diff -r "dest_$patch/before" after
+done
+
+# patches without checksums are decoded instead
+[ "$(stat -c %s unchecked.patch)" -lt "$(stat -c %s plain.patch)" ]
+"$BINARY" verify unchecked.patch | grep "no checksums"
+
+# compatibility version 0 has no room for them
+"$BINARY" create legacy.patch --format-version 0 "${args[@]}"
+"$BINARY" verify legacy.patch | grep "no checksums"
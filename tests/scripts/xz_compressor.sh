@@ -0,0 +1,44 @@
+#!/bin/env bash
+
+set -o xtrace
+set -o pipefail
+set -e
+
+BINARY="$1"
+RUNTIME_DIR="$2"
+
+if [ "$(pwd)" != "$RUNTIME_DIR" ]; then
+	echo "INVALID PWD: $(pwd), not $RUNTIME_DIR"
+	exit 1
+fi
+
+# xz patches are smaller than zlib ones, with any preset, thread count or
+# solid blocks, and apply the same
+
+mkdir -p before after
+for i in $(seq 1 20); do
+	seq 1 5000 | sed -e "s/^/line $i: /" > "before/$i.txt"
+	seq 1 5000 | sed -e "s/^/line $i: /" -e "s/7$/changed $i/" > "after/$i.txt"
+	zlib_args+=(-M -c zlib "before/$i.txt" "after/$i.txt")
+	xz_args+=(-M -c xz "before/$i.txt" "after/$i.txt")
+done
+
+"$BINARY" create zlib.patch "${zlib_args[@]}"
+"$BINARY" create xz.patch "${xz_args[@]}"
+"$BINARY" create xz9.patch --xz-preset 9e --xz-threads 4 "${xz_args[@]}"
+"$BINARY" create solid_xz.patch --solid --solid-compressor xz --xz-preset 2 "${zlib_args[@]}"
+[ "$(stat -c %s xz.patch)" -lt "$(stat -c %s zlib.patch)" ]
+[ "$(stat -c %s solid_xz.patch)" -lt "$(stat -c %s xz.patch)" ]
+
+! "$BINARY" create bad.patch --xz-preset 10 "${xz_args[@]}"
+! "$BINARY" create bad.patch --xz-preset 6x "${xz_args[@]}"
+! "$BINARY" create bad.patch --solid --solid-compressor bzip2 "${xz_args[@]}"
+! "$BINARY" create bad.patch --solid --solid-compressor xz --dictionary "${xz_args[@]}"
+
+for patch in xz xz9 solid_xz; do
+	rm -rf "dest_$patch"
+	mkdir "dest_$patch"
+	cp -r before "dest_$patch/before"
+	"$BINARY" apply "$patch.patch" "dest_$patch"
+	diff -r "dest_$patch/before" after
+done
@@ -0,0 +1,50 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <vector>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include <compressor.hpp>
+
+static void setup() {
+}
+
+static std::vector<std::byte> random_bytes(size_t size) {
+	std::mt19937 gen(42);
+	std::vector<std::byte> res(size);
+	for (auto &b : res) b = (std::byte)gen();
+	return res;
+}
+
+TEST(auto_compressor_selects_zlib_for_compressible_data) {
+	std::vector<std::byte> data(100 << 10, std::byte{'a'});
+	ASSERT_EQUAL(AutoCompressor::get()->select(data), ZLibCompressor::get().get());
+
+	std::vector<std::byte> res = AutoCompressor::get()->compress(data);
+	ASSERT_TRUE(res.size() < data.size());
+	ASSERT_SEQUENCE_EQUAL(data, ZLibCompressor::get()->decompress(res));
+}
+
+TEST(auto_compressor_selects_plain_for_incompressible_data) {
+	std::vector<std::byte> data = random_bytes(100 << 10);
+	ASSERT_EQUAL(AutoCompressor::get()->select(data), PlainCompressor::get().get());
+
+	// too small to save anything
+	std::vector<std::byte> small{std::byte{1}, std::byte{2}, std::byte{3}};
+	ASSERT_EQUAL(AutoCompressor::get()->select(small), PlainCompressor::get().get());
+}
+
+TEST(auto_compressor_cannot_decompress) {
+	std::vector<std::byte> data{std::byte{1}, std::byte{2}, std::byte{3}};
+	std::vector<std::byte> out;
+	ASSERT_EQUAL(AutoCompressor::get()->decompress_into(data, out), -1);
+	ASSERT_TRUE(out.empty());
+}
+
+TEST(compressor_select_itself) {
+	std::vector<std::byte> data{std::byte{1}};
+	ASSERT_EQUAL(ZLibCompressor::get()->select(data), ZLibCompressor::get().get());
+	ASSERT_EQUAL(PlainCompressor::get()->select(data), PlainCompressor::get().get());
+}
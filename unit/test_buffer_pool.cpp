@@ -0,0 +1,46 @@
+#include <buffer_pool.hpp>
+#include <memory>
+#include <patch.hpp>
+#include <unit_common.hpp>
+#include <unit_test_framework.hpp>
+#include <vector>
+
+TEST(buffer_pool_reuses_released_buffers) {
+    BufferPool pool;
+
+    std::vector<std::byte> buffer = pool.acquire();
+    ASSERT_EQUAL(buffer.capacity(), 0);
+    buffer.resize(1000);
+    const std::byte *data = buffer.data();
+
+    pool.release(std::move(buffer));
+    std::vector<std::byte> reused = pool.acquire();
+    ASSERT_TRUE(reused.empty());
+    ASSERT_TRUE(reused.capacity() >= 1000);
+    ASSERT_TRUE(reused.data() == data);
+
+    ASSERT_EQUAL(pool.acquire().capacity(), 0);
+}
+
+TEST(buffer_pool_limits) {
+    BufferPool pool(1, 100);
+
+    std::vector<std::byte> large(101);
+    pool.release(std::move(large));
+    ASSERT_EQUAL(pool.acquire().capacity(), 0);
+
+    std::vector<std::byte> first(10), second(20);
+    pool.release(std::move(first));
+    pool.release(std::move(second));
+    ASSERT_EQUAL(pool.acquire().capacity(), 10);
+    ASSERT_EQUAL(pool.acquire().capacity(), 0);
+}
+
+TEST(buffer_pool_object_pool) {
+    ASSERT_TRUE(object_pool() != nullptr);
+    ASSERT_TRUE(object_pool() == object_pool());
+
+    auto instruction = Instruction::from_signature(Instruction::ENTITY_DELETE);
+    ASSERT_TRUE(instruction != nullptr);
+    ASSERT_EQUAL(instruction->signature, Instruction::ENTITY_DELETE);
+}
@@ -0,0 +1,198 @@
+#include <checkpoint.hpp>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unit_common.hpp>
+#include <unit_test_framework.hpp>
+#include <util.hpp>
+#include <vector>
+
+#define PATCH TEMP_FILE1
+#define DEST TEMP_FILE2
+#define CHECKPOINT TEMP_FILE2 ".patchit-checkpoint"
+
+static std::vector<std::byte> str2vec(std::string s) {
+    std::vector<std::byte> res;
+    for (auto c : s) res.push_back((std::byte)c);
+    return res;
+}
+
+static void setup() {
+    std::system("rm -rf " PATCH " " DEST " " CHECKPOINT " && mkdir " DEST);
+    open_and_write_entire_file(PATCH, str2vec("patch"));
+    open_and_write_entire_file(DEST "/a", str2vec("a"));
+}
+
+TEST(checkpoint_path_next_to_destination) {
+    setup();
+    Checkpoint checkpoint(PATCH, DEST "/");
+    ASSERT_EQUAL(checkpoint.path(), CHECKPOINT);
+    ASSERT_TRUE(!checkpoint.exists());
+}
+
+TEST(checkpoint_id_of) {
+    setup();
+    uint64_t id, other;
+    ASSERT_EQUAL(Checkpoint::id_of(PATCH, id), 0);
+    ASSERT_EQUAL(Checkpoint::id_of(PATCH, other), 0);
+    ASSERT_EQUAL(other, id);
+
+    std::vector<std::byte> large(300000, std::byte{1});
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, large), 0);
+    ASSERT_EQUAL(Checkpoint::id_of(PATCH, id), 0);
+    large[large.size() - 1] = std::byte{2};
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, large), 0);
+    ASSERT_EQUAL(Checkpoint::id_of(PATCH, other), 0);
+    ASSERT_NOT_EQUAL(other, id);
+
+    ASSERT_NOT_EQUAL(Checkpoint::id_of(DEST "/missing", id), 0);
+}
+
+TEST(checkpoint_unidentified_patch) {
+    setup();
+    Checkpoint saved(PATCH, DEST);
+    saved.interval = 1;
+    ASSERT_EQUAL(chdir(DEST), 0);
+    ASSERT_EQUAL(saved.complete(0, {"a"}), 0);
+    ASSERT_TRUE(saved.exists());
+
+    // neither saved nor resumed without the patch
+    Checkpoint missing(DEST "/missing", DEST);
+    missing.interval = 1;
+    ASSERT_NOT_EQUAL(missing.identify(), 0);
+    ASSERT_NOT_EQUAL(missing.load(), 0);
+    ASSERT_NOT_EQUAL(missing.complete(0, {"a"}), 0);
+    ASSERT_EQUAL(chdir(".."), 0);
+}
+
+TEST(checkpoint_save_and_load) {
+    setup();
+    Checkpoint checkpoint(PATCH, DEST);
+    checkpoint.interval = 2;
+
+    ASSERT_EQUAL(chdir(DEST), 0);
+    ASSERT_EQUAL(checkpoint.complete(0, {"a"}), 0);
+    ASSERT_TRUE(!checkpoint.exists());
+    ASSERT_EQUAL(checkpoint.pending_instructions(), 1);
+    ASSERT_EQUAL(checkpoint.complete(1, {"a", "missing"}), 0);
+    ASSERT_TRUE(checkpoint.exists());
+    ASSERT_EQUAL(checkpoint.pending_instructions(), 0);
+
+    Checkpoint loaded(PATCH, DEST);
+    ASSERT_EQUAL(loaded.load(), 0);
+    ASSERT_EQUAL(loaded.completed_instructions(), 2);
+
+    // the post-image changed: its size, its modification time or its inode
+    struct stat sb;
+    ASSERT_EQUAL(stat("a", &sb), 0);
+    ASSERT_EQUAL(open_and_write_entire_file("a", str2vec("bb")), 0);
+    ASSERT_EQUAL(loaded.load(), -1);
+    ASSERT_EQUAL(open_and_write_entire_file("a", str2vec("a")), 0);
+    struct timespec times[2] = {sb.st_atim, {sb.st_mtim.tv_sec - 1, sb.st_mtim.tv_nsec}};
+    ASSERT_EQUAL(utimensat(AT_FDCWD, "a", times, 0), 0);
+    ASSERT_EQUAL(loaded.load(), -1);
+    times[1] = sb.st_mtim;
+    ASSERT_EQUAL(utimensat(AT_FDCWD, "a", times, 0), 0);
+    ASSERT_EQUAL(loaded.load(), 0);
+    ASSERT_EQUAL(rename("a", "b"), 0);
+    ASSERT_EQUAL(std::system("cp -p b a"), 0);
+    ASSERT_EQUAL(loaded.load(), -1);
+    ASSERT_EQUAL(rename("b", "a"), 0);
+    ASSERT_EQUAL(open_and_write_entire_file("missing", str2vec("")), 0);
+    ASSERT_EQUAL(loaded.load(), -1);
+    unlink("missing");
+    ASSERT_EQUAL(loaded.load(), 0);
+
+    ASSERT_EQUAL(checkpoint.remove(), 0);
+    ASSERT_TRUE(!checkpoint.exists());
+    ASSERT_EQUAL(checkpoint.remove(), 0);
+    ASSERT_EQUAL(chdir(".."), 0);
+}
+
+TEST(checkpoint_disabled_by_default) {
+    setup();
+    Checkpoint checkpoint(PATCH, DEST);
+    ASSERT_EQUAL(chdir(DEST), 0);
+    ASSERT_EQUAL(checkpoint.complete(0, {"a"}), 0);
+    ASSERT_EQUAL(checkpoint.completed_instructions(), 1);
+    ASSERT_EQUAL(checkpoint.pending_instructions(), 0);
+    ASSERT_TRUE(!checkpoint.exists());
+    ASSERT_EQUAL(chdir(".."), 0);
+}
+
+TEST(checkpoint_load_other_patch) {
+    setup();
+    Checkpoint checkpoint(PATCH, DEST);
+    checkpoint.interval = 1;
+    ASSERT_EQUAL(chdir(DEST), 0);
+    ASSERT_EQUAL(checkpoint.complete(0, {"a"}), 0);
+
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, str2vec("other patch")), 0);
+    Checkpoint other(PATCH, DEST);
+    ASSERT_EQUAL(other.load(), -1);
+    ASSERT_EQUAL(chdir(".."), 0);
+}
+
+TEST(checkpoint_load_other_filter) {
+    setup();
+    Checkpoint checkpoint(PATCH, DEST);
+    checkpoint.interval = 1;
+    checkpoint.filter = {"+a*", "-*.o"};
+    ASSERT_EQUAL(chdir(DEST), 0);
+    ASSERT_EQUAL(checkpoint.complete(0, {"a"}), 0);
+
+    Checkpoint other(PATCH, DEST);
+    ASSERT_EQUAL(other.load(), -1);
+    other.filter = {"+a*"};
+    ASSERT_EQUAL(other.load(), -1);
+    other.filter = checkpoint.filter;
+    ASSERT_EQUAL(other.load(), 0);
+    ASSERT_EQUAL(chdir(".."), 0);
+}
+
+TEST(checkpoint_started_in_place) {
+    setup();
+    Checkpoint checkpoint(PATCH, DEST);
+    checkpoint.interval = 5;
+    ASSERT_EQUAL(chdir(DEST), 0);
+    ASSERT_EQUAL(checkpoint.complete(0, {"a"}), 0);
+    ASSERT_TRUE(!checkpoint.exists());
+
+    // saved right away, and resuming is refused until the instruction completes
+    ASSERT_EQUAL(checkpoint.start(1), 0);
+    ASSERT_TRUE(checkpoint.exists());
+    Checkpoint loaded(PATCH, DEST);
+    ASSERT_EQUAL(loaded.load(), -1);
+
+    ASSERT_EQUAL(checkpoint.complete(1, {"a"}), 0);
+    ASSERT_EQUAL(checkpoint.pending_instructions(), 0);
+    ASSERT_EQUAL(loaded.load(), 0);
+    ASSERT_EQUAL(loaded.completed_instructions(), 2);
+
+    // never saved without an interval
+    Checkpoint disabled(PATCH, DEST);
+    ASSERT_EQUAL(checkpoint.remove(), 0);
+    ASSERT_EQUAL(disabled.start(0), 0);
+    ASSERT_TRUE(!disabled.exists());
+    ASSERT_EQUAL(chdir(".."), 0);
+}
+
+TEST(checkpoint_load_corrupted) {
+    setup();
+    Checkpoint checkpoint(PATCH, DEST);
+    checkpoint.interval = 1;
+    checkpoint.filter = {"-b"};
+    ASSERT_EQUAL(chdir(DEST), 0);
+    ASSERT_EQUAL(checkpoint.complete(4, {"a"}), 0);
+
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(CHECKPOINT, data), 0);
+    for (size_t size = 0; size < data.size(); size++) {
+        std::vector<std::byte> truncated(data.begin(), data.begin() + size);
+        ASSERT_EQUAL(open_and_write_entire_file(CHECKPOINT, truncated), 0);
+        ASSERT_EQUAL(checkpoint.load(), -1);
+    }
+    ASSERT_EQUAL(chdir(".."), 0);
+}
@@ -0,0 +1,57 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <crc32c.hpp>
+
+static std::span<const std::byte> bytes(const char *s) {
+	return std::span((const std::byte *)s, strlen(s));
+}
+
+/* One bit at a time, as in RFC 3720. */
+static uint32_t bitwise_crc32c(std::span<const std::byte> data) {
+	uint32_t crc = 0xffffffff;
+	for (auto b : data) {
+		crc ^= (uint8_t)b;
+		for (int bit = 0; bit < 8; bit++) crc = crc & 1 ? crc >> 1 ^ 0x82f63b78 : crc >> 1;
+	}
+	return ~crc;
+}
+
+TEST(crc32c_known_values) {
+	ASSERT_EQUAL(crc32c(bytes("")), 0);
+	ASSERT_EQUAL(crc32c(bytes("123456789")), 0xe3069283);
+	ASSERT_EQUAL(crc32c(bytes("The quick brown fox jumps over the lazy dog")), 0x22620404);
+
+	std::vector<std::byte> zeros(32);
+	ASSERT_EQUAL(crc32c(zeros), 0x8a9136aa);
+}
+
+TEST(crc32c_matches_bitwise) {
+	unsigned               seed = 7;
+	std::vector<std::byte> data(3 * 4096 * 2 + 100);
+	for (auto &b : data) b = (std::byte)rand_r(&seed);
+
+	// around the sizes of the three streams, and the unaligned tails
+	for (size_t size : {1, 7, 8, 9, 63, 4096, 12287, 12288, 12289, 24576, 24676}) {
+		for (size_t offset : {0, 3}) {
+			auto part = std::span(data).subspan(offset, size);
+			ASSERT_EQUAL(crc32c(part), bitwise_crc32c(part));
+		}
+	}
+}
+
+TEST(crc32c_chaining) {
+	unsigned               seed = 11;
+	std::vector<std::byte> data(50000);
+	for (auto &b : data) b = (std::byte)rand_r(&seed);
+
+	for (size_t split : {0, 1, 4095, 12288, 30001, 50000}) {
+		auto first = std::span(data).first(split);
+		auto second = std::span(data).subspan(split);
+		ASSERT_EQUAL(crc32c(second, crc32c(first)), crc32c(data));
+	}
+}
@@ -7,8 +7,25 @@
 
 #include <diff.hpp>
 #include <config.hpp>
+#include <util.hpp>
+
+static std::vector<std::byte> str2vec(std::string s) {
+	std::vector<std::byte> res;
+	for (auto c: s) res.push_back((std::byte)c);
+	return res;
+}
+
+#define SRC TEMP_FILE1
+#define DEST TEMP_FILE2
 
 static void setup() {
+	std::system("rm -rf " SRC " " DEST);
+}
+
+static std::string lines(int first, int last) {
+	std::string res;
+	for (int i = first; i <= last; i++) res += std::to_string(i) + "\n";
+	return res;
 }
 
 TEST(diff_from_signature) {
@@ -17,5 +34,80 @@ TEST(diff_from_signature) {
 	ASSERT_NOT_EQUAL(p = dynamic_cast<SystemDiff*>(ptr.get()), nullptr);
 	ASSERT_EQUAL(p->signature, Diff::SYSTEM_DIFF);
 
+	ptr = Diff::from_signature(Diff::REPLACE_DIFF);
+	ASSERT_NOT_EQUAL(dynamic_cast<ReplaceDiff*>(ptr.get()), nullptr);
+	ASSERT_EQUAL(ptr->signature, Diff::REPLACE_DIFF);
+
 	ASSERT_EQUAL(Diff::from_signature(150), nullptr);
 }
+
+TEST(compare_files_identical) {
+	setup();
+	FileRelation relation;
+	open_and_write_entire_file(SRC, str2vec(lines(1, 1000)));
+	open_and_write_entire_file(DEST, str2vec(lines(1, 1000)));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation), 0);
+	ASSERT_EQUAL(relation, FILES_IDENTICAL);
+
+	open_and_write_entire_file(SRC, {});
+	open_and_write_entire_file(DEST, {});
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation), 0);
+	ASSERT_EQUAL(relation, FILES_IDENTICAL);
+}
+
+TEST(compare_files_similar) {
+	setup();
+	FileRelation relation;
+
+	// a change in the middle, and a line moved from the start to the end
+	open_and_write_entire_file(SRC, str2vec(lines(1, 1000)));
+	open_and_write_entire_file(DEST, str2vec(lines(2, 500) + "x\n" + lines(502, 1000) + "1\n"));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation), 0);
+	ASSERT_EQUAL(relation, FILES_SIMILAR);
+}
+
+TEST(compare_files_rewritten) {
+	setup();
+	FileRelation relation;
+	open_and_write_entire_file(SRC, str2vec(lines(1, 1000)));
+	open_and_write_entire_file(DEST, str2vec(lines(5000, 6000)));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation), 0);
+	ASSERT_EQUAL(relation, FILES_REWRITTEN);
+
+	// everything removed
+	open_and_write_entire_file(DEST, {});
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation), 0);
+	ASSERT_EQUAL(relation, FILES_REWRITTEN);
+}
+
+TEST(compare_files_estimate) {
+	setup();
+	FileRelation relation;
+	uint64_t     estimate;
+
+	// a line changed: a few bytes removed and added, five bytes of diff each
+	open_and_write_entire_file(SRC, str2vec(lines(1, 1000)));
+	open_and_write_entire_file(DEST, str2vec(lines(1, 500) + "x\n" + lines(502, 1000)));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation, nullptr, &estimate), 0);
+	ASSERT_EQUAL(relation, FILES_SIMILAR);
+	ASSERT_TRUE(estimate > 0 && estimate < 1000);
+
+	// the source repeated: found in it, but only as many bytes as it has are kept
+	std::string src = lines(1, 1000);
+	open_and_write_entire_file(DEST, str2vec(src + src + src));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation, nullptr, &estimate), 0);
+	ASSERT_EQUAL(relation, FILES_REWRITTEN);
+	ASSERT_EQUAL(estimate, 3 * src.size());
+
+	open_and_write_entire_file(DEST, str2vec(src));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation, nullptr, &estimate), 0);
+	ASSERT_EQUAL(estimate, 0);
+}
+
+TEST(compare_files_missing) {
+	setup();
+	FileRelation relation;
+	open_and_write_entire_file(DEST, str2vec("to"));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation), -1);
+	ASSERT_EQUAL(compare_files("/tmp", DEST, relation), -1);
+}
@@ -245,3 +245,18 @@ TEST(entity_move_instruction_apply_dest_does_not_exist_but_can_create_subdirs) {
 	std::system("rm -rf " DEST);
 	ASSERT_EQUAL(e->apply(), 0);
 }
+
+TEST(entity_move_instruction_write_binary_representation_appends) {
+	setup();
+	auto e = std::make_shared<EntityMoveInstruction>(true, false, SRC, DEST);
+	std::vector<std::byte> vec = str2vec("header");
+
+	e->write_binary_representation(vec);
+	ASSERT_SEQUENCE_EQUAL(std::vector<std::byte>(vec.begin() + 6, vec.end()),
+	                      e->binary_representation());
+
+	auto d = std::make_shared<EntityMoveInstruction>();
+	ASSERT_EQUAL(d->from_binary_representation(std::span(vec).subspan(6)), 0);
+	ASSERT_EQUAL(d->move_from, SRC);
+	ASSERT_EQUAL(d->move_to, DEST);
+}
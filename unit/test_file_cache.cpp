@@ -0,0 +1,153 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <sys/stat.h>
+
+#include <vector>
+#include <cstring>
+#include <string>
+
+#include <diff.hpp>
+#include <file_cache.hpp>
+#include <util.hpp>
+
+#define CACHE TEMP_FILE3
+#define SRC TEMP_FILE1
+#define DEST TEMP_FILE2
+
+static std::vector<std::byte> str2vec(std::string s) {
+	std::vector<std::byte> res;
+	for (auto c : s) res.push_back((std::byte)c);
+	return res;
+}
+
+static std::string lines(int first, int last) {
+	std::string res;
+	for (int i = first; i <= last; i++) res += std::to_string(i) + "\n";
+	return res;
+}
+
+static void setup() {
+	std::system("rm -rf " CACHE " " SRC " " DEST);
+}
+
+static struct stat stat_of(const char *path) {
+	struct stat sb;
+	stat(path, &sb);
+	return sb;
+}
+
+TEST(file_signature_hash) {
+	FileSignature a, b;
+	auto data = str2vec(lines(1, 100));
+
+	a.compute_hash(data);
+	b.compute_hash(data);
+	ASSERT_EQUAL(a.hash[0], b.hash[0]);
+	ASSERT_EQUAL(a.hash[1], b.hash[1]);
+	ASSERT_TRUE(a.same_contents(data));
+
+	data[50] = (std::byte)'x';
+	ASSERT_TRUE(!a.same_contents(data));
+	data.pop_back();
+	ASSERT_TRUE(!a.same_contents(data));
+	ASSERT_TRUE(!a.same_contents({}));
+}
+
+TEST(file_signature_count_new_bytes) {
+	FileSignature s;
+	auto src = str2vec(lines(1, 1000));
+	s.compute_index(src);
+	ASSERT_TRUE(s.indexed);
+
+	ASSERT_EQUAL(s.count_new_bytes(src, SIZE_MAX), 0);
+
+	// blocks are found at any offset
+	auto shifted = str2vec("shift\n" + lines(1, 1000));
+	ASSERT_TRUE(s.count_new_bytes(shifted, SIZE_MAX) < 2 * FileSignature::block_size);
+
+	auto other = str2vec(lines(5000, 6000));
+	ASSERT_EQUAL(s.count_new_bytes(other, SIZE_MAX), other.size());
+	ASSERT_TRUE(s.count_new_bytes(other, 100) < other.size());
+}
+
+TEST(file_cache_store_lookup) {
+	setup();
+	FileCache cache(CACHE);
+	FileSignature s, found;
+	open_and_write_entire_file(SRC, str2vec(lines(1, 1000)));
+	auto sb = stat_of(SRC);
+
+	ASSERT_TRUE(!cache.lookup(SRC, sb, found));
+	s.compute_hash(str2vec(lines(1, 1000)));
+	cache.store(SRC, sb, s);
+	ASSERT_TRUE(cache.lookup(SRC, sb, found));
+	ASSERT_EQUAL(found.hash[0], s.hash[0]);
+	ASSERT_EQUAL(found.hash[1], s.hash[1]);
+	ASSERT_TRUE(!found.indexed);
+
+	// a file that changed since is not found
+	sb.st_size++;
+	ASSERT_TRUE(!cache.lookup(SRC, sb, found));
+	sb.st_size--;
+	sb.st_mtim.tv_nsec++;
+	ASSERT_TRUE(!cache.lookup(SRC, sb, found));
+}
+
+TEST(file_cache_save_load) {
+	setup();
+	FileSignature s, found;
+	auto data = str2vec(lines(1, 1000));
+	open_and_write_entire_file(SRC, data);
+	auto sb = stat_of(SRC);
+	s.compute_hash(data);
+	s.compute_index(data);
+
+	FileCache cache(CACHE);
+	cache.store(SRC, sb, s);
+	ASSERT_EQUAL(cache.save(), 0);
+
+	FileCache loaded(CACHE);
+	loaded.load();
+	ASSERT_EQUAL(loaded.size(), 1);
+	ASSERT_TRUE(loaded.lookup(SRC, sb, found));
+	ASSERT_EQUAL(found.hash[0], s.hash[0]);
+	ASSERT_TRUE(found.indexed);
+	ASSERT_SEQUENCE_EQUAL(found.blocks, s.blocks);
+}
+
+TEST(file_cache_corrupted) {
+	setup();
+	FileCache cache(CACHE);
+	cache.load();
+	ASSERT_EQUAL(cache.size(), 0);
+
+	open_and_write_entire_file(CACHE, str2vec("__PATCHIT_CACHE__"));
+	cache.load();
+	ASSERT_EQUAL(cache.size(), 0);
+
+	open_and_write_entire_file(CACHE, str2vec("garbage"));
+	cache.load();
+	ASSERT_EQUAL(cache.size(), 0);
+}
+
+TEST(compare_files_cached) {
+	setup();
+	FileCache cache(CACHE);
+	FileRelation relation;
+	open_and_write_entire_file(SRC, str2vec(lines(1, 1000)));
+	open_and_write_entire_file(DEST, str2vec(lines(1, 1000)));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation, &cache), 0);
+	ASSERT_EQUAL(relation, FILES_IDENTICAL);
+	ASSERT_EQUAL(cache.size(), 1);
+
+	// the cached signature is used in place of the source
+	open_and_write_entire_file(DEST, str2vec(lines(5000, 6000)));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation, &cache), 0);
+	ASSERT_EQUAL(relation, FILES_REWRITTEN);
+	open_and_write_entire_file(DEST, str2vec(lines(2, 500) + "x\n" + lines(502, 1000)));
+	ASSERT_EQUAL(compare_files(SRC, DEST, relation, &cache), 0);
+	ASSERT_EQUAL(relation, FILES_SIMILAR);
+	ASSERT_EQUAL(cache.hits, 2);
+	ASSERT_EQUAL(cache.misses, 1);
+}
@@ -0,0 +1,86 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <hex.hpp>
+#include <util.hpp>
+
+static std::vector<std::byte> str2vec(std::string s) {
+	std::vector<std::byte> res;
+	for (auto c : s) res.push_back((std::byte)c);
+	return res;
+}
+
+static std::string vec2str(std::vector<std::byte> v) {
+	std::string res;
+	for (auto b : v) res += (char)b;
+	return res;
+}
+
+static std::vector<std::byte> random_bytes(size_t size) {
+	std::vector<std::byte> res(size);
+	for (auto &b : res) b = (std::byte)(rand() & 0xff);
+	return res;
+}
+
+TEST(hex_dump_same_as_xxd) {
+	srand(1);
+	for (size_t size : {0, 1, 15, 16, 17, 47, 48, 100, 4099}) {
+		auto data = random_bytes(size);
+		open_and_write_entire_file(TEMP_FILE1, data);
+		std::system("xxd -c1 -ps " TEMP_FILE1 " > " TEMP_FILE2);
+
+		std::vector<std::byte> expected, dump;
+		ASSERT_EQUAL(open_and_read_entire_file(TEMP_FILE2, expected), 0);
+		hex_dump(data, dump);
+		ASSERT_SEQUENCE_EQUAL(dump, expected);
+
+		std::vector<std::byte> decoded;
+		ASSERT_EQUAL(hex_undump(dump, decoded), 0);
+		ASSERT_SEQUENCE_EQUAL(decoded, data);
+	}
+}
+
+TEST(hex_dump_appends) {
+	std::vector<std::byte> out = str2vec("x");
+	hex_dump(str2vec("\x01\xab"), out);
+	ASSERT_EQUAL(vec2str(out), "x01\nab\n");
+
+	out = str2vec("y");
+	ASSERT_EQUAL(hex_undump(str2vec("41\n42\n"), out), 0);
+	ASSERT_EQUAL(vec2str(out), "yAB");
+}
+
+TEST(hex_undump_other_layouts) {
+	std::vector<std::byte> out;
+
+	// upper case, several bytes on a line, and whitespace, also past 16 bytes
+	std::string dump = "4A 4b\r\n\t4c" + std::string(30, '\n');
+	for (int i = 0; i < 20; i++) dump += "30\n";
+	ASSERT_EQUAL(hex_undump(str2vec(dump), out), 0);
+	ASSERT_EQUAL(vec2str(out), "JKL" + std::string(20, '0'));
+
+	// a change of layout after the first 16 bytes
+	out.clear();
+	dump.clear();
+	for (int i = 0; i < 20; i++) dump += "31\n";
+	dump += "3232\n";
+	ASSERT_EQUAL(hex_undump(str2vec(dump), out), 0);
+	ASSERT_EQUAL(vec2str(out), std::string(20, '1') + "22");
+}
+
+TEST(hex_undump_invalid) {
+	std::vector<std::byte> out = str2vec("x");
+	std::string dump;
+	for (int i = 0; i < 20; i++) dump += "31\n";
+
+	ASSERT_EQUAL(hex_undump(str2vec(dump + "3g\n"), out), -1);
+	ASSERT_EQUAL(hex_undump(str2vec(dump + "3\n"), out), -1);
+	dump[7] = 'z';
+	ASSERT_EQUAL(hex_undump(str2vec(dump), out), -1);
+	ASSERT_EQUAL(vec2str(out), "x");
+}
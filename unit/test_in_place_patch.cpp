@@ -0,0 +1,183 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <config.hpp>
+#include <diff.hpp>
+#include <in_place_patch.hpp>
+#include <util.hpp>
+
+static std::vector<std::byte> random_bytes(size_t size, unsigned seed) {
+	std::vector<std::byte> res(size);
+	for (auto &b : res) b = (std::byte)rand_r(&seed);
+	return res;
+}
+
+static std::vector<std::byte> read_file(const char *file) {
+	std::vector<std::byte> res;
+	open_and_read_entire_file(file, res);
+	return res;
+}
+
+TEST(in_place_patch_myers_random_edits) {
+	unsigned seed = 5;
+	for (int round = 0; round < 30; round++) {
+		auto src = random_bytes(rand_r(&seed) % 20000, round);
+		auto dest = src;
+		for (int i = 0; i < 6; i++) {
+			size_t at = dest.empty() ? 0 : rand_r(&seed) % dest.size();
+			size_t length = std::min<size_t>(rand_r(&seed) % 3000, dest.size() - at);
+			auto   inserted = random_bytes(rand_r(&seed) % 3000, seed);
+			if (rand_r(&seed) % 2) dest.erase(dest.begin() + at, dest.begin() + at + length);
+			else dest.insert(dest.begin() + at, inserted.begin(), inserted.end());
+		}
+
+		MyersDiff diff;
+		diff.compressor = PlainCompressor::get();
+		diff.compute(src, dest);
+		MyersDiff restored;
+		ASSERT_EQUAL(restored.from_binary_representation(diff.binary_representation()), 0);
+
+		open_and_write_entire_file(TEMP_FILE1, src);
+		ASSERT_TRUE(Config::get()->in_place);
+		ASSERT_EQUAL(restored.apply(TEMP_FILE1), 0);
+		ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), dest);
+	}
+}
+
+TEST(in_place_patch_writes_only_changes) {
+	auto src = random_bytes(2 << 20, 1);
+	auto dest = src;
+	memset(dest.data() + 1000000, 0x55, 10);
+	open_and_write_entire_file(TEMP_FILE1, src);
+
+	InPlacePatch patch;
+	patch.copy(0, 0, 1000000);
+	patch.insert(1000000, std::span(dest).subspan(1000000, 10));
+	patch.copy(1000010, 1000010, src.size() - 1000010);
+	ASSERT_EQUAL(patch.apply(TEMP_FILE1, src.size(), dest.size()), 0);
+	ASSERT_EQUAL(patch.written, 10);
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), dest);
+}
+
+TEST(in_place_patch_overlapping_moves) {
+	// shifted by one byte both ways, through more than one scratch buffer
+	auto src = random_bytes(1536 << 10, 2);
+	for (bool right : {true, false}) {
+		std::vector<std::byte> dest;
+		std::byte              extra[1] = {std::byte{0x42}};
+		InPlacePatch           patch;
+		if (right) {
+			dest.push_back(extra[0]);
+			dest.insert(dest.end(), src.begin(), src.end());
+			patch.insert(0, extra);
+			patch.copy(0, 1, src.size());
+		} else {
+			dest.assign(src.begin() + 1, src.end());
+			patch.copy(1, 0, src.size() - 1);
+		}
+
+		open_and_write_entire_file(TEMP_FILE1, src);
+		ASSERT_EQUAL(patch.apply(TEMP_FILE1, src.size(), dest.size()), 0);
+		ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), dest);
+	}
+}
+
+TEST(in_place_patch_cycle) {
+	// three ranges rotated, then two swapped: each copy overwrites the source of another
+	auto src = random_bytes(3000, 3);
+	auto at = [&](size_t from, size_t length) {
+		return std::vector<std::byte>(src.begin() + from, src.begin() + from + length);
+	};
+
+	std::vector<std::byte> dest;
+	for (auto part : {at(2000, 1000), at(0, 1000), at(1000, 1000)}) {
+		dest.insert(dest.end(), part.begin(), part.end());
+	}
+	InPlacePatch patch;
+	patch.copy(2000, 0, 1000);
+	patch.copy(0, 1000, 1000);
+	patch.copy(1000, 2000, 1000);
+	open_and_write_entire_file(TEMP_FILE1, src);
+	ASSERT_EQUAL(patch.apply(TEMP_FILE1, src.size(), dest.size()), 0);
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), dest);
+
+	dest = at(1500, 1500);
+	auto first = at(0, 1500);
+	dest.insert(dest.end(), first.begin(), first.end());
+	InPlacePatch swap;
+	swap.copy(0, 1500, 1500);
+	swap.copy(1500, 0, 1500);
+	open_and_write_entire_file(TEMP_FILE1, src);
+
+	// holding one of the ranges takes more memory than allowed
+	swap.max_held = 1499;
+	ASSERT_EQUAL(swap.apply(TEMP_FILE1, src.size(), dest.size()), -1);
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), src);
+	swap.max_held = 1500;
+	ASSERT_EQUAL(swap.apply(TEMP_FILE1, src.size(), dest.size()), 0);
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), dest);
+}
+
+TEST(in_place_patch_many_cycles) {
+	// adjacent ranges swapped all over the file: every pair is a cycle of its own
+	auto src = random_bytes(20000, 7);
+	auto dest = src;
+	InPlacePatch patch;
+	for (size_t start = 0; start + 10 <= src.size(); start += 10) {
+		std::rotate(dest.begin() + start, dest.begin() + start + 4, dest.begin() + start + 10);
+		patch.copy(start, start + 6, 4);
+		patch.copy(start + 4, start, 6);
+	}
+	open_and_write_entire_file(TEMP_FILE1, src);
+	ASSERT_EQUAL(patch.apply(TEMP_FILE1, src.size(), dest.size()), 0);
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), dest);
+	ASSERT_EQUAL(patch.written, src.size());
+}
+
+TEST(in_place_patch_invalid) {
+	auto src = random_bytes(100, 4);
+	open_and_write_entire_file(TEMP_FILE1, src);
+
+	// wrong size of the file, copy past the end, overlapping copies
+	InPlacePatch size;
+	size.copy(0, 1, 99);
+	ASSERT_EQUAL(size.apply(TEMP_FILE1, 99, 100), -1);
+
+	InPlacePatch past;
+	past.copy(50, 0, 51);
+	ASSERT_EQUAL(past.apply(TEMP_FILE1, 100, 51), -1);
+
+	InPlacePatch overlapping;
+	overlapping.copy(0, 10, 20);
+	overlapping.copy(10, 40, 20);
+	overlapping.copy(30, 30, 10);
+	overlapping.copy(60, 35, 10);
+	ASSERT_EQUAL(overlapping.apply(TEMP_FILE1, 100, 100), -1);
+
+	InPlacePatch missing;
+	missing.copy(0, 1, 10);
+	ASSERT_EQUAL(missing.apply("/nonexistent/file", 100, 100), -1);
+
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), src);
+}
+
+TEST(in_place_patch_disabled) {
+	auto src = random_bytes(5000, 6);
+	auto dest = src;
+	dest.erase(dest.begin() + 100, dest.begin() + 200);
+
+	MyersDiff diff;
+	diff.compressor = PlainCompressor::get();
+	diff.compute(src, dest);
+	open_and_write_entire_file(TEMP_FILE1, src);
+	Config::get()->in_place = false;
+	int r = diff.apply(TEMP_FILE1);
+	Config::get()->in_place = true;
+	ASSERT_EQUAL(r, 0);
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE1), dest);
+}
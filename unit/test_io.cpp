@@ -0,0 +1,194 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <config.hpp>
+#include <cstring>
+#include <io.hpp>
+#include <string>
+#include <thread>
+#include <unit_common.hpp>
+#include <unit_test_framework.hpp>
+#include <util.hpp>
+#include <vector>
+
+#define DIR TEMP_FILE4
+
+static std::vector<std::shared_ptr<FileIO>> backends() {
+    std::vector<std::shared_ptr<FileIO>> res = {PosixIO::get()};
+    if (UringIO::get()) {
+        res.push_back(UringIO::get());
+    }
+    return res;
+}
+
+static std::vector<std::byte> make_data(size_t size, int seed) {
+    std::vector<std::byte> res(size);
+    for (size_t i = 0; i < size; i++) {
+        res[i] = (std::byte)((i * 31 + seed) & 0xff);
+    }
+    return res;
+}
+
+static std::string path(int i) {
+    return std::string(DIR "/file_") + std::to_string(i);
+}
+
+static void setup() {
+    std::system("rm -rf " DIR " && mkdir -p " DIR);
+}
+
+TEST(io_write_read_and_stat_batches) {
+    /* More files than fit into a single ring submission. */
+    const int count = 150;
+
+    for (auto io : backends()) {
+        setup();
+        std::vector<std::vector<std::byte>> data(count);
+        std::vector<FileIO::WriteRequest>   writes(count);
+        for (int i = 0; i < count; i++) {
+            data[i] = make_data(i * 97 % 5000, i);
+            writes[i] = {path(i), &data[i], i % 2 == 0, -1};
+        }
+        ASSERT_EQUAL(io->write_files(writes), 0);
+        for (auto &request : writes) ASSERT_EQUAL(request.error, 0);
+
+        std::vector<FileIO::StatRequest> stats(count);
+        for (int i = 0; i < count; i++) stats[i].path = path(i);
+        ASSERT_EQUAL(io->stat_files(stats), 0);
+        for (int i = 0; i < count; i++) {
+            ASSERT_EQUAL(stats[i].error, 0);
+            ASSERT_TRUE(S_ISREG(stats[i].sb.st_mode));
+            ASSERT_EQUAL((size_t)stats[i].sb.st_size, data[i].size());
+        }
+
+        std::vector<FileIO::ReadRequest> reads(count);
+        for (int i = 0; i < count; i++) reads[i].path = path(i);
+        ASSERT_EQUAL(io->read_files(reads), 0);
+        for (int i = 0; i < count; i++) {
+            ASSERT_EQUAL(reads[i].error, 0);
+            ASSERT_TRUE(reads[i].data == data[i]);
+        }
+    }
+}
+
+TEST(io_overwrite_truncates) {
+    for (auto io : backends()) {
+        setup();
+        auto                              large = make_data(1000, 1);
+        auto                              small = make_data(10, 2);
+        std::vector<FileIO::WriteRequest> writes = {{path(0), &large, false, -1}};
+        ASSERT_EQUAL(io->write_files(writes), 0);
+        writes[0].data = &small;
+        ASSERT_EQUAL(io->write_files(writes), 0);
+
+        std::vector<FileIO::ReadRequest> reads(1);
+        reads[0].path = path(0);
+        ASSERT_EQUAL(io->read_files(reads), 0);
+        ASSERT_TRUE(reads[0].data == small);
+    }
+}
+
+TEST(io_errors_are_reported_per_request) {
+    for (auto io : backends()) {
+        setup();
+        auto                              data = make_data(100, 3);
+        std::vector<FileIO::WriteRequest> writes = {
+            {path(0), &data, false, -1},
+            {DIR "/missing/file", &data, false, -1},
+        };
+        ASSERT_NOT_EQUAL(io->write_files(writes), 0);
+        ASSERT_EQUAL(writes[0].error, 0);
+        ASSERT_EQUAL(writes[1].error, ENOENT);
+
+        std::vector<FileIO::StatRequest> stats(2);
+        stats[0].path = path(0);
+        stats[1].path = path(1);
+        ASSERT_NOT_EQUAL(io->stat_files(stats), 0);
+        ASSERT_EQUAL(stats[0].error, 0);
+        ASSERT_EQUAL(stats[1].error, ENOENT);
+
+        std::vector<FileIO::ReadRequest> reads(2);
+        reads[0].path = path(1);
+        reads[1].path = path(0);
+        ASSERT_NOT_EQUAL(io->read_files(reads), 0);
+        ASSERT_EQUAL(reads[0].error, ENOENT);
+        ASSERT_EQUAL(reads[1].error, 0);
+        ASSERT_TRUE(reads[1].data == data);
+    }
+}
+
+TEST(io_uring_failure_falls_back) {
+    /* A thread of its own, as a failed ring is dropped for good. */
+    std::shared_ptr<UringIO>          uring;
+    std::vector<std::byte>            data = make_data(1000, 7);
+    std::vector<FileIO::WriteRequest> writes;
+    std::vector<FileIO::ReadRequest>  reads(100);
+    int                               write_res = -1, read_res = -1;
+    bool                              broken = false, dropped = false;
+
+    setup();
+    for (int i = 0; i < 100; i++) {
+        writes.push_back({path(i), &data, false, -1});
+        reads[i].path = path(i);
+    }
+    std::thread([&]() {
+        if (!(uring = UringIO::get())) {
+            return;
+        }
+        /* Every io_uring_enter fails on a descriptor that is not a ring. */
+        int ring_fd = uring->ring_fd;
+        uring->ring_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        write_res = uring->write_files(writes);
+        broken = uring->broken;
+        read_res = uring->read_files(reads);
+        dropped = !UringIO::get();
+        close(uring->ring_fd);
+        uring->ring_fd = ring_fd;
+    }).join();
+    if (!uring) {
+        return;
+    }
+
+    ASSERT_EQUAL(write_res, 0);
+    ASSERT_TRUE(broken);
+    ASSERT_EQUAL(read_res, 0);
+    ASSERT_TRUE(dropped);
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQUAL(writes[i].error, 0);
+        ASSERT_EQUAL(reads[i].error, 0);
+        ASSERT_TRUE(reads[i].data == data);
+    }
+}
+
+TEST(io_read_empty_file) {
+    for (auto io : backends()) {
+        setup();
+        std::vector<std::byte>            empty;
+        std::vector<FileIO::WriteRequest> writes = {{path(0), &empty, true, -1}};
+        ASSERT_EQUAL(io->write_files(writes), 0);
+
+        std::vector<FileIO::ReadRequest> reads(1);
+        reads[0].path = path(0);
+        reads[0].data = make_data(10, 0);
+        ASSERT_EQUAL(io->read_files(reads), 0);
+        ASSERT_EQUAL(reads[0].data.size(), 0);
+    }
+}
+
+TEST(io_get_follows_config) {
+    Config::get()->io_backend = "posix";
+    ASSERT_EQUAL(strcmp(FileIO::get()->name(), "posix"), 0);
+
+    Config::get()->io_backend = "uring";
+    ASSERT_EQUAL(strcmp(FileIO::get()->name(), UringIO::get() ? "uring" : "posix"), 0);
+
+    setup();
+    auto data = make_data(4096, 5);
+    ASSERT_EQUAL(open_and_write_entire_file(path(0).c_str(), data), 0);
+    std::vector<std::byte> read;
+    ASSERT_EQUAL(open_and_read_entire_file(path(0).c_str(), read), 0);
+    ASSERT_TRUE(read == data);
+    ASSERT_NOT_EQUAL(open_and_read_entire_file(path(1).c_str(), read), 0);
+
+    Config::get()->io_backend = "posix";
+}
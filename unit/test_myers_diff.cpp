@@ -0,0 +1,170 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <diff.hpp>
+#include <util.hpp>
+#include <config.hpp>
+
+static std::vector<std::byte> str2vec(std::string s) {
+	std::vector<std::byte> res;
+	for (auto c : s) res.push_back((std::byte)c);
+	return res;
+}
+
+static std::string vec2str(std::vector<std::byte> v) {
+	std::string res;
+	for (auto b : v) res += (char)b;
+	return res;
+}
+
+static std::vector<std::byte> random_bytes(size_t size) {
+	std::vector<std::byte> res(size);
+	for (auto &b : res) b = (std::byte)(rand() & 0xff);
+	return res;
+}
+
+/* Apply a few random insertions, deletions and changes. */
+static std::vector<std::byte> edit(std::vector<std::byte> data, int edits) {
+	for (int i = 0; i < edits; i++) {
+		size_t at = data.empty() ? 0 : rand() % data.size();
+		size_t length = std::min<size_t>(rand() % 200, data.size() - at);
+		switch (rand() % 3) {
+		case 0: {
+			auto inserted = random_bytes(rand() % 200);
+			data.insert(data.begin() + at, inserted.begin(), inserted.end());
+			break;
+		}
+		case 1:
+			data.erase(data.begin() + at, data.begin() + at + length);
+			break;
+		default:
+			for (size_t j = at; j < at + length; j++) data[j] = (std::byte)(rand() & 0xff);
+		}
+	}
+	return data;
+}
+
+static void check_round_trip(MyersDiff &diff, const std::vector<std::byte> &src,
+                             const std::vector<std::byte> &dest) {
+	std::vector<std::byte> out;
+	diff.compute(src, dest);
+	ASSERT_EQUAL(MyersDiff::patch(src, diff.data, out), 0);
+	ASSERT_SEQUENCE_EQUAL(out, dest);
+}
+
+TEST(myers_diff_signature) {
+	auto diff = Diff::from_signature(Diff::MYERS_DIFF);
+	ASSERT_NOT_EQUAL(diff, nullptr);
+	ASSERT_EQUAL(diff->signature, Diff::MYERS_DIFF);
+}
+
+TEST(myers_diff_shortest_script) {
+	MyersDiff diff;
+	std::vector<std::byte> out;
+
+	// one byte inserted: size, then copy 3, delete 0, insert 1 "X", then copy 3
+	diff.compute(str2vec("abcdef"), str2vec("abcXdef"));
+	ASSERT_EQUAL(vec2str(diff.data), std::string("\x06\x03\x00\x01X\x03\x00\x00", 8));
+
+	// the classic example of the paper: 5 edits
+	diff.compute(str2vec("abcabba"), str2vec("cbabac"));
+	ASSERT_EQUAL(MyersDiff::patch(str2vec("abcabba"), diff.data, out), 0);
+	ASSERT_EQUAL(vec2str(out), "cbabac");
+	size_t inserted = 0;
+	for (size_t i = 1; i < diff.data.size();) {
+		size_t insert = (size_t)diff.data[i + 2];
+		inserted += insert;
+		i += 3 + insert;
+	}
+	ASSERT_EQUAL(inserted, 2);
+
+	diff.compute({}, {});
+	ASSERT_EQUAL(diff.data.size(), 1);
+	diff.compute(str2vec("abc"), {});
+	ASSERT_EQUAL(MyersDiff::patch(str2vec("abc"), diff.data, out), 0);
+	ASSERT_TRUE(out.empty());
+}
+
+TEST(myers_diff_random_edits) {
+	MyersDiff diff;
+	srand(2);
+	for (size_t size : {0, 1, 63, 64, 65, 1000, 100000}) {
+		auto src = random_bytes(size);
+		for (int edits : {0, 1, 10, 50}) {
+			auto dest = edit(src, edits);
+			check_round_trip(diff, src, dest);
+		}
+	}
+
+	// a few edits make a small script
+	auto src = random_bytes(1000000);
+	diff.compute(src, edit(src, 10));
+	ASSERT_TRUE(diff.data.size() < 5000);
+}
+
+TEST(myers_diff_cost_limit) {
+	MyersDiff diff;
+	srand(3);
+
+	// a tiny limit gives a longer script, which still applies
+	diff.max_cost = 4;
+	auto src = random_bytes(20000);
+	for (int edits : {1, 20, 200}) {
+		check_round_trip(diff, src, edit(src, edits));
+	}
+
+	// unrelated files do not take quadratic time
+	diff.max_cost = 0;
+	check_round_trip(diff, random_bytes(200000), random_bytes(200000));
+}
+
+TEST(myers_diff_patch_invalid) {
+	MyersDiff diff;
+	std::vector<std::byte> out;
+	diff.compute(str2vec("abcdef"), str2vec("abcXdef"));
+
+	ASSERT_EQUAL(MyersDiff::patch(str2vec("abcdefg"), diff.data, out), -1);
+	ASSERT_EQUAL(MyersDiff::patch(str2vec("abcdef"), {}, out), -1);
+	diff.data[1] = (std::byte)7;
+	ASSERT_EQUAL(MyersDiff::patch(str2vec("abcdef"), diff.data, out), -1);
+	diff.data[1] = (std::byte)3;
+	diff.data[3] = (std::byte)9;
+	ASSERT_EQUAL(MyersDiff::patch(str2vec("abcdef"), diff.data, out), -1);
+}
+
+TEST(myers_diff_files) {
+	std::system("rm -rf " TEMP_FILE1 " " TEMP_FILE2 " " TEMP_FILE3);
+	srand(4);
+	auto src = random_bytes(50000);
+	auto dest = edit(src, 5);
+	open_and_write_entire_file(TEMP_FILE1, src);
+	open_and_write_entire_file(TEMP_FILE2, dest);
+
+	auto diff = std::make_shared<MyersDiff>();
+	diff->compressor = ZLibCompressor::get();
+	ASSERT_EQUAL(diff->from_files(TEMP_FILE1, TEMP_FILE2), 0);
+	ASSERT_EQUAL(diff->from_files(TEMP_FILE1, TEMP_FILE3), -1);
+
+	auto restored = std::make_shared<MyersDiff>();
+	ASSERT_EQUAL(restored->from_binary_representation(diff->binary_representation()), 0);
+	ASSERT_SEQUENCE_EQUAL(restored->data, diff->data);
+
+	// no diff command needed
+	std::system("cp " TEMP_FILE1 " " TEMP_FILE3);
+	char *old = getenv("PATH");
+	setenv("PATH", "", 1);
+	int r = restored->apply(TEMP_FILE3);
+	setenv("PATH", old, 1);
+	ASSERT_EQUAL(r, 0);
+	std::vector<std::byte> applied;
+	ASSERT_EQUAL(open_and_read_entire_file(TEMP_FILE3, applied), 0);
+	ASSERT_SEQUENCE_EQUAL(applied, dest);
+
+	// the file changed since
+	ASSERT_EQUAL(restored->apply(TEMP_FILE3), -1);
+}
@@ -134,6 +134,7 @@ TEST(patch_load_from_file_missing_file) {
     ASSERT_EQUAL(p->load_from_file(PATCH), -1);
 }
 
+/* The following tests corrupt patches of compatibility version 0. */
 #define setup_simple_patchfile                                                 \
     auto p = std::make_shared<Patch>();                                        \
 	auto p2 = std::make_shared<Patch>(); \
@@ -143,7 +144,7 @@ TEST(patch_load_from_file_missing_file) {
     auto i1 = std::make_shared<EntityModifyInstruction>(false, false, SRC, d); \
     i1->compressor = PlainCompressor::get();                                   \
     p->append(i1);                                                             \
-    ASSERT_EQUAL(p->write_to_file(PATCH), 0);                                  \
+    ASSERT_EQUAL(p->write_to_file(PATCH, 0), 0);                               \
                                                                                \
     std::vector<std::byte> data;                                               \
     ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
@@ -384,3 +385,83 @@ TEST(patch_apply_fail) {
 	std::system("rm -rf " SRC);
 	ASSERT_EQUAL(p->apply(), -1);
 }
+
+static std::shared_ptr<Patch> make_tree_patch(int count) {
+    auto p = std::make_shared<Patch>();
+    for (int i = 0; i < count; i++) {
+        std::string dir = "some/deeply/nested/directory/of/the/tree/";
+        p->append(std::make_shared<EntityMoveInstruction>(
+            true, i % 2, dir + "old_" + std::to_string(i), dir + "new_" + std::to_string(i)));
+        p->append(std::make_shared<EntityDeleteInstruction>(i % 3, dir + "old_" + std::to_string(i)));
+    }
+    return p;
+}
+
+TEST(patch_compact_format_is_smaller) {
+    setup();
+    auto p = make_tree_patch(100);
+    std::vector<std::byte> v0, v1;
+
+    ASSERT_EQUAL(p->write_to_file(PATCH, 0), 0);
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, v0), 0);
+    ASSERT_EQUAL(p->write_to_file(PATCH, 1), 0);
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, v1), 0);
+    ASSERT_TRUE(v1.size() * 3 < v0.size());
+}
+
+TEST(patch_load_both_versions) {
+    setup();
+    auto p = make_tree_patch(10);
+    auto d = static_pointer_cast<Diff>(std::make_shared<SystemDiff>());
+    d->compressor = ZLibCompressor::get();
+    ASSERT_EQUAL(d->from_files(SRC, DEST), 0);
+    p->append(std::make_shared<EntityModifyInstruction>(true, false, SRC, d));
+
+    for (uint64_t version : {0, 1}) {
+        auto loaded = std::make_shared<Patch>();
+        ASSERT_EQUAL(p->write_to_file(PATCH, version), 0);
+        ASSERT_EQUAL(loaded->load_from_file(PATCH), 0);
+        ASSERT_EQUAL(loaded->version, version);
+        ASSERT_EQUAL(loaded->instructions.size(), p->instructions.size());
+        for (size_t i = 0; i < p->instructions.size(); i++) {
+            ASSERT_SEQUENCE_EQUAL(loaded->instructions[i]->binary_representation(),
+                                  p->instructions[i]->binary_representation());
+        }
+    }
+}
+
+TEST(patch_load_compact_corrupted) {
+    setup();
+    auto p = make_tree_patch(3);
+    auto p2 = std::make_shared<Patch>();
+    std::vector<std::byte> data, corrupted;
+
+    ASSERT_EQUAL(p->write_to_file(PATCH, 1), 0);
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
+    ASSERT_EQUAL(p2->load_from_file(PATCH), 0);
+
+    // unsupported flags
+    int pos = strlen("__PATCHIT__") + 1 + 8;
+    corrupted = data;
+    corrupted[pos] = std::byte{1};
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, corrupted), 0);
+    ASSERT_EQUAL(p2->load_from_file(PATCH), -1);
+
+    // footer offset out of bounds
+    corrupted = data;
+    corrupted[corrupted.size() - 1] = std::byte{1};
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, corrupted), 0);
+    ASSERT_EQUAL(p2->load_from_file(PATCH), -1);
+
+    // truncated footer
+    corrupted = data;
+    corrupted.erase(corrupted.end() - 9);
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, corrupted), 0);
+    ASSERT_EQUAL(p2->load_from_file(PATCH), -1);
+
+    // path id out of range
+    corrupted = data;
+    corrupted[pos + 1 + 1 + 1 + 1] = std::byte{100};
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, corrupted), 0);
+    ASSERT_EQUAL(p2->load_from_file(PATCH), -1);
+}
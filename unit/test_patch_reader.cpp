@@ -0,0 +1,514 @@
+#include <config.hpp>
+#include <cstring>
+#include <patch.hpp>
+#include <string>
+#include <unit_common.hpp>
+#include <unit_test_framework.hpp>
+#include <util.hpp>
+#include <vector>
+
+static std::vector<std::byte> str2vec(std::string s) {
+    std::vector<std::byte> res;
+    for (auto c : s) res.push_back((std::byte)c);
+    return res;
+}
+
+static std::string vec2str(std::vector<std::byte> v) {
+    std::string res;
+    for (auto b : v) res += (char)b;
+    return res;
+}
+
+#define SRC TEMP_FILE1
+#define DEST TEMP_FILE2
+#define PATCH TEMP_FILE3
+#define TARGET TEMP_FILE4
+
+static void setup() {
+    std::system("rm -rf " SRC " " DEST " " PATCH " " TARGET);
+    open_and_write_entire_file(SRC, str2vec("from"));
+    open_and_write_entire_file(DEST, str2vec("to"));
+}
+
+/*
+ * Modifies TARGET, then moves it back and forth.
+ */
+static void write_patch(int bounces, uint64_t version = Patch::compatibility_version) {
+    Patch p;
+    auto  d = std::make_shared<SystemDiff>();
+    d->compressor = ZLibCompressor::get();
+    d->from_files(SRC, DEST);
+    p.append(std::make_shared<EntityModifyInstruction>(false, false, TARGET, d));
+    for (int i = 0; i < bounces; i++) {
+        p.append(std::make_shared<EntityMoveInstruction>(false, true, TARGET, SRC));
+        p.append(std::make_shared<EntityMoveInstruction>(false, true, SRC, TARGET));
+    }
+    p.write_to_file(PATCH, version);
+}
+
+TEST(patch_reader_next) {
+    setup();
+    write_patch(2);
+
+    PatchReader            reader;
+    uint8_t                signature;
+    std::vector<std::byte> repr;
+
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_EQUAL(reader.size(), 5);
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQUAL(reader.next(signature, repr), 1);
+        ASSERT_EQUAL(signature, i ? Instruction::ENTITY_MOVE
+                                  : Instruction::ENTITY_MODIFY);
+    }
+    ASSERT_EQUAL(reader.next(signature, repr), 0);
+    ASSERT_EQUAL(reader.next(signature, repr), 0);
+
+    reader.close();
+    ASSERT_EQUAL(reader.next(signature, repr), -1);
+}
+
+TEST(patch_reader_open_missing_file) {
+    setup();
+    PatchReader reader;
+    ASSERT_EQUAL(reader.open(PATCH), -1);
+}
+
+TEST(patch_reader_corrupted_length) {
+    setup();
+    write_patch(1, 0);
+
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
+    int pos = strlen("__PATCHIT__") + 1 + 8 + 8;
+    data[pos + 6] = std::byte{0xff};  // ~2^55 byte instruction
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, data), 0);
+
+    PatchReader            reader;
+    uint8_t                signature;
+    std::vector<std::byte> repr;
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_EQUAL(reader.next(signature, repr), -1);
+}
+
+TEST(patch_reader_solid_auto_compressor) {
+    setup();
+    auto d = std::make_shared<SystemDiff>();
+    d->compressor = PlainCompressor::get();
+    d->from_files(SRC, DEST);
+
+    // the blocks are stored with the id of the compressor selected for them
+    PatchWriter writer;
+    ASSERT_EQUAL(writer.open(PATCH, Patch::compatibility_version, {}, 16,
+                             AutoCompressor::get()),
+                 0);
+    ASSERT_EQUAL(writer.append(std::make_shared<EntityModifyInstruction>(false, false,
+                                                                         TARGET, d)),
+                 0);
+    ASSERT_EQUAL(writer.append(std::make_shared<EntityMoveInstruction>(false, true,
+                                                                       TARGET, SRC)),
+                 0);
+    ASSERT_EQUAL(writer.finish(), 0);
+
+    open_and_write_entire_file(TARGET, str2vec("from"));
+    PatchReader reader;
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_EQUAL(Patch::apply(reader), 0);
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(SRC, data), 0);
+    ASSERT_EQUAL(vec2str(data), "to");
+}
+
+TEST(patch_apply_from_reader) {
+    setup();
+    write_patch(20);
+    open_and_write_entire_file(TARGET, str2vec("from"));
+
+    Config::get()->decode_workers = 2;
+    Config::get()->memory_budget = 1;
+
+    PatchReader reader;
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_EQUAL(Patch::apply(reader), 0);
+
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(TARGET, data), 0);
+    ASSERT_EQUAL(vec2str(data), "to");
+}
+
+TEST(patch_apply_from_reader_stops_at_failure) {
+    setup();
+    write_patch(0);
+
+    // TARGET does not exist, so the first instruction fails
+    PatchReader reader;
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_EQUAL(Patch::apply(reader), -1);
+}
+
+#define BATCH_DIR "/tmp/patchit_unit_batch"
+
+static std::string batch_file(const char *prefix, int i) {
+    return std::string(BATCH_DIR "/") + prefix + std::to_string(i);
+}
+
+TEST(patch_apply_from_reader_batches_modifications) {
+    for (const char *backend : {"posix", "uring"}) {
+        setup();
+        std::system("rm -rf " BATCH_DIR " && mkdir " BATCH_DIR);
+        open_and_write_entire_file(TARGET, str2vec("again"));
+
+        auto diff = std::make_shared<SystemDiff>();
+        auto replace = std::make_shared<ReplaceDiff>();
+        diff->compressor = ZLibCompressor::get();
+        replace->compressor = ZLibCompressor::get();
+        ASSERT_EQUAL(diff->from_files(SRC, DEST), 0);
+        ASSERT_EQUAL(replace->from_files(SRC, TARGET), 0);
+
+        // many small modifications, some of the same target, split by moves
+        Patch p;
+        for (int i = 0; i < 100; i++) {
+            open_and_write_entire_file(batch_file("f", i).c_str(), str2vec("from"));
+            p.append(std::make_shared<EntityModifyInstruction>(false, false,
+                                                               batch_file("f", i), diff));
+            if (i % 7 == 3) {
+                p.append(std::make_shared<EntityModifyInstruction>(
+                    false, false, batch_file("f", i), replace));
+            }
+            if (i % 10 == 9) {
+                p.append(std::make_shared<EntityMoveInstruction>(
+                    false, false, batch_file("f", i), batch_file("g", i)));
+            }
+        }
+        ASSERT_EQUAL(p.write_to_file(PATCH), 0);
+
+        Config::get()->io_backend = backend;
+        PatchReader reader;
+        ASSERT_EQUAL(reader.open(PATCH), 0);
+        ASSERT_EQUAL(Patch::apply(reader), 0);
+        Config::get()->io_backend = "posix";
+
+        for (int i = 0; i < 100; i++) {
+            std::vector<std::byte> data;
+            std::string            file = batch_file(i % 10 == 9 ? "g" : "f", i);
+            ASSERT_EQUAL(open_and_read_entire_file(file.c_str(), data), 0);
+            ASSERT_EQUAL(vec2str(data), i % 7 == 3 ? "again" : "to");
+        }
+    }
+    std::system("rm -rf " BATCH_DIR);
+}
+
+TEST(patch_apply_from_reader_batches_aliased_targets) {
+    for (const char *backend : {"posix", "uring"}) {
+        setup();
+        std::system("rm -rf " BATCH_DIR " && mkdir " BATCH_DIR);
+        open_and_write_entire_file(SRC, str2vec("abcdefgh"));
+        open_and_write_entire_file(DEST, str2vec("Xbcdefgh"));
+        open_and_write_entire_file(TARGET, str2vec("XbcdefgY"));
+        ASSERT_EQUAL(std::system("cp " SRC " " BATCH_DIR "/x"), 0);
+        ASSERT_EQUAL(std::system("cp " SRC " " BATCH_DIR "/y"), 0);
+        ASSERT_EQUAL(symlink("y", BATCH_DIR "/link"), 0);
+
+        auto first = std::make_shared<SystemDiff>();
+        auto second = std::make_shared<SystemDiff>();
+        first->compressor = ZLibCompressor::get();
+        second->compressor = ZLibCompressor::get();
+        ASSERT_EQUAL(first->from_files(SRC, DEST), 0);
+        ASSERT_EQUAL(second->from_files(DEST, TARGET), 0);
+
+        // the second modification of each file must see the result of the first
+        Patch p;
+        p.append(std::make_shared<EntityModifyInstruction>(false, false, BATCH_DIR "/x",
+                                                           first));
+        p.append(std::make_shared<EntityModifyInstruction>(false, false, BATCH_DIR "/y",
+                                                           first));
+        p.append(std::make_shared<EntityModifyInstruction>(false, false,
+                                                           BATCH_DIR "/./x", second));
+        p.append(std::make_shared<EntityModifyInstruction>(false, false,
+                                                           BATCH_DIR "/link", second));
+        ASSERT_EQUAL(p.write_to_file(PATCH), 0);
+
+        Config::get()->io_backend = backend;
+        PatchReader reader;
+        ASSERT_EQUAL(reader.open(PATCH), 0);
+        ASSERT_EQUAL(Patch::apply(reader), 0);
+        Config::get()->io_backend = "posix";
+
+        for (const char *file : {BATCH_DIR "/x", BATCH_DIR "/y"}) {
+            std::vector<std::byte> data;
+            ASSERT_EQUAL(open_and_read_entire_file(file, data), 0);
+            ASSERT_EQUAL(vec2str(data), "XbcdefgY");
+        }
+    }
+    std::system("rm -rf " BATCH_DIR);
+}
+
+TEST(patch_reader_index) {
+    setup();
+    write_patch(2);
+
+    PatchReader            reader;
+    uint8_t                signature;
+    std::vector<std::byte> repr;
+    std::string            path;
+
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    const PathTable *table = reader.path_table();
+    ASSERT_EQUAL(table->size(), 2);
+
+    int64_t target = table->find(TARGET), src = table->find(SRC);
+    ASSERT_TRUE(target != -1 && src != -1);
+    ASSERT_EQUAL(table->path_at(target, path), 0);
+    ASSERT_EQUAL(path, TARGET);
+
+    ASSERT_EQUAL(reader.instruction_paths(0).size(), 1);
+    ASSERT_EQUAL(reader.instruction_paths(0)[0], (uint64_t)target);
+    ASSERT_EQUAL(reader.instruction_paths(3).size(), 2);
+    ASSERT_EQUAL(reader.instruction_paths(3)[0], (uint64_t)target);
+    ASSERT_EQUAL(reader.instruction_paths(3)[1], (uint64_t)src);
+    ASSERT_EQUAL(reader.instruction_paths(5).size(), 0);
+
+    // read the last instruction, then go back to the first one
+    ASSERT_EQUAL(reader.seek(4), 0);
+    ASSERT_EQUAL(reader.next(signature, repr), 1);
+    ASSERT_EQUAL(signature, Instruction::ENTITY_MOVE);
+    ASSERT_EQUAL(reader.next(signature, repr), 0);
+    ASSERT_EQUAL(reader.seek(0), 0);
+    ASSERT_EQUAL(reader.next(signature, repr), 1);
+    ASSERT_EQUAL(signature, Instruction::ENTITY_MODIFY);
+    ASSERT_EQUAL(reader.seek(5), 0);
+    ASSERT_EQUAL(reader.next(signature, repr), 0);
+    ASSERT_EQUAL(reader.seek(6), -1);
+}
+
+TEST(patch_reader_no_index) {
+    setup();
+    write_patch(1, 0);
+
+    PatchReader            reader;
+    uint8_t                signature;
+    std::vector<std::byte> repr;
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_TRUE(reader.path_table() == nullptr);
+    ASSERT_EQUAL(reader.instruction_paths(0).size(), 0);
+
+    // only forward, by reading the instructions in between
+    ASSERT_EQUAL(reader.seek(2), 0);
+    ASSERT_EQUAL(reader.seek(1), -1);
+    ASSERT_EQUAL(reader.next(signature, repr), 1);
+    ASSERT_EQUAL(signature, Instruction::ENTITY_MOVE);
+    ASSERT_EQUAL(reader.seek(4), -1);
+}
+
+TEST(patch_reader_corrupted_index) {
+    setup();
+    write_patch(1);
+
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
+    // the size of the last instruction, right before its path positions
+    data[data.size() - 8 - 4] = std::byte{0x7f};
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, data), 0);
+
+    PatchReader reader;
+    ASSERT_EQUAL(reader.open(PATCH), -1);
+}
+
+TEST(patch_reader_solid) {
+    setup();
+    Patch p;
+    auto  d = std::make_shared<SystemDiff>();
+    d->compressor = PlainCompressor::get();
+    d->from_files(SRC, DEST);
+
+    // small blocks, so that the instructions are spread over several of them
+    PatchWriter writer;
+    ASSERT_EQUAL(writer.open(PATCH, 0, {}, 16), -1);
+    ASSERT_EQUAL(writer.open(PATCH, Patch::compatibility_version, {}, 16), 0);
+    ASSERT_EQUAL(writer.append(std::make_shared<EntityModifyInstruction>(false, false,
+                                                                         TARGET, d)),
+                 0);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQUAL(writer.append(std::make_shared<EntityMoveInstruction>(
+                         false, true, TARGET, SRC)),
+                     0);
+        ASSERT_EQUAL(writer.append(std::make_shared<EntityMoveInstruction>(
+                         false, true, SRC, TARGET)),
+                     0);
+    }
+    ASSERT_EQUAL(writer.finish(), 0);
+
+    PatchReader            reader;
+    uint8_t                signature;
+    std::vector<std::byte> repr;
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_TRUE(reader.solid);
+    ASSERT_EQUAL(reader.size(), 9);
+    ASSERT_TRUE(reader.block_offsets.size() > 2);
+    ASSERT_EQUAL(reader.instruction_paths(8).size(), 2);
+
+    // read the last instruction, then go back to the first one
+    ASSERT_EQUAL(reader.seek(8), 0);
+    ASSERT_EQUAL(reader.next(signature, repr), 1);
+    ASSERT_EQUAL(signature, Instruction::ENTITY_MOVE);
+    ASSERT_EQUAL(reader.next(signature, repr), 0);
+    ASSERT_EQUAL(reader.seek(0), 0);
+    ASSERT_EQUAL(reader.next(signature, repr), 1);
+    ASSERT_EQUAL(signature, Instruction::ENTITY_MODIFY);
+    reader.close();
+
+    open_and_write_entire_file(TARGET, str2vec("from"));
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_EQUAL(Patch::apply(reader), 0);
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(TARGET, data), 0);
+    ASSERT_EQUAL(vec2str(data), "to");
+    reader.close();
+
+    // a corrupted block is detected when it is read
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    data[reader.block_offsets[0] + 4] ^= std::byte{0xff};
+    reader.close();
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, data), 0);
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_EQUAL(reader.next(signature, repr), -1);
+}
+
+/*
+ * Writes the patch of write_patch with checksums, solid or not.
+ */
+static void write_checksummed_patch(size_t block_size) {
+    auto d = std::make_shared<SystemDiff>();
+    d->compressor = ZLibCompressor::get();
+    d->from_files(SRC, DEST);
+
+    PatchWriter writer;
+    ASSERT_EQUAL(writer.open(PATCH, 0, {}, 0, nullptr, true), -1);
+    ASSERT_EQUAL(writer.open(PATCH, Patch::compatibility_version, {}, block_size, nullptr, true),
+                 0);
+    ASSERT_EQUAL(writer.append(std::make_shared<EntityModifyInstruction>(false, false,
+                                                                         TARGET, d)),
+                 0);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQUAL(writer.append(std::make_shared<EntityMoveInstruction>(
+                         false, true, TARGET, SRC)),
+                     0);
+        ASSERT_EQUAL(writer.append(std::make_shared<EntityMoveInstruction>(
+                         false, true, SRC, TARGET)),
+                     0);
+    }
+    ASSERT_EQUAL(writer.finish(), 0);
+}
+
+TEST(patch_reader_checksums) {
+    for (size_t block_size : {0, 16}) {
+        setup();
+        write_checksummed_patch(block_size);
+
+        PatchReader            reader;
+        uint8_t                signature;
+        std::vector<std::byte> repr;
+        ASSERT_EQUAL(reader.open(PATCH), 0);
+        ASSERT_TRUE(reader.has_checksums());
+        ASSERT_EQUAL(reader.verify_checksums(1), 0);
+        ASSERT_EQUAL(reader.verify_checksums(4), 0);
+        for (int i = 0; i < 9; i++) {
+            ASSERT_EQUAL(reader.next(signature, repr), 1);
+        }
+        reader.close();
+
+        open_and_write_entire_file(TARGET, str2vec("from"));
+        ASSERT_EQUAL(Patch::verify(PATCH, 2, true), 0);
+        ASSERT_EQUAL(reader.open(PATCH), 0);
+        ASSERT_EQUAL(Patch::apply(reader), 0);
+        reader.close();
+    }
+
+    // patches written without them are still read
+    setup();
+    write_patch(1);
+    PatchReader reader;
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_TRUE(!reader.has_checksums());
+    ASSERT_EQUAL(reader.verify_checksums(1), -1);
+    ASSERT_EQUAL(Patch::verify(PATCH, 2), 0);
+}
+
+TEST(patch_reader_checksums_corrupted_records) {
+    for (size_t block_size : {0, 16}) {
+        setup();
+        write_checksummed_patch(block_size);
+
+        PatchReader            reader;
+        uint8_t                signature;
+        std::vector<std::byte> data, repr;
+        ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
+        ASSERT_EQUAL(reader.open(PATCH), 0);
+        auto &offsets = block_size ? reader.block_offsets : reader.index_offsets;
+        ASSERT_TRUE(offsets.size() > 2);
+        // the last byte of the first and of the second record
+        data[offsets[1] - 1] ^= std::byte{0x01};
+        data[offsets[2] - 1] ^= std::byte{0x80};
+        reader.close();
+        ASSERT_EQUAL(open_and_write_entire_file(PATCH, data), 0);
+
+        ASSERT_EQUAL(reader.open(PATCH), 0);
+        ASSERT_EQUAL(reader.verify_checksums(1), 2);
+        ASSERT_EQUAL(reader.verify_checksums(3), 2);
+        ASSERT_EQUAL(reader.next(signature, repr), -1);
+        reader.close();
+        ASSERT_EQUAL(Patch::verify(PATCH, 2), -1);
+    }
+}
+
+TEST(patch_reader_checksums_corrupted_header_and_footer) {
+    setup();
+    write_checksummed_patch(0);
+
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
+    size_t footer = 0;
+    for (int i = 7; i >= 0; i--) footer = footer << 8 | (size_t)data[data.size() - 8 + i];
+
+    // the last byte of the signature, the number of instructions in the footer
+    // and a record checksum
+    for (size_t position : {(size_t)3, footer, data.size() - 8 - 4 - 4 * 3}) {
+        auto corrupted = data;
+        corrupted[position] ^= std::byte{0x10};
+        ASSERT_EQUAL(open_and_write_entire_file(PATCH, corrupted), 0);
+
+        PatchReader reader;
+        ASSERT_EQUAL(reader.open(PATCH), -1);
+        ASSERT_EQUAL(Patch::verify(PATCH, 1), -1);
+    }
+}
+
+TEST(patch_apply_from_reader_filtered) {
+    for (uint64_t version : {0, 1}) {
+        setup();
+        write_patch(3, version);
+        open_and_write_entire_file(TARGET, str2vec("from"));
+
+        // the instructions all touch TARGET, so excluding it skips all of them
+        PathFilter  filter;
+        PatchReader reader;
+        filter.exclude(TARGET);
+        ASSERT_EQUAL(reader.open(PATCH), 0);
+        ASSERT_EQUAL(Patch::apply(reader, &filter), 0);
+        ASSERT_EQUAL(reader.skipped_instructions(), version ? 7 : 0);
+
+        std::vector<std::byte> data;
+        ASSERT_EQUAL(open_and_read_entire_file(TARGET, data), 0);
+        ASSERT_EQUAL(vec2str(data), "from");
+
+        // only the moves touch SRC
+        PathFilter moves;
+        moves.include(SRC);
+        ASSERT_EQUAL(reader.open(PATCH), 0);
+        ASSERT_EQUAL(Patch::apply(reader, &moves), 0);
+        ASSERT_EQUAL(reader.skipped_instructions(), version ? 1 : 0);
+        ASSERT_EQUAL(open_and_read_entire_file(TARGET, data), 0);
+        ASSERT_EQUAL(vec2str(data), "from");
+    }
+}
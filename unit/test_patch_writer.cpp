@@ -0,0 +1,132 @@
+#include <config.hpp>
+#include <cstring>
+#include <patch.hpp>
+#include <string>
+#include <unit_common.hpp>
+#include <unit_test_framework.hpp>
+#include <util.hpp>
+#include <vector>
+
+static std::vector<std::byte> str2vec(std::string s) {
+    std::vector<std::byte> res;
+    for (auto c : s) res.push_back((std::byte)c);
+    return res;
+}
+
+#define SRC TEMP_FILE1
+#define DEST TEMP_FILE2
+#define PATCH TEMP_FILE3
+
+static void setup() {
+    std::system("rm -rf " SRC " " DEST " " PATCH " " PATCH ".*");
+    open_and_write_entire_file(SRC, str2vec("from"));
+    open_and_write_entire_file(DEST, str2vec("to"));
+}
+
+static std::shared_ptr<Instruction> make_modify_instruction() {
+    auto d = std::make_shared<SystemDiff>();
+    d->compressor = PlainCompressor::get();
+    d->from_files(SRC, DEST);
+    return std::make_shared<EntityModifyInstruction>(false, false, SRC, d);
+}
+
+TEST(patch_writer_write_and_load) {
+    setup();
+    PatchWriter writer;
+
+    ASSERT_EQUAL(writer.open(PATCH), 0);
+    ASSERT_EQUAL(writer.append(make_modify_instruction()), 0);
+    ASSERT_EQUAL(writer.append(std::make_shared<EntityMoveInstruction>(
+                     true, false, SRC, DEST)),
+                 0);
+    ASSERT_EQUAL(writer.append(std::make_shared<EntityDeleteInstruction>(true, DEST)),
+                 0);
+    ASSERT_EQUAL(writer.count, 3);
+    ASSERT_EQUAL(writer.finish(), 0);
+    ASSERT_EQUAL(WEXITSTATUS(std::system("ls " PATCH ".* 2>/dev/null")), 2);
+
+    Patch p;
+    ASSERT_EQUAL(p.load_from_file(PATCH), 0);
+    ASSERT_EQUAL(p.instructions.size(), 3);
+    ASSERT_EQUAL(p.instructions[0]->signature, Instruction::ENTITY_MODIFY);
+    ASSERT_EQUAL(p.instructions[1]->signature, Instruction::ENTITY_MOVE);
+    ASSERT_EQUAL(p.instructions[2]->signature, Instruction::ENTITY_DELETE);
+}
+
+TEST(patch_writer_same_bytes_as_write_to_file) {
+    setup();
+    auto i = make_modify_instruction();
+
+    Patch p;
+    p.append(i);
+    ASSERT_EQUAL(p.write_to_file(PATCH), 0);
+    std::vector<std::byte> expected;
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, expected), 0);
+
+    PatchWriter writer;
+    ASSERT_EQUAL(writer.open(PATCH), 0);
+    ASSERT_EQUAL(writer.append(i), 0);
+    ASSERT_EQUAL(writer.finish(), 0);
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
+
+    ASSERT_SEQUENCE_EQUAL(data, expected);
+}
+
+TEST(patch_writer_abort_keeps_old_patch) {
+    setup();
+    ASSERT_EQUAL(open_and_write_entire_file(PATCH, str2vec("old")), 0);
+
+    {
+        PatchWriter writer;
+        ASSERT_EQUAL(writer.open(PATCH), 0);
+        ASSERT_EQUAL(writer.append(make_modify_instruction()), 0);
+        writer.abort();
+        ASSERT_EQUAL(writer.append(make_modify_instruction()), -1);
+        ASSERT_EQUAL(writer.finish(), -1);
+
+        ASSERT_EQUAL(writer.open(PATCH), 0);
+        ASSERT_EQUAL(writer.open(PATCH), -1);
+        // destroyed without finish()
+    }
+
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(PATCH, data), 0);
+    ASSERT_SEQUENCE_EQUAL(data, str2vec("old"));
+    ASSERT_EQUAL(WEXITSTATUS(std::system("ls " PATCH ".* 2>/dev/null")), 2);
+}
+
+TEST(patch_writer_open_invalid_directory) {
+    setup();
+    PatchWriter writer;
+    ASSERT_EQUAL(writer.open("/nonexistent/dir/patch"), -1);
+    ASSERT_EQUAL(writer.finish(), -1);
+}
+
+TEST(patch_writer_dictionary) {
+    setup();
+    auto d = std::make_shared<SystemDiff>();
+    d->from_files(SRC, DEST);
+
+    std::vector<std::byte> dictionary = str2vec("+to\n-from\n");
+    PatchWriter            writer;
+    ASSERT_EQUAL(writer.open(PATCH, 0, dictionary), -1);
+    ASSERT_EQUAL(writer.open(PATCH, Patch::compatibility_version, dictionary), 0);
+    d->compressor = writer.patch_context()->dictionary_compressor;
+    ASSERT_EQUAL(writer.append(std::make_shared<EntityModifyInstruction>(false, false,
+                                                                         SRC, d)),
+                 0);
+    ASSERT_EQUAL(writer.finish(), 0);
+
+    PatchReader reader;
+    ASSERT_EQUAL(reader.open(PATCH), 0);
+    ASSERT_NOT_EQUAL(reader.patch_context()->dictionary_compressor, nullptr);
+    reader.close();
+
+    Patch p;
+    ASSERT_EQUAL(p.load_from_file(PATCH), 0);
+    ASSERT_EQUAL(p.apply(), 0);
+    std::vector<std::byte> data;
+    ASSERT_EQUAL(open_and_read_entire_file(SRC, data), 0);
+    ASSERT_SEQUENCE_EQUAL(data, str2vec("to"));
+}
@@ -0,0 +1,78 @@
+#include <path_filter.hpp>
+#include <string>
+#include <unit_common.hpp>
+#include <unit_test_framework.hpp>
+#include <vector>
+
+TEST(path_filter_empty_selects_everything) {
+    PathFilter filter;
+    ASSERT_TRUE(!filter.active());
+    ASSERT_TRUE(filter.included("a/b"));
+    ASSERT_TRUE(!filter.excluded("a/b"));
+    ASSERT_TRUE(filter.selects({"a/b", ""}));
+}
+
+TEST(path_filter_include) {
+    PathFilter filter;
+    filter.include("services/web");
+    filter.include("*.conf");
+    ASSERT_TRUE(filter.active());
+
+    ASSERT_TRUE(filter.included("services/web"));
+    ASSERT_TRUE(filter.included("services/web/static/index.html"));
+    ASSERT_TRUE(filter.included("etc/app.conf"));
+    ASSERT_TRUE(!filter.included("services/webapp/main.cpp"));
+    ASSERT_TRUE(!filter.included("services/db/main.cpp"));
+
+    // a move into the subtree
+    ASSERT_TRUE(filter.selects({"services/db/main.cpp", "services/web/main.cpp"}));
+}
+
+TEST(path_filter_exclude) {
+    PathFilter filter;
+    filter.include("services/*");
+    filter.exclude("*/cache");
+    filter.exclude("*.tmp");
+
+    ASSERT_TRUE(filter.selects({"services/web/index.html"}));
+    ASSERT_TRUE(!filter.selects({"services/web/cache/a"}));
+    ASSERT_TRUE(!filter.selects({"services/web/file.tmp"}));
+    ASSERT_TRUE(!filter.selects({"other/file"}));
+
+    // an excluded path is never touched
+    ASSERT_TRUE(filter.selects({"other/file", "services/db/x"}));
+    ASSERT_TRUE(!filter.selects({"services/db/x", "services/x.tmp"}));
+    ASSERT_TRUE(!filter.selects({}));
+}
+
+TEST(path_filter_normalizes_paths_and_globs) {
+    PathFilter filter;
+    filter.include("dir");
+    filter.include("conf/");
+    filter.exclude("./dir/cache/");
+
+    ASSERT_TRUE(filter.included("./dir/x"));
+    ASSERT_TRUE(filter.included("dir//sub/./y"));
+    ASSERT_TRUE(filter.included("conf"));
+    ASSERT_TRUE(filter.included("./conf/app.conf"));
+    ASSERT_TRUE(filter.included("conf/"));
+    ASSERT_TRUE(!filter.included("./other/x"));
+
+    ASSERT_TRUE(filter.excluded("dir/cache/a"));
+    ASSERT_TRUE(filter.excluded("./dir/cache"));
+    ASSERT_TRUE(!filter.selects({"./dir/cache/a"}));
+    ASSERT_TRUE(filter.selects({"./dir/a"}));
+
+    std::vector<std::string> expected = {"+dir", "+conf", "-dir/cache"};
+    ASSERT_TRUE(filter.rules() == expected);
+}
+
+TEST(path_filter_rules) {
+    PathFilter filter;
+    ASSERT_TRUE(filter.rules().empty());
+
+    filter.exclude("*.tmp");
+    filter.include("services/*");
+    std::vector<std::string> expected = {"+services/*", "-*.tmp"};
+    ASSERT_TRUE(filter.rules() == expected);
+}
@@ -0,0 +1,140 @@
+#include <path_table.hpp>
+#include <string>
+#include <unit_common.hpp>
+#include <unit_test_framework.hpp>
+#include <util.hpp>
+#include <vector>
+
+TEST(path_table_intern_and_lookup) {
+    PathTable table;
+
+    ASSERT_EQUAL(table.intern("a/b/c"), 0);
+    ASSERT_EQUAL(table.intern("a/b/d"), 1);
+    ASSERT_EQUAL(table.intern("a/b/c"), 0);
+    ASSERT_EQUAL(table.size(), 2);
+
+    std::string path;
+    ASSERT_EQUAL(table.lookup(1, path), 0);
+    ASSERT_EQUAL(path, "a/b/d");
+    ASSERT_EQUAL(table.lookup(2, path), -1);
+
+    table.clear();
+    ASSERT_EQUAL(table.size(), 0);
+    ASSERT_EQUAL(table.lookup(0, path), -1);
+}
+
+TEST(path_table_write_and_read) {
+    PathTable   table, loaded;
+    std::string prefix = "some/long/directory/prefix/";
+    size_t      total = 0;
+
+    /* Interned out of order, across several restart points. */
+    for (int i = 49; i >= 0; i--) {
+        std::string path = prefix + "file_" + std::to_string(i);
+        total += path.size();
+        table.intern(path);
+    }
+    table.intern("");
+    table.intern("other");
+
+    std::vector<std::byte> data = {std::byte{42}};
+    std::vector<uint64_t>  positions;
+    ASSERT_EQUAL(table.write(data, &positions), 0);
+    ASSERT_TRUE(data.size() < total / 2);
+    ASSERT_EQUAL(positions.size(), table.size());
+    ASSERT_EQUAL(positions[50], 0);
+    ASSERT_EQUAL(positions[51], 1);
+
+    size_t offset = 1;
+    ASSERT_EQUAL(loaded.read(data, offset), 0);
+    ASSERT_EQUAL(offset, data.size());
+    ASSERT_EQUAL(loaded.size(), table.size());
+
+    std::string expected, path, previous;
+    uint64_t    position;
+    for (size_t i = 0; i < table.size(); i++) {
+        ASSERT_EQUAL(table.lookup(i, expected), 0);
+        ASSERT_EQUAL(loaded.lookup(i, path), 0);
+        ASSERT_EQUAL(path, expected);
+        ASSERT_EQUAL(loaded.position_of(i, position), 0);
+        ASSERT_EQUAL(position, positions[i]);
+        ASSERT_EQUAL(loaded.find(path), (int64_t)position);
+    }
+
+    for (size_t i = 0; i < loaded.size(); i++) {
+        ASSERT_EQUAL(loaded.path_at(i, path), 0);
+        ASSERT_TRUE(i == 0 || previous < path);
+        previous = path;
+    }
+    ASSERT_EQUAL(loaded.path_at(loaded.size(), path), -1);
+    ASSERT_EQUAL(loaded.lookup(loaded.size(), path), -1);
+
+    ASSERT_EQUAL(loaded.find(prefix), -1);
+    ASSERT_EQUAL(loaded.find(prefix + "file_5x"), -1);
+    ASSERT_EQUAL(loaded.find("zzz"), -1);
+}
+
+TEST(path_table_find_empty) {
+    PathTable              table, loaded;
+    std::vector<std::byte> data;
+    size_t                 offset = 0;
+
+    table.write(data);
+    ASSERT_EQUAL(loaded.read(data, offset), 0);
+    ASSERT_EQUAL(loaded.size(), 0);
+    ASSERT_EQUAL(loaded.find(""), -1);
+}
+
+TEST(path_table_read_corrupted) {
+    PathTable table, loaded;
+    table.intern("abd");
+    table.intern("abc");
+
+    std::vector<std::byte> data;
+    table.write(data);
+
+    for (size_t size = 0; size < data.size(); size++) {
+        size_t offset = 0;
+        ASSERT_EQUAL(loaded.read(std::span(data).first(size), offset), -1);
+    }
+
+    // the second path shares more than the length of the first one
+    std::string path;
+    size_t      offset = 0;
+    data[3 + 1 + 1 + 3] = std::byte{4};
+    ASSERT_EQUAL(loaded.read(data, offset), 0);
+    ASSERT_EQUAL(loaded.path_at(0, path), 0);
+    ASSERT_EQUAL(path, "abc");
+    ASSERT_EQUAL(loaded.path_at(1, path), -1);
+    ASSERT_EQUAL(loaded.lookup(0, path), -1);
+
+    // the restart point is out of bounds
+    data[data.size() - 12] = std::byte{100};
+    offset = 0;
+    ASSERT_EQUAL(loaded.read(data, offset), -1);
+}
+
+TEST(path_table_store_and_restore_path) {
+    PathTable              table;
+    std::vector<std::byte> data;
+    std::string            path;
+    size_t                 offset = 0;
+
+    store_path("x/y", &table, data);
+    store_path("x/y", nullptr, data);
+    ASSERT_EQUAL(data.size(), 1 + 4);
+
+    ASSERT_EQUAL(restore_path(data, offset, &table, path), 0);
+    ASSERT_EQUAL(path, "x/y");
+    ASSERT_EQUAL(restore_path(data, offset, nullptr, path), 0);
+    ASSERT_EQUAL(path, "x/y");
+    ASSERT_EQUAL(offset, data.size());
+
+    offset = 0;
+    data[0] = std::byte{7};
+    ASSERT_EQUAL(restore_path(data, offset, &table, path), -1);
+
+    offset = 1;
+    data.pop_back();
+    ASSERT_EQUAL(restore_path(data, offset, nullptr, path), -1);
+}
@@ -0,0 +1,134 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <pipeline.hpp>
+
+static Pipeline<int>::Producer count_to(int n) {
+	auto next = std::make_shared<int>(0);
+	return [=](int &item) {
+		if (*next == n) return 0;
+		item = (*next)++;
+		return 1;
+	};
+}
+
+TEST(pipeline_preserves_order) {
+	Pipeline<int> pipeline(8);
+	std::vector<int> consumed;
+
+	pipeline.add_stage("square", 4, [](int &item, uint64_t index) {
+		// finish items out of order
+		std::this_thread::sleep_for(std::chrono::microseconds((index * 7919) % 300));
+		item = item * item;
+		return 0;
+	});
+	pipeline.add_stage("negate", 3, [](int &item, uint64_t index) {
+		item = -item;
+		return 0;
+	});
+
+	ASSERT_EQUAL(pipeline.run(count_to(200), [&](int &item, uint64_t index) {
+		ASSERT_EQUAL((uint64_t)consumed.size(), index);
+		consumed.push_back(item);
+		return 0;
+	}), 0);
+
+	ASSERT_EQUAL(consumed.size(), 200);
+	for (int i = 0; i < 200; i++) ASSERT_EQUAL(consumed[i], -i * i);
+}
+
+TEST(pipeline_no_stages) {
+	Pipeline<int> pipeline(1);
+	int sum = 0;
+	ASSERT_EQUAL(pipeline.run(count_to(10), [&](int &item, uint64_t index) {
+		sum += item;
+		return 0;
+	}), 0);
+	ASSERT_EQUAL(sum, 45);
+}
+
+TEST(pipeline_respects_budget) {
+	Pipeline<int> pipeline(5, [](const int &item) { return 2; });
+	std::atomic<int> in_flight(0), max_in_flight(0);
+	auto produce = count_to(100);
+
+	pipeline.add_stage("work", 4, [&](int &item, uint64_t index) {
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+		return 0;
+	});
+
+	ASSERT_EQUAL(pipeline.run(
+		[&](int &item) {
+			int r = produce(item);
+			if (r == 1) {
+				int now = ++in_flight;
+				for (int m = max_in_flight; now > m && !max_in_flight.compare_exchange_weak(m, now);) {}
+			}
+			return r;
+		},
+		[&](int &item, uint64_t index) {
+			in_flight--;
+			return 0;
+		}), 0);
+
+	// the producer counts an item before waiting for the budget
+	ASSERT_TRUE(max_in_flight <= 3);
+}
+
+TEST(pipeline_stage_failure) {
+	Pipeline<int> pipeline(4);
+	int consumed = 0;
+
+	pipeline.add_stage("fail", 2, [](int &item, uint64_t index) {
+		return item == 50 ? -1 : 0;
+	});
+
+	ASSERT_EQUAL(pipeline.run(count_to(1000), [&](int &item, uint64_t index) {
+		consumed++;
+		return 0;
+	}), -1);
+	ASSERT_TRUE(consumed <= 50);
+}
+
+TEST(pipeline_producer_and_consumer_failure) {
+	Pipeline<int> p1(4);
+	ASSERT_EQUAL(p1.run([](int &item) { return -1; },
+		[](int &item, uint64_t index) { return 0; }), -1);
+
+	Pipeline<int> p2(4);
+	p2.add_stage("noop", 2, [](int &item, uint64_t index) { return 0; });
+	ASSERT_EQUAL(p2.run(count_to(100), [](int &item, uint64_t index) {
+		return index == 10 ? -1 : 0;
+	}), -1);
+}
+
+TEST(pipeline_cost_grows_in_stage) {
+	// items cost 1 when produced, 10 once processed
+	Pipeline<int> pipeline(10, [](const int &item) { return item < 0 ? 10 : 1; });
+	std::atomic<int> produced(0), max_ahead(0);
+
+	pipeline.add_stage("grow", 1, [](int &item, uint64_t index) {
+		item = -1;
+		return 0;
+	});
+
+	ASSERT_EQUAL(pipeline.run(
+		[&](int &item) {
+			if (produced == 50) return 0;
+			item = produced++;
+			return 1;
+		},
+		[&](int &item, uint64_t index) {
+			int ahead = produced - (int)index;
+			if (ahead > max_ahead) max_ahead = ahead;
+			return 0;
+		}), 0);
+
+	// the producer counts an item before waiting for the budget
+	ASSERT_TRUE(max_ahead <= 11);
+}
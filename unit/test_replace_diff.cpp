@@ -0,0 +1,76 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <vector>
+#include <cstring>
+#include <string>
+
+#include <diff.hpp>
+#include <util.hpp>
+#include <config.hpp>
+
+static std::vector<std::byte> str2vec(std::string s) {
+	std::vector<std::byte> res;
+	for (auto c: s) res.push_back((std::byte)c);
+	return res;
+}
+
+static std::string vec2str(std::vector<std::byte> v) {
+	std::string res;
+	for (auto b: v) res += (char)b;
+	return res;
+}
+
+#define SRC TEMP_FILE1
+#define DEST TEMP_FILE2
+
+static void setup() {
+	std::system("rm -rf " SRC " " DEST);
+	open_and_write_entire_file(SRC, str2vec("from"));
+	open_and_write_entire_file(DEST, str2vec("to"));
+}
+
+TEST(replace_diff_from_files) {
+	setup();
+	ReplaceDiff diff;
+	ASSERT_EQUAL(diff.signature, Diff::REPLACE_DIFF);
+	ASSERT_EQUAL(diff.from_files(SRC, DEST), 0);
+	ASSERT_EQUAL(vec2str(diff.data), "to");
+	ASSERT_EQUAL(diff.data_size(), 2);
+
+	ASSERT_EQUAL(diff.from_files(SRC, "/nonexistent/file"), -1);
+}
+
+TEST(replace_diff_binary_representation) {
+	setup();
+	for (auto compressor : std::vector<std::shared_ptr<Compressor>>{
+	         PlainCompressor::get(), ZLibCompressor::get(), AutoCompressor::get()}) {
+		ReplaceDiff diff;
+		diff.compressor = compressor;
+		ASSERT_EQUAL(diff.from_files(SRC, DEST), 0);
+		auto vec = diff.binary_representation();
+
+		ReplaceDiff restored;
+		ASSERT_EQUAL(restored.from_binary_representation(vec), 0);
+		ASSERT_EQUAL(vec2str(restored.data), "to");
+	}
+
+	ReplaceDiff diff;
+	std::vector<std::byte> vec{std::byte{150}};
+	ASSERT_EQUAL(diff.from_binary_representation(vec), -1);
+	vec.clear();
+	ASSERT_EQUAL(diff.from_binary_representation(vec), -1);
+}
+
+TEST(replace_diff_apply) {
+	setup();
+	ReplaceDiff diff;
+	std::vector<std::byte> data;
+	diff.compressor = PlainCompressor::get();
+	ASSERT_EQUAL(diff.from_files(SRC, DEST), 0);
+	ASSERT_EQUAL(diff.apply(SRC), 0);
+	ASSERT_EQUAL(open_and_read_entire_file(SRC, data), 0);
+	ASSERT_EQUAL(vec2str(data), "to");
+
+	ASSERT_EQUAL(diff.apply("/nonexistent/file"), -1);
+}
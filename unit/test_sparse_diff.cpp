@@ -0,0 +1,121 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <diff.hpp>
+#include <util.hpp>
+
+static std::vector<std::byte> read_file(const char *file) {
+	std::vector<std::byte> res;
+	open_and_read_entire_file(file, res);
+	return res;
+}
+
+/* 4K of data at 0 and at 1M, holes up to 2M. */
+static std::vector<std::byte> write_sparse_file(const char *file) {
+	std::vector<std::byte> contents(2 << 20), block(4096, std::byte{0x61});
+	std::system((std::string("rm -f ") + file).c_str());
+	int fd = open(file, O_WRONLY | O_CREAT, 0644);
+	write_at(fd, block.data(), block.size(), 0);
+	write_at(fd, block.data(), block.size(), 1 << 20);
+	ftruncate(fd, 2 << 20);
+	close(fd);
+	memset(contents.data(), 0x61, 4096);
+	memset(contents.data() + (1 << 20), 0x61, 4096);
+	return contents;
+}
+
+static uint64_t allocated(const char *file) {
+	struct stat sb;
+	stat(file, &sb);
+	return (uint64_t)sb.st_blocks * 512;
+}
+
+TEST(sparse_diff_signature) {
+	SparseDiff diff;
+	ASSERT_EQUAL(diff.signature, Diff::SPARSE_DIFF);
+	ASSERT_NOT_EQUAL(Diff::from_signature(Diff::SPARSE_DIFF), nullptr);
+}
+
+TEST(sparse_diff_find_data_extents) {
+	write_sparse_file(TEMP_FILE1);
+	std::vector<FileExtent> extents;
+	int fd = open(TEMP_FILE1, O_RDONLY);
+	ASSERT_EQUAL(find_data_extents(fd, 2 << 20, extents), 0);
+	close(fd);
+
+	// without support for holes, the whole file is data
+	if (!SparseDiff::has_holes(TEMP_FILE1)) {
+		ASSERT_EQUAL(extents.size(), 1);
+		return;
+	}
+	ASSERT_EQUAL(extents.size(), 2);
+	ASSERT_EQUAL(extents[0].offset, 0);
+	ASSERT_EQUAL(extents[0].length, 4096);
+	ASSERT_EQUAL(extents[1].offset, 1 << 20);
+	ASSERT_EQUAL(extents[1].length, 4096);
+
+	uint64_t stored = 0;
+	ASSERT_TRUE(SparseDiff::has_holes(TEMP_FILE1, &stored));
+	ASSERT_TRUE(stored > 2 * 4096 && stored < 2 * 4096 + 16);
+
+	open_and_write_entire_file(TEMP_FILE2, std::vector<std::byte>(10000, std::byte{1}));
+	ASSERT_TRUE(!SparseDiff::has_holes(TEMP_FILE2, &stored));
+	ASSERT_EQUAL(stored, 10000 + 6);
+	ASSERT_TRUE(!SparseDiff::has_holes("/nonexistent/file"));
+}
+
+TEST(sparse_diff_apply) {
+	auto contents = write_sparse_file(TEMP_FILE1);
+	open_and_write_entire_file(TEMP_FILE2, std::vector<std::byte>(3 << 20, std::byte{1}));
+
+	SparseDiff diff;
+	diff.compressor = PlainCompressor::get();
+	ASSERT_EQUAL(diff.from_files(TEMP_FILE2, TEMP_FILE1), 0);
+	if (SparseDiff::has_holes(TEMP_FILE1)) {
+		ASSERT_TRUE(diff.data_size() < 10000);
+	}
+
+	SparseDiff restored;
+	ASSERT_EQUAL(restored.from_binary_representation(diff.binary_representation()), 0);
+	ASSERT_EQUAL(restored.apply(TEMP_FILE2), 0);
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE2), contents);
+	if (SparseDiff::has_holes(TEMP_FILE1)) {
+		ASSERT_TRUE(allocated(TEMP_FILE2) < (1 << 20));
+	}
+
+	// a file without holes is stored whole
+	auto dense = std::vector<std::byte>(5000, std::byte{7});
+	open_and_write_entire_file(TEMP_FILE3, dense);
+	ASSERT_EQUAL(diff.from_files(TEMP_FILE2, TEMP_FILE3), 0);
+	ASSERT_EQUAL(diff.apply(TEMP_FILE2), 0);
+	ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE2), dense);
+}
+
+TEST(sparse_diff_invalid) {
+	write_sparse_file(TEMP_FILE1);
+	auto dense = std::vector<std::byte>(5000, std::byte{7});
+	open_and_write_entire_file(TEMP_FILE2, dense);
+
+	SparseDiff diff;
+	diff.compressor = PlainCompressor::get();
+	ASSERT_EQUAL(diff.from_files(TEMP_FILE2, "/nonexistent/file"), -1);
+	ASSERT_EQUAL(diff.from_files(TEMP_FILE2, TEMP_FILE1), 0);
+
+	// data missing at the end, or a range past the size of the file
+	auto repr = diff.binary_representation();
+	for (auto corrupted : {std::vector<std::byte>(repr.begin(), repr.end() - 1),
+	                       [&] { auto r = repr; r[1] = std::byte{1}; return r; }()}) {
+		SparseDiff restored;
+		ASSERT_EQUAL(restored.from_binary_representation(corrupted), 0);
+		ASSERT_EQUAL(restored.apply(TEMP_FILE2), -1);
+		ASSERT_SEQUENCE_EQUAL(read_file(TEMP_FILE2), dense);
+	}
+}
@@ -4,6 +4,8 @@
 #include <vector>
 #include <cstring>
 #include <string>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <diff.hpp>
 #include <util.hpp>
@@ -54,6 +56,33 @@ TEST(system_diff_from_files_ok) {
 	ASSERT_TRUE(!ptr->data.empty());
 }
 
+TEST(system_diff_from_files_low_descriptors) {
+	setup();
+	SystemDiff diff;
+
+	// with stdin and descriptor 3 closed, the dumps get descriptors 0 and 3: the
+	// one moved to 3 must not replace the other before it is moved to 4
+	int saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+	int saved_3 = fcntl(3, F_DUPFD_CLOEXEC, 10);
+	ASSERT_NOT_EQUAL(saved_in, -1);
+	close(STDIN_FILENO);
+	close(3);
+	int r = diff.from_files(SRC, DEST);
+	dup2(saved_in, STDIN_FILENO);
+	close(saved_in);
+	if (saved_3 != -1) {
+		dup2(saved_3, 3);
+		close(saved_3);
+	}
+
+	ASSERT_EQUAL(r, 0);
+	ASSERT_TRUE(!diff.data.empty());
+	ASSERT_EQUAL(diff.apply(SRC), 0);
+	std::vector<std::byte> data;
+	ASSERT_EQUAL(open_and_read_entire_file(SRC, data), 0);
+	ASSERT_EQUAL(vec2str(data), "to");
+}
+
 TEST(system_diff_from_files_no_xxd) {
 	setup();
 	std::shared_ptr<SystemDiff> ptr = dynamic_pointer_cast<SystemDiff>(Diff::from_signature(Diff::SYSTEM_DIFF));
@@ -106,6 +135,21 @@ TEST(system_diff_from_binary_representation_zlib) {
 	ASSERT_SEQUENCE_EQUAL(ptr->data, data);
 }
 
+TEST(system_diff_from_binary_representation_auto) {
+	setup();
+	std::shared_ptr<SystemDiff> ptr = dynamic_pointer_cast<SystemDiff>(Diff::from_signature(Diff::SYSTEM_DIFF));
+	ptr->compressor = AutoCompressor::get();
+
+	// the id of the compressor picked is stored
+	ASSERT_EQUAL(ptr->from_files(SRC, DEST), 0);
+	auto vec = ptr->binary_representation();
+	auto data = ptr->data;
+	ASSERT_EQUAL(vec[0], (std::byte)AutoCompressor::get()->select(data)->get_id());
+
+	ASSERT_EQUAL(ptr->from_binary_representation(vec), 0);
+	ASSERT_SEQUENCE_EQUAL(ptr->data, data);
+}
+
 TEST(system_diff_from_binary_representation_invalid) {
 	setup();
 	std::shared_ptr<SystemDiff> ptr = dynamic_pointer_cast<SystemDiff>(Diff::from_signature(Diff::SYSTEM_DIFF));
@@ -165,3 +209,83 @@ TEST(system_diff_apply_empty_diff) {
 	ASSERT_EQUAL(ptr->apply(TEMP_FILE3), 0);
 }
 
+
+TEST(system_diff_apply_native) {
+	setup();
+	auto ptr = dynamic_pointer_cast<SystemDiff>(Diff::from_signature(Diff::SYSTEM_DIFF));
+
+	// additions, deletions and changes at the start, middle and end
+	std::string from = "abcdefghijklmnopqrstuvwxyz", to = "0abcdfghXYZjklmnopqrstuvw!";
+	open_and_write_entire_file(SRC, str2vec(from));
+	open_and_write_entire_file(DEST, str2vec(to));
+	ASSERT_EQUAL(ptr->from_files(SRC, DEST), 0);
+
+	std::vector<std::byte> out;
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec(from), ptr->data, out), 0);
+	ASSERT_EQUAL(vec2str(out), to);
+
+	// no xxd or patch needed
+	std::system("rm -rf " TEMP_FILE3);
+	std::system("cp " SRC " " TEMP_FILE3);
+	char *old = getenv("PATH");
+	setenv("PATH", "", 1);
+	int r = ptr->apply(TEMP_FILE3);
+	setenv("PATH", old, 1);
+	ASSERT_EQUAL(r, 0);
+	std::vector<std::byte> applied;
+	ASSERT_EQUAL(open_and_read_entire_file(TEMP_FILE3, applied), 0);
+	ASSERT_EQUAL(vec2str(applied), to);
+}
+
+TEST(system_diff_patch_bytes_commands) {
+	std::vector<std::byte> out;
+
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("0a1\n> 78\n"), out), 0);
+	ASSERT_EQUAL(vec2str(out), "xab");
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("2d1\n< 62\n"), out), 0);
+	ASSERT_EQUAL(vec2str(out), "a");
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("1,2c1\n< 61\n< 62\n---\n> 7A\n"), out), 0);
+	ASSERT_EQUAL(vec2str(out), "z");
+	ASSERT_EQUAL(SystemDiff::patch_bytes({}, str2vec("0a1,2\n> 61\n> 62\n\\ No newline at end of file\n"), out), 0);
+	ASSERT_EQUAL(vec2str(out), "ab");
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), {}, out), 0);
+	ASSERT_EQUAL(vec2str(out), "ab");
+}
+
+TEST(system_diff_patch_bytes_invalid) {
+	std::vector<std::byte> out;
+
+	// removed bytes that are not there
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("2d1\n< 63\n"), out), -1);
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("3d2\n< 63\n"), out), -1);
+	// hunks out of order
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("2d1\n< 62\n1d0\n< 61\n"), out), -1);
+	// malformed
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("1x1\n"), out), -1);
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("0a1\n> 7g\n"), out), -1);
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("1c1\n< 61\n> 62\n"), out), -1);
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("0a1\n"), out), -1);
+	ASSERT_EQUAL(SystemDiff::patch_bytes(str2vec("ab"), str2vec("0a2\n> 61\n"), out), -1);
+}
+
+TEST(system_diff_apply_with_tools) {
+	setup();
+	auto ptr = dynamic_pointer_cast<SystemDiff>(Diff::from_signature(Diff::SYSTEM_DIFF));
+
+	// paths are passed to the tools as they are, without a shell
+	const char *src = TEMP_FILE3 " $(false) 'x";
+	std::string to = "0abcdfghXYZjklmnopqrstuvw!";
+	open_and_write_entire_file(src, str2vec("abcdefghijklmnopqrstuvwxyz"));
+	open_and_write_entire_file(DEST, str2vec(to));
+	ASSERT_EQUAL(ptr->from_files(src, DEST), 0);
+	ASSERT_TRUE(!ptr->data.empty());
+
+	ASSERT_EQUAL(ptr->apply_with_tools(src), 0);
+	std::vector<std::byte> applied;
+	ASSERT_EQUAL(open_and_read_entire_file(src, applied), 0);
+	ASSERT_EQUAL(vec2str(applied), to);
+	unlink(src);
+
+	ASSERT_EQUAL(ptr->from_files(TEMP_FILE3 " missing", DEST), -1);
+	ASSERT_EQUAL(ptr->apply_with_tools(TEMP_FILE3 " missing"), -1);
+}
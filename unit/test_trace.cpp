@@ -0,0 +1,90 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <trace.hpp>
+#include <util.hpp>
+
+static std::string vec2str(std::vector<std::byte> v) {
+	std::string res;
+	for (auto b: v) res += (char)b;
+	return res;
+}
+
+static size_t count(const std::string &s, const std::string &what) {
+	size_t res = 0;
+	for (size_t pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + 1)) res++;
+	return res;
+}
+
+TEST(trace_disabled_scope_records_nothing) {
+	ASSERT_FALSE(Tracer::get()->is_enabled());
+	{
+		TRACE_SCOPE("trace_test_disabled");
+	}
+	ASSERT_EQUAL(Tracer::get()->write_to_file(TEMP_FILE1), 0);
+
+	std::vector<std::byte> data;
+	ASSERT_EQUAL(open_and_read_entire_file(TEMP_FILE1, data), 0);
+	ASSERT_EQUAL(count(vec2str(data), "trace_test_disabled"), 0);
+}
+
+TEST(trace_write_to_file) {
+	Tracer::get()->enable();
+	{
+		TRACE_SCOPE("trace_test_main", 7, "dir/\"quoted\".txt");
+	}
+	std::thread([]() {
+		TRACE_SCOPE("trace_test_thread");
+	}).join();
+	ASSERT_EQUAL(Tracer::get()->write_to_file(TEMP_FILE1), 0);
+
+	std::vector<std::byte> data;
+	ASSERT_EQUAL(open_and_read_entire_file(TEMP_FILE1, data), 0);
+	std::string json = vec2str(data);
+	ASSERT_EQUAL(count(json, "\"traceEvents\""), 1);
+	ASSERT_EQUAL(count(json, "\"name\":\"trace_test_main\""), 2);
+	ASSERT_EQUAL(count(json, "\"name\":\"trace_test_thread\""), 2);
+	ASSERT_EQUAL(count(json, "\"index\":7,\"path\":\"dir/\\\"quoted\\\".txt\""), 1);
+
+	ASSERT_EQUAL(Tracer::get()->write_to_file("/nonexistent/dir/trace.json"), -1);
+}
+
+TEST(trace_ring_overwrites_oldest_events) {
+	Tracer::get()->enable();
+	Tracer::get()->set_ring_capacity(4);
+	std::thread([]() {
+		for (int i = 0; i < 10; i++) {
+			TRACE_SCOPE(i < 8 ? "trace_test_old" : "trace_test_new");
+		}
+	}).join();
+	Tracer::get()->set_ring_capacity(1 << 16);
+	ASSERT_EQUAL(Tracer::get()->write_to_file(TEMP_FILE1), 0);
+
+	std::vector<std::byte> data;
+	ASSERT_EQUAL(open_and_read_entire_file(TEMP_FILE1, data), 0);
+	std::string json = vec2str(data);
+	ASSERT_EQUAL(count(json, "trace_test_old"), 0);
+	ASSERT_EQUAL(count(json, "trace_test_new"), 4);
+}
+
+TEST(trace_ring_drops_unmatched_end_events) {
+	Tracer::get()->enable();
+	Tracer::get()->set_ring_capacity(3);
+	std::thread([]() {
+		TRACE_SCOPE("trace_test_outer");
+		TRACE_SCOPE("trace_test_inner");
+	}).join();
+	Tracer::get()->set_ring_capacity(1 << 16);
+	ASSERT_EQUAL(Tracer::get()->write_to_file(TEMP_FILE1), 0);
+
+	// B outer was overwritten: B inner, E inner and E outer are left
+	std::vector<std::byte> data;
+	ASSERT_EQUAL(open_and_read_entire_file(TEMP_FILE1, data), 0);
+	std::string json = vec2str(data);
+	ASSERT_EQUAL(count(json, "trace_test_inner"), 2);
+	ASSERT_EQUAL(count(json, "trace_test_outer"), 0);
+}
@@ -34,6 +34,30 @@ TEST(util_shorten_size) {
 	ASSERT_EQUAL(shorten_size(50000ll*1024*1024*1024*1024), "50000.0 TiB");
 }
 
+TEST(util_parse_size) {
+	size_t value;
+	ASSERT_EQUAL(parse_size("0", value), 0);
+	ASSERT_EQUAL(value, 0);
+	ASSERT_EQUAL(parse_size("17", value), 0);
+	ASSERT_EQUAL(value, 17);
+	ASSERT_EQUAL(parse_size("3K", value), 0);
+	ASSERT_EQUAL(value, 3 * 1024);
+	ASSERT_EQUAL(parse_size("64M", value), 0);
+	ASSERT_EQUAL(value, 64 * 1024 * 1024);
+	ASSERT_EQUAL(parse_size("2G", value), 0);
+	ASSERT_EQUAL(value, 2ull * 1024 * 1024 * 1024);
+	ASSERT_EQUAL(parse_size("1T", value), 0);
+	ASSERT_EQUAL(value, 1ull << 40);
+
+	ASSERT_EQUAL(parse_size(nullptr, value), -1);
+	ASSERT_EQUAL(parse_size("", value), -1);
+	ASSERT_EQUAL(parse_size("-1", value), -1);
+	ASSERT_EQUAL(parse_size("12X", value), -1);
+	ASSERT_EQUAL(parse_size("1KB", value), -1);
+	ASSERT_EQUAL(parse_size("99999999999999999999", value), -1);
+	ASSERT_EQUAL(parse_size("99999999999T", value), -1);
+}
+
 static std::vector<std::byte> str2vec(std::string s) {
 	std::vector<std::byte> res;
 	for (auto c: s) res.push_back((std::byte)c);
@@ -130,6 +154,58 @@ TEST(util_store_uint64_t_restore_uint64_t) {
 	ASSERT_EQUAL(restore_uint64_t(it, vec.end(), val), -1);
 }
 
+TEST(util_store_uint32_t_restore_uint32_t) {
+	setup();
+
+	std::vector<std::byte> vec;
+	size_t offset = 0;
+	uint32_t val;
+
+	store_uint32_t(0xe3069283, vec);
+	store_uint32_t(7, vec);
+	ASSERT_EQUAL(vec.size(), 8);
+	ASSERT_EQUAL(vec[0], std::byte{0x83});
+
+	ASSERT_EQUAL(restore_uint32_t(vec, offset, val), 0);
+	ASSERT_EQUAL(val, 0xe3069283);
+	ASSERT_EQUAL(restore_uint32_t(vec, offset, val), 0);
+	ASSERT_EQUAL(val, 7);
+	ASSERT_EQUAL(offset, 8);
+
+	offset = 5;
+	ASSERT_EQUAL(restore_uint32_t(vec, offset, val), -1);
+}
+
+TEST(util_store_varint_restore_varint) {
+	setup();
+
+	std::vector<std::byte> vec;
+	uint64_t values[] = {0, 1, 127, 128, 300, 1ull << 35, ~0ull};
+	size_t offset = 0;
+	uint64_t val;
+
+	for (auto value : values) store_varint(value, vec);
+	ASSERT_EQUAL(vec.size(), 1 + 1 + 1 + 2 + 2 + 6 + 10);
+
+	for (auto value : values) {
+		ASSERT_EQUAL(restore_varint(vec, offset, val), 0);
+		ASSERT_EQUAL(val, value);
+	}
+	ASSERT_EQUAL(offset, vec.size());
+	ASSERT_EQUAL(restore_varint(vec, offset, val), -1);
+
+	// truncated
+	vec.clear();
+	store_varint(300, vec);
+	offset = 0;
+	ASSERT_EQUAL(restore_varint(std::span(vec).first(1), offset, val), -1);
+
+	// more than 10 bytes
+	vec.assign(11, std::byte{0x80});
+	offset = 0;
+	ASSERT_EQUAL(restore_varint(vec, offset, val), -1);
+}
+
 TEST(util_mkdirr) {
 	setup();
 	char *f;
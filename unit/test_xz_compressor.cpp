@@ -0,0 +1,110 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <lzma.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <string>
+
+#include <compressor.hpp>
+#include <patch_context.hpp>
+
+static std::vector<std::byte> random_text(size_t size, unsigned seed) {
+	std::vector<std::byte> res(size);
+	for (auto &b : res) b = (std::byte)('a' + (rand_r(&seed) % 8));
+	return res;
+}
+
+TEST(xz_compressor_get) {
+	ASSERT_NOT_EQUAL(XzCompressor::get(), nullptr);
+	ASSERT_EQUAL(XzCompressor::get()->get_id(), XzCompressor::id);
+	ASSERT_EQUAL(PatchContext::compressor_from_id(XzCompressor::id, nullptr), XzCompressor::get());
+}
+
+TEST(xz_compressor_compress_decompress) {
+	for (size_t size : {0, 1, 1000, 300000}) {
+		auto data = random_text(size, size);
+		auto res = XzCompressor::get()->compress(data);
+		ASSERT_TRUE(res.size() > 8);
+		ASSERT_SEQUENCE_EQUAL(XzCompressor::get()->decompress(res), data);
+
+		// the stream is a plain .xz stream
+		std::vector<std::byte> decoded(size);
+		uint64_t memory_limit = UINT64_MAX;
+		size_t in_pos = 0, out_pos = 0;
+		ASSERT_EQUAL(lzma_stream_buffer_decode(&memory_limit, 0, nullptr, (const uint8_t *)res.data(),
+		                                       &in_pos, res.size() - 8, (uint8_t *)decoded.data(),
+		                                       &out_pos, size), LZMA_OK);
+		ASSERT_SEQUENCE_EQUAL(decoded, data);
+	}
+}
+
+TEST(xz_compressor_presets_and_threads) {
+	auto data = random_text(200000, 1);
+	XzCompressor fast(0), extreme(9 | LZMA_PRESET_EXTREME), threaded(0, 4);
+
+	// any instance reads what any other wrote
+	ASSERT_SEQUENCE_EQUAL(XzCompressor::get()->decompress(fast.compress(data)), data);
+	ASSERT_SEQUENCE_EQUAL(fast.decompress(extreme.compress(data)), data);
+	ASSERT_TRUE(extreme.compress(data).size() <= fast.compress(data).size());
+
+	// preset 0 has 256K dictionaries: 1.5M makes two blocks and more
+	auto large = random_text(3 << 20, 2);
+	auto res = threaded.compress(large);
+	ASSERT_SEQUENCE_EQUAL(XzCompressor::get()->decompress(res), large);
+
+	XzCompressor invalid(10);
+	std::vector<std::byte> out;
+	ASSERT_EQUAL(invalid.compress_into(data, out), -1);
+	ASSERT_TRUE(out.empty());
+}
+
+TEST(xz_compressor_corrupted) {
+	auto data = random_text(1000, 3);
+	auto res = XzCompressor::get()->compress(data);
+	std::vector<std::byte> out{std::byte{7}};
+
+	// wrong original size, either way
+	auto wrong = res;
+	wrong[wrong.size() - 8] = std::byte{10};
+	wrong[wrong.size() - 7] = std::byte{0};
+	ASSERT_EQUAL(XzCompressor::get()->decompress_into(wrong, out), -1);
+	wrong[wrong.size() - 7] = std::byte{100};
+	ASSERT_EQUAL(XzCompressor::get()->decompress_into(wrong, out), -1);
+
+	// damaged stream, truncated stream, too short
+	wrong = res;
+	wrong[wrong.size() / 2] ^= std::byte{0xff};
+	ASSERT_EQUAL(XzCompressor::get()->decompress_into(wrong, out), -1);
+	wrong = res;
+	wrong.erase(wrong.begin() + wrong.size() / 2, wrong.end() - 8);
+	ASSERT_EQUAL(XzCompressor::get()->decompress_into(wrong, out), -1);
+	ASSERT_EQUAL(XzCompressor::get()->decompress_into(std::span(res).subspan(0, 5), out), -1);
+
+	// a failure leaves the output as it was
+	ASSERT_EQUAL(out.size(), 1);
+	ASSERT_EQUAL(XzCompressor::get()->decompress_into(res, out), 0);
+	ASSERT_EQUAL(out.size(), 1001);
+}
+
+TEST(xz_compressor_threads) {
+	std::vector<std::thread> threads;
+	std::atomic<int> failures = 0;
+	XzCompressor fast(1);
+
+	for (unsigned t = 0; t < 4; t++) {
+		threads.emplace_back([t, &failures, &fast]() {
+			for (unsigned i = 0; i < 10; i++) {
+				auto data = random_text((t * 10 + i) * 997 % 50000, t * 10 + i);
+				if (fast.decompress(fast.compress(data)) != data) {
+					failures++;
+				}
+			}
+		});
+	}
+	for (auto &thread : threads) thread.join();
+	ASSERT_EQUAL(failures.load(), 0);
+}
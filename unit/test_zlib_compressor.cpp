@@ -1,6 +1,10 @@
 #include <unit_test_framework.hpp>
 #include <unit_common.hpp>
 
+#include <zlib.h>
+
+#include <atomic>
+#include <thread>
 #include <vector>
 #include <cstring>
 #include <string>
@@ -31,3 +35,83 @@ TEST(zlib_compressor_compress_decompress) {
 	res.clear();
 	ASSERT_TRUE(ZLibCompressor::get()->decompress(res).empty());
 }
+
+TEST(zlib_compressor_into_appends) {
+	std::vector<std::byte> data{std::byte{4}, std::byte{5}, std::byte{6}};
+	std::vector<std::byte> res{std::byte{9}};
+	std::vector<std::byte> out{std::byte{7}};
+
+	ASSERT_EQUAL(ZLibCompressor::get()->compress_into(data, res), 0);
+	ASSERT_EQUAL(res[0], std::byte{9});
+	ASSERT_EQUAL(ZLibCompressor::get()->decompress_into(std::span(res).subspan(1), out), 0);
+	ASSERT_EQUAL(out.size(), 4);
+	ASSERT_EQUAL(out[0], std::byte{7});
+	ASSERT_EQUAL(out[3], std::byte{6});
+
+	// a failure leaves the output as it was
+	ASSERT_EQUAL(ZLibCompressor::get()->decompress_into(std::span(res).subspan(0, 5), out), -1);
+	ASSERT_EQUAL(out.size(), 4);
+}
+
+static std::vector<std::byte> random_text(size_t size, unsigned seed) {
+	std::vector<std::byte> res(size);
+	for (auto &b : res) b = (std::byte)('a' + (rand_r(&seed) % 8));
+	return res;
+}
+
+TEST(zlib_compressor_same_as_compress) {
+	// the reused stream gives what a fresh one does, payload after payload
+	for (size_t size : {0, 1, 100, 70000, 1000, 300000, 5}) {
+		auto data = random_text(size, size);
+		std::vector<std::byte> expected(compressBound(size));
+		uLongf len = expected.size();
+		ASSERT_EQUAL(::compress((Bytef *)expected.data(), &len, (const Bytef *)data.data(), size), Z_OK);
+		expected.resize(len);
+
+		auto res = ZLibCompressor::get()->compress(data);
+		res.resize(res.size() - 8);
+#ifndef PATCHIT_LIBDEFLATE
+		ASSERT_SEQUENCE_EQUAL(res, expected);
+#endif
+
+		// readable by stock zlib whatever the backend
+		std::vector<std::byte> decompressed(size);
+		uLongf decompressed_len = size;
+		ASSERT_EQUAL(::uncompress((Bytef *)decompressed.data(), &decompressed_len,
+		                          (const Bytef *)res.data(), res.size()), Z_OK);
+		ASSERT_SEQUENCE_EQUAL(decompressed, data);
+		ASSERT_SEQUENCE_EQUAL(ZLibCompressor::get()->decompress(ZLibCompressor::get()->compress(data)), data);
+	}
+}
+
+TEST(zlib_compressor_wrong_original_size) {
+	auto data = random_text(1000, 1);
+	auto res = ZLibCompressor::get()->compress(data);
+	std::vector<std::byte> out;
+
+	// too small a size fails, and the stream is still usable afterwards
+	res[res.size() - 8] = std::byte{10};
+	res[res.size() - 7] = std::byte{0};
+	ASSERT_EQUAL(ZLibCompressor::get()->decompress_into(res, out), -1);
+	ASSERT_TRUE(out.empty());
+	ASSERT_SEQUENCE_EQUAL(ZLibCompressor::get()->decompress(ZLibCompressor::get()->compress(data)), data);
+}
+
+TEST(zlib_compressor_threads) {
+	std::vector<std::thread> threads;
+	std::atomic<int> failures = 0;
+
+	for (unsigned t = 0; t < 8; t++) {
+		threads.emplace_back([t, &failures]() {
+			auto compressor = ZLibCompressor::get();
+			for (unsigned i = 0; i < 50; i++) {
+				auto data = random_text((t * 50 + i) * 37 % 20000, t * 50 + i);
+				if (compressor->decompress(compressor->compress(data)) != data) {
+					failures++;
+				}
+			}
+		});
+	}
+	for (auto &thread : threads) thread.join();
+	ASSERT_EQUAL(failures.load(), 0);
+}
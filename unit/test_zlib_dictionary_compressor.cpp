@@ -0,0 +1,98 @@
+#include <unit_test_framework.hpp>
+#include <unit_common.hpp>
+
+#include <vector>
+#include <cstring>
+#include <string>
+
+#include <compressor.hpp>
+
+static void setup() {
+}
+
+static std::vector<std::byte> str2vec(std::string s) {
+	std::vector<std::byte> res;
+	for (auto c : s) res.push_back((std::byte)c);
+	return res;
+}
+
+TEST(zlib_dictionary_compressor_compress_decompress) {
+	ZLibDictionaryCompressor c(str2vec("locale=en_US\ncolor=blue\n"));
+	std::vector<std::byte> data = str2vec("locale=en_US\ncolor=red\n");
+	std::vector<std::byte> res;
+
+	ASSERT_EQUAL(c.get_id(), ZLibDictionaryCompressor::id);
+	res = c.compress(data);
+	ASSERT_TRUE(res.size() > 0);
+	ASSERT_SEQUENCE_EQUAL(data, c.decompress(res));
+
+	// the dictionary makes the stream smaller
+	ASSERT_TRUE(res.size() < ZLibCompressor::get()->compress(data).size());
+
+	// a different dictionary cannot decompress it
+	ZLibDictionaryCompressor other(str2vec("something else"));
+	ASSERT_TRUE(other.decompress(res).empty());
+
+	res.clear();
+	ASSERT_TRUE(c.decompress(res).empty());
+}
+
+TEST(zlib_dictionary_compressor_into_appends) {
+	ZLibDictionaryCompressor c(str2vec("abcdef"));
+	std::vector<std::byte> data{std::byte{4}, std::byte{5}, std::byte{6}};
+	std::vector<std::byte> res{std::byte{9}};
+	std::vector<std::byte> out{std::byte{7}};
+
+	ASSERT_EQUAL(c.compress_into(data, res), 0);
+	ASSERT_EQUAL(res[0], std::byte{9});
+	ASSERT_EQUAL(c.decompress_into(std::span(res).subspan(1), out), 0);
+	ASSERT_EQUAL(out.size(), 4);
+	ASSERT_EQUAL(out[0], std::byte{7});
+	ASSERT_EQUAL(out[3], std::byte{6});
+
+	// a failure leaves the output as it was
+	ASSERT_EQUAL(c.decompress_into(std::span(res).subspan(0, 5), out), -1);
+	ASSERT_EQUAL(out.size(), 4);
+}
+
+TEST(zlib_dictionary_compressor_train) {
+	std::vector<std::vector<std::byte>> samples;
+	for (int i = 0; i < 4; i++) {
+		samples.push_back(str2vec("common line\nunique " + std::to_string(i) + "\n" +
+		                          std::string(100, 'x') + "\n"));
+	}
+
+	std::vector<std::byte> dictionary = ZLibDictionaryCompressor::train(samples);
+	std::string            s((const char *)dictionary.data(), dictionary.size());
+
+	ASSERT_NOT_EQUAL(s.find("common line\n"), std::string::npos);
+	ASSERT_NOT_EQUAL(s.find(std::string(64, 'x')), std::string::npos);
+	ASSERT_EQUAL(s.find("unique"), std::string::npos);
+
+	// the most valuable segment comes last
+	ASSERT_EQUAL(s.substr(s.size() - 64), std::string(64, 'x'));
+
+	// training is deterministic and respects the maximum size
+	ASSERT_SEQUENCE_EQUAL(dictionary, ZLibDictionaryCompressor::train(samples));
+	ASSERT_TRUE(ZLibDictionaryCompressor::train(samples, 20).size() <= 20);
+	ASSERT_TRUE(ZLibDictionaryCompressor::train({}).empty());
+}
+
+TEST(zlib_dictionary_compressor_interleaved) {
+	// the streams of the thread are shared with ZLibCompressor and reset between payloads
+	ZLibDictionaryCompressor a(str2vec("first dictionary\n")), b(str2vec("second one\n"));
+	std::vector<std::byte> data = str2vec("first dictionary\nsecond one\n");
+
+	auto res_a = a.compress(data);
+	auto res_plain = ZLibCompressor::get()->compress(data);
+	auto res_b = b.compress(data);
+	ASSERT_SEQUENCE_EQUAL(a.compress(data), res_a);
+	ASSERT_SEQUENCE_EQUAL(b.decompress(res_b), data);
+	ASSERT_SEQUENCE_EQUAL(ZLibCompressor::get()->decompress(res_plain), data);
+	ASSERT_SEQUENCE_EQUAL(a.decompress(res_a), data);
+
+	// the wrong dictionary, or none at all
+	ASSERT_TRUE(b.decompress(res_a).empty());
+	ASSERT_TRUE(ZLibCompressor::get()->decompress(res_a).empty());
+	ASSERT_SEQUENCE_EQUAL(a.decompress(res_a), data);
+}